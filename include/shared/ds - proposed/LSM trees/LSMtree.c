@@ -6,6 +6,10 @@
 //  - C0
 //  - filename_size (size of name)
 //  - Ne (initliazed to 0)
+//  - seq and the list of snapshots (empty)
+//  - the block of range tombstones (empty)
+//  - the row cache and the filters (created once the sizes are known)
+//  - the memory governor of the process
 void init_lsm(LSM_tree *lsm, char* name, int filename_size){
     lsm->name = (char*)calloc(filename_size, sizeof(char));
     strcpy(lsm->name, name);
@@ -13,7 +17,23 @@ void init_lsm(LSM_tree *lsm, char* name, int filename_size){
     lsm->C0 = (component *) malloc(sizeof(component));
     lsm->filename_size = filename_size;
     lsm->Ne = 0;
-    if (BLOOM_ON) lsm->bloom = (bloom_filter_t *) malloc(sizeof(bloom_filter_t));
+    lsm->seq = 0;
+    lsm->snapshots = NULL;
+    lsm->Ns = 0;
+    lsm->snapshots_size = 0;
+    lsm->ranges = NULL;
+    lsm->ranges_max_high = NULL;
+    lsm->Nr = 0;
+    lsm->ranges_size = 0;
+    lsm->num_append = 0;
+    lsm->cache = NULL;
+    lsm->tree_filter = NULL;
+    lsm->filters = NULL;
+    lsm->filter_kinds = NULL;
+    lsm->range_filters = NULL;
+    lsm->models = NULL;
+    lsm->checksums = NULL;
+    lsm->governor = memory_governor_get();
 }
 
 // Create LSM Tree with a fixed number of component Nc without
@@ -23,34 +43,124 @@ void create_lsm(LSM_tree *lsm, char* name, int Nc, int* Cs_size, int value_size,
     // Init struct lsm
     init_lsm(lsm, name, filename_size);
 
-    // Init the bloom filter
-    if (BLOOM_ON){
-        // Bloom filter initialized with enough bits for the last component
-        bloom_init(lsm->bloom, (uint64_t) BLOOM_SIZE, HASHES);
-    }
-
     // List contains Nc+2 elements: [C0, buffer, C1, C2,...]
     lsm->value_size = value_size;
     lsm->Cs_size = (int *) malloc((Nc+2)*sizeof(int));
     lsm->Cs_Ne = (int *) malloc((Nc+2)*sizeof(int));
+    lsm->Cs_Nt = (int *) malloc((Nc+2)*sizeof(int));
     lsm->Nc = Nc;
     lsm->Ne = 0;
     // TODO: read from disk the number of elements per layer
     for (int i=0; i < (Nc+2); i++){
         lsm->Cs_size[i] = Cs_size[i];
         lsm->Cs_Ne[i] = 0;
+        lsm->Cs_Nt[i] = 0;
+    }
+
+    // Memory budget: C0 and buffer reduced to fit in half of the memory available
+    size_t available = memory_available(lsm->governor);
+    size_t memtable = (size_t) (Cs_size[0] + Cs_size[1]) * entry_size(value_size);
+    if (memtable > available / 2){
+        double ratio = (double) (available / 2) / memtable;
+        lsm->Cs_size[0] = (int) (ratio * Cs_size[0]);
+        if (lsm->Cs_size[0] < 1) lsm->Cs_size[0] = 1;
+        lsm->Cs_size[1] = (int) (ratio * Cs_size[1]);
+        if (lsm->Cs_size[1] < lsm->Cs_size[0]) lsm->Cs_size[1] = lsm->Cs_size[0];
+        printf("Memory budget: C0 reduced to %d, buffer to %d elements\n", lsm->Cs_size[0],
+               lsm->Cs_size[1]);
+    }
+    memory_charge(lsm->governor, MEM_MEMTABLE, memtable_bytes(lsm));
+
+    // Init the filter of the keys
+    if (BLOOM_ON){
+        // Filter initialized with enough bits for the last component
+        // (reduced to fit in a quarter of the memory available)
+        index_t bloom_size = (uint64_t) BLOOM_SIZE;
+        available = memory_available(lsm->governor);
+        if (bloom_size / 8 > available / 4) bloom_size = (available / 4) * 8;
+        if (bloom_size < 64) bloom_size = 64;
+        lsm->tree_filter = filter_create(TREE_FILTER, (int) (bloom_size / FILTER_BITS_PER_KEY));
+        memory_charge(lsm->governor, MEM_FILTER, filter_bytes(lsm->tree_filter));
+    }
+    init_filters(lsm);
+
+    if (ROW_CACHE_ON) lsm->cache = memory_create_cache(lsm->governor, ROW_CACHE_SIZE, value_size);
+    lsm->models = (learned_index **) calloc(Nc+2, sizeof(learned_index*));
+    lsm->checksums = (block_checksums **) calloc(Nc+2, sizeof(block_checksums*));
+}
+
+// Filters of the components: empty for C0 and the buffer, read from disk
+// (if saved) for the disk components, as their range filters
+void init_filters(LSM_tree *lsm){
+    lsm->filters = (filter **) calloc(lsm->Nc+2, sizeof(filter*));
+    lsm->range_filters = (range_filter **) calloc(lsm->Nc+2, sizeof(range_filter*));
+    lsm->filter_kinds = (int *) malloc((lsm->Nc+2)*sizeof(int));
+    for (int j=0; j < lsm->Nc+2; j++){
+        lsm->filter_kinds[j] = (j < 2) ? FILTER_MEMORY : FILTER_DISK;
+        if (j < 2) lsm->filters[j] = filter_create(lsm->filter_kinds[j], lsm->Cs_size[j]);
+        else if (lsm->Cs_Ne[j] > 0){
+            lsm->filters[j] = read_component_filter(lsm->name, j-1, lsm->filename_size);
+        }
+        if (lsm->filters[j] != NULL){
+            memory_charge(lsm->governor, MEM_FILTER, filter_bytes(lsm->filters[j]));
+        }
+        if (RANGE_FILTER_ON && (j >= 2) && (lsm->Cs_Ne[j] > 0)){
+            lsm->range_filters[j] = read_range_filter(lsm->name, j-1, lsm->filename_size);
+            if (lsm->range_filters[j] != NULL){
+                memory_charge(lsm->governor, MEM_FILTER,
+                              range_filter_bytes(lsm->range_filters[j]));
+            }
+        }
     }
+}
 
+// Memory used by C0 and the buffer
+size_t memtable_bytes(LSM_tree *lsm){
+    return (size_t) (lsm->Cs_size[0] + lsm->Cs_size[1]) * entry_size(lsm->value_size);
 }
 
 // LSM destructor
 void free_lsm(LSM_tree *lsm){
+    memory_release(lsm->governor, MEM_MEMTABLE, memtable_bytes(lsm));
     free(lsm->name);
     free(lsm->Cs_Ne);
     free(lsm->Cs_size);
+    free(lsm->Cs_Nt);
+    free(lsm->snapshots);
+    free(lsm->ranges);
+    free(lsm->ranges_max_high);
+    row_cache_release(lsm->cache);
+    for (int j=0; j < lsm->Nc+2; j++){
+        if (lsm->models[j] == NULL) continue;
+        memory_release(lsm->governor, MEM_FILTER, learned_index_bytes(lsm->models[j]));
+        learned_index_free(lsm->models[j]);
+    }
+    free(lsm->models);
+    for (int j=0; j < lsm->Nc+2; j++){
+        if (lsm->checksums[j] == NULL) continue;
+        memory_release(lsm->governor, MEM_FILTER, checksums_bytes(lsm->checksums[j]));
+        checksums_free(lsm->checksums[j]);
+    }
+    free(lsm->checksums);
+    for (int j=0; j < lsm->Nc+2; j++){
+        if (lsm->filters[j] == NULL) continue;
+        memory_release(lsm->governor, MEM_FILTER, filter_bytes(lsm->filters[j]));
+        filter_free(lsm->filters[j]);
+    }
+    free(lsm->filters);
+    free(lsm->filter_kinds);
+    for (int j=0; j < lsm->Nc+2; j++){
+        if (lsm->range_filters[j] == NULL) continue;
+        memory_release(lsm->governor, MEM_FILTER, range_filter_bytes(lsm->range_filters[j]));
+        range_filter_free(lsm->range_filters[j]);
+    }
+    free(lsm->range_filters);
     free_component(lsm->C0);
     free_component(lsm->buffer);
-    if (BLOOM_ON) bloom_destroy(lsm->bloom);
+    if (BLOOM_ON){
+        memory_release(lsm->governor, MEM_FILTER, filter_bytes(lsm->tree_filter));
+        filter_free(lsm->tree_filter);
+    }
     free(lsm);
 }
 
@@ -65,9 +175,9 @@ void build_lsm(LSM_tree *lsm, char* name, int Nc, int* Cs_size, int value_size,
     // Allocate memory and create lsm
     create_lsm(lsm, name, Nc, Cs_size, value_size, filename_size);
 
-    // Initialize C0 and buffer (on memory)
-    init_component(lsm->C0, Cs_size, value_size, lsm->Cs_Ne, "C0");
-    init_component(lsm->buffer, Cs_size + 1, value_size, lsm->Cs_Ne + 1,  "buffer");
+    // Initialize C0 and buffer (on memory), sized to the memory budget
+    init_component(lsm->C0, lsm->Cs_size, value_size, lsm->Cs_Ne, "C0");
+    init_component(lsm->buffer, lsm->Cs_size + 1, value_size, lsm->Cs_Ne + 1,  "buffer");
 
     // Check if folder exists
     if (access(name, F_OK) == -1){
@@ -95,6 +205,17 @@ void build_lsm(LSM_tree *lsm, char* name, int Nc, int* Cs_size, int value_size,
 //     - Nc
 //     - Cs_size
 //     - Cs_Ne (updated regularly)
+//     - seq (updated with Cs_Ne)
+//     - Cs_Nt (updated with Cs_Ne)
+//     - the filter of the keys
+//     - the CRC32C of the fields above (updated with Cs_Ne) and of the filter
+// The range tombstones are saved in their own block (ranges.data)
+
+// Size of the fields of meta.data before the filter of the keys
+static long meta_header_size(LSM_tree *lsm){
+    return lsm->filename_size*sizeof(char) + 3*sizeof(int) + 3*(lsm->Nc+2)*sizeof(int) +
+           sizeof(uint64_t);
+}
 
 void write_lsm_to_disk(LSM_tree *lsm){
     // Save memory components to disk
@@ -104,7 +225,7 @@ void write_lsm_to_disk(LSM_tree *lsm){
     // Save metadata of the lsm to disk in file name.data
     char *filename = (char*) calloc(56, sizeof(char));
     sprintf(filename,"%s/meta.data", lsm->name);
-    FILE* fout = fopen(filename, "wb");
+    FILE* fout = fopen(filename, "w+b");
     printf("name to save %s\n", lsm->name);
     fwrite(lsm->name, sizeof(char), lsm->filename_size, fout);
     fwrite(&lsm->Ne, sizeof(int), 1, fout);
@@ -112,14 +233,20 @@ void write_lsm_to_disk(LSM_tree *lsm){
     fwrite(&lsm->value_size, sizeof(int), 1, fout);
     fwrite(lsm->Cs_size, sizeof(int), lsm->Nc+2, fout);
     fwrite(lsm->Cs_Ne, sizeof(int), lsm->Nc+2, fout);
-    // save bloom filter if enabled
-    if (BLOOM_ON){
-        fwrite(&lsm->bloom->size, sizeof(index_t), 1, fout);
-        fwrite(&lsm->bloom->count, sizeof(index_t), 1, fout);
-        fwrite(lsm->bloom->table, sizeof(index_t), (lsm->bloom->size) / 8, fout);
-    }
+    fwrite(&lsm->seq, sizeof(uint64_t), 1, fout);
+    fwrite(lsm->Cs_Nt, sizeof(int), lsm->Nc+2, fout);
+    // save the filter of the keys if enabled
+    if (BLOOM_ON) filter_write(lsm->tree_filter, fout);
+    // Checksums of the fields and of the filter
+    long header = meta_header_size(lsm);
+    long end = ftell(fout);
+    uint32_t crc[2] = {crc32c_file(fout, 0, header), crc32c_file(fout, header, end - header)};
+    fseek(fout, end, SEEK_SET);
+    fwrite(crc, sizeof(uint32_t), 2, fout);
     fclose(fout);
     free(filename);
+
+    write_range_tombstones(lsm);
 }
 
 // Try to read lsm from disk in its repository: name
@@ -138,64 +265,226 @@ void read_lsm_from_disk(LSM_tree *lsm, char *name, int filename_size){
     fread(&lsm->value_size, sizeof(int), 1, fin);
     lsm->Cs_Ne = (int *) malloc((lsm->Nc + 2)*sizeof(int));
     lsm->Cs_size = (int *) malloc((lsm->Nc + 2)*sizeof(int));
+    lsm->Cs_Nt = (int *) malloc((lsm->Nc + 2)*sizeof(int));
     fread(lsm->Cs_size, sizeof(int), lsm->Nc + 2, fin);
     fread(lsm->Cs_Ne, sizeof(int), lsm->Nc + 2, fin);
-    if (BLOOM_ON){
-        index_t* size = (index_t *) malloc(sizeof(index_t));
-        fread(size, sizeof(index_t), 1, fin);
-        bloom_init(lsm->bloom, *size, HASHES);
-        fread(&lsm->bloom->count, sizeof(index_t), 1, fin);
-        fread(lsm->bloom->table, sizeof(index_t), (lsm->bloom->size) / 8, fin);
-        free(size);
+    fread(&lsm->seq, sizeof(uint64_t), 1, fin);
+    fread(lsm->Cs_Nt, sizeof(int), lsm->Nc + 2, fin);
+    if (BLOOM_ON) lsm->tree_filter = filter_read(fin);
+    // Check the fields and the filter (if their checksums were saved): a
+    // corrupted filter is replaced by a saturated one
+    long header = meta_header_size(lsm);
+    long end = ftell(fin);
+    uint32_t crc[2];
+    if ((CHECKSUM_VERIFY >= VERIFY_COMPACTION) && (fread(crc, sizeof(uint32_t), 2, fin) == 2)){
+        if (crc32c_file(fin, 0, header) != crc[0]){
+            fprintf(stderr, "ERROR: metadata of %s corrupted\n", name);
+            exit(1);
+        }
+        if (BLOOM_ON && (crc32c_file(fin, header, end - header) != crc[1])){
+            printf("ERROR: filter of the keys of %s corrupted, disabled\n", name);
+            filter_free(lsm->tree_filter);
+            lsm->tree_filter = filter_create(TREE_FILTER, 1);
+            lsm->tree_filter->saturated = 1;
+        }
     }
+    if (BLOOM_ON) memory_charge(lsm->governor, MEM_FILTER, filter_bytes(lsm->tree_filter));
     fclose(fin);
     free(filename);
+    memory_charge(lsm->governor, MEM_MEMTABLE, memtable_bytes(lsm));
+    if (ROW_CACHE_ON) lsm->cache = memory_create_cache(lsm->governor, ROW_CACHE_SIZE,
+                                                      lsm->value_size);
 
     // Read memory components from disk
     read_disk_component(lsm->C0, lsm->name, lsm->Cs_Ne, "C0", lsm->Cs_size, lsm->value_size,
                         filename_size);
     read_disk_component(lsm->buffer, lsm->name, lsm->Cs_Ne + 1, "buffer",
                         lsm->Cs_size + 1, lsm->value_size, filename_size);
+    read_range_tombstones(lsm);
+    init_filters(lsm);
+    for (int j=0; j < 2; j++){
+        if (lsm->filters[j] == NULL) continue;
+        component* C = (j == 0) ? lsm->C0 : lsm->buffer;
+        for (int i=0; i < lsm->Cs_Ne[j]; i++) filter_add(lsm->filters[j], C->keys[i]);
+    }
+
+    // Learned indexes of the disk components (binary search until the next
+    // merge of a component whose index was not saved)
+    lsm->models = (learned_index **) calloc(lsm->Nc + 2, sizeof(learned_index*));
+    if (LEARNED_INDEX){
+        for (int j=2; j < lsm->Nc+2; j++){
+            if (lsm->Cs_Ne[j] == 0) continue;
+            lsm->models[j] = read_learned_index(lsm->name, j-1, lsm->Cs_Ne[j], filename_size);
+            if (lsm->models[j] != NULL){
+                memory_charge(lsm->governor, MEM_FILTER, learned_index_bytes(lsm->models[j]));
+            }
+        }
+    }
+
+    // Checksums of the disk components checked by the reads
+    lsm->checksums = (block_checksums **) calloc(lsm->Nc + 2, sizeof(block_checksums*));
+    if (CHECKSUM_VERIFY == VERIFY_READS){
+        char component_id[16];
+        for (int j=2; j < lsm->Nc+2; j++){
+            if (lsm->Cs_Ne[j] == 0) continue;
+            sprintf(component_id, "C%d", j-1);
+            lsm->checksums[j] = read_checksums(lsm->name, component_id, filename_size);
+            if (lsm->checksums[j] != NULL){
+                memory_charge(lsm->governor, MEM_FILTER, checksums_bytes(lsm->checksums[j]));
+            }
+        }
+    }
+}
+
+// Rebuild the filter of the component at level (saved for a disk component)
+// after a merge wrote it
+void update_filter(LSM_tree *lsm, int level, component* C){
+    if (lsm->filters[level] != NULL){
+        memory_release(lsm->governor, MEM_FILTER, filter_bytes(lsm->filters[level]));
+        filter_free(lsm->filters[level]);
+    }
+    int capacity = (level < 2) ? lsm->Cs_size[level] : *C->Ne;
+    lsm->filters[level] = filter_build(lsm->filter_kinds[level], C->keys, *C->Ne, capacity);
+    if (lsm->filters[level] == NULL) return;
+    memory_charge(lsm->governor, MEM_FILTER, filter_bytes(lsm->filters[level]));
+    if (level >= 2) write_component_filter(lsm->filters[level], lsm->name, level-1,
+                                           lsm->filename_size);
+}
+
+// Rebuild (and save) the range filter of the disk component at level after a
+// merge wrote it
+void update_range_filter(LSM_tree *lsm, int level, component* C){
+    if (!RANGE_FILTER_ON) return;
+    if (lsm->range_filters[level] != NULL){
+        memory_release(lsm->governor, MEM_FILTER, range_filter_bytes(lsm->range_filters[level]));
+        range_filter_free(lsm->range_filters[level]);
+        lsm->range_filters[level] = NULL;
+    }
+    if (*C->Ne == 0) return;
+    lsm->range_filters[level] = range_filter_build(C->keys, *C->Ne);
+    memory_charge(lsm->governor, MEM_FILTER, range_filter_bytes(lsm->range_filters[level]));
+    write_range_filter(lsm->range_filters[level], lsm->name, level-1, lsm->filename_size);
+}
+
+// Rebuild the checksums of the disk component at level (checked by the reads)
+// after a merge wrote it
+void update_checksums(LSM_tree *lsm, int level, component* C){
+    if (CHECKSUM_VERIFY != VERIFY_READS) return;
+    if (lsm->checksums[level] != NULL){
+        memory_release(lsm->governor, MEM_FILTER, checksums_bytes(lsm->checksums[level]));
+        checksums_free(lsm->checksums[level]);
+        lsm->checksums[level] = NULL;
+    }
+    if (*C->Ne == 0) return;
+    lsm->checksums[level] = component_checksums(C, lsm->value_size);
+    memory_charge(lsm->governor, MEM_FILTER, checksums_bytes(lsm->checksums[level]));
+}
+
+// Rebuild the filter, the range filter, the learned index and the checksums
+// (disk components) of the component at level after a merge wrote it
+void update_component_indexes(LSM_tree *lsm, int level, component* C){
+    update_filter(lsm, level, C);
+    if (level < 2) return;
+    update_range_filter(lsm, level, C);
+    update_learned_index(lsm, level, C);
+    update_checksums(lsm, level, C);
+}
+
+// Select the kind of filter of the component at level (FILTER_NONE for no
+// filter), used from its next merge; C0 needs a dynamic filter.
+// Return 0 if the kind does not fit
+int set_filter_kind(LSM_tree *lsm, int level, int kind){
+    const filter_ops* ops = filter_get_ops(kind);
+    if ((level < 0) || (level > lsm->Nc+1) || ((kind != FILTER_NONE) && (ops == NULL))){
+        printf("ERROR: no filter of kind %d for level %d\n", kind, level);
+        return 0;
+    }
+    if ((level == 0) && (ops != NULL) && (ops->create == NULL)){
+        printf("ERROR: the filter of C0 must support insertions (kind %d)\n", kind);
+        return 0;
+    }
+    lsm->filter_kinds[level] = kind;
+    // C0 and disk components without filter take the new one at once
+    if ((level == 0) || ((kind == FILTER_NONE) && (lsm->filters[level] != NULL))){
+        component C = {.keys = lsm->C0->keys, .Ne = lsm->Cs_Ne};
+        if (level == 0) update_filter(lsm, 0, &C);
+        else{
+            memory_release(lsm->governor, MEM_FILTER, filter_bytes(lsm->filters[level]));
+            filter_free(lsm->filters[level]);
+            lsm->filters[level] = NULL;
+        }
+    }
+    return 1;
 }
 
-// Append (k,v) to the lsm tree
+// Rebuild (and save) the learned index of the disk component at level after a
+// merge wrote it
+void update_learned_index(LSM_tree *lsm, int level, component* C){
+    if (!LEARNED_INDEX) return;
+    if (lsm->models[level] != NULL){
+        memory_release(lsm->governor, MEM_FILTER, learned_index_bytes(lsm->models[level]));
+        learned_index_free(lsm->models[level]);
+        lsm->models[level] = NULL;
+    }
+    if (*C->Ne == 0) return;
+    lsm->models[level] = learned_index_build(C->keys, *C->Ne, LEARNED_EPSILON);
+    memory_charge(lsm->governor, MEM_FILTER, learned_index_bytes(lsm->models[level]));
+    write_learned_index(lsm->models[level], lsm->name, level-1, lsm->filename_size);
+}
+
+// Append (k,v) to the lsm tree, type being OP_VALUE or OP_DELETE
 // TODO: efficient log which saves the state of the LSM-tree
-void append_lsm(LSM_tree *lsm, int key, char *value){
+void append_lsm(LSM_tree *lsm, int key, char *value, uint8_t type){
     // Track the number of appends to manage the logging of C0
-    static int num_append = 0;
-    num_append++;
+    lsm->num_append++;
+    // The value cached for key is outdated
+    if (lsm->cache != NULL) row_cache_erase(lsm->cache, key);
 
-    // Append to C0 on memory
+    // Append to C0 on memory, tagged with the next sequence number
     lsm->C0->keys[lsm->Cs_Ne[0]] = key;
+    lsm->C0->seqs[lsm->Cs_Ne[0]] = ++lsm->seq;
+    lsm->C0->types[lsm->Cs_Ne[0]] = type;
     strcpy(lsm->C0->values + lsm->Cs_Ne[0]*lsm->value_size, value);
 
+    if (lsm->filters[0] != NULL) filter_add(lsm->filters[0], key);
+
     //Increment number of elements in C0
     lsm->Cs_Ne[0]++;
+    if (type == OP_DELETE) lsm->Cs_Nt[0]++;
 
     // Append to C0 on disk every k appends (for log purpose in cash of crash)
     // TODO: log on disk before update on memory?
-    if (num_append % CO_TOLERANCE == 0){
+    if (lsm->num_append % CO_TOLERANCE == 0){
         if (CO_TOLERANCE <= *lsm->Cs_size){
             // printf("Num append to write %d\n", num_append);
             // Bulk-append to C0
-            append_on_disk(lsm->C0, num_append, lsm->name, lsm->value_size, lsm->filename_size);
+            append_on_disk(lsm->C0, lsm->num_append, lsm->name, lsm->value_size, lsm->filename_size);
             update_component_size(lsm);
         }
         // Re-initialize the appends counter
-        num_append = 0;
+        lsm->num_append = 0;
     }
 
     // MERGING OPERATIONS
     
+    size_t entry = entry_size(lsm->value_size);
     // Check if C0 is full
     if (lsm->Cs_Ne[0] >= lsm->Cs_size[0]){
+        // Temporary copies of the sort of C0 and of the merge with the buffer
+        size_t merge_bytes = entry * (lsm->Cs_Ne[0] + lsm->Cs_Ne[1]);
+        memory_reserve(lsm->governor, MEM_MERGE, merge_bytes, 0);
         // Inplace sorting of C0->keys and corresponding reorder in C0->values
-        merge_sort_with_values(lsm->C0->keys, lsm->C0->values, 0,
-                               lsm->Cs_size[0]-1, lsm->value_size);
-        merge_components(lsm->buffer, lsm->C0, lsm->name, lsm->value_size, lsm->filename_size);
+        merge_sort_with_values(lsm->C0, 0, lsm->Cs_size[0]-1, lsm->value_size);
+        merge_components(lsm, lsm->buffer, lsm->C0, 0);
+        update_component_indexes(lsm, 1, lsm->buffer);
+        update_component_indexes(lsm, 0, lsm->C0);
+        lsm->Cs_Nt[1] = count_tombstones(lsm->buffer);
+        lsm->Cs_Nt[0] = 0;
+        memory_release(lsm->governor, MEM_MERGE, merge_bytes);
 
         // Update the number of elements in component on disk
         update_component_size(lsm);
+        move_range_tombstones(lsm, 0, 1);
     }
 
     // iterative over all the full components
@@ -203,34 +492,62 @@ void append_lsm(LSM_tree *lsm, int key, char *value){
     int current_C_index = 1;
     component* current_component = lsm->buffer;
     char * component_id = (char*) malloc(8*sizeof(char));
+    // Components read from disk only get room for the merge (not Cs_size):
+    // capacities[j] for the component at index j, its memory in current_bytes
+    int* capacities = (int *) malloc((lsm->Nc+2)*sizeof(int));
+    size_t current_bytes = 0;
 
     // TODO: case of the last component (only merging and reallocation of memory if needed)
     // Check if current component is still able to recieve one batch of its previous
     // component, else it's considered full and need to be flush in its next component
-    while (lsm->Cs_Ne[current_C_index] + lsm->Cs_size[current_C_index-1] > lsm->Cs_size[current_C_index]){
+    while ((current_C_index < lsm->Nc + 1) &&
+           (lsm->Cs_Ne[current_C_index] + lsm->Cs_size[current_C_index-1] > lsm->Cs_size[current_C_index])){
+        // Reserve the memory of the next component and of the temporary copy
+        // of the merge
+        capacities[current_C_index+1] = lsm->Cs_Ne[current_C_index+1] +
+                                        lsm->Cs_Ne[current_C_index];
+        size_t next_bytes = entry * capacities[current_C_index+1];
+        size_t copy_bytes = entry * lsm->Cs_Ne[current_C_index+1];
+        memory_reserve(lsm->governor, MEM_MERGE, next_bytes + copy_bytes, current_bytes);
+
         // Initialize and read next component
         component* next_component = (component *) malloc(sizeof(component));
         sprintf(component_id, "C%d", current_C_index);
         read_disk_component(next_component, lsm->name,
                             lsm->Cs_Ne + (current_C_index+1),
-                            component_id,lsm->Cs_size + (current_C_index+1),
+                            component_id, capacities + (current_C_index+1),
                             lsm->value_size, lsm->filename_size);
-        merge_components(next_component, current_component, lsm->name, lsm->value_size,
-                         lsm->filename_size);
+        merge_components(lsm, next_component, current_component,
+                         current_C_index + 1 == lsm->Nc + 1);
+        update_component_indexes(lsm, current_C_index + 1, next_component);
+        update_component_indexes(lsm, current_C_index, current_component);
+        lsm->Cs_Nt[current_C_index + 1] = count_tombstones(next_component);
+        lsm->Cs_Nt[current_C_index] = 0;
+        memory_release(lsm->governor, MEM_MERGE, copy_bytes);
 
         // Update the number of elements in component on disk
         update_component_size(lsm);
+        move_range_tombstones(lsm, current_C_index, current_C_index + 1);
 
         // Updates component
         if (current_C_index > 1){
             free_component(current_component);
+            memory_release(lsm->governor, MEM_MERGE, current_bytes);
         }
         current_C_index++;
         current_component = next_component;
+        current_bytes = next_bytes;
     }
     // To avoiding freeing the buffer
-    if (current_C_index >1 ) free_component(current_component);;
+    if (current_C_index >1 ){
+        free_component(current_component);
+        memory_release(lsm->governor, MEM_MERGE, current_bytes);
+    }
     free(component_id);
+    free(capacities);
+
+    // Reclaim the space of the deleted keys
+    compact_tombstones(lsm);
 }
 
 // Insert key,value in lsm
@@ -240,40 +557,66 @@ void append_lsm(LSM_tree *lsm, int key, char *value){
 void insert_lsm(LSM_tree *lsm, int key, char *value){
     // increment total number of elements in the LSMTree
     lsm->Ne++;
-    // Insert to the bloom filter
-    if (BLOOM_ON) bloom_add(lsm->bloom, (uint64_t) key);
-    append_lsm(lsm, key, value);
+    // Insert to the filter of the keys
+    if (BLOOM_ON) filter_add(lsm->tree_filter, key);
+    append_lsm(lsm, key, value, OP_VALUE);
 }
 
 // Read value of key in LSMTree lsm
 // return -1 if value not present, else index >=0 with value pointer
 // set to the value found
 int read_lsm(LSM_tree *lsm, int key, char* value){
+    return read_lsm_snapshot(lsm, key, value, SEQ_MAX);
+}
+
+// Read value of key in LSMTree lsm as it was when snapshot was acquired
+// (SEQ_MAX reads the most recent value).
+// return -1 if value not present, else index >=0 with value pointer
+// set to the value found
+int read_lsm_snapshot(LSM_tree *lsm, int key, char* value, uint64_t snapshot){
     // Memory allocation
     int* index = (int*) malloc(sizeof(int)); // -1 not found else found
+    uint8_t type = OP_VALUE;
+    uint64_t seq = 0;
     if (value == NULL) value = (char*) malloc(lsm->value_size*sizeof(char));
 
     // Bloom filter check
-    if (BLOOM_ON && bloom_check(lsm->bloom, (uint64_t) key) == 0){
+    if (BLOOM_ON && filter_check(lsm->tree_filter, key) == 0){
         free(index);
         if (VERBOSE) printf("Bloom check on for key %d\n", key);
         return -1;
     }
 
-    // Linear scan in C0 (initialize index to -1)
-    keys_linear_search(index, key, lsm->C0->keys, lsm->Cs_Ne[0]);
+    // Row cache (most recent values only)
+    if ((snapshot == SEQ_MAX) && (lsm->cache != NULL) && row_cache_get(lsm->cache, key, value)){
+        if (VERBOSE == 1) printf("Key found in row cache\n");
+        free(index);
+        return 1;
+    }
+
+    // Linear scan in C0 (initialize index to -1), skipped if not in its filter
+    *index = -1;
+    if ((lsm->filters[0] == NULL) || filter_check(lsm->filters[0], key)){
+        keys_linear_search(index, key, lsm->C0->keys, lsm->C0->seqs, lsm->Cs_Ne[0], snapshot);
+    }
     if (*index != -1){
         if (VERBOSE == 1) printf("Key found in C0\n");
+        type = lsm->C0->types[*index];
+        seq = lsm->C0->seqs[*index];
         strcpy(value, lsm->C0->values + (*index)*lsm->value_size);
     }
 
     // Reading buffer
     // Checking extreme of the buffer
     //if ((*index == -1) && (key >= lsm->buffer->keys[0]) && (key <= lsm->buffer->keys[lsm->Cs_Ne[1]-1])){
-    if (*index == -1){
+    if ((*index == -1) && ((lsm->filters[1] == NULL) || filter_check(lsm->filters[1], key))){
         *index = binary_search(lsm->buffer->keys, key, 0, lsm->Cs_Ne[1]-1);
+        *index = first_visible(lsm->buffer->keys, lsm->buffer->seqs, *index, lsm->Cs_Ne[1],
+                               snapshot);
         if (*index != -1){
             if (VERBOSE == 1) printf("Key found in %s\n", lsm->buffer->component_id);
+            type = lsm->buffer->types[*index];
+            seq = lsm->buffer->seqs[*index];
             strcpy(value, lsm->buffer->values + (*index)*lsm->value_size);
         }
     }
@@ -281,29 +624,42 @@ int read_lsm(LSM_tree *lsm, int key, char* value){
     // Binary search over disk components
     if (*index == -1){
         char* filename_keys = (char *) calloc(lsm->filename_size + 8,sizeof(char));
+        char* filename_seqs = (char *) calloc(lsm->filename_size + 8,sizeof(char));
 
         // Starting with C1 (indexed at 2 in Cs_Ne)
-        for (int j=2; j<lsm->Nc+1; j++){
-            if (lsm->Cs_Ne[j] > 0){
+        for (int j=2; j<lsm->Nc+2; j++){
+            if ((lsm->Cs_Ne[j] > 0) &&
+                ((lsm->filters[j] == NULL) || filter_check(lsm->filters[j], key))){
                 // Build filename of the keys
                 get_files_name_disk(filename_keys, lsm->name, j-1, "k",
                                     lsm->filename_size);
+                get_files_name_disk(filename_seqs, lsm->name, j-1, "s",
+                                    lsm->filename_size);
                 // Searching in component
-                component_search(index, key, lsm->Cs_Ne[j], filename_keys);
+                component_search(index, key, lsm->Cs_Ne[j], filename_keys, filename_seqs,
+                                 snapshot, lsm->models[j], lsm->checksums[j]);
 
                 // Key found (can still be deleted)
                 if (*index != -1){
                     if (VERBOSE == 1) printf("Key Found in C%d\n", j-1);
-                    read_value(value, *index, lsm->name, j-1, 
-                               lsm->value_size, lsm->filename_size);
+                    type = read_type(*index, lsm->name, j-1, lsm->filename_size,
+                                     lsm->checksums[j]);
+                    if (lsm->Nr > 0) seq = read_seq(*index, lsm->name, j-1, lsm->filename_size,
+                                                    lsm->checksums[j]);
+                    // Corrupted value: not returned
+                    if ((type == OP_VALUE) &&
+                        !read_value(value, *index, lsm->name, j-1, lsm->value_size,
+                                    lsm->filename_size, lsm->checksums[j])) type = OP_DELETE;
                     break;
                 }
             }
         }
         free(filename_keys);
+        free(filename_seqs);
     }
     // Check if key found and not previously deleted
-    if ((*index >= 0) && (*(value) != *TOMBSTONE)){
+    if ((*index >= 0) && (type == OP_VALUE) && !range_deleted(lsm, key, seq, snapshot)){
+        if ((snapshot == SEQ_MAX) && (lsm->cache != NULL)) row_cache_put(lsm->cache, key, value);
         free(index);
         return 1;
     }
@@ -312,6 +668,94 @@ int read_lsm(LSM_tree *lsm, int key, char* value){
     return -1;
 }
 
+// Range scan of the keys in [low, high] as they were when snapshot was acquired
+// (SEQ_MAX reads the most recent values).
+// The first max_elements live keys are written in increasing order to keys and
+// their values to values (value_size chars each); return the number of keys.
+int scan_lsm(LSM_tree *lsm, int low, int high, int* keys, char* values, int max_elements,
+             uint64_t snapshot){
+    scan_entry* entries = NULL;
+    int Nentries = 0;
+    int capacity = 0;
+
+    // Collect all the versions of the keys in range, from every component
+    for (int i=0; i < lsm->Cs_Ne[0]; i++){
+        if ((lsm->C0->keys[i] >= low) && (lsm->C0->keys[i] <= high)){
+            add_scan_entry(&entries, &Nentries, &capacity, lsm->C0->keys[i],
+                           lsm->C0->seqs[i], lsm->C0->types[i], 0, i);
+        }
+    }
+    for (int i=lower_bound(lsm->buffer->keys, low, 0, lsm->Cs_Ne[1]-1);
+         (i < lsm->Cs_Ne[1]) && (lsm->buffer->keys[i] <= high); i++){
+        add_scan_entry(&entries, &Nentries, &capacity, lsm->buffer->keys[i],
+                       lsm->buffer->seqs[i], lsm->buffer->types[i], 1, i);
+    }
+    for (int j=2; j<lsm->Nc+2; j++){
+        // Components without key in range skipped by their range filter
+        if ((lsm->Cs_Ne[j] > 0) && ((lsm->range_filters[j] == NULL) ||
+                                    range_filter_check(lsm->range_filters[j], low, high))){
+            component_scan(&entries, &Nentries, &capacity, low, high, j, lsm->Cs_Ne[j],
+                           lsm->name, lsm->filename_size, lsm->checksums[j]);
+        }
+    }
+
+    // Newest version first for each key
+    if (Nentries > 1) qsort(entries, Nentries, sizeof(scan_entry), scan_entry_cmp);
+
+    int count = 0;
+    char* value = (char*) malloc(lsm->value_size*sizeof(char));
+    for (int i=0; (i < Nentries) && (count < max_elements); i++){
+        scan_entry* e = entries + i;
+        // Skip the versions written after the snapshot
+        if (e->seq > snapshot) continue;
+        // Visible version: read its value if not deleted
+        if ((e->type == OP_VALUE) && !range_deleted(lsm, e->key, e->seq, snapshot)){
+            if (e->level == 0) strcpy(value, lsm->C0->values + e->index*lsm->value_size);
+            else if (e->level == 1) strcpy(value, lsm->buffer->values + e->index*lsm->value_size);
+            else if (!read_value(value, e->index, lsm->name, e->level-1, lsm->value_size,
+                                 lsm->filename_size, lsm->checksums[e->level])){
+                // Corrupted value: key skipped
+                while ((i+1 < Nentries) && (entries[i+1].key == e->key)) i++;
+                continue;
+            }
+            keys[count] = e->key;
+            strcpy(values + count*lsm->value_size, value);
+            count++;
+        }
+        // Skip the older versions of the key
+        while ((i+1 < Nentries) && (entries[i+1].key == e->key)) i++;
+    }
+    free(value);
+    free(entries);
+    return count;
+}
+
+// Acquire a snapshot of the lsm: reads with the returned sequence number see
+// the state of the tree at this time, merges keep the versions it needs until
+// it is released.
+uint64_t snapshot_acquire(LSM_tree *lsm){
+    if (lsm->Ns >= lsm->snapshots_size){
+        lsm->snapshots_size = (lsm->snapshots_size == 0) ? 4 : 2 * lsm->snapshots_size;
+        lsm->snapshots = (uint64_t *) realloc(lsm->snapshots,
+                                              lsm->snapshots_size * sizeof(uint64_t));
+    }
+    // Sequence numbers only increase: the list stays sorted
+    lsm->snapshots[lsm->Ns++] = lsm->seq;
+    return lsm->seq;
+}
+
+// Release a snapshot previously acquired
+void snapshot_release(LSM_tree *lsm, uint64_t snapshot){
+    for (int i=0; i < lsm->Ns; i++){
+        if (lsm->snapshots[i] == snapshot){
+            for (int j=i; j < lsm->Ns - 1; j++) lsm->snapshots[j] = lsm->snapshots[j+1];
+            lsm->Ns--;
+            return;
+        }
+    }
+    printf("ERROR: snapshot %llu is not live\n", (unsigned long long) snapshot);
+}
+
 
 // Read value of key in LSMTree lsm
 // return -1 if value not present, else index >=0 with value pointer
@@ -319,12 +763,23 @@ int read_lsm(LSM_tree *lsm, int key, char* value){
 int read_lsm_parallel(LSM_tree *lsm, int key, char* value){
     // Memory allocation
     int* index = (int*) malloc(sizeof(int)); // -1 not found else found
+    uint8_t type = OP_VALUE;
+    uint64_t seq = 0;
     if (value == NULL) value = (char*) malloc(lsm->value_size*sizeof(char));
 
+    // Row cache
+    if ((lsm->cache != NULL) && row_cache_get(lsm->cache, key, value)){
+        if (VERBOSE == 1) printf("Key found in row cache\n");
+        free(index);
+        return 1;
+    }
+
     // Linear scan in C0 (initialize index to -1)
-    keys_linear_search(index, key, lsm->C0->keys, lsm->Cs_Ne[0]);
+    keys_linear_search(index, key, lsm->C0->keys, lsm->C0->seqs, lsm->Cs_Ne[0], SEQ_MAX);
     if (*index != -1){
         if (VERBOSE == 1) printf("Key found in C0\n");
+        type = lsm->C0->types[*index];
+        seq = lsm->C0->seqs[*index];
         strcpy(value, lsm->C0->values + (*index)*lsm->value_size);
     }
 
@@ -332,8 +787,12 @@ int read_lsm_parallel(LSM_tree *lsm, int key, char* value){
     // Checking extreme of the buffer
     if ((*index == -1) && (key >= lsm->buffer->keys[0]) && (key <= lsm->buffer->keys[lsm->Cs_Ne[1]-1])){
         *index = binary_search(lsm->buffer->keys, key, 0, lsm->Cs_Ne[1]-1);
+        *index = first_visible(lsm->buffer->keys, lsm->buffer->seqs, *index, lsm->Cs_Ne[1],
+                               SEQ_MAX);
         if (*index != -1){
             if (VERBOSE == 1) printf("Key found in %s\n", lsm->buffer->component_id);
+            type = lsm->buffer->types[*index];
+            seq = lsm->buffer->seqs[*index];
             strcpy(value, lsm->buffer->values + (*index)*lsm->value_size);
         }
     }
@@ -342,7 +801,7 @@ int read_lsm_parallel(LSM_tree *lsm, int key, char* value){
     if (*index == -1){
         int result_code;
         void *thread_result;
-        pthread_t threads[lsm->Nc-1];
+        pthread_t threads[lsm->Nc+2];
         // Initialize the semaphore and the shared variable (gt any level)
         mutex = (sem_t*) malloc(sizeof(sem_t));
         mutex = sem_open("/mysemaphore", O_CREAT, 1);
@@ -368,7 +827,7 @@ int read_lsm_parallel(LSM_tree *lsm, int key, char* value){
         // signal(SIGUSR1, handler);
 
         // Starting with C1 (indexed at 2 in Cs_Ne)
-        for (int j=2; j<lsm->Nc+1; j++){
+        for (int j=2; j<lsm->Nc+2; j++){
             if (lsm->Cs_Ne[j] > 0){
                 // Build the thread argument
                 arg_thread* arg = malloc(sizeof(arg_thread) + sizeof(arg_thread_common*));
@@ -387,7 +846,7 @@ int read_lsm_parallel(LSM_tree *lsm, int key, char* value){
             }
         }
         // Reading answer from threads
-        for (int j=2; j<lsm->Nc+1; j++){
+        for (int j=2; j<lsm->Nc+2; j++){
             if (lsm->Cs_Ne[j] > 0){
                 // If value was found by previous, next thread is cancelled
                 if (*index != -1) {
@@ -406,8 +865,13 @@ int read_lsm_parallel(LSM_tree *lsm, int key, char* value){
                     *index = (int) thread_result;
                     // Key found (can still be deleted)
                     if (VERBOSE == 1) printf("Key Found in C%d, by thread id: %d\n", j-1, j-2);
-                    read_value(value, *index, lsm->name, j-1,
-                               lsm->value_size, lsm->filename_size);
+                    type = read_type(*index, lsm->name, j-1, lsm->filename_size,
+                                     lsm->checksums[j]);
+                    if (lsm->Nr > 0) seq = read_seq(*index, lsm->name, j-1, lsm->filename_size,
+                                                    lsm->checksums[j]);
+                    if ((type == OP_VALUE) &&
+                        !read_value(value, *index, lsm->name, j-1, lsm->value_size,
+                                    lsm->filename_size, lsm->checksums[j])) type = OP_DELETE;
                 }
             }
         }
@@ -416,7 +880,8 @@ int read_lsm_parallel(LSM_tree *lsm, int key, char* value){
         // free(common);
     }
     // Check if key found and not previously deleted
-    if ((*index >= 0) && (*(value) != *TOMBSTONE)){
+    if ((*index >= 0) && (type == OP_VALUE) && !range_deleted(lsm, key, seq, SEQ_MAX)){
+        if (lsm->cache != NULL) row_cache_put(lsm->cache, key, value);
         free(index);
         return 1;
     }
@@ -428,48 +893,248 @@ int read_lsm_parallel(LSM_tree *lsm, int key, char* value){
 // Update (key, value) to the lsm tree: idea is to scan linearly
 // C0 and update directly (key,value) if found, else append it; the
 // update will occur when merging (merge keep always the key in the
-// smallest component)
-void update_lsm(LSM_tree *lsm, int key, char *value){
+// smallest component). The value in C0 is only overwritten if no live
+// snapshot reads it, else the new version is appended.
+// type is OP_VALUE for an update, OP_DELETE to write a tombstone.
+void put_lsm(LSM_tree *lsm, int key, char *value, uint8_t type){
     // Bloom filter check
-    if (BLOOM_ON && bloom_check(lsm->bloom, (uint64_t) key) == 0){
+    if (BLOOM_ON && filter_check(lsm->tree_filter, key) == 0){
         printf("UPDATE: Key %d was no present\n", key);
         return;
     }
+    // A deletable filter only removes the keys it holds: a tombstone is only
+    // written for a key present, an update of a key absent adds it
+    if (BLOOM_ON && filter_deletable(lsm->tree_filter)){
+        char* current = (char*) malloc(lsm->value_size*sizeof(char));
+        int present = (read_lsm(lsm, key, current) == 1);
+        free(current);
+        if (!present && (type == OP_DELETE)) return;
+        if (!present) filter_add(lsm->tree_filter, key);
+    }
     // Linear scan of C0
     int* index = (int*) malloc(sizeof(int));
-    keys_linear_search(index, key, lsm->C0->keys, lsm->Cs_Ne[0]);
-    if (*index != -1){
+    keys_linear_search(index, key, lsm->C0->keys, lsm->C0->seqs, lsm->Cs_Ne[0], SEQ_MAX);
+    if ((*index != -1) &&
+        !snapshot_between(lsm->snapshots, lsm->Ns, lsm->C0->seqs[*index], lsm->seq + 1)){
         // Update the value for key index
+        if (lsm->cache != NULL) row_cache_erase(lsm->cache, key);
+        lsm->Cs_Nt[0] += (type == OP_DELETE) - (lsm->C0->types[*index] == OP_DELETE);
+        lsm->C0->seqs[*index] = ++lsm->seq;
+        lsm->C0->types[*index] = type;
         strcpy(lsm->C0->values + (*index)*lsm->value_size, value);
     }
     else{
         // Append the update
         // TODO: correct update of the number of elements in the lsm tree
         // or decide if we want to have it as exact value
-        append_lsm(lsm, key, value);
+        append_lsm(lsm, key, value, type);
     }
     // free memory
     free(index);
 }
 
-// Delete (key, value) to the lsm tree: 
+// Update (key, value) to the lsm tree
+void update_lsm(LSM_tree *lsm, int key, char *value){
+    put_lsm(lsm, key, value, OP_VALUE);
+}
+
+// Delete (key, value) to the lsm tree: write a tombstone (empty value)
 void delete_lsm(LSM_tree *lsm, int key){
     // Decrement total number of elments in lsm
     lsm->Ne--;
-    // Use deletion character
-    char* deletion = (char*) malloc(lsm->value_size*sizeof(char));
-    sprintf(deletion, TOMBSTONE);
-    update_lsm(lsm, key, deletion);
+    char deletion[] = "";
+    put_lsm(lsm, key, deletion, OP_DELETE);
 }
 
-// Updates number of elements in each component in the metadata of the LSM
+// Delete all the keys in [low, high] with a single range tombstone: it hides
+// the older versions of these keys from the reads and the merges drop them.
+// It is flushed with C0 and follows its data down to the last component, where
+// it is removed once no snapshot reads a version under it.
+// lsm->Ne is left as is: counting the keys deleted would mean reading the range,
+// and Ne is an estimate anyway (delete_lsm decrements it for absent keys too).
+void delete_range_lsm(LSM_tree *lsm, int low, int high){
+    if (low > high) return;
+    if (lsm->Nr >= lsm->ranges_size){
+        lsm->ranges_size = (lsm->ranges_size == 0) ? 4 : 2 * lsm->ranges_size;
+        lsm->ranges = (range_tombstone *) realloc(lsm->ranges,
+                                                  lsm->ranges_size * sizeof(range_tombstone));
+        lsm->ranges_max_high = (int *) realloc(lsm->ranges_max_high,
+                                               lsm->ranges_size * sizeof(int));
+    }
+    // Kept sorted by low
+    int r = ranges_after(lsm->ranges, lsm->Nr, low);
+    memmove(lsm->ranges + r + 1, lsm->ranges + r, (lsm->Nr - r) * sizeof(range_tombstone));
+    lsm->Nr++;
+    range_tombstone* range = lsm->ranges + r;
+    range->low = low;
+    range->high = high;
+    range->seq = ++lsm->seq;
+    range->level = 0;
+    range->live = 0;
+    ranges_update_max_high(lsm->ranges, lsm->ranges_max_high, lsm->Nr, r);
+    if (lsm->cache != NULL) row_cache_erase_range(lsm->cache, low, high);
+    write_range_tombstones(lsm);
+    update_component_size(lsm);
+}
+
+// Return 1 if the version (key, seq) is hidden by a range tombstone visible at
+// snapshot, else 0: the oldest tombstone over it newer than seq is visible
+int range_deleted(LSM_tree *lsm, int key, uint64_t seq, uint64_t snapshot){
+    uint64_t covering = range_covering_seq(lsm->ranges, lsm->ranges_max_high, lsm->Nr,
+                                           key, seq);
+    return (covering != SEQ_MAX) && (covering <= snapshot);
+}
+
+// Move the range tombstones of component from (index in Cs_Ne) into component to
+// after their merge. In the last component, a range tombstone is removed when
+// the merge did not keep any version under it (see merge_list).
+void move_range_tombstones(LSM_tree *lsm, int from, int to){
+    int last = lsm->Nc + 1;
+    int Nr = 0;
+    for (int r=0; r<lsm->Nr; r++){
+        range_tombstone range = lsm->ranges[r];
+        if (range.level == from) range.level = to;
+        if ((to == last) && (range.level == last) && !range.live) continue;
+        range.live = 0;
+        lsm->ranges[Nr++] = range;
+    }
+    lsm->Nr = Nr;
+    ranges_update_max_high(lsm->ranges, lsm->ranges_max_high, lsm->Nr, 0);
+    write_range_tombstones(lsm);
+}
+
+// Save the block of range tombstones to disk in file ranges.data
+void write_range_tombstones(LSM_tree *lsm){
+    char *filename = (char*) calloc(56, sizeof(char));
+    sprintf(filename,"%s/ranges.data", lsm->name);
+    FILE* fout = fopen(filename, "wb");
+    if (fout == NULL){
+        perror("fopen");
+        free(filename);
+        return;
+    }
+    fwrite(&lsm->Nr, sizeof(int), 1, fout);
+    uint32_t crc = crc32c(0, &lsm->Nr, sizeof(int));
+    // ranges may be NULL while there are none
+    if (lsm->Nr > 0){
+        fwrite(lsm->ranges, sizeof(range_tombstone), lsm->Nr, fout);
+        crc = crc32c(crc, lsm->ranges, lsm->Nr * sizeof(range_tombstone));
+    }
+    fwrite(&crc, sizeof(uint32_t), 1, fout);
+    fclose(fout);
+    free(filename);
+}
+
+// Read the block of range tombstones from disk (empty if no file)
+void read_range_tombstones(LSM_tree *lsm){
+    char *filename = (char*) calloc(56, sizeof(char));
+    sprintf(filename,"%s/ranges.data", lsm->name);
+    FILE* fin = fopen(filename, "rb");
+    lsm->Nr = 0;
+    if (fin != NULL){
+        fread(&lsm->Nr, sizeof(int), 1, fin);
+        lsm->ranges_size = lsm->Nr;
+        lsm->ranges = (range_tombstone *) malloc(lsm->Nr * sizeof(range_tombstone));
+        int Nread = fread(lsm->ranges, sizeof(range_tombstone), lsm->Nr, fin);
+        uint32_t crc;
+        if ((CHECKSUM_VERIFY >= VERIFY_COMPACTION) && ((Nread != lsm->Nr) ||
+            ((fread(&crc, sizeof(uint32_t), 1, fin) == 1) &&
+             (crc32c(crc32c(0, &lsm->Nr, sizeof(int)), lsm->ranges,
+                     lsm->Nr * sizeof(range_tombstone)) != crc)))){
+            fprintf(stderr, "ERROR: range tombstones of %s corrupted\n", lsm->name);
+            exit(1);
+        }
+        fclose(fin);
+        // Sorted by low (files written before they were kept sorted too)
+        qsort(lsm->ranges, lsm->Nr, sizeof(range_tombstone), range_tombstone_cmp);
+        lsm->ranges_max_high = (int *) malloc(lsm->Nr * sizeof(int));
+        ranges_update_max_high(lsm->ranges, lsm->ranges_max_high, lsm->Nr, 0);
+    }
+    free(filename);
+}
+
+// Compact the disk component at level (index in Cs_Ne) into the next one.
+// The last component is compacted with itself, purging its tombstones and
+// the versions no snapshot reads anymore.
+void compact_component(LSM_tree *lsm, int level){
+    int last = lsm->Nc + 1;
+    // Components read with room for the merge only, and the temporary copy
+    int current_capacity = lsm->Cs_Ne[level];
+    int next_capacity = (level < last) ? lsm->Cs_Ne[level] + lsm->Cs_Ne[level+1] : 0;
+    int copy = (level < last) ? lsm->Cs_Ne[level+1] : lsm->Cs_Ne[level];
+    size_t merge_bytes = entry_size(lsm->value_size) * (current_capacity + next_capacity + copy);
+    memory_reserve(lsm->governor, MEM_MERGE, merge_bytes, 0);
+
+    char * component_id = (char*) malloc(16*sizeof(char));
+    component* current_component = (component *) malloc(sizeof(component));
+    sprintf(component_id, "C%d", level - 1);
+    read_disk_component(current_component, lsm->name, lsm->Cs_Ne + level, component_id,
+                        &current_capacity, lsm->value_size, lsm->filename_size);
+    if (level < last){
+        component* next_component = (component *) malloc(sizeof(component));
+        sprintf(component_id, "C%d", level);
+        read_disk_component(next_component, lsm->name, lsm->Cs_Ne + (level+1), component_id,
+                            &next_capacity, lsm->value_size, lsm->filename_size);
+        merge_components(lsm, next_component, current_component, level + 1 == last);
+        update_component_indexes(lsm, level + 1, next_component);
+        update_component_indexes(lsm, level, current_component);
+        lsm->Cs_Nt[level + 1] = count_tombstones(next_component);
+        free_component(next_component);
+        move_range_tombstones(lsm, level, level + 1);
+    }
+    else{
+        // Merge with an empty component
+        int empty_size = 0;
+        int empty_Ne = 0;
+        component* empty = (component *) malloc(sizeof(component));
+        init_component(empty, &empty_size, lsm->value_size, &empty_Ne, "empty");
+        merge_list(empty, current_component, lsm->value_size, lsm->snapshots, lsm->Ns,
+                   lsm->ranges, lsm->ranges_max_high, lsm->Nr, 1, lsm->tree_filter);
+        write_disk_component(current_component, lsm->name, lsm->value_size, lsm->filename_size);
+        update_component_indexes(lsm, level, current_component);
+        lsm->Cs_Nt[level] = count_tombstones(current_component);
+        free_component(empty);
+        move_range_tombstones(lsm, level, level);
+    }
+    if (level < last) lsm->Cs_Nt[level] = 0;
+    update_component_size(lsm);
+    free_component(current_component);
+    free(component_id);
+    memory_release(lsm->governor, MEM_MERGE, merge_bytes);
+}
+
+// Tombstone-triggered compactions: a disk component whose density of tombstones
+// is above TOMBSTONE_DENSITY is pushed into the next one (if it has room),
+// until its tombstones reach the last component where they are purged.
+void compact_tombstones(LSM_tree *lsm){
+    int last = lsm->Nc + 1;
+    for (int j=2; j<=last; j++){
+        if ((lsm->Cs_Nt[j] < TOMBSTONE_MIN) ||
+            (lsm->Cs_Nt[j] <= TOMBSTONE_DENSITY * lsm->Cs_Ne[j])) continue;
+        // Tombstones kept by the last component are still read by a snapshot
+        if ((j == last) && (lsm->Ns > 0)) continue;
+        if ((j < last) && (lsm->Cs_Ne[j] + lsm->Cs_Ne[j+1] > lsm->Cs_size[j+1])) continue;
+        if (VERBOSE == 1) printf("Compacting C%d: %d tombstones / %d\n", j-1,
+                                 lsm->Cs_Nt[j], lsm->Cs_Ne[j]);
+        compact_component(lsm, j);
+    }
+}
+
+// Updates number of elements in each component, the last sequence number
+// and the number of tombstones in the metadata of the LSM
 void update_component_size(LSM_tree *lsm){
     char *filename = (char*) calloc(56, sizeof(char));
     sprintf(filename,"%s/meta.data", lsm->name);
     FILE* fout = fopen(filename, "r+b");
-    // Goto the offset of Cs_Ne
-    fseek(fout, -(lsm->Nc+2)*sizeof(int), SEEK_END);
+    // Goto the offset of Cs_Ne (after name, Ne, Nc, value_size and Cs_size)
+    fseek(fout, lsm->filename_size*sizeof(char) + (3 + lsm->Nc+2)*sizeof(int), SEEK_SET);
     fwrite(lsm->Cs_Ne, sizeof(int), lsm->Nc+2, fout);
+    fwrite(&lsm->seq, sizeof(uint64_t), 1, fout);
+    fwrite(lsm->Cs_Nt, sizeof(int), lsm->Nc+2, fout);
+    // Checksum of the fields (first of the two at the end of the file)
+    uint32_t crc = crc32c_file(fout, 0, meta_header_size(lsm));
+    fseek(fout, -2*(long)sizeof(uint32_t), SEEK_END);
+    fwrite(&crc, sizeof(uint32_t), 1, fout);
     fclose(fout);
     free(filename);    
 }
@@ -480,6 +1145,13 @@ void print_state(LSM_tree *lsm){
     printf("Number of elements in LSMTree: %d\n", lsm->Ne);
     printf("Number of elements in C0: %d / %d\n", lsm->Cs_Ne[0], lsm->Cs_size[0]);
     printf("Number of elements in buffer: %d / %d\n", lsm->Cs_Ne[1], lsm->Cs_size[1]);
-    for (int i=2; i<lsm->Nc+2; i++) printf("Number of elements in C%d: %d / %d\n",i-1,
-                                      lsm->Cs_Ne[i], lsm->Cs_size[i]);
+    for (int i=2; i<lsm->Nc+2; i++) printf("Number of elements in C%d: %d / %d (%d tombstones)\n",
+                                      i-1, lsm->Cs_Ne[i], lsm->Cs_size[i], lsm->Cs_Nt[i]);
+    print_memory(lsm->governor);
+    if (lsm->cache != NULL){
+        uint64_t hits, misses;
+        row_cache_stats(lsm->cache, &hits, &misses);
+        printf("Row cache: %llu hits, %llu misses\n", (unsigned long long) hits,
+               (unsigned long long) misses);
+    }
 }
\ No newline at end of file
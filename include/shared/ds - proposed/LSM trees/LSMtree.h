@@ -6,6 +6,7 @@
 #include <sys/mman.h>
 #include <fcntl.h> // for open
 #include <unistd.h> // for close
+#include <sys/stat.h> // for mkdir
 #include <pthread.h>
 #include <signal.h>
 #include <limits.h>
@@ -15,8 +16,36 @@
 
 // verbose to debugg (1 activated, else 0)
 #define VERBOSE 1
-// Indicator for a deleted key
-#define TOMBSTONE ((const char *)"!")
+// Type of an entry: a value or a deletion (tombstone)
+#define OP_VALUE 0
+#define OP_DELETE 1
+// Snapshot reading the most recent version of every key
+#define SEQ_MAX UINT64_MAX
+// Kinds of filters (filter.c)
+#define FILTER_NONE 0
+#define FILTER_BLOOM 1
+#define FILTER_CUCKOO 2
+#define FILTER_XOR 3
+#define FILTER_KINDS 4
+// Kinds of memory accounted by the memory governor
+#define MEM_MEMTABLE 0
+#define MEM_FILTER 1
+#define MEM_CACHE 2
+#define MEM_MERGE 3
+#define MEM_KINDS 4
+// Partitioning of the keys between the shards of a sharded lsm
+#define SHARD_HASH 0
+#define SHARD_RANGE 1
+// When the checksums of the components are verified (checksum.c)
+#define VERIFY_NONE 0
+#define VERIFY_COMPACTION 1 // components read from disk (opening, merges)
+#define VERIFY_READS 2 // and every block read by a search or a scan
+// Files of a component with checksums
+#define CHECKSUM_KEYS 0
+#define CHECKSUM_VALUES 1
+#define CHECKSUM_SEQS 2
+#define CHECKSUM_TYPES 3
+#define CHECKSUM_FILES 4
 
 // ********************************************************
 // Parameters that may be changed by the user:
@@ -25,10 +54,49 @@
 #define CO_TOLERANCE 2000
 // Frequency of check in parallel read
 #define FREQUENCE 20
-// Define if use of a bloom filter
+// Define if use of a filter of all the keys inserted (TREE_FILTER kind, see
+// filter.c): with a deletable filter, the keys purged from the lsm are removed
 #define BLOOM_ON 1
+#define TREE_FILTER FILTER_BLOOM
 #define HASHES 5
 #define BLOOM_SIZE 10000000
+// Filter of each component, checked before searching it (FILTER_NONE for no
+// filter): memory components need a dynamic filter, disk components are
+// rebuilt at each merge so a static one fits
+#define FILTER_MEMORY FILTER_CUCKOO
+#define FILTER_DISK FILTER_XOR
+#define FILTER_BITS_PER_KEY 10
+// Range filter of each disk component (bounds and filter of the key prefixes),
+// checked before scanning it; ranges over more than RANGE_FILTER_PROBES
+// prefixes are always scanned
+#define RANGE_FILTER_ON 1
+#define RANGE_FILTER_KIND FILTER_XOR
+#define RANGE_FILTER_PROBES 16
+// Compact a disk component into the next one when this fraction of its
+// entries are tombstones (and it holds at least TOMBSTONE_MIN of them)
+#define TOMBSTONE_DENSITY 0.25
+#define TOMBSTONE_MIN 100
+// Memory budget (in bytes) shared by all the lsm of the process: memtables
+// (C0 and buffer), bloom filters, row caches and merge buffers. 0 for no limit.
+// At creation, C0 and the buffer are reduced to fit in half of the memory
+// available, the bloom filter in a quarter and the row cache in half of the rest.
+#define MEMORY_BUDGET (512UL*1024*1024)
+// Learned index per disk component (else binary search), error bound in keys
+#define LEARNED_INDEX 1
+#define LEARNED_EPSILON 16
+// Row cache of the values of the hot keys (number of entries, split in shards)
+#define ROW_CACHE_ON 1
+#define ROW_CACHE_SIZE 65536
+#define ROW_CACHE_SHARDS 16
+// Maximum number of pending requests in the queue of a shard (writers wait)
+#define SHARD_QUEUE_SIZE 4096
+// CRC32C of each block of CHECKSUM_BLOCK bytes of the files of the components
+// (and of each batch appended to the log of C0), verified as CHECKSUM_VERIFY.
+// A point read checks the whole blocks of its key, type and value: small blocks
+// keep it cheap, but with VERIFY_READS their checksums (16 bytes each) stay in
+// memory
+#define CHECKSUM_BLOCK 512
+#define CHECKSUM_VERIFY VERIFY_READS
 // ********************************************************
 
 // Global semaphore for parallel read
@@ -44,14 +112,130 @@ typedef struct {
     index_t *table;
 } bloom_filter_t;
 
+// Operations of a kind of filter: create/add for the dynamic ones, build for
+// the static ones, remove only for the deletable ones (else NULL)
+typedef struct filter_ops {
+    const char* name;
+    void* (*create)(int capacity);
+    void* (*build)(int* keys, int n);
+    int (*add)(void* state, int key);
+    int (*remove)(void* state, int key);
+    int (*check)(void* state, int key);
+    size_t (*bytes)(void* state);
+    void (*write)(void* state, FILE* fout);
+    void* (*read)(FILE* fin);
+    void (*destroy)(void* state);
+} filter_ops;
+
+typedef struct filter {
+    int kind; // FILTER_BLOOM, FILTER_CUCKOO or FILTER_XOR
+    const filter_ops* ops;
+    void* state;
+    int saturated; // Full: every key may be present
+} filter;
+
+typedef struct range_filter {
+    int min; // Smallest key
+    int max; // Largest key
+    int shift; // Low bits removed from the keys to get their prefix
+    filter* prefixes;
+} range_filter;
+
 typedef struct component {
     int *keys;
     char *values;
+    uint64_t *seqs; // sequence number of each entry (sorted: key asc, then seq desc)
+    uint8_t *types; // type of each entry (OP_VALUE or OP_DELETE)
     int *Ne; // number of elements stored (point to the int inside the list of the LSMtree)
     int *S; // capacity (point to the int inside the list of the LSMtree)
     char* component_id; //identifier of the component for the filename (Cnumber or buffer)
 } component;
 
+// Checksum of length bytes at offset of a file
+typedef struct checksum_record {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t crc;
+} checksum_record;
+
+// Checksums of the files of a component (CHECKSUM_KEYS, ...), sorted by offset
+typedef struct block_checksums {
+    int N[CHECKSUM_FILES];
+    int size[CHECKSUM_FILES];
+    checksum_record* records[CHECKSUM_FILES];
+} block_checksums;
+
+// Segment of a learned index: predicts position + slope * (k - key) for the
+// keys k >= key (until the next segment)
+typedef struct segment {
+    int key;
+    int position;
+    double slope;
+} segment;
+
+// Learned index of a disk component: piecewise linear model of the position of
+// the keys, with an error of at most epsilon
+typedef struct learned_index {
+    int Ne; // Number of elements of the component when built
+    int epsilon;
+    int Nsegments;
+    segment* segments;
+} learned_index;
+
+// Shard of the row cache: CLOCK over a fixed array of slots, indexed by an
+// open addressing hash table, with a TinyLFU admission (count-min sketch)
+typedef struct row_cache_shard {
+    pthread_mutex_t lock;
+    int capacity; // Number of slots
+    int* keys;
+    char* values;
+    uint8_t* used; // slot holds an entry
+    uint8_t* referenced; // CLOCK bit
+    int* free_slots; // Stack of the unused slots
+    int Nfree;
+    int hand; // CLOCK hand
+    int* table; // Hash table of slots indexes (-1 empty), linear probing
+    int table_mask;
+    uint8_t* sketch; // Count-min sketch: 4 rows of 4 bits counters (one per byte)
+    int sketch_mask;
+    int samples; // Accesses since the last aging of the sketch
+    uint64_t hits;
+    uint64_t misses;
+} row_cache_shard;
+
+typedef struct row_cache {
+    int Nshards;
+    int value_size;
+    int refs; // Number of lsm sharing the cache
+    struct memory_governor* governor; // Governor accounting its memory (or NULL)
+    row_cache_shard* shards;
+} row_cache;
+
+// Memory governor: accounts the memory of the lsm against a single budget.
+// Merges reserve their buffers: over budget, the row caches are shrunk first,
+// then a new merge waits for the merges in progress to release their memory
+// (and so do the writers of a sharded lsm), instead of allocating more.
+typedef struct memory_governor {
+    pthread_mutex_t lock;
+    pthread_cond_t released;
+    size_t budget; // 0 for no limit
+    size_t used[MEM_KINDS]; // Memory used per kind (MEM_MEMTABLE, ...)
+    size_t total;
+    row_cache** caches; // Row caches which can be resized
+    int* caches_capacity; // Capacity requested at their creation
+    int Ncaches;
+    int caches_size;
+} memory_governor;
+
+// Range tombstone: deletes the versions of the keys in [low, high] older than seq
+typedef struct range_tombstone {
+    int low;
+    int high;
+    uint64_t seq;
+    int level; // index in Cs_Ne of the component it was flushed with
+    int live; // set by a merge which kept a version under it for a snapshot
+} range_tombstone;
+
 // First version: finit number of components
 typedef struct LSM_tree {
     char *name;
@@ -65,9 +249,81 @@ typedef struct LSM_tree {
     // TODO: linked list for infinite number oc components?
     int *Cs_Ne; // List of number of elements per component: [C0, buffer, C1, C2,...]
     int *Cs_size; // List of number of elements per component: [C0, buffer, C1, C2,...]
-    bloom_filter_t *bloom;
+    int *Cs_Nt; // List of number of tombstones per component: [C0, buffer, C1, C2,...]
+    filter *tree_filter; // Filter of all the keys inserted (TREE_FILTER kind)
+    filter **filters; // Filter per component (NULL: always searched)
+    int *filter_kinds; // Kind of filter per component
+    range_filter **range_filters; // Range filter per disk component (NULL: always scanned)
+    uint64_t seq; // Sequence number of the last write
+    uint64_t *snapshots; // Live snapshots, sorted in increasing order
+    int Ns; // Number of live snapshots
+    int snapshots_size; // Capacity of the snapshots list
+    range_tombstone *ranges; // Range tombstones block, sorted by low (saved in ranges.data)
+    int *ranges_max_high; // Largest high of ranges[0..r], to stop a lookup early
+    int Nr; // Number of range tombstones
+    int ranges_size; // Capacity of the range tombstones block
+    int num_append; // Appends since the last logging of C0
+    row_cache *cache; // Values of the hot keys (NULL if disabled)
+    memory_governor *governor; // Memory budget of the lsm
+    learned_index **models; // Learned index per component (NULL: binary search)
+    block_checksums **checksums; // Checksums per disk component (NULL: not verified)
 } LSM_tree;
 
+// Request to a shard, executed in order by its worker thread
+typedef struct shard_request {
+    int op; // SHARD_INSERT, SHARD_UPDATE, ... (see shard.c)
+    int key;
+    int high; // upper bound of a range (scan, range delete)
+    char* value; // copy of the value to write, or buffer of the value read
+    int* keys; // output of a scan
+    char* values;
+    int max_elements;
+    int result; // output of a read (1 found, else -1) or a scan (number of keys)
+    struct shard_waiter* waiter; // NULL for writes: the worker frees the request
+    struct shard_request* next;
+} shard_request;
+
+// Completion of a group of requests (read, multiget, scan, sync)
+typedef struct shard_waiter {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int pending;
+} shard_waiter;
+
+// One shard: an independent lsm owned by its worker thread (which also runs
+// its merges) and the queue of its pending requests
+typedef struct shard {
+    LSM_tree* lsm;
+    pthread_t worker;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    shard_request* head;
+    shard_request* tail;
+    int Nq; // Number of requests in the queue
+} shard;
+
+// Shared-nothing sharded lsm: the keys are partitioned between Nshards lsm
+// stored in name/shard0, name/shard1, ...
+typedef struct sharded_lsm {
+    char* name;
+    int Nshards;
+    int partition; // SHARD_HASH or SHARD_RANGE
+    int key_low; // Range of the keys split between the shards (SHARD_RANGE)
+    int key_high;
+    int value_size;
+    shard* shards;
+} sharded_lsm;
+
+// Version of a key found by a scan: position of the entry in its component
+typedef struct scan_entry {
+    int key;
+    uint64_t seq;
+    uint8_t type;
+    int level; // index in Cs_Ne: 0 for C0, 1 for buffer, j for C(j-1)
+    int index;
+} scan_entry;
+
 // Struct used for the parallel implementation
 typedef struct arg_thread_common
 {
@@ -85,37 +341,65 @@ typedef struct arg_thread
 } arg_thread;
 
 
-// A min heap node
-typedef struct MinHeapNode
-{
-    int element; // The element to be stored
-    int i; // index of the array from which the element is taken
-    int j; // index of the next element to be picked from array
-} MinHeapNode;
+// A sorted run for a k-way merge: Ne entries by increasing key, with their
+// values (value_size bytes each) and, unless NULL, their sequence numbers
+// and types (newest version first for equal keys, as inside a component)
+typedef struct merge_run {
+    int* keys;
+    char* values;
+    uint64_t* seqs;
+    uint8_t* types;
+    int Ne;
+} merge_run;
 
-typedef struct MinHeap
-{
-    MinHeapNode *harr; // pointer to array of elements in heap
-    int heap_size; // size of min heap    
-}MinHeap;
+// Loser tree over k runs, the newest first: the runs are the leaves k..2k-1,
+// each internal node 1..k-1 keeps the run which lost the match played there
+// and tree[0] the overall winner, the run holding the smallest entry
+typedef struct loser_tree {
+    merge_run* runs;
+    int k;
+    int* pos; // next entry of each run
+    int* tree;
+} loser_tree;
 
 
 // Declarations for LSMTree.c
 void init_lsm(LSM_tree *lsm, char* name, int filename_size);
 void create_lsm(LSM_tree *lsm, char* name, int Nc, int* Cs_size, int value_size, int filename_size);
+void init_filters(LSM_tree *lsm);
+size_t memtable_bytes(LSM_tree *lsm);
 void free_lsm(LSM_tree *lsm);
 void build_lsm(LSM_tree *lsm, char* name, int Nc, int* Cs_size, int value_size,
                int filename_size);
 void write_lsm_to_disk(LSM_tree *lsm);
 void read_lsm_from_disk(LSM_tree *lsm, char *name, int filename_size);
-void append_lsm(LSM_tree *lsm, int key, char *value);
+void append_lsm(LSM_tree *lsm, int key, char *value, uint8_t type);
 void insert_lsm(LSM_tree *lsm, int key, char *value);
 int read_lsm(LSM_tree *lsm, int key, char* value);
+int read_lsm_snapshot(LSM_tree *lsm, int key, char* value, uint64_t snapshot);
+int scan_lsm(LSM_tree *lsm, int low, int high, int* keys, char* values, int max_elements,
+             uint64_t snapshot);
+uint64_t snapshot_acquire(LSM_tree *lsm);
+void snapshot_release(LSM_tree *lsm, uint64_t snapshot);
 int read_lsm_parallel(LSM_tree *lsm, int key, char* value);
+void put_lsm(LSM_tree *lsm, int key, char *value, uint8_t type);
 void update_lsm(LSM_tree *lsm, int key, char *value);
 void delete_lsm(LSM_tree *lsm, int key);
+void delete_range_lsm(LSM_tree *lsm, int low, int high);
+int range_deleted(LSM_tree *lsm, int key, uint64_t seq, uint64_t snapshot);
+void move_range_tombstones(LSM_tree *lsm, int from, int to);
+void write_range_tombstones(LSM_tree *lsm);
+void read_range_tombstones(LSM_tree *lsm);
+void compact_component(LSM_tree *lsm, int level);
+void compact_tombstones(LSM_tree *lsm);
 void update_component_size(LSM_tree *lsm);
 void print_state(LSM_tree *lsm);
+void update_learned_index(LSM_tree *lsm, int level, component* C);
+void update_filter(LSM_tree *lsm, int level, component* C);
+void update_range_filter(LSM_tree *lsm, int level, component* C);
+void update_checksums(LSM_tree *lsm, int level, component* C);
+void update_component_indexes(LSM_tree *lsm, int level, component* C);
+int set_filter_kind(LSM_tree *lsm, int level, int kind);
 
 // Declarations for component.c
 void init_component(component * c, int* component_size, int value_size, int* Ne,
@@ -127,13 +411,21 @@ void read_disk_component(component* C, char *name, int* Ne, char *component_id,
 void write_disk_component(component *pC, char *name, int value_size, int filename_size);
 void append_on_disk(component * C, int N, char* name, int value_size,
                     int filename_size);
-void read_value(char* value, int index, char* name, int component_index, int value_size,
-                int filename_size);
+int read_value(char* value, int index, char* name, int component_index, int value_size,
+               int filename_size, block_checksums* cs);
+uint8_t read_type(int index, char* name, int component_index, int filename_size,
+                  block_checksums* cs);
+uint64_t read_seq(int index, char* name, int component_index, int filename_size,
+                  block_checksums* cs);
 void swap_component_pointer(component *current_component, component *next_component,
                             int value_size);
-void merge_components(component* next_component, component* current_component, char* name,
-                      int value_size, int filename_size);
-void component_search(int* index, int key, int length, char* filename);
+void merge_components(LSM_tree *lsm, component* next_component, component* current_component,
+                      int last);
+void component_search(int* index, int key, int length, char* filename_keys,
+                      char* filename_seqs, uint64_t snapshot, learned_index* model,
+                      block_checksums* cs);
+void component_scan(scan_entry** entries, int* Nentries, int* capacity, int low, int high,
+                    int level, int length, char* name, int filename_size, block_checksums* cs);
 void *component_search_parallel(void *argument);
 
 // Declarations for helper.c
@@ -144,12 +436,123 @@ void get_files_name_disk(char *filename, char *name, int component_index,
 int binary_search(int* keys, int key, int down, int top);
 int binary_search_signal(int* keys, int key, int down, int top,
                          int thread_level, int* shared_level, int next_check);
-void keys_linear_search(int* index, int key, int* keys, int Ne);                     
-void merge_with_values(int* keys, char* values, int down, int middle, int top,
-                       int value_size);
-void merge_list(int* keys1, int* keys2, char* values1, char* values2,
-                int* size1, int* size2, int value_size);
-void merge_sort_with_values(int* keys, char* values, int down, int top, int value_size);
+int lower_bound(int* keys, int key, int down, int top);
+int first_visible(int* keys, uint64_t* seqs, int index, int Ne, uint64_t snapshot);
+int snapshot_between(uint64_t* snapshots, int Ns, uint64_t down, uint64_t up);
+void keys_linear_search(int* index, int key, int* keys, uint64_t* seqs, int Ne,
+                        uint64_t snapshot);
+void merge_with_values(component* C, int down, int middle, int top, int value_size);
+int ranges_after(range_tombstone* ranges, int Nr, int key);
+int range_tombstone_cmp(const void* a, const void* b);
+void ranges_update_max_high(range_tombstone* ranges, int* max_high, int Nr, int from);
+uint64_t range_covering_seq(range_tombstone* ranges, int* max_high, int Nr, int key,
+                            uint64_t seq);
+void merge_list(component* C1, component* C2, int value_size, uint64_t* snapshots, int Ns,
+                range_tombstone* ranges, int* ranges_max_high, int Nr, int last,
+                filter* purged);
+int count_tombstones(component* C);
+void merge_sort_with_values(component* C, int down, int top, int value_size);
+void add_scan_entry(scan_entry** entries, int* Nentries, int* capacity, int key,
+                    uint64_t seq, uint8_t type, int level, int index);
+int scan_entry_cmp(const void* a, const void* b);
+
+// Declarations for shard.c
+void build_sharded_lsm(sharded_lsm *slsm, char* name, int Nshards, int partition, int key_low,
+                       int key_high, int Nc, int* Cs_size, int value_size, int filename_size);
+void read_sharded_lsm_from_disk(sharded_lsm *slsm, char* name, int filename_size);
+void free_sharded_lsm(sharded_lsm *slsm);
+int shard_of(sharded_lsm *slsm, int key);
+void *shard_worker(void *argument);
+void shard_submit(shard* s, shard_request* request);
+void insert_sharded(sharded_lsm *slsm, int key, char *value);
+void update_sharded(sharded_lsm *slsm, int key, char *value);
+void delete_sharded(sharded_lsm *slsm, int key);
+void delete_range_sharded(sharded_lsm *slsm, int low, int high);
+int read_sharded(sharded_lsm *slsm, int key, char* value);
+int multiget_sharded(sharded_lsm *slsm, int* keys, int n, char* values, int* found);
+int scan_sharded(sharded_lsm *slsm, int low, int high, int* keys, char* values,
+                 int max_elements);
+void sync_sharded(sharded_lsm *slsm);
+void print_sharded_state(sharded_lsm *slsm);
+
+// Declarations for cache.c
+row_cache* row_cache_create(int capacity, int value_size);
+void row_cache_share(row_cache* cache);
+void row_cache_release(row_cache* cache);
+int row_cache_get(row_cache* cache, int key, char* value);
+void row_cache_put(row_cache* cache, int key, char* value);
+void row_cache_erase(row_cache* cache, int key);
+void row_cache_erase_range(row_cache* cache, int low, int high);
+void row_cache_stats(row_cache* cache, uint64_t* hits, uint64_t* misses);
+void row_cache_resize(row_cache* cache, int capacity);
+int row_cache_capacity(row_cache* cache);
+size_t row_cache_bytes(row_cache* cache);
+size_t row_cache_entry_size(int value_size);
+
+// Declarations for memory.c
+memory_governor* memory_governor_get();
+void memory_set_budget(memory_governor* governor, size_t budget);
+size_t memory_available(memory_governor* governor);
+size_t entry_size(int value_size);
+void memory_charge(memory_governor* governor, int kind, size_t bytes);
+void memory_release(memory_governor* governor, int kind, size_t bytes);
+void memory_reserve(memory_governor* governor, int kind, size_t bytes, size_t held);
+void memory_throttle(memory_governor* governor);
+row_cache* memory_create_cache(memory_governor* governor, int capacity, int value_size);
+void memory_unregister_cache(memory_governor* governor, row_cache* cache);
+void print_memory(memory_governor* governor);
+
+// Declarations for learned.c
+learned_index* learned_index_build(int* keys, int Ne, int epsilon);
+void learned_index_free(learned_index* model);
+size_t learned_index_bytes(learned_index* model);
+int learned_index_search(learned_index* model, int* keys, int key);
+void write_learned_index(learned_index* model, char* name, int component_index,
+                         int filename_size);
+learned_index* read_learned_index(char* name, int component_index, int Ne, int filename_size);
+
+// Declarations for filter.c
+const filter_ops* filter_get_ops(int kind);
+filter* filter_create(int kind, int capacity);
+filter* filter_build(int kind, int* keys, int n, int capacity);
+void filter_add(filter* f, int key);
+int filter_remove(filter* f, int key);
+int filter_check(filter* f, int key);
+int filter_deletable(filter* f);
+size_t filter_bytes(filter* f);
+void filter_write(filter* f, FILE* fout);
+filter* filter_read(FILE* fin);
+void filter_free(filter* f);
+void write_component_filter(filter* f, char* name, int component_index, int filename_size);
+filter* read_component_filter(char* name, int component_index, int filename_size);
+range_filter* range_filter_build(int* keys, int n);
+int range_filter_prefix(range_filter* rf, int key);
+int range_filter_check(range_filter* rf, int low, int high);
+size_t range_filter_bytes(range_filter* rf);
+void range_filter_free(range_filter* rf);
+void write_range_filter(range_filter* rf, char* name, int component_index, int filename_size);
+range_filter* read_range_filter(char* name, int component_index, int filename_size);
+
+// Declarations for checksum.c
+uint32_t crc32c_software(uint32_t crc, const void* data, size_t length);
+uint32_t crc32c(uint32_t crc, const void* data, size_t length);
+int crc32c_hardware_enabled();
+uint32_t crc32c_file(FILE* fd, long offset, long length);
+block_checksums* checksums_create();
+void checksums_free(block_checksums* cs);
+block_checksums* component_checksums(component* C, int value_size);
+void write_checksums(block_checksums* cs, char* name, char* component_id, int filename_size,
+                     int append);
+void append_checksums(component* C, int N, uint64_t* offsets, char* name, int value_size,
+                      int filename_size);
+block_checksums* read_checksums(char* name, char* component_id, int filename_size);
+size_t checksums_bytes(block_checksums* cs);
+int checksums_verify(block_checksums* cs, int f, const void* base, uint64_t base_offset,
+                     uint64_t offset, size_t length);
+int checksums_read(FILE* fd, block_checksums* cs, int f, uint64_t offset, size_t length,
+                   void* out);
+int verify_component(component* C, block_checksums* cs, char* name, int value_size,
+                     int filename_size);
 
 // Declarations for bloom.c
 void set_bit(bloom_filter_t *B, index_t i);
@@ -157,17 +560,20 @@ index_t get_bit(bloom_filter_t *B, index_t i);
 index_t hash1(bloom_filter_t *B, key_t_ k);
 index_t hash2(bloom_filter_t *B, key_t_ k);
 void bloom_init(bloom_filter_t *B, index_t size_in_bits, int hashes);
+index_t bloom_words(bloom_filter_t *B);
 void bloom_destroy(bloom_filter_t *B);
 int bloom_check(bloom_filter_t *B, key_t_ k);
 void bloom_add(bloom_filter_t *B, key_t_ k);
 
 // Declarations for heap.c
-void MinHeap_init(MinHeap *minheap, MinHeapNode* a, int size);
-void MinHeapify(MinHeap * minheap, int i);
-MinHeapNode getMin(MinHeap *minheap);
-void replaceMin(MinHeap *minheap, MinHeapNode x);
-void swap(MinHeapNode *x, MinHeapNode *y);
+void loser_tree_init(loser_tree* lt, merge_run* runs, int k);
+int loser_tree_top(loser_tree* lt);
+void loser_tree_pop(loser_tree* lt);
+void loser_tree_free(loser_tree* lt);
+int mergeKRuns(merge_run* runs, int k, merge_run* out, int value_size, int newest_only);
 void mergeKArrays(int *output, int *arr, int k, int n);
+void mergeKArrays_values(int *keys_output, char *values_output, int *keys,
+                         char* values, int k, int n, int value_size);
 
 // Declarations for exp.c
 void print_array_int(int* array, int size);
@@ -179,3 +585,5 @@ double LSMTree_generation(char*name, int Nc, int* Cs_size, int value_size, int n
 double batch_updates(LSM_tree *lsm, int num_updates, int key_down, int key_up);
 double batch_reads(LSM_tree *lsm, int num_reads, int key_down, int key_up);
 double batch_parallel_reads(LSM_tree *lsm, int num_reads, int key_down, int key_up);
+int* fence_build(int* keys, int Ne, int page, int* Nfences);
+int fence_search(int* fences, int Nfences, int* keys, int Ne, int page, int key);
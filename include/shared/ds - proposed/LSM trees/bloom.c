@@ -73,13 +73,19 @@ void bloom_init(bloom_filter_t * B, index_t size_in_bits, int hashes){
     B->hashes = hashes;
     B->size = size_in_bits;
     B->count = 0;
-    B->table = (index_t*)malloc(sizeof(index_t) *(size_in_bits / 8)); // convert size from bits to bytes
+    B->table = (index_t*)malloc(sizeof(index_t) * bloom_words(B)); // one bit per position
 
     if(!B->table) {
         printf("memory error\n");
     }
     // set values to zero
-    memset(B->table, 0, size_in_bits / 8);
+    memset(B->table, 0, sizeof(index_t) * bloom_words(B));
+}
+
+// Number of words of the table (size bits rounded up)
+index_t bloom_words(bloom_filter_t *B){
+    index_t wsize = (sizeof(index_t) * 8);
+    return (B->size + wsize - 1) / wsize;
 }
 
 void bloom_destroy(bloom_filter_t *B){
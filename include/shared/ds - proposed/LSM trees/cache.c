@@ -0,0 +1,317 @@
+#include "LSMTree.h"
+
+// Row cache: values of the hot keys of an lsm, so that repeated reads of a key
+// stored in a disk component are served from memory (no open/fseek/fread).
+// The keys are split between ROW_CACHE_SHARDS shards, each with its own lock,
+// so the cache can be shared by the shards of a sharded lsm.
+// In a shard:
+//     - eviction with CLOCK: a hit sets the referenced bit of the slot, the
+//       hand clears them until it finds a slot not referenced
+//     - admission with TinyLFU: a count-min sketch estimates the frequency of
+//       the keys accessed; a new key only evicts the victim of CLOCK if it is
+//       more frequent. Counters are halved every 10 x capacity accesses.
+// The lsm erases a key from the cache on each write of the key.
+// The memory governor resizes the cache (see memory.c).
+
+#define SKETCH_ROWS 4
+#define SKETCH_MAX 15
+
+// Hash of a key (finalizer of MurmurHash3)
+static uint64_t cache_hash(int key){
+    uint64_t h = (uint32_t) key;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Smallest power of 2 >= n
+static int next_power_of_2(int n){
+    int p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+// Estimated frequency of the key of hash h, incremented if increment is set
+// (only the smallest counters: conservative update)
+static int sketch_frequency(row_cache_shard* shard, uint64_t h, int increment){
+    uint32_t h1 = (uint32_t) h;
+    uint32_t h2 = (uint32_t) (h >> 32) | 1;
+    int width = shard->sketch_mask + 1;
+    uint8_t* counters[SKETCH_ROWS];
+    int frequency = SKETCH_MAX;
+    for (int r=0; r<SKETCH_ROWS; r++){
+        counters[r] = shard->sketch + r*width + ((h1 + r*h2) & shard->sketch_mask);
+        if (*counters[r] < frequency) frequency = *counters[r];
+    }
+    if (increment && (frequency < SKETCH_MAX)){
+        for (int r=0; r<SKETCH_ROWS; r++){
+            if (*counters[r] == frequency) (*counters[r])++;
+        }
+        // Aging: halve all the counters
+        if (++shard->samples >= 10 * shard->capacity){
+            for (int i=0; i<SKETCH_ROWS*width; i++) shard->sketch[i] >>= 1;
+            shard->samples = 0;
+        }
+    }
+    return frequency;
+}
+
+// Position of key in the hash table of shard (-1 if not present)
+static int table_find(row_cache_shard* shard, int key, uint64_t h){
+    int i = h & shard->table_mask;
+    while (shard->table[i] != -1){
+        if (shard->keys[shard->table[i]] == key) return i;
+        i = (i + 1) & shard->table_mask;
+    }
+    return -1;
+}
+
+// Remove the entry at position i of the hash table and free its slot
+// (backward shift of the following entries, no tombstones)
+static void table_remove(row_cache_shard* shard, int i){
+    int slot = shard->table[i];
+    shard->used[slot] = 0;
+    shard->free_slots[shard->Nfree++] = slot;
+    int j = i;
+    while (1){
+        j = (j + 1) & shard->table_mask;
+        if (shard->table[j] == -1) break;
+        int home = cache_hash(shard->keys[shard->table[j]]) & shard->table_mask;
+        // Move entry j to the hole if its home is not in ]i, j]
+        if ((i <= j) ? ((home <= i) || (home > j)) : ((home <= i) && (home > j))){
+            shard->table[i] = shard->table[j];
+            i = j;
+        }
+    }
+    shard->table[i] = -1;
+}
+
+// Allocate the (empty) slots and hash table of a shard of capacity entries
+static void shard_alloc_slots(row_cache_shard* shard, int capacity, int value_size){
+    shard->capacity = capacity;
+    shard->keys = (int *) malloc(capacity * sizeof(int));
+    shard->values = (char *) malloc(capacity * value_size * sizeof(char));
+    shard->used = (uint8_t *) calloc(capacity, sizeof(uint8_t));
+    shard->referenced = (uint8_t *) calloc(capacity, sizeof(uint8_t));
+    shard->free_slots = (int *) malloc(capacity * sizeof(int));
+    for (int i=0; i<capacity; i++) shard->free_slots[i] = capacity - 1 - i;
+    shard->Nfree = capacity;
+    shard->hand = 0;
+    int table_size = next_power_of_2(2 * capacity);
+    shard->table = (int *) malloc(table_size * sizeof(int));
+    for (int i=0; i<table_size; i++) shard->table[i] = -1;
+    shard->table_mask = table_size - 1;
+}
+
+static void shard_free_slots(row_cache_shard* shard){
+    free(shard->keys);
+    free(shard->values);
+    free(shard->used);
+    free(shard->referenced);
+    free(shard->free_slots);
+    free(shard->table);
+}
+
+// Number of entries per shard for a cache of capacity entries
+static int shard_capacity_of(row_cache* cache, int capacity){
+    int shard_capacity = (capacity + cache->Nshards - 1) / cache->Nshards;
+    return (shard_capacity < 1) ? 1 : shard_capacity;
+}
+
+// Create a row cache of capacity entries of value_size chars
+row_cache* row_cache_create(int capacity, int value_size){
+    row_cache* cache = (row_cache *) malloc(sizeof(row_cache));
+    cache->Nshards = ROW_CACHE_SHARDS;
+    cache->value_size = value_size;
+    cache->refs = 1;
+    cache->governor = NULL;
+    cache->shards = (row_cache_shard *) malloc(cache->Nshards * sizeof(row_cache_shard));
+    int shard_capacity = shard_capacity_of(cache, capacity);
+    for (int s=0; s<cache->Nshards; s++){
+        row_cache_shard* shard = cache->shards + s;
+        pthread_mutex_init(&shard->lock, NULL);
+        shard_alloc_slots(shard, shard_capacity, value_size);
+        // The sketch keeps the width of the initial capacity when resized
+        int sketch_width = next_power_of_2(shard_capacity);
+        shard->sketch = (uint8_t *) calloc(SKETCH_ROWS * sketch_width, sizeof(uint8_t));
+        shard->sketch_mask = sketch_width - 1;
+        shard->samples = 0;
+        shard->hits = 0;
+        shard->misses = 0;
+    }
+    return cache;
+}
+
+// One more lsm uses the cache
+void row_cache_share(row_cache* cache){
+    __sync_fetch_and_add(&cache->refs, 1);
+}
+
+// The lsm does not use the cache anymore: freed with its last user
+void row_cache_release(row_cache* cache){
+    if (cache == NULL) return;
+    if (__sync_sub_and_fetch(&cache->refs, 1) > 0) return;
+    if (cache->governor != NULL) memory_unregister_cache(cache->governor, cache);
+    for (int s=0; s<cache->Nshards; s++){
+        row_cache_shard* shard = cache->shards + s;
+        pthread_mutex_destroy(&shard->lock);
+        shard_free_slots(shard);
+        free(shard->sketch);
+    }
+    free(cache->shards);
+    free(cache);
+}
+
+// Look for key in the cache: return 1 and set value if found, else 0
+int row_cache_get(row_cache* cache, int key, char* value){
+    uint64_t h = cache_hash(key);
+    row_cache_shard* shard = cache->shards + (h >> 32) % cache->Nshards;
+    pthread_mutex_lock(&shard->lock);
+    sketch_frequency(shard, h, 1);
+    int i = table_find(shard, key, h);
+    if (i != -1){
+        int slot = shard->table[i];
+        shard->referenced[slot] = 1;
+        strcpy(value, shard->values + slot*cache->value_size);
+        shard->hits++;
+    }
+    else shard->misses++;
+    pthread_mutex_unlock(&shard->lock);
+    return i != -1;
+}
+
+// Cache (key, value) read from the lsm, if admitted
+void row_cache_put(row_cache* cache, int key, char* value){
+    uint64_t h = cache_hash(key);
+    row_cache_shard* shard = cache->shards + (h >> 32) % cache->Nshards;
+    pthread_mutex_lock(&shard->lock);
+    int i = table_find(shard, key, h);
+    int slot;
+    if (i != -1) slot = shard->table[i];
+    else{
+        if (shard->Nfree == 0){
+            // CLOCK: victim is the next slot not referenced
+            while (shard->referenced[shard->hand]){
+                shard->referenced[shard->hand] = 0;
+                shard->hand = (shard->hand + 1) % shard->capacity;
+            }
+            int victim = shard->hand;
+            // TinyLFU: keep the victim if it is at least as frequent
+            int victim_key = shard->keys[victim];
+            uint64_t victim_h = cache_hash(victim_key);
+            if (sketch_frequency(shard, h, 0) <= sketch_frequency(shard, victim_h, 0)){
+                pthread_mutex_unlock(&shard->lock);
+                return;
+            }
+            table_remove(shard, table_find(shard, victim_key, victim_h));
+            shard->hand = (shard->hand + 1) % shard->capacity;
+        }
+        slot = shard->free_slots[--shard->Nfree];
+        shard->keys[slot] = key;
+        shard->used[slot] = 1;
+        shard->referenced[slot] = 0;
+        i = h & shard->table_mask;
+        while (shard->table[i] != -1) i = (i + 1) & shard->table_mask;
+        shard->table[i] = slot;
+    }
+    strcpy(shard->values + slot*cache->value_size, value);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+// Invalidate key (written in the lsm)
+void row_cache_erase(row_cache* cache, int key){
+    uint64_t h = cache_hash(key);
+    row_cache_shard* shard = cache->shards + (h >> 32) % cache->Nshards;
+    pthread_mutex_lock(&shard->lock);
+    int i = table_find(shard, key, h);
+    if (i != -1) table_remove(shard, i);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+// Invalidate the keys in [low, high] (range delete)
+void row_cache_erase_range(row_cache* cache, int low, int high){
+    for (int s=0; s<cache->Nshards; s++){
+        row_cache_shard* shard = cache->shards + s;
+        pthread_mutex_lock(&shard->lock);
+        for (int slot=0; slot<shard->capacity; slot++){
+            int key = shard->keys[slot];
+            if (shard->used[slot] && (low <= key) && (key <= high)){
+                table_remove(shard, table_find(shard, key, cache_hash(key)));
+            }
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+// Change the capacity of the cache to capacity entries: the entries are kept
+// while there is room for them
+void row_cache_resize(row_cache* cache, int capacity){
+    int shard_capacity = shard_capacity_of(cache, capacity);
+    for (int s=0; s<cache->Nshards; s++){
+        row_cache_shard* shard = cache->shards + s;
+        pthread_mutex_lock(&shard->lock);
+        if (shard->capacity == shard_capacity){
+            pthread_mutex_unlock(&shard->lock);
+            continue;
+        }
+        row_cache_shard old = *shard;
+        shard_alloc_slots(shard, shard_capacity, cache->value_size);
+        // Entries reinserted in CLOCK order, from the hand
+        for (int i=0; (i < old.capacity) && (shard->Nfree > 0); i++){
+            int slot_old = (old.hand + i) % old.capacity;
+            if (!old.used[slot_old]) continue;
+            int key = old.keys[slot_old];
+            int slot = shard->free_slots[--shard->Nfree];
+            shard->keys[slot] = key;
+            shard->used[slot] = 1;
+            shard->referenced[slot] = old.referenced[slot_old];
+            strcpy(shard->values + slot*cache->value_size,
+                   old.values + slot_old*cache->value_size);
+            int j = cache_hash(key) & shard->table_mask;
+            while (shard->table[j] != -1) j = (j + 1) & shard->table_mask;
+            shard->table[j] = slot;
+        }
+        shard_free_slots(&old);
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+// Number of entries the cache can hold
+int row_cache_capacity(row_cache* cache){
+    int capacity = 0;
+    for (int s=0; s<cache->Nshards; s++) capacity += cache->shards[s].capacity;
+    return capacity;
+}
+
+// Memory used by the cache (in bytes)
+size_t row_cache_bytes(row_cache* cache){
+    size_t bytes = sizeof(row_cache) + cache->Nshards * sizeof(row_cache_shard);
+    for (int s=0; s<cache->Nshards; s++){
+        row_cache_shard* shard = cache->shards + s;
+        bytes += (size_t) shard->capacity * (2*sizeof(int) + cache->value_size + 2);
+        bytes += (size_t) (shard->table_mask + 1) * sizeof(int);
+        bytes += (size_t) SKETCH_ROWS * (shard->sketch_mask + 1);
+    }
+    return bytes;
+}
+
+// Upper bound of the memory used per entry of a cache (slots and hash table)
+size_t row_cache_entry_size(int value_size){
+    return 2*sizeof(int) + value_size + 2 + 4*sizeof(int);
+}
+
+// Number of hits and misses of the cache
+void row_cache_stats(row_cache* cache, uint64_t* hits, uint64_t* misses){
+    *hits = 0;
+    *misses = 0;
+    for (int s=0; s<cache->Nshards; s++){
+        row_cache_shard* shard = cache->shards + s;
+        pthread_mutex_lock(&shard->lock);
+        *hits += shard->hits;
+        *misses += shard->misses;
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
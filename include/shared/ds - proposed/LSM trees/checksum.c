@@ -0,0 +1,309 @@
+#include "LSMTree.h"
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+// CRC32C (Castagnoli) checksums of the files of the components. The data
+// files keep their layout (they are mmapped and read at fixed offsets): each
+// one has a checksum file (kC1.crc for kC1.data) with one record per block of
+// CHECKSUM_BLOCK bytes, or per batch appended to the log of C0.
+// The CRC uses the SSE4.2 instruction when the processor has it (checked at
+// run time), else a table.
+
+static uint32_t crc_table[256];
+static int crc_hardware = 0;
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(){
+    for (uint32_t i=0; i<256; i++){
+        uint32_t crc = i;
+        for (int k=0; k<8; k++) crc = (crc & 1) ? (crc >> 1) ^ 0x82f63b78U : crc >> 1;
+        crc_table[i] = crc;
+    }
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    crc_hardware = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+// CRC32C of data continuing crc (0 to start), with the table
+uint32_t crc32c_software(uint32_t crc, const void* data, size_t length){
+    pthread_once(&crc_once, crc_init);
+    const uint8_t* p = (const uint8_t*) data;
+    crc = ~crc;
+    while (length--) crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hardware(uint32_t crc, const void* data, size_t length){
+    const uint8_t* p = (const uint8_t*) data;
+    uint64_t c = ~crc;
+    while (length >= 8){
+        uint64_t word;
+        memcpy(&word, p, 8);
+        c = _mm_crc32_u64(c, word);
+        p += 8;
+        length -= 8;
+    }
+    uint32_t c32 = (uint32_t) c;
+    while (length--) c32 = _mm_crc32_u8(c32, *p++);
+    return ~c32;
+}
+#endif
+
+// CRC32C of data continuing crc (0 to start)
+uint32_t crc32c(uint32_t crc, const void* data, size_t length){
+    pthread_once(&crc_once, crc_init);
+#if defined(__x86_64__)
+    if (crc_hardware) return crc32c_hardware(crc, data, length);
+#endif
+    return crc32c_software(crc, data, length);
+}
+
+// 1 if the CRC uses the SSE4.2 instruction
+int crc32c_hardware_enabled(){
+    pthread_once(&crc_once, crc_init);
+    return crc_hardware;
+}
+
+// CRC32C of length bytes of the file from offset (the position is kept)
+uint32_t crc32c_file(FILE* fd, long offset, long length){
+    long position = ftell(fd);
+    char buffer[4096];
+    uint32_t crc = 0;
+    fseek(fd, offset, SEEK_SET);
+    while (length > 0){
+        size_t n = fread(buffer, 1, (length < 4096) ? length : 4096, fd);
+        if (n == 0) break;
+        crc = crc32c(crc, buffer, n);
+        length -= n;
+    }
+    fseek(fd, position, SEEK_SET);
+    return crc;
+}
+
+// ------------------------ Checksums of the files of a component
+
+static char checksum_letters[] = "kvst";
+
+// Name of the checksum file of the file f of the component component_id
+static void get_checksum_name(char* filename, char* name, char* component_id, int f){
+    sprintf(filename, "%s/%c%s.crc", name, checksum_letters[f], component_id);
+}
+
+block_checksums* checksums_create(){
+    return (block_checksums *) calloc(1, sizeof(block_checksums));
+}
+
+void checksums_free(block_checksums* cs){
+    if (cs == NULL) return;
+    for (int f=0; f<CHECKSUM_FILES; f++) free(cs->records[f]);
+    free(cs);
+}
+
+// Records of the length bytes of data written at offset of the file f
+// (one per block of CHECKSUM_BLOCK bytes)
+static void checksums_add(block_checksums* cs, int f, const void* data, uint64_t offset,
+                          size_t length){
+    const uint8_t* p = (const uint8_t*) data;
+    while (length > 0){
+        size_t block = (length < CHECKSUM_BLOCK) ? length : CHECKSUM_BLOCK;
+        if (cs->N[f] >= cs->size[f]){
+            cs->size[f] = (cs->size[f] == 0) ? 16 : 2 * cs->size[f];
+            cs->records[f] = (checksum_record *) realloc(cs->records[f],
+                                                         cs->size[f] * sizeof(checksum_record));
+        }
+        checksum_record* r = cs->records[f] + cs->N[f]++;
+        r->offset = offset;
+        r->length = (uint32_t) block;
+        r->crc = crc32c(0, p, block);
+        p += block;
+        offset += block;
+        length -= block;
+    }
+}
+
+// Size of an entry in each file of a component
+static size_t checksum_width(int f, int value_size){
+    if (f == CHECKSUM_KEYS) return sizeof(int);
+    if (f == CHECKSUM_VALUES) return value_size * sizeof(char);
+    if (f == CHECKSUM_SEQS) return sizeof(uint64_t);
+    return sizeof(uint8_t);
+}
+
+static const void* checksum_data(component* C, int f){
+    if (f == CHECKSUM_KEYS) return C->keys;
+    if (f == CHECKSUM_VALUES) return C->values;
+    if (f == CHECKSUM_SEQS) return C->seqs;
+    return C->types;
+}
+
+// Checksums of the files of the component C as written by write_disk_component
+block_checksums* component_checksums(component* C, int value_size){
+    block_checksums* cs = checksums_create();
+    for (int f=0; f<CHECKSUM_FILES; f++){
+        checksums_add(cs, f, checksum_data(C, f), 0, *C->Ne * checksum_width(f, value_size));
+    }
+    return cs;
+}
+
+// Save the checksums of the component component_id (rewritten, or appended
+// to the records already saved)
+void write_checksums(block_checksums* cs, char* name, char* component_id, int filename_size,
+                     int append){
+    char* filename = (char *) calloc(filename_size + 8,sizeof(char));
+    for (int f=0; f<CHECKSUM_FILES; f++){
+        get_checksum_name(filename, name, component_id, f);
+        FILE* fout = fopen(filename, append ? "ab" : "wb");
+        if (fout == NULL){
+            perror("fopen");
+            continue;
+        }
+        // No record array for the files without records
+        if (cs->N[f] > 0) fwrite(cs->records[f], sizeof(checksum_record), cs->N[f], fout);
+        fclose(fout);
+    }
+    free(filename);
+}
+
+// Checksums of the batch of the last N entries of C appended by append_on_disk
+// at offsets[f] of each file f
+void append_checksums(component* C, int N, uint64_t* offsets, char* name, int value_size,
+                      int filename_size){
+    block_checksums* cs = checksums_create();
+    int first = *C->Ne - N;
+    for (int f=0; f<CHECKSUM_FILES; f++){
+        size_t width = checksum_width(f, value_size);
+        checksums_add(cs, f, (const uint8_t*) checksum_data(C, f) + first * width,
+                      offsets[f], N * width);
+    }
+    write_checksums(cs, name, C->component_id, filename_size, 1);
+    checksums_free(cs);
+}
+
+// Read the checksums of the component component_id: NULL if not saved
+block_checksums* read_checksums(char* name, char* component_id, int filename_size){
+    char* filename = (char *) calloc(filename_size + 8,sizeof(char));
+    block_checksums* cs = checksums_create();
+    for (int f=0; f<CHECKSUM_FILES; f++){
+        get_checksum_name(filename, name, component_id, f);
+        FILE* fin = fopen(filename, "rb");
+        if (fin == NULL){
+            checksums_free(cs);
+            free(filename);
+            return NULL;
+        }
+        fseek(fin, 0, SEEK_END);
+        cs->N[f] = cs->size[f] = (int) (ftell(fin) / sizeof(checksum_record));
+        fseek(fin, 0, SEEK_SET);
+        cs->records[f] = (checksum_record *) malloc((cs->size[f] + 1) * sizeof(checksum_record));
+        fread(cs->records[f], sizeof(checksum_record), cs->N[f], fin);
+        fclose(fin);
+    }
+    free(filename);
+    return cs;
+}
+
+size_t checksums_bytes(block_checksums* cs){
+    size_t bytes = sizeof(block_checksums);
+    for (int f=0; f<CHECKSUM_FILES; f++) bytes += cs->size[f] * sizeof(checksum_record);
+    return bytes;
+}
+
+// First record of the file f ending after offset (records sorted by offset)
+static int checksums_first(block_checksums* cs, int f, uint64_t offset){
+    // Files written at once: one record per block
+    uint64_t guess = offset / CHECKSUM_BLOCK;
+    if (guess < (uint64_t) cs->N[f]){
+        checksum_record* r = cs->records[f] + guess;
+        if ((r->offset <= offset) && (offset < r->offset + r->length)) return (int) guess;
+    }
+    int down = 0;
+    int top = cs->N[f];
+    while (down < top){
+        int middle = (down + top) / 2;
+        checksum_record* r = cs->records[f] + middle;
+        if (r->offset + r->length <= offset) down = middle + 1;
+        else top = middle;
+    }
+    return down;
+}
+
+// Check the blocks of the file f holding [offset, offset+length[, base being
+// the content of the file from base_offset (whole file mmapped: 0): 0 if one of
+// them is corrupted or missing
+int checksums_verify(block_checksums* cs, int f, const void* base, uint64_t base_offset,
+                     uint64_t offset, size_t length){
+    uint64_t end = offset + length;
+    uint64_t covered = offset;
+    for (int i=checksums_first(cs, f, offset); (i < cs->N[f]) && (covered < end); i++){
+        checksum_record* r = cs->records[f] + i;
+        if (r->offset > covered) return 0;
+        const uint8_t* data = (const uint8_t*) base + (r->offset - base_offset);
+        if (crc32c(0, data, r->length) != r->crc) return 0;
+        covered = r->offset + r->length;
+    }
+    return covered >= end;
+}
+
+// Read length bytes at offset of the file f (opened in fd) into out, checking
+// the blocks holding them if cs is not NULL: 0 if corrupted
+int checksums_read(FILE* fd, block_checksums* cs, int f, uint64_t offset, size_t length,
+                   void* out){
+    if (cs == NULL){
+        fseek(fd, offset, SEEK_SET);
+        return fread(out, 1, length, fd) == length;
+    }
+    int first = checksums_first(cs, f, offset);
+    int last = checksums_first(cs, f, offset + length - 1);
+    if (last >= cs->N[f]) return 0;
+    uint64_t start = cs->records[f][first].offset;
+    uint64_t end = cs->records[f][last].offset + cs->records[f][last].length;
+    uint8_t* buffer = (uint8_t *) malloc(end - start);
+    fseek(fd, start, SEEK_SET);
+    int ok = (fread(buffer, 1, end - start, fd) == end - start);
+    if (ok) ok = checksums_verify(cs, f, buffer, start, offset, length);
+    if (ok) memcpy(out, buffer + (offset - start), length);
+    free(buffer);
+    return ok;
+}
+
+// Number of first entries of the component C (read from disk) whose bytes
+// match their checksums in every file; a block going past the entries read
+// is read again from its file
+int verify_component(component* C, block_checksums* cs, char* name, int value_size,
+                     int filename_size){
+    char* filename = (char *) calloc(filename_size + 8,sizeof(char));
+    int valid = *C->Ne;
+    for (int f=0; f<CHECKSUM_FILES; f++){
+        size_t width = checksum_width(f, value_size);
+        uint64_t size = *C->Ne * width;
+        uint64_t checked = 0;
+        for (int i=0; (i < cs->N[f]) && (checked < size); i++){
+            checksum_record* r = cs->records[f] + i;
+            if (r->offset != checked) break;
+            if (r->offset + r->length <= size){
+                const uint8_t* data = (const uint8_t*) checksum_data(C, f) + r->offset;
+                if (crc32c(0, data, r->length) != r->crc) break;
+            }
+            else{
+                get_files_name(filename, name, C->component_id, checksum_letters + f,
+                               filename_size);
+                FILE* fd = fopen(filename, "rb");
+                if (fd == NULL) break;
+                uint8_t* block = (uint8_t *) malloc(r->length);
+                int ok = checksums_read(fd, cs, f, r->offset, r->length, block);
+                free(block);
+                fclose(fd);
+                if (!ok) break;
+            }
+            checked += r->length;
+        }
+        if (checked > size) checked = size;
+        if ((int) (checked / width) < valid) valid = (int) (checked / width);
+    }
+    free(filename);
+    return valid;
+}
@@ -6,6 +6,8 @@ void init_component(component * c, int* component_size, int value_size, int* Ne,
     // Valgrind modif: malloc to calloc (because of padding)
     c->keys = (int *) calloc((*component_size), sizeof(int));
     c->values = (char *) calloc((*component_size)*value_size, sizeof(char));
+    c->seqs = (uint64_t *) calloc((*component_size), sizeof(uint64_t));
+    c->types = (uint8_t *) calloc((*component_size), sizeof(uint8_t));
     c->Ne = Ne;
     c->S = component_size;
     c->component_id = (char *) malloc(sizeof(component_id));
@@ -17,6 +19,8 @@ void init_component(component * c, int* component_size, int value_size, int* Ne,
 void free_component(component *c){
     free(c->keys);
     free(c->values);
+    free(c->seqs);
+    free(c->types);
     free(c->component_id);
     free(c);
 }
@@ -26,14 +30,18 @@ void create_disk_component(char* name, int Nc, int filename_size){
     char *filename = (char *) calloc(filename_size + 8, sizeof(char));
     // Arbitrary size big enough
     char* component_id = (char*) malloc(16*sizeof(char));
-    char component_type[] = {'k','v'};
+    char component_type[] = {'k','v','s','t'};
     for (int i=1; i<=Nc; i++){
         sprintf(component_id,"C%d", i);
-        for (int k=0; k<2; k++){
+        for (int k=0; k<4; k++){
             // Building filename
             get_files_name(filename, name, component_id, &component_type[k], filename_size);
             fopen(filename, "wb");
         }
+        // Empty checksums
+        block_checksums* cs = checksums_create();
+        write_checksums(cs, name, component_id, filename_size, 0);
+        checksums_free(cs);
     }
     // Free memory
     free(filename);
@@ -48,8 +56,12 @@ void read_disk_component(component* C, char *name, int* Ne, char *component_id,
     // Building filename
     char *filename_keys = (char *) calloc(filename_size + 8,sizeof(char));
     char *filename_values = (char *) calloc(filename_size + 8,sizeof(char));
+    char *filename_seqs = (char *) calloc(filename_size + 8,sizeof(char));
+    char *filename_types = (char *) calloc(filename_size + 8,sizeof(char));
     get_files_name(filename_keys, name, component_id, "k", filename_size);
     get_files_name(filename_values, name, component_id, "v", filename_size);
+    get_files_name(filename_seqs, name, component_id, "s", filename_size);
+    get_files_name(filename_types, name, component_id, "t", filename_size);
 
     // Reading files
     FILE *fkeys;
@@ -70,9 +82,45 @@ void read_disk_component(component* C, char *name, int* Ne, char *component_id,
         fread(C->values, value_size, *Ne, fvalues);
         fclose(fvalues);
     }
+    FILE *fseqs;
+    if ((fseqs = fopen(filename_seqs, "rb")) == NULL) {
+        fprintf(stderr, "can't open file %s \n", filename_seqs);
+        exit(1);
+    }
+    else {
+        fread(C->seqs, sizeof(uint64_t), *Ne, fseqs);
+        fclose(fseqs);
+    }
+    FILE *ftypes;
+    if ((ftypes = fopen(filename_types, "rb")) == NULL) {
+        fprintf(stderr, "can't open file %s \n", filename_types);
+        exit(1);
+    }
+    else {
+        fread(C->types, sizeof(uint8_t), *Ne, ftypes);
+        fclose(ftypes);
+    }
+
+    // Check the entries read against their checksums (if saved): the log of C0
+    // is cut before its first corrupted batch, other components are lost
+    if (CHECKSUM_VERIFY >= VERIFY_COMPACTION){
+        block_checksums* cs = read_checksums(name, component_id, filename_size);
+        if (cs != NULL){
+            int valid = verify_component(C, cs, name, value_size, filename_size);
+            if (valid < *Ne){
+                printf("ERROR: component %s corrupted after %d entries of %d\n", component_id,
+                       valid, *Ne);
+                if (strcmp(component_id, "C0") != 0) exit(1);
+                *Ne = valid;
+            }
+            checksums_free(cs);
+        }
+    }
 
     free(filename_keys);
     free(filename_values);
+    free(filename_seqs);
+    free(filename_types);
 }
 
 // Write on disk the keys and values of the component pC
@@ -80,8 +128,12 @@ void write_disk_component(component *pC, char *name, int value_size, int filenam
     // Building filename
     char *filename_keys = (char *) calloc(filename_size + 8,sizeof(char));
     char *filename_values = (char *) calloc(filename_size + 8,sizeof(char));
+    char *filename_seqs = (char *) calloc(filename_size + 8,sizeof(char));
+    char *filename_types = (char *) calloc(filename_size + 8,sizeof(char));
     get_files_name(filename_keys, name, pC->component_id, "k", filename_size);
     get_files_name(filename_values, name, pC->component_id, "v", filename_size);
+    get_files_name(filename_seqs, name, pC->component_id, "s", filename_size);
+    get_files_name(filename_types, name, pC->component_id, "t", filename_size);
 
     // Write keys
     FILE *fkeys = fopen(filename_keys, "wb");
@@ -93,37 +145,80 @@ void write_disk_component(component *pC, char *name, int value_size, int filenam
     fwrite(pC->values, value_size*sizeof(char), *(pC->Ne), fvalues);
     fclose(fvalues);
 
+    // Write sequence numbers
+    FILE *fseqs = fopen(filename_seqs, "wb");
+    fwrite(pC->seqs, sizeof(uint64_t), *(pC->Ne), fseqs);
+    fclose(fseqs);
+
+    // Write types
+    FILE *ftypes = fopen(filename_types, "wb");
+    fwrite(pC->types, sizeof(uint8_t), *(pC->Ne), ftypes);
+    fclose(ftypes);
+
+    // Write checksums
+    block_checksums* cs = component_checksums(pC, value_size);
+    write_checksums(cs, name, pC->component_id, filename_size, 0);
+    checksums_free(cs);
+
     free(filename_keys);
     free(filename_values);
+    free(filename_seqs);
+    free(filename_types);
 }
 
-// Append to a component on disk the last N keys/values 
+// Append to a component on disk the last N keys/values, with the checksums
+// of the batch
 void append_on_disk(component * C, int N, char* name, int value_size,
                     int filename_size){
     char *filename = (char *) calloc(filename_size + 8,sizeof(char));
     FILE* fd;
+    // Offset of the batch in each file
+    uint64_t offsets[CHECKSUM_FILES];
     // Check the number of keys in the component
     if (*C->Ne < N) N = *C->Ne;
 
     // Write the N last keys
     get_files_name(filename, name, C->component_id, "k", filename_size);
     fd = fopen(filename, "ab");
+    fseek(fd, 0, SEEK_END);
+    offsets[CHECKSUM_KEYS] = ftell(fd);
     fwrite(C->keys + (*C->Ne - N), sizeof(int), N, fd);
     fclose(fd);
 
     // Write the N last values
     get_files_name(filename, name, C->component_id, "v", filename_size);
     fd = fopen(filename, "ab");
+    fseek(fd, 0, SEEK_END);
+    offsets[CHECKSUM_VALUES] = ftell(fd);
     fwrite(C->values + (*C->Ne - N)*value_size, value_size*sizeof(char), N, fd);
     fclose(fd);
 
+    // Write the N last sequence numbers
+    get_files_name(filename, name, C->component_id, "s", filename_size);
+    fd = fopen(filename, "ab");
+    fseek(fd, 0, SEEK_END);
+    offsets[CHECKSUM_SEQS] = ftell(fd);
+    fwrite(C->seqs + (*C->Ne - N), sizeof(uint64_t), N, fd);
+    fclose(fd);
+
+    // Write the N last types
+    get_files_name(filename, name, C->component_id, "t", filename_size);
+    fd = fopen(filename, "ab");
+    fseek(fd, 0, SEEK_END);
+    offsets[CHECKSUM_TYPES] = ftell(fd);
+    fwrite(C->types + (*C->Ne - N), sizeof(uint8_t), N, fd);
+    fclose(fd);
+
+    append_checksums(C, N, offsets, name, value_size, filename_size);
+
     // Free memory
     free(filename);
 }
 
-// Read value at given index in the component on disk
-void read_value(char* value, int index, char* name, int component_index, int value_size,
-                int filename_size){
+// Read value at given index in the component on disk, checking its block
+// against the checksums cs (if not NULL): return 0 if corrupted
+int read_value(char* value, int index, char* name, int component_index, int value_size,
+               int filename_size, block_checksums* cs){
     if (value == NULL) value = (char*) malloc(value_size*sizeof(char));
     char* filename = (char *) calloc(filename_size + 8,sizeof(char));
     // Reading the found value at the corresponding index
@@ -137,12 +232,60 @@ void read_value(char* value, int index, char* name, int component_index, int val
     if (fd == NULL){
         perror("fopen");
     }
-    fseek(fd, index*value_size*sizeof(char), SEEK_SET);
-    fread(value, value_size, 1, fd);
+    int ok = checksums_read(fd, cs, CHECKSUM_VALUES, index*value_size*sizeof(char), value_size,
+                            value);
+    fclose(fd);
+    if (!ok) printf("ERROR: corrupted value %d in %s\n", index, filename);
+
+    // free memory
+    free(filename);
+    return ok;
+}
+
+// Read type of the entry at given index in the component on disk (checked as
+// read_value): a corrupted entry reads as deleted
+uint8_t read_type(int index, char* name, int component_index, int filename_size,
+                  block_checksums* cs){
+    uint8_t type = OP_VALUE;
+    char* filename = (char *) calloc(filename_size + 8,sizeof(char));
+    get_files_name_disk(filename, name, component_index, "t", filename_size);
+
+    FILE* fd = fopen(filename, "rb");
+    if (fd == NULL){
+        perror("fopen");
+    }
+    if (!checksums_read(fd, cs, CHECKSUM_TYPES, index*sizeof(uint8_t), sizeof(uint8_t), &type)){
+        printf("ERROR: corrupted type %d in %s\n", index, filename);
+        type = OP_DELETE;
+    }
+    fclose(fd);
+
+    // free memory
+    free(filename);
+    return type;
+}
+
+// Read sequence number of the entry at given index in the component on disk
+// (checked as read_value): 0 if corrupted
+uint64_t read_seq(int index, char* name, int component_index, int filename_size,
+                  block_checksums* cs){
+    uint64_t seq = 0;
+    char* filename = (char *) calloc(filename_size + 8,sizeof(char));
+    get_files_name_disk(filename, name, component_index, "s", filename_size);
+
+    FILE* fd = fopen(filename, "rb");
+    if (fd == NULL){
+        perror("fopen");
+    }
+    if (!checksums_read(fd, cs, CHECKSUM_SEQS, index*sizeof(uint64_t), sizeof(uint64_t), &seq)){
+        printf("ERROR: corrupted sequence number %d in %s\n", index, filename);
+        seq = 0;
+    }
     fclose(fd);
 
     // free memory
     free(filename);
+    return seq;
 }
 
 // TOFIX: code redundancy BUT hard to divide into 2 functions because different type
@@ -159,6 +302,12 @@ void swap_component_pointer(component *current_component, component *next_compon
     char *tempv = next_component->values;
     next_component->values = current_component->values;
     current_component->values = tempv;
+    uint64_t *temps = next_component->seqs;
+    next_component->seqs = current_component->seqs;
+    current_component->seqs = temps;
+    uint8_t *tempt = next_component->types;
+    next_component->types = current_component->types;
+    current_component->types = tempt;
 
     // Reallocate memory
     // KEYS
@@ -194,34 +343,77 @@ void swap_component_pointer(component *current_component, component *next_compon
     {
         next_component->values = tmpv;
     }
+
+    // SEQS
+    current_component->seqs = realloc(current_component->seqs,
+                                      *(current_component->S) * sizeof(uint64_t));
+    uint64_t *tmps = realloc(next_component->seqs, *(next_component->S) * sizeof(uint64_t));
+    if (tmps == NULL)
+    {
+        // could not realloc, alloc new space and copy
+        uint64_t *news = (uint64_t *) malloc(*(next_component->S) * sizeof(uint64_t));
+        for (int i=0; i < *(next_component->Ne) + *(current_component->Ne); i++) news[i] = next_component->seqs[i];
+        free(next_component->seqs);
+        next_component->seqs = news;
+    }
+    else
+    {
+        next_component->seqs = tmps;
+    }
+
+    // TYPES
+    current_component->types = realloc(current_component->types,
+                                       *(current_component->S) * sizeof(uint8_t));
+    uint8_t *tmpt = realloc(next_component->types, *(next_component->S) * sizeof(uint8_t));
+    if (tmpt == NULL)
+    {
+        // could not realloc, alloc new space and copy
+        uint8_t *newt = (uint8_t *) malloc(*(next_component->S) * sizeof(uint8_t));
+        for (int i=0; i < *(next_component->Ne) + *(current_component->Ne); i++) newt[i] = next_component->types[i];
+        free(next_component->types);
+        next_component->types = newt;
+    }
+    else
+    {
+        next_component->types = tmpt;
+    }
 }
 
-void merge_components(component* next_component, component* current_component, char* name,
-                      int value_size, int filename_size){
+// Merge current_component into next_component, keeping the versions still
+// visible to the live snapshots of the lsm, and write both to disk.
+// last is set when next_component is the last component (tombstones purged)
+void merge_components(LSM_tree *lsm, component* next_component, component* current_component,
+                      int last){
     if (next_component->Ne == 0){
-        swap_component_pointer(current_component, next_component, value_size);
+        swap_component_pointer(current_component, next_component, lsm->value_size);
+        // Updates number of elements
+        *next_component->Ne += *current_component->Ne;
     }
     else{
         // We don't free the memory in prev component,
         // we just update the number of elements in it.
-        merge_list(current_component->keys, next_component->keys,
-                   current_component->values, next_component->values,
-                   current_component->Ne, next_component->Ne,
-                   value_size);
+        merge_list(current_component, next_component, lsm->value_size,
+                   lsm->snapshots, lsm->Ns, lsm->ranges, lsm->ranges_max_high, lsm->Nr,
+                   last, lsm->tree_filter);
     }
-    // Updates number of elements
-    *next_component->Ne += *current_component->Ne;
     *current_component->Ne = 0;
 
     // Write the component to disk
-    write_disk_component(next_component, name, value_size, filename_size);
-    write_disk_component(current_component, name, value_size, filename_size);
+    write_disk_component(next_component, lsm->name, lsm->value_size, lsm->filename_size);
+    write_disk_component(current_component, lsm->name, lsm->value_size, lsm->filename_size);
 }
 
-// Seach in the disk component stored in filename key.
-void component_search(int* index, int key, int length, char* filename){
+// Seach in the disk component stored in filename_keys the newest version of
+// key visible at snapshot; the sequence numbers (filename_seqs) are only
+// read when an older snapshot is requested.
+// With a learned index (model), only the window of its prediction is searched.
+// With checksums (cs), the blocks holding the entry found (or the position of
+// the key if absent) are checked: the key is not found in a corrupted block.
+void component_search(int* index, int key, int length, char* filename_keys,
+                      char* filename_seqs, uint64_t snapshot, learned_index* model,
+                      block_checksums* cs){
     // Mapping the file into memory
-    int fd = open(filename, O_RDONLY);
+    int fd = open(filename_keys, O_RDONLY);
     if (fd == -1){
         perror("open");
     }
@@ -233,8 +425,9 @@ void component_search(int* index, int key, int length, char* filename){
     // Checking extreme of the current component
     // if ((key >= keys[0]) && (key <= keys[length-1])){
     // Binary search
-    if (VERBOSE == 1) printf("Reading %s\n", filename);
-    *index = binary_search(keys, key, 0, length-1);                    
+    if (VERBOSE == 1) printf("Reading %s\n", filename_keys);
+    if (model != NULL) *index = learned_index_search(model, keys, key);
+    else *index = binary_search(keys, key, 0, length-1);
     // }
 
     // Closing file
@@ -242,10 +435,107 @@ void component_search(int* index, int key, int length, char* filename){
         perror ("close");
     }
 
+    // Looking for the visible version
+    if ((*index != -1) && (snapshot != SEQ_MAX)){
+        int fs = open(filename_seqs, O_RDONLY);
+        if (fs == -1){
+            perror("open");
+        }
+        uint64_t* seqs = mmap(0, length*sizeof(uint64_t), PROT_READ, MAP_SHARED, fs, 0);
+        if (seqs == MAP_FAILED){
+            perror ("mmap");
+        }
+        if (close(fs) == -1){
+            perror ("close");
+        }
+        *index = first_visible(keys, seqs, *index, length, snapshot);
+        munmap(seqs, length*sizeof(uint64_t));
+    }
+    else *index = first_visible(keys, NULL, *index, length, SEQ_MAX);
+
+    if (cs != NULL){
+        int position = (*index != -1) ? *index : lower_bound(keys, key, 0, length-1);
+        if (position >= length) position = length - 1;
+        if (!checksums_verify(cs, CHECKSUM_KEYS, keys, 0, position*sizeof(int), sizeof(int))){
+            printf("ERROR: corrupted block of keys in %s\n", filename_keys);
+            *index = -1;
+        }
+    }
+
     // Free mmap memory
     munmap(keys, length*sizeof(int));
 }
 
+// Add to entries all the versions of the keys in [low, high] stored in the
+// disk component (level is its index in Cs_Ne)
+void component_scan(scan_entry** entries, int* Nentries, int* capacity, int low, int high,
+                    int level, int length, char* name, int filename_size, block_checksums* cs){
+    char* filename_keys = (char *) calloc(filename_size + 8,sizeof(char));
+    char* filename_seqs = (char *) calloc(filename_size + 8,sizeof(char));
+    char* filename_types = (char *) calloc(filename_size + 8,sizeof(char));
+    get_files_name_disk(filename_keys, name, level-1, "k", filename_size);
+    get_files_name_disk(filename_seqs, name, level-1, "s", filename_size);
+    get_files_name_disk(filename_types, name, level-1, "t", filename_size);
+
+    // Mapping the files into memory
+    int fd = open(filename_keys, O_RDONLY);
+    if (fd == -1){
+        perror("open");
+    }
+    int* keys = mmap(0, length*sizeof(int), PROT_READ, MAP_SHARED, fd, 0);
+    if (keys == MAP_FAILED){
+        perror ("mmap");
+    }
+    int fs = open(filename_seqs, O_RDONLY);
+    if (fs == -1){
+        perror("open");
+    }
+    uint64_t* seqs = mmap(0, length*sizeof(uint64_t), PROT_READ, MAP_SHARED, fs, 0);
+    if (seqs == MAP_FAILED){
+        perror ("mmap");
+    }
+    int ft = open(filename_types, O_RDONLY);
+    if (ft == -1){
+        perror("open");
+    }
+    uint8_t* types = mmap(0, length*sizeof(uint8_t), PROT_READ, MAP_SHARED, ft, 0);
+    if (types == MAP_FAILED){
+        perror ("mmap");
+    }
+    if ((close(fd) == -1) || (close(fs) == -1) || (close(ft) == -1)){
+        perror ("close");
+    }
+
+    if (VERBOSE == 1) printf("Scanning %s\n", filename_keys);
+    int first = lower_bound(keys, low, 0, length-1);
+    int end = first;
+    while ((end < length) && (keys[end] <= high)) end++;
+    // Blocks of the entries in range (and of the first key after it) checked
+    // before using them
+    int checked = (end < length) ? end + 1 : end;
+    if ((cs != NULL) && (checked > first) &&
+        (!checksums_verify(cs, CHECKSUM_KEYS, keys, 0, first*sizeof(int),
+                           (checked - first)*sizeof(int)) ||
+         !checksums_verify(cs, CHECKSUM_SEQS, seqs, 0, first*sizeof(uint64_t),
+                           (end - first)*sizeof(uint64_t)) ||
+         !checksums_verify(cs, CHECKSUM_TYPES, types, 0, first*sizeof(uint8_t),
+                           (end - first)*sizeof(uint8_t)))){
+        printf("ERROR: corrupted block in the range scanned of %s\n", filename_keys);
+        end = first;
+    }
+    for (int i=first; i < end; i++){
+        add_scan_entry(entries, Nentries, capacity, keys[i], seqs[i], types[i], level, i);
+    }
+
+    // Free mmap memory
+    munmap(keys, length*sizeof(int));
+    munmap(seqs, length*sizeof(uint64_t));
+    munmap(types, length*sizeof(uint8_t));
+    free(filename_keys);
+    free(filename_seqs);
+    free(filename_types);
+}
+
 void *component_search_parallel(void *argument){
     // Change the cancel state to asynchronous
     // pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
@@ -287,6 +577,8 @@ void *component_search_parallel(void *argument){
         if (VERBOSE == 1) printf("Reading %s\n", filename);
         index = binary_search_signal(keys, common->key, 0, arg->Cs_Ne-1, arg->thread_id,
                                      common->shared_level, FREQUENCE);
+        // Newest version of the key
+        index = first_visible(keys, NULL, index, arg->Cs_Ne, SEQ_MAX);
         // update shared variable if key found
         if (index != -1){
             sem_wait(mutex);
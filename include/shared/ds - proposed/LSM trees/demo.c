@@ -57,8 +57,32 @@ int main(){
     for (int i=0; i<lsm_backup->value_size - 7; i++) value[i] = 'b';
     sprintf(value + lsm_backup->value_size - 7, "_%d", key%10000);
     // update_lsm(lsm_backup, key, value);
+    // Snapshot acquired before the delete still reads the old value
+    uint64_t snapshot = snapshot_acquire(lsm_backup);
     delete_lsm(lsm_backup, 999);
     read_test(lsm_backup, key);
+    if (read_lsm_snapshot(lsm_backup, key, value, snapshot) == 1){
+        printf("Reading key: %d at snapshot %llu; value found: %s\n", key,
+               (unsigned long long) snapshot, value);
+    }
+
+    // Range scan at the snapshot and on the current state
+    int scan_keys[16];
+    char* scan_values = (char*) malloc(16 * lsm_backup->value_size * sizeof(char));
+    int found = scan_lsm(lsm_backup, 995, 1004, scan_keys, scan_values, 16, snapshot);
+    printf("Scan [995, 1004] at snapshot: %d keys\n", found);
+    found = scan_lsm(lsm_backup, 995, 1004, scan_keys, scan_values, 16, SEQ_MAX);
+    printf("Scan [995, 1004]: %d keys\n", found);
+    for (int i=0; i < found; i++) printf("    %d: %s\n", scan_keys[i],
+                                         scan_values + i*lsm_backup->value_size);
+    // Range delete of [1000, 1002]: one range tombstone
+    delete_range_lsm(lsm_backup, 1000, 1002);
+    found = scan_lsm(lsm_backup, 995, 1004, scan_keys, scan_values, 16, SEQ_MAX);
+    printf("Scan [995, 1004] after range delete: %d keys\n", found);
+    found = scan_lsm(lsm_backup, 995, 1004, scan_keys, scan_values, 16, snapshot);
+    printf("Scan [995, 1004] at snapshot after range delete: %d keys\n", found);
+    free(scan_values);
+    snapshot_release(lsm_backup, snapshot);
 
 
     // Wrap up
@@ -239,4 +239,27 @@ double batch_parallel_reads(LSM_tree *lsm, int num_reads, int key_down, int key_
     printf("time: %f \n", time_spent);
 
     return time_spent;
-}
\ No newline at end of file
+}
+
+// Fence pointers of the sorted keys[0..Ne-1]: first key of every page of
+// page keys (baseline of the learned index)
+int* fence_build(int* keys, int Ne, int page, int* Nfences){
+    *Nfences = (Ne + page - 1) / page;
+    int* fences = (int *) malloc(*Nfences * sizeof(int));
+    for (int f=0; f < *Nfences; f++) fences[f] = keys[f * page];
+    return fences;
+}
+
+// Search key with the fence pointers: the first version of key is between the
+// last fence smaller than key and the next one; return its index, -1 if not
+// present
+int fence_search(int* fences, int Nfences, int* keys, int Ne, int page, int key){
+    if ((Nfences == 0) || (key < fences[0])) return -1;
+    int f = lower_bound(fences, key, 0, Nfences - 1) - 1;
+    int down = (f < 0) ? 0 : f * page;
+    int top = (f + 1) * page;
+    if (top > Ne - 1) top = Ne - 1;
+    int index = lower_bound(keys, key, down, top);
+    if ((index <= top) && (keys[index] == key)) return index;
+    return -1;
+}
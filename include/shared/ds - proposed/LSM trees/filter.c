@@ -0,0 +1,537 @@
+#include "LSMTree.h"
+
+// Pluggable membership filters: the lsm only calls them through a filter_ops
+// table, so that each use picks the structure which suits it:
+//     - FILTER_BLOOM: the bloom filter of bloom.c (no deletes)
+//     - FILTER_CUCKOO: cuckoo filter (buckets of 4 fingerprints of 16 bits),
+//       supports deletes of keys added before
+//     - FILTER_XOR: xor filter (fingerprints of 8 bits, ~9.8 bits per key),
+//       static: built once from the keys of an immutable component
+// A dynamic filter which cannot take more keys (full cuckoo) is saturated: it
+// then answers "maybe" for every key until rebuilt.
+
+// 64 bits mix of a key (splitmix64)
+static uint64_t filter_hash(int key, uint64_t seed){
+    uint64_t h = (uint64_t) (uint32_t) key + seed + 0x9e3779b97f4a7c15UL;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9UL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebUL;
+    return h ^ (h >> 31);
+}
+
+// ------------------------ Bloom filter (bloom.c)
+
+static void* bloom_create(int capacity){
+    bloom_filter_t* B = (bloom_filter_t *) malloc(sizeof(bloom_filter_t));
+    index_t size = (index_t) FILTER_BITS_PER_KEY * (capacity > 0 ? capacity : 1);
+    if (size < 64) size = 64;
+    bloom_init(B, size, HASHES);
+    return B;
+}
+
+static int bloom_filter_add(void* state, int key){
+    bloom_add((bloom_filter_t *) state, (uint64_t) key);
+    return 1;
+}
+
+static int bloom_filter_check(void* state, int key){
+    return bloom_check((bloom_filter_t *) state, (uint64_t) key);
+}
+
+static size_t bloom_filter_bytes(void* state){
+    return bloom_words((bloom_filter_t *) state) * sizeof(index_t);
+}
+
+static void bloom_filter_write(void* state, FILE* fout){
+    bloom_filter_t* B = (bloom_filter_t *) state;
+    fwrite(&B->size, sizeof(index_t), 1, fout);
+    fwrite(&B->count, sizeof(index_t), 1, fout);
+    fwrite(B->table, sizeof(index_t), bloom_words(B), fout);
+}
+
+static void* bloom_filter_read(FILE* fin){
+    bloom_filter_t* B = (bloom_filter_t *) malloc(sizeof(bloom_filter_t));
+    index_t size;
+    fread(&size, sizeof(index_t), 1, fin);
+    bloom_init(B, size, HASHES);
+    fread(&B->count, sizeof(index_t), 1, fin);
+    fread(B->table, sizeof(index_t), bloom_words(B), fin);
+    return B;
+}
+
+static void bloom_filter_destroy(void* state){
+    bloom_destroy((bloom_filter_t *) state);
+}
+
+// ------------------------ Cuckoo filter
+
+#define CUCKOO_SLOTS 4
+#define CUCKOO_KICKS 500
+
+typedef struct cuckoo_filter {
+    uint32_t buckets; // Number of buckets
+    uint16_t* table; // CUCKOO_SLOTS fingerprints per bucket, 0 for empty
+    uint16_t victim; // Fingerprint left out of the table by the last kicks
+    uint32_t victim_bucket;
+    int Nkeys;
+} cuckoo_filter;
+
+static void cuckoo_locate(cuckoo_filter* F, int key, uint32_t* bucket, uint16_t* fp){
+    uint64_t h = filter_hash(key, 0);
+    *bucket = (uint32_t) (((h & 0xffffffffUL) * F->buckets) >> 32);
+    *fp = (uint16_t) (h >> 48);
+    if (*fp == 0) *fp = 1;
+}
+
+// Other bucket of a fingerprint (partial-key cuckoo hashing): H - bucket
+// modulo the number of buckets, so that the other bucket of it is bucket
+static uint32_t cuckoo_alt(cuckoo_filter* F, uint32_t bucket, uint16_t fp){
+    uint32_t H = (fp * 0x5bd1e995U) % F->buckets;
+    return (H >= bucket) ? H - bucket : H + F->buckets - bucket;
+}
+
+static int cuckoo_put(cuckoo_filter* F, uint32_t bucket, uint16_t fp){
+    uint16_t* slots = F->table + (size_t) bucket * CUCKOO_SLOTS;
+    for (int s=0; s < CUCKOO_SLOTS; s++){
+        if (slots[s] == 0){
+            slots[s] = fp;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void* cuckoo_create(int capacity){
+    cuckoo_filter* F = (cuckoo_filter *) calloc(1, sizeof(cuckoo_filter));
+    // Buckets for a load of at most 95%
+    F->buckets = (uint32_t) (capacity / (CUCKOO_SLOTS * 0.95)) + 1;
+    F->table = (uint16_t *) calloc((size_t) F->buckets * CUCKOO_SLOTS, sizeof(uint16_t));
+    return F;
+}
+
+static int cuckoo_add(void* state, int key){
+    cuckoo_filter* F = (cuckoo_filter *) state;
+    // Full (a fingerprint is already aside)
+    if (F->victim != 0) return 0;
+    uint32_t bucket;
+    uint16_t fp;
+    cuckoo_locate(F, key, &bucket, &fp);
+    F->Nkeys++;
+    if (cuckoo_put(F, bucket, fp)) return 1;
+    bucket = cuckoo_alt(F, bucket, fp);
+    if (cuckoo_put(F, bucket, fp)) return 1;
+    // Relocate fingerprints to their other bucket
+    for (int kick=0; kick < CUCKOO_KICKS; kick++){
+        uint16_t* slot = F->table + (size_t) bucket * CUCKOO_SLOTS + ((fp + kick) % CUCKOO_SLOTS);
+        uint16_t evicted = *slot;
+        *slot = fp;
+        fp = evicted;
+        bucket = cuckoo_alt(F, bucket, fp);
+        if (cuckoo_put(F, bucket, fp)) return 1;
+    }
+    // Full: keep the last fingerprint aside, no more insertions
+    F->victim = fp;
+    F->victim_bucket = bucket;
+    return 1;
+}
+
+static int cuckoo_find(cuckoo_filter* F, uint32_t bucket, uint16_t fp, int erase){
+    uint16_t* slots = F->table + (size_t) bucket * CUCKOO_SLOTS;
+    for (int s=0; s < CUCKOO_SLOTS; s++){
+        if (slots[s] == fp){
+            if (erase) slots[s] = 0;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int cuckoo_lookup(cuckoo_filter* F, int key, int erase){
+    uint32_t bucket;
+    uint16_t fp;
+    cuckoo_locate(F, key, &bucket, &fp);
+    uint32_t alt = cuckoo_alt(F, bucket, fp);
+    if (cuckoo_find(F, bucket, fp, erase) || cuckoo_find(F, alt, fp, erase)) return 1;
+    if ((F->victim == fp) && ((F->victim_bucket == bucket) || (F->victim_bucket == alt))){
+        if (erase) F->victim = 0;
+        return 1;
+    }
+    return 0;
+}
+
+static int cuckoo_check(void* state, int key){
+    return cuckoo_lookup((cuckoo_filter *) state, key, 0);
+}
+
+// Remove a key added before (removing any other key may erase the fingerprint
+// of a key present)
+static int cuckoo_remove(void* state, int key){
+    cuckoo_filter* F = (cuckoo_filter *) state;
+    if (!cuckoo_lookup(F, key, 1)) return 0;
+    F->Nkeys--;
+    // Room again for the fingerprint left aside
+    if (F->victim != 0){
+        uint16_t fp = F->victim;
+        uint32_t bucket = F->victim_bucket;
+        if (cuckoo_put(F, bucket, fp) || cuckoo_put(F, cuckoo_alt(F, bucket, fp), fp)){
+            F->victim = 0;
+        }
+    }
+    return 1;
+}
+
+static size_t cuckoo_bytes(void* state){
+    cuckoo_filter* F = (cuckoo_filter *) state;
+    return sizeof(cuckoo_filter) + (size_t) F->buckets * CUCKOO_SLOTS * sizeof(uint16_t);
+}
+
+static void cuckoo_write(void* state, FILE* fout){
+    cuckoo_filter* F = (cuckoo_filter *) state;
+    fwrite(F, sizeof(cuckoo_filter), 1, fout);
+    fwrite(F->table, sizeof(uint16_t), (size_t) F->buckets * CUCKOO_SLOTS, fout);
+}
+
+static void* cuckoo_read(FILE* fin){
+    cuckoo_filter* F = (cuckoo_filter *) malloc(sizeof(cuckoo_filter));
+    fread(F, sizeof(cuckoo_filter), 1, fin);
+    F->table = (uint16_t *) malloc((size_t) F->buckets * CUCKOO_SLOTS * sizeof(uint16_t));
+    fread(F->table, sizeof(uint16_t), (size_t) F->buckets * CUCKOO_SLOTS, fin);
+    return F;
+}
+
+static void cuckoo_destroy(void* state){
+    cuckoo_filter* F = (cuckoo_filter *) state;
+    free(F->table);
+    free(F);
+}
+
+// ------------------------ Xor filter
+
+typedef struct xor_filter {
+    uint64_t seed;
+    uint32_t block; // Number of fingerprints per segment (3 segments)
+    uint8_t* fingerprints;
+} xor_filter;
+
+static uint32_t xor_reduce(uint32_t hash, uint32_t n){
+    return (uint32_t) (((uint64_t) hash * n) >> 32);
+}
+
+static uint64_t xor_rotl(uint64_t x, int r){
+    return (x << r) | (x >> (64 - r));
+}
+
+// Positions of a hash in the 3 segments
+static void xor_positions(xor_filter* F, uint64_t h, uint32_t* p){
+    p[0] = xor_reduce((uint32_t) h, F->block);
+    p[1] = xor_reduce((uint32_t) xor_rotl(h, 21), F->block) + F->block;
+    p[2] = xor_reduce((uint32_t) xor_rotl(h, 42), F->block) + 2 * F->block;
+}
+
+static uint8_t xor_fingerprint(uint64_t h){
+    return (uint8_t) (h ^ (h >> 32));
+}
+
+// Build from sorted keys (duplicates skipped): every key is assigned one of
+// its 3 positions by peeling the positions held by a single key
+static void* xor_build(int* keys, int n){
+    xor_filter* F = (xor_filter *) malloc(sizeof(xor_filter));
+    uint32_t size = (uint32_t) (1.23 * n) + 32;
+    F->block = size / 3;
+    size = 3 * F->block;
+    F->fingerprints = (uint8_t *) calloc(size, sizeof(uint8_t));
+    uint64_t* xormask = (uint64_t *) malloc(size * sizeof(uint64_t));
+    uint32_t* count = (uint32_t *) malloc(size * sizeof(uint32_t));
+    uint32_t* queue = (uint32_t *) malloc(size * sizeof(uint32_t));
+    uint64_t* stack_hash = (uint64_t *) malloc((n + 1) * sizeof(uint64_t));
+    uint32_t* stack_position = (uint32_t *) malloc((n + 1) * sizeof(uint32_t));
+    uint32_t p[3];
+    int distinct = 0;
+    for (int i=0; i<n; i++) if ((i == 0) || (keys[i] != keys[i-1])) distinct++;
+
+    for (F->seed = 1; ; F->seed++){
+        memset(xormask, 0, size * sizeof(uint64_t));
+        memset(count, 0, size * sizeof(uint32_t));
+        for (int i=0; i<n; i++){
+            if ((i > 0) && (keys[i] == keys[i-1])) continue;
+            uint64_t h = filter_hash(keys[i], F->seed);
+            xor_positions(F, h, p);
+            for (int k=0; k<3; k++){
+                xormask[p[k]] ^= h;
+                count[p[k]]++;
+            }
+        }
+        int Nqueue = 0;
+        for (uint32_t i=0; i<size; i++) if (count[i] == 1) queue[Nqueue++] = i;
+        int Nstack = 0;
+        while (Nqueue > 0){
+            uint32_t position = queue[--Nqueue];
+            if (count[position] != 1) continue;
+            uint64_t h = xormask[position];
+            stack_hash[Nstack] = h;
+            stack_position[Nstack++] = position;
+            xor_positions(F, h, p);
+            for (int k=0; k<3; k++){
+                xormask[p[k]] ^= h;
+                if (--count[p[k]] == 1) queue[Nqueue++] = p[k];
+            }
+        }
+        if (Nstack == distinct) break;
+    }
+    // Assign the fingerprints in the reverse order of the peeling
+    memset(F->fingerprints, 0, size);
+    for (int s=distinct-1; s>=0; s--){
+        uint64_t h = stack_hash[s];
+        xor_positions(F, h, p);
+        uint8_t fp = xor_fingerprint(h);
+        for (int k=0; k<3; k++) if (p[k] != stack_position[s]) fp ^= F->fingerprints[p[k]];
+        F->fingerprints[stack_position[s]] = fp;
+    }
+    free(xormask);
+    free(count);
+    free(queue);
+    free(stack_hash);
+    free(stack_position);
+    return F;
+}
+
+static int xor_check(void* state, int key){
+    xor_filter* F = (xor_filter *) state;
+    uint64_t h = filter_hash(key, F->seed);
+    uint32_t p[3];
+    xor_positions(F, h, p);
+    return xor_fingerprint(h) ==
+           (F->fingerprints[p[0]] ^ F->fingerprints[p[1]] ^ F->fingerprints[p[2]]);
+}
+
+static size_t xor_bytes(void* state){
+    return sizeof(xor_filter) + 3 * (size_t) ((xor_filter *) state)->block;
+}
+
+static void xor_write(void* state, FILE* fout){
+    xor_filter* F = (xor_filter *) state;
+    fwrite(&F->seed, sizeof(uint64_t), 1, fout);
+    fwrite(&F->block, sizeof(uint32_t), 1, fout);
+    fwrite(F->fingerprints, sizeof(uint8_t), 3 * (size_t) F->block, fout);
+}
+
+static void* xor_read(FILE* fin){
+    xor_filter* F = (xor_filter *) malloc(sizeof(xor_filter));
+    fread(&F->seed, sizeof(uint64_t), 1, fin);
+    fread(&F->block, sizeof(uint32_t), 1, fin);
+    F->fingerprints = (uint8_t *) malloc(3 * (size_t) F->block);
+    fread(F->fingerprints, sizeof(uint8_t), 3 * (size_t) F->block, fin);
+    return F;
+}
+
+static void xor_destroy(void* state){
+    xor_filter* F = (xor_filter *) state;
+    free(F->fingerprints);
+    free(F);
+}
+
+// ------------------------ Interface
+
+static const filter_ops filter_table[FILTER_KINDS] = {
+    [FILTER_BLOOM] = {"bloom", bloom_create, NULL, bloom_filter_add, NULL, bloom_filter_check,
+                      bloom_filter_bytes, bloom_filter_write, bloom_filter_read,
+                      bloom_filter_destroy},
+    [FILTER_CUCKOO] = {"cuckoo", cuckoo_create, NULL, cuckoo_add, cuckoo_remove, cuckoo_check,
+                       cuckoo_bytes, cuckoo_write, cuckoo_read, cuckoo_destroy},
+    [FILTER_XOR] = {"xor", NULL, xor_build, NULL, NULL, xor_check, xor_bytes, xor_write,
+                    xor_read, xor_destroy},
+};
+
+// Operations of a kind of filter (NULL for FILTER_NONE)
+const filter_ops* filter_get_ops(int kind){
+    if ((kind <= FILTER_NONE) || (kind >= FILTER_KINDS)) return NULL;
+    return filter_table + kind;
+}
+
+static filter* filter_wrap(int kind, void* state){
+    filter* f = (filter *) malloc(sizeof(filter));
+    f->kind = kind;
+    f->ops = filter_get_ops(kind);
+    f->state = state;
+    f->saturated = 0;
+    return f;
+}
+
+// Empty dynamic filter for capacity keys (NULL for a static kind)
+filter* filter_create(int kind, int capacity){
+    const filter_ops* ops = filter_get_ops(kind);
+    if ((ops == NULL) || (ops->create == NULL)) return NULL;
+    return filter_wrap(kind, ops->create(capacity));
+}
+
+// Filter of the sorted keys[0..n-1] (capacity: at least n, for dynamic kinds)
+filter* filter_build(int kind, int* keys, int n, int capacity){
+    const filter_ops* ops = filter_get_ops(kind);
+    if (ops == NULL) return NULL;
+    if (ops->build != NULL) return filter_wrap(kind, ops->build(keys, n));
+    filter* f = filter_create(kind, (capacity > n) ? capacity : n);
+    for (int i=0; i<n; i++) if ((i == 0) || (keys[i] != keys[i-1])) filter_add(f, keys[i]);
+    return f;
+}
+
+void filter_add(filter* f, int key){
+    if (f->saturated) return;
+    if (!f->ops->add(f->state, key)) f->saturated = 1;
+}
+
+// Remove a key added before: 0 if the filter can't
+int filter_remove(filter* f, int key){
+    if ((f->ops->remove == NULL) || f->saturated) return 0;
+    return f->ops->remove(f->state, key);
+}
+
+// 0 if key is absent, 1 if it may be present
+int filter_check(filter* f, int key){
+    if (f->saturated) return 1;
+    return f->ops->check(f->state, key);
+}
+
+int filter_deletable(filter* f){
+    return (f != NULL) && (f->ops->remove != NULL);
+}
+
+size_t filter_bytes(filter* f){
+    return sizeof(filter) + f->ops->bytes(f->state);
+}
+
+void filter_write(filter* f, FILE* fout){
+    fwrite(&f->kind, sizeof(int), 1, fout);
+    fwrite(&f->saturated, sizeof(int), 1, fout);
+    f->ops->write(f->state, fout);
+}
+
+filter* filter_read(FILE* fin){
+    int kind, saturated;
+    if (fread(&kind, sizeof(int), 1, fin) != 1) return NULL;
+    fread(&saturated, sizeof(int), 1, fin);
+    const filter_ops* ops = filter_get_ops(kind);
+    if (ops == NULL) return NULL;
+    filter* f = filter_wrap(kind, ops->read(fin));
+    f->saturated = saturated;
+    return f;
+}
+
+void filter_free(filter* f){
+    if (f == NULL) return;
+    f->ops->destroy(f->state);
+    free(f);
+}
+
+// Save the filter of the disk component component_index (fC*.data)
+void write_component_filter(filter* f, char* name, int component_index, int filename_size){
+    char* filename = (char *) calloc(filename_size + 8,sizeof(char));
+    get_files_name_disk(filename, name, component_index, "f", filename_size);
+    FILE* fout = fopen(filename, "wb");
+    if (fout == NULL){
+        perror("fopen");
+        free(filename);
+        return;
+    }
+    filter_write(f, fout);
+    fclose(fout);
+    free(filename);
+}
+
+// Read the filter of the disk component component_index: NULL if not saved
+filter* read_component_filter(char* name, int component_index, int filename_size){
+    char* filename = (char *) calloc(filename_size + 8,sizeof(char));
+    get_files_name_disk(filename, name, component_index, "f", filename_size);
+    FILE* fin = fopen(filename, "rb");
+    free(filename);
+    if (fin == NULL) return NULL;
+    filter* f = filter_read(fin);
+    fclose(fin);
+    return f;
+}
+
+// ------------------------ Range filter
+
+// Range filter of a disk component: bounds of its keys and a filter of the
+// prefixes of its keys (offset from INT_MIN, without the shift low bits).
+// The shift is chosen so that a prefix holds about one key: a short range is
+// checked with one probe per prefix it covers.
+range_filter* range_filter_build(int* keys, int n){
+    range_filter* rf = (range_filter *) malloc(sizeof(range_filter));
+    rf->min = keys[0];
+    rf->max = keys[n-1];
+    int distinct = 0;
+    for (int i=0; i<n; i++) if ((i == 0) || (keys[i] != keys[i-1])) distinct++;
+    uint64_t span = (uint64_t) ((int64_t) rf->max - rf->min) + 1;
+    rf->shift = 0;
+    while ((span >> (rf->shift + 1)) >= (uint64_t) distinct) rf->shift++;
+    int* prefixes = (int *) malloc(n * sizeof(int));
+    for (int i=0; i<n; i++) prefixes[i] = range_filter_prefix(rf, keys[i]);
+    rf->prefixes = filter_build(RANGE_FILTER_KIND, prefixes, n, n);
+    free(prefixes);
+    return rf;
+}
+
+int range_filter_prefix(range_filter* rf, int key){
+    return (int) (uint32_t) (((uint64_t) ((int64_t) key - INT_MIN)) >> rf->shift);
+}
+
+// 0 if no key of the component is in [low, high], 1 if some may be
+int range_filter_check(range_filter* rf, int low, int high){
+    if ((high < rf->min) || (low > rf->max)) return 0;
+    if (low < rf->min) low = rf->min;
+    if (high > rf->max) high = rf->max;
+    int64_t first = ((uint64_t) ((int64_t) low - INT_MIN)) >> rf->shift;
+    int64_t last = ((uint64_t) ((int64_t) high - INT_MIN)) >> rf->shift;
+    if (last - first >= RANGE_FILTER_PROBES) return 1;
+    for (int64_t p=first; p<=last; p++){
+        if (filter_check(rf->prefixes, (int) (uint32_t) p)) return 1;
+    }
+    return 0;
+}
+
+size_t range_filter_bytes(range_filter* rf){
+    return sizeof(range_filter) + filter_bytes(rf->prefixes);
+}
+
+void range_filter_free(range_filter* rf){
+    if (rf == NULL) return;
+    filter_free(rf->prefixes);
+    free(rf);
+}
+
+// Save the range filter of the disk component component_index (rC*.data)
+void write_range_filter(range_filter* rf, char* name, int component_index, int filename_size){
+    char* filename = (char *) calloc(filename_size + 8,sizeof(char));
+    get_files_name_disk(filename, name, component_index, "r", filename_size);
+    FILE* fout = fopen(filename, "wb");
+    if (fout == NULL){
+        perror("fopen");
+        free(filename);
+        return;
+    }
+    fwrite(&rf->min, sizeof(int), 1, fout);
+    fwrite(&rf->max, sizeof(int), 1, fout);
+    fwrite(&rf->shift, sizeof(int), 1, fout);
+    filter_write(rf->prefixes, fout);
+    fclose(fout);
+    free(filename);
+}
+
+// Read the range filter of the disk component component_index: NULL if not saved
+range_filter* read_range_filter(char* name, int component_index, int filename_size){
+    char* filename = (char *) calloc(filename_size + 8,sizeof(char));
+    get_files_name_disk(filename, name, component_index, "r", filename_size);
+    FILE* fin = fopen(filename, "rb");
+    free(filename);
+    if (fin == NULL) return NULL;
+    range_filter* rf = (range_filter *) malloc(sizeof(range_filter));
+    fread(&rf->min, sizeof(int), 1, fin);
+    fread(&rf->max, sizeof(int), 1, fin);
+    fread(&rf->shift, sizeof(int), 1, fin);
+    rf->prefixes = filter_read(fin);
+    fclose(fin);
+    if (rf->prefixes == NULL){
+        free(rf);
+        return NULL;
+    }
+    return rf;
+}
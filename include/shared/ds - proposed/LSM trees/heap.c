@@ -1,59 +1,111 @@
-// C program to merge k sorted arrays of size n each.
+// K-way merge of sorted runs with a loser tree (tournament tree).
 #include "LSMTree.h"
 
-// to get index of left child of node at index i
-int left(int i) { return (2*i + 1); }
+// Does the current entry of run a come before the one of run b?
+// An exhausted run loses every match, so no sentinel key is needed.
+// Equal keys are ordered by decreasing sequence number when both runs have
+// them, then by run: the newer run (lower index) first.
+static int run_before(loser_tree* lt, int a, int b){
+    merge_run* ra = lt->runs + a;
+    merge_run* rb = lt->runs + b;
+    int ia = lt->pos[a];
+    int ib = lt->pos[b];
+    if (ib >= rb->Ne) return (ia < ra->Ne) || (a < b);
+    if (ia >= ra->Ne) return 0;
+    if (ra->keys[ia] != rb->keys[ib]) return ra->keys[ia] < rb->keys[ib];
+    if ((ra->seqs != NULL) && (rb->seqs != NULL) && (ra->seqs[ia] != rb->seqs[ib]))
+        return ra->seqs[ia] > rb->seqs[ib];
+    return a < b;
+}
 
-// to get index of right child of node at index i
-int right(int i) { return (2*i + 2); }
- 
-// Function acting on a MinHeap
- 
-// FOLLOWING ARE IMPLEMENTATIONS OF STANDARD MIN HEAP METHODS
-// FROM CORMEN BOOK
-// Constructor: Builds a heap from a given array a[] of given size
-void MinHeap_init(MinHeap *minheap, MinHeapNode* a, int size)
-{
-    minheap->heap_size = size;
-    minheap->harr = a;  // store address of array
-    int i = (minheap->heap_size - 1)/2;
-    while (i >= 0)
-    {
-        MinHeapify(minheap, i);
-        i--;
+// Build the loser tree over the k runs (runs[0] the newest), playing each
+// match once bottom-up: k - 1 comparisons.
+void loser_tree_init(loser_tree* lt, merge_run* runs, int k){
+    lt->runs = runs;
+    lt->k = k;
+    lt->pos = (int *) calloc(k > 0 ? k : 1, sizeof(int));
+    lt->tree = (int *) malloc((k > 0 ? k : 1) * sizeof(int));
+    lt->tree[0] = 0;
+    if (k < 2) return;
+    // Winner of the match played at each node, leaves included
+    int* winners = (int *) malloc(2 * k * sizeof(int));
+    for (int r = 0; r < k; r++) winners[k + r] = r;
+    for (int node = k - 1; node >= 1; node--){
+        int a = winners[2*node];
+        int b = winners[2*node + 1];
+        if (run_before(lt, a, b)){
+            winners[node] = a;
+            lt->tree[node] = b;
+        }
+        else{
+            winners[node] = b;
+            lt->tree[node] = a;
+        }
     }
+    lt->tree[0] = winners[1];
+    free(winners);
 }
- 
-// A recursive method to heapify a subtree with root at given index
-// This method assumes that the subtrees are already heapified
-void MinHeapify(MinHeap * minheap, int i)
-{
-    int l = left(i);
-    int r = right(i);
-    int smallest = i;
-    if (l < minheap->heap_size && minheap->harr[l].element < minheap->harr[i].element)
-        smallest = l;
-    if (r < minheap->heap_size && minheap->harr[r].element < minheap->harr[smallest].element)
-        smallest = r;
-    if (smallest != i)
-    {
-        swap(&(minheap->harr[i]), &(minheap->harr[smallest]));
-        MinHeapify(minheap, smallest);
-    }
+
+// Run holding the smallest entry (at lt->pos of it), or -1 once every run
+// is exhausted
+int loser_tree_top(loser_tree* lt){
+    if (lt->k == 0) return -1;
+    int r = lt->tree[0];
+    return (lt->pos[r] < lt->runs[r].Ne) ? r : -1;
 }
 
-// to get the root
-MinHeapNode getMin(MinHeap *minheap) { return minheap->harr[0]; }
+// Move past the smallest entry, replaying only the matches on the path from
+// its leaf to the root: about log2(k) comparisons.
+void loser_tree_pop(loser_tree* lt){
+    int winner = lt->tree[0];
+    lt->pos[winner]++;
+    for (int node = (lt->k + winner) / 2; node >= 1; node /= 2){
+        if (run_before(lt, lt->tree[node], winner)){
+            int loser = winner;
+            winner = lt->tree[node];
+            lt->tree[node] = loser;
+        }
+    }
+    lt->tree[0] = winner;
+}
 
-// to replace root with new node x and heapify() new root
-void replaceMin(MinHeap *minheap, MinHeapNode x) {
-    minheap->harr[0] = x;  MinHeapify(minheap, 0);
+void loser_tree_free(loser_tree* lt){
+    free(lt->pos);
+    free(lt->tree);
 }
- 
-// A utility function to swap two elements
-void swap(MinHeapNode *x, MinHeapNode *y)
-{
-    MinHeapNode temp = *x;  *x = *y;  *y = temp;
+
+// Merge the k runs (runs[0] the newest) into out, whose arrays must have room
+// for all their entries; out->seqs and out->types are filled unless NULL.
+// Values (value_size bytes) move with their keys, zeroed for runs without
+// any. With newest_only, only the first version of each key is kept: the one
+// with the highest sequence number, or else from the newest run. Returns the
+// number of entries written (also stored in out->Ne).
+int mergeKRuns(merge_run* runs, int k, merge_run* out, int value_size, int newest_only){
+    loser_tree lt;
+    loser_tree_init(&lt, runs, k);
+    int count = 0;
+    int r;
+    while ((r = loser_tree_top(&lt)) >= 0){
+        merge_run* run = runs + r;
+        int j = lt.pos[r];
+        if (!newest_only || (count == 0) || (out->keys[count-1] != run->keys[j])){
+            out->keys[count] = run->keys[j];
+            if (out->seqs != NULL)
+                out->seqs[count] = (run->seqs != NULL) ? run->seqs[j] : 0;
+            if (out->types != NULL)
+                out->types[count] = (run->types != NULL) ? run->types[j] : OP_VALUE;
+            if ((out->values != NULL) && (run->values != NULL))
+                memcpy(out->values + count*value_size, run->values + j*value_size,
+                       value_size);
+            else if (out->values != NULL)
+                memset(out->values + count*value_size, 0, value_size);
+            count++;
+        }
+        loser_tree_pop(&lt);
+    }
+    loser_tree_free(&lt);
+    out->Ne = count;
+    return count;
 }
 
 // This function takes an array of k arrays with n elements.
@@ -63,87 +115,36 @@ void swap(MinHeapNode *x, MinHeapNode *y)
 void mergeKArrays(int *output, int *arr, int k, int n)
 {
     if (output == NULL) output = (int *) malloc(k*n*sizeof(int));
-    // Create a min heap with k heap nodes.  Every heap node
-    // has first element of an array
-    MinHeapNode *harr = (MinHeapNode *) malloc(k*sizeof(MinHeapNode));
+    merge_run* runs = (merge_run *) calloc(k > 0 ? k : 1, sizeof(merge_run));
     for (int i = 0; i < k; i++)
     {
-        harr[i].element = arr[i*n]; // Store the first element
-        harr[i].i = i;  // index of array
-        harr[i].j = 1;  // Index of next element to be stored from array
-    }
-    // Create the heap
-    MinHeap *hp = (MinHeap*) malloc(sizeof(MinHeap));
-    MinHeap_init(hp, harr, k);
- 
-    // Now one by one get the minimum element from min
-    // heap and replace it with next element of its array
-    for (int count = 0; count < n*k; count++)
-    {
-        // Get the minimum element and store it in output
-        MinHeapNode root = getMin(hp);
-        output[count] = root.element;
- 
-        // Find the next element that will replace current
-        // root of heap. The next element belongs to same
-        // array as the current root.
-        if (root.j < n)
-        {
-            root.element = arr[n*root.i + root.j];
-            root.j += 1;
-        }
-        // If root was the last element of its array
-        else root.element =  INT_MAX; //INT_MAX is for infinite
- 
-        // Replace root with next element of array
-        replaceMin(hp, root);
+        runs[i].keys = arr + i*n;
+        runs[i].Ne = n;
     }
+    merge_run out = {output, NULL, NULL, NULL, 0};
+    mergeKRuns(runs, k, &out, 0, 0);
+    free(runs);
 }
 
+// Same with the values (value_size bytes each) moved along with the keys
 void mergeKArrays_values(int *keys_output, char *values_output, int *keys,
                          char* values, int k, int n, int value_size)
 {
     if (keys_output == NULL) keys_output = (int *) malloc(k*n*sizeof(int));
     if (values_output == NULL) values_output = (char *) malloc(k*n*value_size*sizeof(char));
-
-    // Create a min heap with k heap nodes.  Every heap node
-    // has first element of an array
-    MinHeapNode *harr = (MinHeapNode *) malloc(k*sizeof(MinHeapNode));
+    merge_run* runs = (merge_run *) calloc(k > 0 ? k : 1, sizeof(merge_run));
     for (int i = 0; i < k; i++)
     {
-        harr[i].element = keys[i*n]; // Store the first element
-        harr[i].i = i;  // index of array
-        harr[i].j = 1;  // Index of next element to be stored from array
-    }
-    // Create the heap
-    MinHeap *hp = (MinHeap*) malloc(sizeof(MinHeap));
-    MinHeap_init(hp, harr, k);
- 
-    // Now one by one get the minimum element from min
-    // heap and replace it with next element of its array
-    for (int count = 0; count < n*k; count++)
-    {
-        // Get the minimum element and store it in output
-        MinHeapNode root = getMin(hp);
-        keys_output[count] = root.element;
-        strcpy(values_output + count*value_size, values + (n*root.i + root.j - 1)*value_size);
- 
-        // Find the next element that will replace current
-        // root of heap. The next element belongs to same
-        // array as the current root.
-        if (root.j < n)
-        {
-            root.element = keys[n*root.i + root.j];
-            root.j += 1;
-        }
-        // If root was the last element of its array
-        else root.element =  INT_MAX; //INT_MAX is for infinite
- 
-        // Replace root with next element of array
-        replaceMin(hp, root);
+        runs[i].keys = keys + i*n;
+        runs[i].values = values + i*n*value_size;
+        runs[i].Ne = n;
     }
+    merge_run out = {keys_output, values_output, NULL, NULL, 0};
+    mergeKRuns(runs, k, &out, value_size, 0);
+    free(runs);
 }
 
+#ifdef HEAP_DEMO
 // A utility function to print array elements
 void printArray_int(int* arr, int size)
 {
@@ -157,15 +158,15 @@ void printArray_char(char* arr, int size, int value_size)
     printf("\n");
 }
 
-// Driver program to test above functions
+// Driver program to test above functions (build heap.c alone with -DHEAP_DEMO)
 int main()
-{   
+{
     int n = 4;
     int k = 3;
-    int value_size = 12;
+    int value_size = 16;
     // Change n at the top to change number of elements
     // in an array
-    int keys[] =  {2, 6, 12, 34,
+    int keys[] =  {2, 6, 12, INT_MAX,
                   1, 9, 20, 100,
                   6, 34, 90, 200};
     // FIlling values
@@ -174,15 +175,30 @@ int main()
         // Filling value
         sprintf(values + i*value_size, "ab_%d", keys[i]);
     }
- 
+
     int *keys_output = (int*) malloc(n*k*sizeof(int));
     char *values_output = (char*) malloc(n*k*value_size*sizeof(char));
     mergeKArrays_values(keys_output, values_output, keys, values, k,
                         n, value_size);
- 
+
     printf("Merged array is \n");
     printArray_int(keys_output, n*k);
     printArray_char(values_output, n*k, value_size);
- 
+
+    // Runs of different lengths, keeping the newest version of 6 (run 0)
+    merge_run runs[3] = {{keys, values, NULL, NULL, 2},
+                         {keys + n, values + n*value_size, NULL, NULL, 4},
+                         {keys + 2*n, values + 2*n*value_size, NULL, NULL, 1}};
+    sprintf(values + 2*n*value_size, "ab_6_old");
+    merge_run out = {keys_output, values_output, NULL, NULL, 0};
+    mergeKRuns(runs, 3, &out, value_size, 1);
+    printf("Newest versions of the runs of 2, 4 and 1 keys\n");
+    printArray_int(keys_output, out.Ne);
+    printArray_char(values_output, out.Ne, value_size);
+
+    free(values);
+    free(keys_output);
+    free(values_output);
     return 0;
-}
\ No newline at end of file
+}
+#endif
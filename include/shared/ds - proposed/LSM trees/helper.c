@@ -49,136 +49,277 @@ int binary_search_signal(int* keys, int key, int down, int top,
     return middle;
 }
 
-// Linear search of key in (unsorted) keys. Set index to the position if found
-void keys_linear_search(int* index, int key, int* keys, int Ne){
+// Binary search of the first position in sorted keys[down,..,top] whose key
+// is >= key; return top + 1 if all the keys are smaller
+int lower_bound(int* keys, int key, int down, int top){
+    while (down <= top){
+        int middle = (top + down)/2;
+        if (keys[middle] < key) down = middle + 1;
+        else top = middle - 1;
+    }
+    return down;
+}
+
+// Versions of a key are stored newest first (decreasing seq). Starting from
+// any index of key found by a binary search, return the index of the newest
+// version visible at snapshot, i.e. the first one with seq <= snapshot, else -1
+int first_visible(int* keys, uint64_t* seqs, int index, int Ne, uint64_t snapshot){
+    if (index == -1) return -1;
+    int key = keys[index];
+    // Go back to the newest version
+    while ((index > 0) && (keys[index - 1] == key)) index--;
+    if (snapshot == SEQ_MAX) return index;
+    // Skip the versions written after the snapshot
+    while ((index < Ne) && (keys[index] == key) && (seqs[index] > snapshot)) index++;
+    if ((index < Ne) && (keys[index] == key)) return index;
+    return -1;
+}
+
+// Check if one of the live snapshots (sorted) falls in [down, up[, i.e. if a
+// version written at down and overwritten at up is still visible to a reader
+int snapshot_between(uint64_t* snapshots, int Ns, uint64_t down, uint64_t up){
+    for (int i=0; i < Ns; i++){
+        if (snapshots[i] >= up) return 0;
+        if (snapshots[i] >= down) return 1;
+    }
+    return 0;
+}
+
+// Compare two entries with the order used inside the components:
+// increasing key, then decreasing sequence number (newest version first)
+static int entry_cmp(int key1, uint64_t seq1, int key2, uint64_t seq2){
+    if (key1 != key2) return (key1 < key2) ? -1 : 1;
+    if (seq1 != seq2) return (seq1 > seq2) ? -1 : 1;
+    return 0;
+}
+
+// Linear search of key in (unsorted) keys. Set index to the position of the
+// newest version visible at snapshot if found, else -1
+void keys_linear_search(int* index, int key, int* keys, uint64_t* seqs, int Ne,
+                        uint64_t snapshot){
     *index = -1;
     for (int i=0; i < Ne; i++){
-        if (keys[i] == key){
-            *index = i;
+        if ((keys[i] == key) && (seqs[i] <= snapshot)){
+            if ((*index == -1) || (seqs[i] > seqs[*index])) *index = i;
         }
     }
 }
 
-void merge_with_values(int* keys, char* values, int down, int middle, int top,
-                       int value_size){
+void merge_with_values(component* C, int down, int middle, int top, int value_size){
     int size = top - down + 1;
 
-    // Copying list and values (indices shifted of down)
+    // Copying list, seqs and values (indices shifted of down)
     int* temp_keys = (int*) malloc(size * sizeof(int));
+    uint64_t* temp_seqs = (uint64_t*) malloc(size * sizeof(uint64_t));
+    uint8_t* temp_types = (uint8_t*) malloc(size * sizeof(uint8_t));
     char* temp_values = (char*) malloc(value_size * size * sizeof(char));
     for (int i=0; i < size; i++){
-        temp_keys[i] = keys[i + down];
-        strcpy(temp_values + i*value_size, values + (i+down)*value_size);
+        temp_keys[i] = C->keys[i + down];
+        temp_seqs[i] = C->seqs[i + down];
+        temp_types[i] = C->types[i + down];
+        strcpy(temp_values + i*value_size, C->values + (i+down)*value_size);
     }
 
     // Going through the sublists
     int ileft = 0;
     int iright = middle + 1 - down;
     int i = down;
-    while ((ileft + down <= middle) && (iright + down <= top)){
-        if (temp_keys[ileft] > temp_keys[iright]){
-            keys[i] = temp_keys[iright];
-            strcpy(values + (i++)*value_size, temp_values + (iright++)*value_size);
-        }
-        else{
-            keys[i] = temp_keys[ileft];
-            strcpy(values + (i++)*value_size, temp_values + (ileft++)*value_size);
-        }
-    }
-
-    // Finishing the filling
-    while (ileft + down <= middle){
-        keys[i] = temp_keys[ileft];
-        strcpy(values + (i++)*value_size, temp_values + (ileft++)*value_size);
-    }
-    while (iright + down <= top){
-        keys[i] = temp_keys[iright];
-        strcpy(values + (i++)*value_size, temp_values + (iright++)*value_size);
+    int from;
+    while ((ileft + down <= middle) || (iright + down <= top)){
+        if (ileft + down > middle) from = iright++;
+        else if (iright + down > top) from = ileft++;
+        else if (entry_cmp(temp_keys[ileft], temp_seqs[ileft],
+                           temp_keys[iright], temp_seqs[iright]) > 0) from = iright++;
+        else from = ileft++;
+        C->keys[i] = temp_keys[from];
+        C->seqs[i] = temp_seqs[from];
+        C->types[i] = temp_types[from];
+        strcpy(C->values + (i++)*value_size, temp_values + from*value_size);
     }
 
     // Freeing memory
     free(temp_keys);
+    free(temp_seqs);
+    free(temp_types);
     free(temp_values);
 
 }
 
-// Merge two sorted lists of keys and update the corresponding values from the two
-// values list in the array of values; the results are set in the second list of
-// keys and values (corresponds to the next component)
-// Tested: ok
-void merge_list(int* keys1, int* keys2, char* values1, char* values2,
-                      int* Ne1, int* Ne2, int value_size){
-    // Temporary files with a copy of keys2 and values2 because
+// Index of the first range tombstone whose low is above key (ranges sorted by low)
+int ranges_after(range_tombstone* ranges, int Nr, int key){
+    int down = 0;
+    int top = Nr;
+    while (down < top){
+        int middle = (down + top) / 2;
+        if (ranges[middle].low <= key) down = middle + 1;
+        else top = middle;
+    }
+    return down;
+}
+
+// qsort comparator for range tombstones (by low)
+int range_tombstone_cmp(const void* a, const void* b){
+    const range_tombstone* r1 = (const range_tombstone*) a;
+    const range_tombstone* r2 = (const range_tombstone*) b;
+    if (r1->low != r2->low) return (r1->low < r2->low) ? -1 : 1;
+    return 0;
+}
+
+// Set max_high[r] to the largest high of ranges[0..r], for r from from on
+void ranges_update_max_high(range_tombstone* ranges, int* max_high, int Nr, int from){
+    for (int r=from; r<Nr; r++){
+        max_high[r] = ranges[r].high;
+        if ((r > 0) && (max_high[r-1] > max_high[r])) max_high[r] = max_high[r-1];
+    }
+}
+
+// Return the oldest sequence number of the range tombstones covering key which
+// are newer than seq (SEQ_MAX if the version is not range deleted).
+// The ranges are sorted by low: only the ones starting at or below key are
+// looked at, from the last one back until none before can reach key.
+uint64_t range_covering_seq(range_tombstone* ranges, int* max_high, int Nr, int key,
+                            uint64_t seq){
+    uint64_t covering = SEQ_MAX;
+    for (int r=ranges_after(ranges, Nr, key)-1; (r >= 0) && (max_high[r] >= key); r--){
+        if ((key <= ranges[r].high) && (ranges[r].seq > seq) &&
+            (ranges[r].seq < covering)) covering = ranges[r].seq;
+    }
+    return covering;
+}
+
+// Merge two sorted components C1 (most recent) and C2; the results are set
+// in the second component (corresponds to the next component) and its number
+// of elements updated.
+// For each key, the newest version is kept; an older version is only kept if
+// a live snapshot still reads it (see snapshot_between), else it is dropped.
+// A version under a newer range tombstone is dropped the same way, and the
+// range tombstones it keeps alive for a snapshot are marked live.
+// When C2 is the last component (last = 1), a tombstone which is the oldest
+// version kept for its key hides nothing anymore and is purged (and removed
+// from the filter purged, if not NULL).
+void merge_list(component* C1, component* C2, int value_size, uint64_t* snapshots, int Ns,
+                range_tombstone* ranges, int* ranges_max_high, int Nr, int last,
+                filter* purged){
+    int Ne1 = *C1->Ne;
+    int Ne2 = *C2->Ne;
+    // Temporary files with a copy of keys2, seqs2 and values2 because
     // both files are modified inplace
-    int* keys2_temp = (int *) malloc((*Ne2) * sizeof(int));
-    for (int i=0; i<(*Ne2); i++) keys2_temp[i] = keys2[i];
-    char* values2_temp = (char *) malloc(value_size * (*Ne2) * sizeof(char));
-    for (int i=0; i<(*Ne2); i++) strcpy(values2_temp + i*value_size,
-                                       values2 + i*value_size);
+    int* keys2_temp = (int *) malloc(Ne2 * sizeof(int));
+    for (int i=0; i<Ne2; i++) keys2_temp[i] = C2->keys[i];
+    uint64_t* seqs2_temp = (uint64_t *) malloc(Ne2 * sizeof(uint64_t));
+    for (int i=0; i<Ne2; i++) seqs2_temp[i] = C2->seqs[i];
+    uint8_t* types2_temp = (uint8_t *) malloc(Ne2 * sizeof(uint8_t));
+    for (int i=0; i<Ne2; i++) types2_temp[i] = C2->types[i];
+    char* values2_temp = (char *) malloc(value_size * Ne2 * sizeof(char));
+    for (int i=0; i<Ne2; i++) strcpy(values2_temp + i*value_size,
+                                     C2->values + i*value_size);
 
-    // Going through the sublists
-    int ileft = 0;
-    int iright = 0;
+    // Going through the sublists with a loser tree (see heap.c), C1 being
+    // the newer run: ties on keys are broken by recency
+    merge_run runs[2] = {{C1->keys, C1->values, C1->seqs, C1->types, Ne1},
+                         {keys2_temp, values2_temp, seqs2_temp, types2_temp, Ne2}};
+    loser_tree lt;
+    loser_tree_init(&lt, runs, 2);
+    int r;
     int i = 0;
-    int number_merges=0; // Count updates/deletes to update metadata
-    while ((ileft < (*Ne1)) && (iright < (*Ne2))){
-        // if (i >= *Ne2) printf("ERROR: i is %d, Ne1: %d, Ne2: %d, iright: %d , ileft: %d\n", i,
-        //                       *Ne1, *Ne2, iright, ileft);
-        // Filling from keys2_temp
-        if (keys1[ileft] > keys2_temp[iright]){
-            keys2[i] = keys2_temp[iright];
-            strcpy(values2 + (i++)*value_size,
-                   values2_temp + (iright++)*value_size);
-        }
-        // Filling from keys1
-        else if (keys1[ileft] < keys2_temp[iright]){
-            keys2[i] = keys1[ileft];
-            strcpy(values2 + (i++)*value_size, values1 + (ileft++)*value_size);
+    // Newer version of the current key (to decide if the next one is visible)
+    int has_newer = 0;
+    int newer_key = 0;
+    uint64_t newer_seq = 0;
+    while ((r = loser_tree_top(&lt)) >= 0){
+        // Pick the smallest entry
+        int j = lt.pos[r];
+        int key = runs[r].keys[j];
+        uint64_t seq = runs[r].seqs[j];
+        uint8_t type = runs[r].types[j];
+        char* value = runs[r].values + j*value_size;
+        loser_tree_pop(&lt);
+        // Version hidden by a newer version of the key or a newer range
+        // tombstone: keep it only if visible to a snapshot in between
+        uint64_t up = (has_newer && (newer_key == key)) ? newer_seq : SEQ_MAX;
+        uint64_t range_seq = range_covering_seq(ranges, ranges_max_high, Nr, key, seq);
+        if (range_seq < up) up = range_seq;
+        int keep = (up == SEQ_MAX) || snapshot_between(snapshots, Ns, seq, up);
+        has_newer = 1;
+        newer_key = key;
+        newer_seq = seq;
+        if (!keep) continue;
+        if (range_seq != SEQ_MAX){
+            for (int r=ranges_after(ranges, Nr, key)-1;
+                 (r >= 0) && (ranges_max_high[r] >= key); r--){
+                if ((key <= ranges[r].high) && (ranges[r].seq > seq)) ranges[r].live = 1;
+            }
         }
-        // Case with equality (when updates/delete operation)
-        else{
-            // Same behavior for updates/deletes, we keep the most recent one (upper)
-            // printf("DEBUG: Update/delete case\n");
-            // printf("On key: %d\n", keys1[ileft]);
-            // printf("Value left: %s \n", values1 + (ileft)*value_size);
-            // printf("Right key: %d\n", keys2[iright]);
-            // printf("Value right: %s \n", values2_temp + (iright)*value_size);
-            keys2[i] = keys1[ileft];
-            strcpy(values2 + (i++)*value_size,
-                   values1 + (ileft++)*value_size);
-            iright++;
-            number_merges++;
+
+        // Purge the previous tombstone if it was the oldest version of its key
+        if (last && (i > 0) && (C2->keys[i-1] != key) && (C2->types[i-1] == OP_DELETE)){
+            if (purged != NULL) filter_remove(purged, C2->keys[i-1]);
+            i--;
         }
+        C2->keys[i] = key;
+        C2->seqs[i] = seq;
+        C2->types[i] = type;
+        strcpy(C2->values + (i++)*value_size, value);
+    }
+    if (last && (i > 0) && (C2->types[i-1] == OP_DELETE)){
+        if (purged != NULL) filter_remove(purged, C2->keys[i-1]);
+        i--;
     }
     // Update number of elements in component (because of updates/deletes)
-    *Ne2 = *Ne2 - number_merges;
+    *C2->Ne = i;
 
-    // Finishing to fill
-    while (ileft < (*Ne1)){
-        keys2[i] = keys1[ileft];
-        strcpy(values2 + (i++)*value_size, values1 + (ileft++)*value_size);
-    }
-    while (iright < (*Ne2)){
-        keys2[i] = keys2_temp[iright];
-        strcpy(values2 + (i++)*value_size, values2_temp + (iright++)*value_size);
-    }
     // Freeing the pointers
+    loser_tree_free(&lt);
     free(keys2_temp);
+    free(seqs2_temp);
+    free(types2_temp);
     free(values2_temp);
 }
 
-// Sort inplace keys and values accordingly
+// Count the tombstones stored in component C
+int count_tombstones(component* C){
+    int count = 0;
+    for (int i=0; i < *C->Ne; i++){
+        if (C->types[i] == OP_DELETE) count++;
+    }
+    return count;
+}
+
+// Append a version found by a scan, growing the array if needed
+void add_scan_entry(scan_entry** entries, int* Nentries, int* capacity, int key,
+                    uint64_t seq, uint8_t type, int level, int index){
+    if (*Nentries >= *capacity){
+        *capacity = (*capacity == 0) ? 64 : 2 * (*capacity);
+        *entries = (scan_entry*) realloc(*entries, (*capacity) * sizeof(scan_entry));
+    }
+    scan_entry* e = *entries + (*Nentries)++;
+    e->key = key;
+    e->seq = seq;
+    e->type = type;
+    e->level = level;
+    e->index = index;
+}
+
+// qsort comparator for scan entries (same order as inside a component)
+int scan_entry_cmp(const void* a, const void* b){
+    const scan_entry* e1 = (const scan_entry*) a;
+    const scan_entry* e2 = (const scan_entry*) b;
+    return entry_cmp(e1->key, e1->seq, e2->key, e2->seq);
+}
+
+// Sort inplace keys of component C and values, seqs accordingly
+// (increasing keys, newest version first for equal keys)
 // down: first index
 // top: last index (i.e. size - 1)
 // Tested: ok
-void merge_sort_with_values(int* keys, char* values, int down, int top, int value_size){
+void merge_sort_with_values(component* C, int down, int top, int value_size){
     if (top - down > 0) {
         int middle = (top + down) / 2;
         // Sorting left
-        merge_sort_with_values(keys, values, down, middle, value_size);
+        merge_sort_with_values(C, down, middle, value_size);
         // Sorting right
-        merge_sort_with_values(keys, values, middle + 1, top, value_size);
+        merge_sort_with_values(C, middle + 1, top, value_size);
         // Merging
-        merge_with_values(keys, values, down, middle, top, value_size);
+        merge_with_values(C, down, middle, top, value_size);
     }
 }
\ No newline at end of file
@@ -0,0 +1,127 @@
+#include "LSMTree.h"
+
+// Learned index of a disk component: piecewise linear model of the position
+// of the keys. Each segment predicts the position of the first version of
+// a key with an error of at most epsilon, so that a search only looks at a
+// window of 2*epsilon+1 keys around the prediction instead of the whole file.
+// Segments are built in one pass over the sorted keys (shrinking cone: a
+// segment is extended while a slope fits all its keys within epsilon).
+
+// Build the learned index of the sorted keys[0..Ne-1]
+learned_index* learned_index_build(int* keys, int Ne, int epsilon){
+    learned_index* model = (learned_index *) malloc(sizeof(learned_index));
+    model->Ne = Ne;
+    model->epsilon = epsilon;
+    model->Nsegments = 0;
+    int size = 4;
+    model->segments = (segment *) malloc(size * sizeof(segment));
+
+    int i = 0;
+    while (i < Ne){
+        // New segment starting at the first version of keys[i]
+        int key = keys[i];
+        double slope_low = 0;
+        double slope_high = INFINITY;
+        int j = i + 1;
+        while ((j < Ne) && (keys[j] == key)) j++;
+        while (j < Ne){
+            double dx = (double) ((int64_t) keys[j] - key);
+            double dy = (double) (j - i);
+            double low = (dy - epsilon) / dx;
+            double high = (dy + epsilon) / dx;
+            if ((low > slope_high) || (high < slope_low)) break;
+            if (low > slope_low) slope_low = low;
+            if (high < slope_high) slope_high = high;
+            // Next key (skipping its older versions)
+            int next = keys[j];
+            while ((j < Ne) && (keys[j] == next)) j++;
+        }
+        if (model->Nsegments >= size){
+            size *= 2;
+            model->segments = (segment *) realloc(model->segments, size * sizeof(segment));
+        }
+        segment* s = model->segments + model->Nsegments++;
+        s->key = key;
+        s->position = i;
+        s->slope = (slope_high == INFINITY) ? 0 : (slope_low + slope_high) / 2;
+        i = j;
+    }
+    return model;
+}
+
+void learned_index_free(learned_index* model){
+    if (model == NULL) return;
+    free(model->segments);
+    free(model);
+}
+
+// Memory used by the learned index
+size_t learned_index_bytes(learned_index* model){
+    return sizeof(learned_index) + model->Nsegments * sizeof(segment);
+}
+
+// Search key in keys (the component of the model): return the index of its
+// first version, -1 if not present
+int learned_index_search(learned_index* model, int* keys, int key){
+    if ((model->Nsegments == 0) || (key < model->segments[0].key)) return -1;
+    // Last segment starting at a key <= key
+    int down = 0;
+    int top = model->Nsegments - 1;
+    while (down < top){
+        int middle = (down + top + 1)/2;
+        if (model->segments[middle].key <= key) down = middle;
+        else top = middle - 1;
+    }
+    segment* s = model->segments + down;
+    int predicted = s->position + (int) (s->slope * (double) ((int64_t) key - s->key) + 0.5);
+    // Window of the prediction (+1 for the rounding)
+    int low = predicted - model->epsilon - 1;
+    int high = predicted + model->epsilon + 1;
+    if (low < s->position) low = s->position;
+    if (high > model->Ne - 1) high = model->Ne - 1;
+    if (low > high) return -1;
+    int index = lower_bound(keys, key, low, high);
+    if ((index <= high) && (keys[index] == key)) return index;
+    return -1;
+}
+
+// Save the learned index of the disk component component_index (iC*.data)
+void write_learned_index(learned_index* model, char* name, int component_index,
+                         int filename_size){
+    char* filename = (char *) calloc(filename_size + 8,sizeof(char));
+    get_files_name_disk(filename, name, component_index, "i", filename_size);
+    FILE* fout = fopen(filename, "wb");
+    if (fout == NULL){
+        perror("fopen");
+        free(filename);
+        return;
+    }
+    fwrite(&model->Ne, sizeof(int), 1, fout);
+    fwrite(&model->epsilon, sizeof(int), 1, fout);
+    fwrite(&model->Nsegments, sizeof(int), 1, fout);
+    fwrite(model->segments, sizeof(segment), model->Nsegments, fout);
+    fclose(fout);
+    free(filename);
+}
+
+// Read the learned index of the disk component component_index: NULL if not
+// saved or not built for its Ne elements
+learned_index* read_learned_index(char* name, int component_index, int Ne, int filename_size){
+    char* filename = (char *) calloc(filename_size + 8,sizeof(char));
+    get_files_name_disk(filename, name, component_index, "i", filename_size);
+    FILE* fin = fopen(filename, "rb");
+    free(filename);
+    if (fin == NULL) return NULL;
+    learned_index* model = (learned_index *) malloc(sizeof(learned_index));
+    fread(&model->Ne, sizeof(int), 1, fin);
+    fread(&model->epsilon, sizeof(int), 1, fin);
+    fread(&model->Nsegments, sizeof(int), 1, fin);
+    model->segments = (segment *) malloc((model->Nsegments + 1) * sizeof(segment));
+    fread(model->segments, sizeof(segment), model->Nsegments, fin);
+    fclose(fin);
+    if (model->Ne != Ne){
+        learned_index_free(model);
+        return NULL;
+    }
+    return model;
+}
@@ -0,0 +1,202 @@
+#include "LSMTree.h"
+
+// Memory governor: a single budget (MEMORY_BUDGET) for all the lsm of the
+// process. It accounts:
+//     - the memtables (C0 and buffer), sized at creation to fit the budget
+//     - the bloom filters, sized at creation to fit the budget, and the
+//       learned indexes of the disk components
+//     - the row caches, shrunk when memory is needed and grown back after
+//     - the merge buffers (components read from disk and temporary copies),
+//       reserved before each merge
+// Over budget, a new merge (or a writer of a sharded lsm) waits for the merges
+// in progress to release their memory; a merge in progress never waits, so a
+// single merge larger than the budget still runs (and is reported).
+
+static memory_governor* governor_global = NULL;
+static pthread_once_t governor_once = PTHREAD_ONCE_INIT;
+
+static void governor_init(){
+    governor_global = (memory_governor *) calloc(1, sizeof(memory_governor));
+    pthread_mutex_init(&governor_global->lock, NULL);
+    pthread_cond_init(&governor_global->released, NULL);
+    governor_global->budget = MEMORY_BUDGET;
+}
+
+// Governor of the process (created at first use)
+memory_governor* memory_governor_get(){
+    pthread_once(&governor_once, governor_init);
+    return governor_global;
+}
+
+// Memory available (SIZE_MAX if no limit), lock held
+static size_t available_locked(memory_governor* governor){
+    if (governor->budget == 0) return SIZE_MAX;
+    return (governor->total < governor->budget) ? governor->budget - governor->total : 0;
+}
+
+// Shrink the row caches to free need bytes (down to one entry per shard),
+// lock held
+static void shrink_caches(memory_governor* governor, size_t need){
+    for (int c=0; (c < governor->Ncaches) && (need > 0); c++){
+        row_cache* cache = governor->caches[c];
+        int capacity = row_cache_capacity(cache);
+        int target = capacity - (int) (need / row_cache_entry_size(cache->value_size)) - 1;
+        if (target < cache->Nshards) target = cache->Nshards;
+        if (target >= capacity) continue;
+        size_t before = row_cache_bytes(cache);
+        row_cache_resize(cache, target);
+        size_t freed = before - row_cache_bytes(cache);
+        governor->used[MEM_CACHE] -= freed;
+        governor->total -= freed;
+        need = (freed >= need) ? 0 : need - freed;
+        if (VERBOSE == 1) printf("Memory budget: row cache shrunk to %d entries\n", target);
+    }
+}
+
+// Grow the row caches back to their capacity with half of the memory available,
+// once no merge is in progress (by steps of at least 1/8 of it), lock held
+static void grow_caches(memory_governor* governor){
+    if ((governor->budget == 0) || (governor->used[MEM_MERGE] > 0)) return;
+    for (int c=0; c < governor->Ncaches; c++){
+        row_cache* cache = governor->caches[c];
+        int capacity = row_cache_capacity(cache);
+        int requested = governor->caches_capacity[c];
+        size_t room = available_locked(governor) / 2 / row_cache_entry_size(cache->value_size);
+        int target = (capacity + room < (size_t) requested) ? capacity + (int) room : requested;
+        if (target - capacity < requested / 8) continue;
+        size_t before = row_cache_bytes(cache);
+        row_cache_resize(cache, target);
+        size_t added = row_cache_bytes(cache) - before;
+        governor->used[MEM_CACHE] += added;
+        governor->total += added;
+    }
+}
+
+// Change the budget (0 for no limit)
+void memory_set_budget(memory_governor* governor, size_t budget){
+    pthread_mutex_lock(&governor->lock);
+    governor->budget = budget;
+    if ((budget > 0) && (governor->total > budget)) shrink_caches(governor,
+                                                                  governor->total - budget);
+    else grow_caches(governor);
+    pthread_cond_broadcast(&governor->released);
+    pthread_mutex_unlock(&governor->lock);
+}
+
+// Memory available in the budget (SIZE_MAX if no limit)
+size_t memory_available(memory_governor* governor){
+    pthread_mutex_lock(&governor->lock);
+    size_t available = available_locked(governor);
+    pthread_mutex_unlock(&governor->lock);
+    return available;
+}
+
+// Memory used by one entry of a component: key, value, seq and type
+size_t entry_size(int value_size){
+    return sizeof(int) + value_size * sizeof(char) + sizeof(uint64_t) + sizeof(uint8_t);
+}
+
+// Account bytes of memory already sized to the budget
+void memory_charge(memory_governor* governor, int kind, size_t bytes){
+    pthread_mutex_lock(&governor->lock);
+    governor->used[kind] += bytes;
+    governor->total += bytes;
+    pthread_mutex_unlock(&governor->lock);
+}
+
+// Release bytes of memory of kind: wakes the merges and writers waiting
+void memory_release(memory_governor* governor, int kind, size_t bytes){
+    pthread_mutex_lock(&governor->lock);
+    governor->used[kind] -= bytes;
+    governor->total -= bytes;
+    grow_caches(governor);
+    pthread_cond_broadcast(&governor->released);
+    pthread_mutex_unlock(&governor->lock);
+}
+
+// Reserve bytes of memory of kind (merge buffers) before allocating them.
+// held is the memory of this kind already reserved by the caller: a caller
+// holding none waits for the others to release theirs while over budget.
+void memory_reserve(memory_governor* governor, int kind, size_t bytes, size_t held){
+    pthread_mutex_lock(&governor->lock);
+    if ((governor->budget > 0) && (governor->total + bytes > governor->budget)){
+        shrink_caches(governor, governor->total + bytes - governor->budget);
+        while ((held == 0) && (governor->used[kind] > 0) &&
+               (governor->total + bytes > governor->budget)){
+            pthread_cond_wait(&governor->released, &governor->lock);
+        }
+        if ((governor->total + bytes > governor->budget) && (VERBOSE == 1)){
+            printf("Memory budget exceeded: %zu / %zu bytes\n", governor->total + bytes,
+                   governor->budget);
+        }
+    }
+    governor->used[kind] += bytes;
+    governor->total += bytes;
+    pthread_mutex_unlock(&governor->lock);
+}
+
+// Backpressure on the writers: wait while over budget with merges in progress
+void memory_throttle(memory_governor* governor){
+    pthread_mutex_lock(&governor->lock);
+    while ((governor->budget > 0) && (governor->total > governor->budget) &&
+           (governor->used[MEM_MERGE] > 0)){
+        pthread_cond_wait(&governor->released, &governor->lock);
+    }
+    pthread_mutex_unlock(&governor->lock);
+}
+
+// Create a row cache of at most capacity entries fitting in half of the
+// memory available; the governor accounts it and resizes it when needed
+row_cache* memory_create_cache(memory_governor* governor, int capacity, int value_size){
+    pthread_mutex_lock(&governor->lock);
+    size_t room = available_locked(governor) / 2 / row_cache_entry_size(value_size);
+    int fitted = (room < (size_t) capacity) ? (int) room : capacity;
+    if (fitted < ROW_CACHE_SHARDS) fitted = ROW_CACHE_SHARDS;
+    if ((fitted < capacity) && (VERBOSE == 1)){
+        printf("Memory budget: row cache reduced to %d entries\n", fitted);
+    }
+    row_cache* cache = row_cache_create(fitted, value_size);
+    cache->governor = governor;
+    if (governor->Ncaches >= governor->caches_size){
+        governor->caches_size = (governor->caches_size == 0) ? 4 : 2 * governor->caches_size;
+        governor->caches = (row_cache **) realloc(governor->caches,
+                                                  governor->caches_size * sizeof(row_cache*));
+        governor->caches_capacity = (int *) realloc(governor->caches_capacity,
+                                                    governor->caches_size * sizeof(int));
+    }
+    governor->caches[governor->Ncaches] = cache;
+    governor->caches_capacity[governor->Ncaches] = capacity;
+    governor->Ncaches++;
+    size_t bytes = row_cache_bytes(cache);
+    governor->used[MEM_CACHE] += bytes;
+    governor->total += bytes;
+    pthread_mutex_unlock(&governor->lock);
+    return cache;
+}
+
+// Stop accounting a row cache (freed)
+void memory_unregister_cache(memory_governor* governor, row_cache* cache){
+    pthread_mutex_lock(&governor->lock);
+    for (int c=0; c < governor->Ncaches; c++){
+        if (governor->caches[c] != cache) continue;
+        size_t bytes = row_cache_bytes(cache);
+        governor->used[MEM_CACHE] -= bytes;
+        governor->total -= bytes;
+        governor->caches[c] = governor->caches[governor->Ncaches - 1];
+        governor->caches_capacity[c] = governor->caches_capacity[governor->Ncaches - 1];
+        governor->Ncaches--;
+        break;
+    }
+    grow_caches(governor);
+    pthread_cond_broadcast(&governor->released);
+    pthread_mutex_unlock(&governor->lock);
+}
+
+// Print the memory used per kind
+void print_memory(memory_governor* governor){
+    pthread_mutex_lock(&governor->lock);
+    printf("Memory used: %zu / %zu bytes (memtables %zu, filters %zu, caches %zu, merges %zu)\n",
+           governor->total, governor->budget, governor->used[MEM_MEMTABLE],
+           governor->used[MEM_FILTER], governor->used[MEM_CACHE], governor->used[MEM_MERGE]);
+    pthread_mutex_unlock(&governor->lock);
+}
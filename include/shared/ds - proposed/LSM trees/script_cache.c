@@ -0,0 +1,59 @@
+#include "LSMtree.h"
+
+// Graph to plot (with and without row cache)
+//     - batch reads of hot keys (100 keys, most of them in disk components)
+//     - batch reads uniform over all the keys
+
+int main(){
+    // LSMT parameters
+    int Nc = 7;
+    int value_size = 32;
+    int num_elements = 1000000;
+
+    // ------------------------ LSM Tree STRUCTURE
+    int SIZE = 1000;
+    int Cs_size[] = {SIZE, 3*SIZE, 9*SIZE, 27*SIZE, 81*SIZE, 243*SIZE, 729*SIZE, 2187*SIZE,
+                     1000000*SIZE};
+    char name[] = "test";
+
+    LSMTree_generation(name, Nc, Cs_size, value_size, num_elements, 0);
+    printf("Reading LSM from disk:\n");
+    LSM_tree *lsm_backup = (LSM_tree *)malloc(sizeof(LSM_tree));
+    read_lsm_from_disk(lsm_backup, name, FILENAME_SIZE);
+
+    int num_reads_table []= {10000, 100000, 1000000};
+    int num_config = 3;
+
+    double * hot_time_cache = (double *) malloc(num_config * sizeof(double));
+    double * uniform_time_cache = (double *) malloc(num_config * sizeof(double));
+    double * hot_time = (double *) malloc(num_config * sizeof(double));
+    double * uniform_time = (double *) malloc(num_config * sizeof(double));
+
+    // With the row cache
+    for (int i=0; i<num_config; i++){
+        hot_time_cache[i] = batch_reads(lsm_backup, num_reads_table[i], 0, 100);
+        uniform_time_cache[i] = batch_reads(lsm_backup, num_reads_table[i], 0, num_elements);
+    }
+    print_state(lsm_backup);
+
+    // Without the row cache
+    row_cache_release(lsm_backup->cache);
+    lsm_backup->cache = NULL;
+    for (int i=0; i<num_config; i++){
+        hot_time[i] = batch_reads(lsm_backup, num_reads_table[i], 0, 100);
+        uniform_time[i] = batch_reads(lsm_backup, num_reads_table[i], 0, num_elements);
+    }
+
+    printf("Number of reads: \n");
+    print_array_int(num_reads_table, num_config);
+    printf("Hot reads time with row cache: \n");
+    print_array_double(hot_time_cache, num_config);
+    printf("Hot reads time without row cache: \n");
+    print_array_double(hot_time, num_config);
+    printf("Uniform reads time with row cache: \n");
+    print_array_double(uniform_time_cache, num_config);
+    printf("Uniform reads time without row cache: \n");
+    print_array_double(uniform_time, num_config);
+
+    free_lsm(lsm_backup);
+}
@@ -0,0 +1,76 @@
+#include "LSMtree.h"
+
+// Checksums of the components (CRC32C)
+// Plots to display
+//     - throughput of the CRC (MB/s) with the SSE4.2 instruction and the table,
+//       for several block sizes
+// then batch reads of an lsm with and without the checksums of its components
+// verified.
+
+// Throughput in MB/s of the CRC of total bytes by blocks of block bytes
+double crc_throughput(char* data, size_t total, int block, int hardware){
+    uint32_t crc = 0;
+    clock_t begin = clock();
+    for (size_t offset=0; offset + block <= total; offset += block){
+        if (hardware) crc ^= crc32c(0, data + offset, block);
+        else crc ^= crc32c_software(0, data + offset, block);
+    }
+    double time_spent = (double)(clock() - begin) / CLOCKS_PER_SEC;
+    if (crc == 1) printf("\n"); // keep the loop
+    return (total / (1024.0 * 1024.0)) / time_spent;
+}
+
+int main(){
+    size_t total = 256*1024*1024;
+    char* data = (char *) malloc(total);
+    srand(time(NULL));
+    for (size_t i=0; i<total; i++) data[i] = rand();
+
+    int block_table[] = {64, 512, 4096, 65536};
+    int num_config = 4;
+    double * hardware_mbs = (double *) malloc(num_config * sizeof(double));
+    double * software_mbs = (double *) malloc(num_config * sizeof(double));
+    for (int c=0; c<num_config; c++){
+        hardware_mbs[c] = crc_throughput(data, total, block_table[c], 1);
+        software_mbs[c] = crc_throughput(data, total / 8, block_table[c], 0);
+    }
+    free(data);
+
+    printf("SSE4.2 CRC instruction: %s\n", crc32c_hardware_enabled() ? "yes" : "no");
+    printf("Block sizes: \n");
+    print_array_int(block_table, num_config);
+    printf("CRC throughput (MB/s): \n");
+    print_array_double(hardware_mbs, num_config);
+    printf("Table CRC throughput (MB/s): \n");
+    print_array_double(software_mbs, num_config);
+
+    // ------------------------ Batch reads of the lsm
+    int Nc = 7;
+    int value_size = 32;
+    int num_elements = 1000000;
+    int SIZE = 1000;
+    int Cs_size[] = {SIZE, 3*SIZE, 9*SIZE, 27*SIZE, 81*SIZE, 243*SIZE, 729*SIZE, 2187*SIZE,
+                     1000000*SIZE};
+    char name[] = "test";
+    LSMTree_generation(name, Nc, Cs_size, value_size, num_elements, 0);
+    LSM_tree *lsm_backup = (LSM_tree *)malloc(sizeof(LSM_tree));
+    read_lsm_from_disk(lsm_backup, name, FILENAME_SIZE);
+    print_state(lsm_backup);
+
+    // Row cache disabled: every read goes to the components (first batch
+    // without checksums, which also loads the files in the page cache)
+    int num_reads = 100000;
+    row_cache_release(lsm_backup->cache);
+    lsm_backup->cache = NULL;
+    block_checksums** checksums = lsm_backup->checksums;
+    lsm_backup->checksums = (block_checksums **) calloc(lsm_backup->Nc + 2,
+                                                        sizeof(block_checksums*));
+    double unverified_time = batch_reads(lsm_backup, num_reads, 0, num_elements);
+    free(lsm_backup->checksums);
+    lsm_backup->checksums = checksums;
+    double verified_time = batch_reads(lsm_backup, num_reads, 0, num_elements);
+    printf("Batch reads time with checksums verified: %f\n", verified_time);
+    printf("Batch reads time without checksums: %f\n", unverified_time);
+
+    free_lsm(lsm_backup);
+}
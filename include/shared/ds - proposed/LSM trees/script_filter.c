@@ -0,0 +1,105 @@
+#include "LSMtree.h"
+
+// Filters compared (bloom, cuckoo, xor) on num_keys keys
+// Plots to display
+//     - bits per key
+//     - false positive rate (keys absent)
+//     - probe time (keys present and absent)
+//     - false positive rate of the deletable filter after removing half of the keys
+// then batch reads of keys absent from an lsm with and without the filters of
+// its components.
+
+char* filter_names[] = {"none", "bloom", "cuckoo", "xor"};
+
+int main(){
+    int num_keys = 1000000;
+    int num_probes = 10000000;
+
+    // Sorted distinct keys (even numbers), the odd numbers are absent
+    int* keys = (int *) malloc(num_keys * sizeof(int));
+    for (int i=0; i<num_keys; i++) keys[i] = 2 * i;
+
+    int kinds[] = {FILTER_BLOOM, FILTER_CUCKOO, FILTER_XOR};
+    int num_config = 3;
+    double * bits_per_key = (double *) malloc(num_config * sizeof(double));
+    double * false_positives = (double *) malloc(num_config * sizeof(double));
+    double * probe_present = (double *) malloc(num_config * sizeof(double));
+    double * probe_absent = (double *) malloc(num_config * sizeof(double));
+
+    srand(time(NULL));
+    for (int c=0; c<num_config; c++){
+        filter* f = filter_build(kinds[c], keys, num_keys, num_keys);
+        bits_per_key[c] = 8.0 * filter_bytes(f) / num_keys;
+
+        clock_t begin = clock();
+        int found = 0;
+        for (int i=0; i<num_probes; i++) found += filter_check(f, keys[rand() % num_keys]);
+        probe_present[c] = (double)(clock() - begin) / CLOCKS_PER_SEC;
+        if (found != num_probes) printf("ERROR: %s filter misses %d keys\n",
+                                        filter_names[kinds[c]], num_probes - found);
+
+        begin = clock();
+        int positives = 0;
+        for (int i=0; i<num_probes; i++) positives += filter_check(f, 2 * (rand() % num_keys) + 1);
+        probe_absent[c] = (double)(clock() - begin) / CLOCKS_PER_SEC;
+        false_positives[c] = (double) positives / num_probes;
+        filter_free(f);
+    }
+
+    // Deletes in the cuckoo filter: the keys removed are not found anymore
+    filter* f = filter_build(FILTER_CUCKOO, keys, num_keys, num_keys);
+    for (int i=0; i<num_keys; i+=2) filter_remove(f, keys[i]);
+    int positives = 0;
+    int missed = 0;
+    for (int i=0; i<num_keys; i++){
+        if (i % 2 == 0) positives += filter_check(f, keys[i]);
+        else missed += !filter_check(f, keys[i]);
+    }
+    if (missed > 0) printf("ERROR: cuckoo filter misses %d keys after deletes\n", missed);
+    double removed_positives = (double) positives / (num_keys / 2);
+    filter_free(f);
+
+    printf("Filters: bloom, cuckoo, xor\n");
+    printf("Bits per key: \n");
+    print_array_double(bits_per_key, num_config);
+    printf("False positive rate: \n");
+    print_array_double(false_positives, num_config);
+    printf("Probe time of %d keys present: \n", num_probes);
+    print_array_double(probe_present, num_config);
+    printf("Probe time of %d keys absent: \n", num_probes);
+    print_array_double(probe_absent, num_config);
+    printf("Cuckoo filter, rate of removed keys still found: %f\n", removed_positives);
+    free(keys);
+
+    // ------------------------ Batch reads of keys absent from the lsm
+    int Nc = 7;
+    int value_size = 32;
+    int num_elements = 1000000;
+    int SIZE = 1000;
+    int Cs_size[] = {SIZE, 3*SIZE, 9*SIZE, 27*SIZE, 81*SIZE, 243*SIZE, 729*SIZE, 2187*SIZE,
+                     1000000*SIZE};
+    char name[] = "test";
+    LSMTree_generation(name, Nc, Cs_size, value_size, num_elements, 0);
+    LSM_tree *lsm_backup = (LSM_tree *)malloc(sizeof(LSM_tree));
+    read_lsm_from_disk(lsm_backup, name, FILENAME_SIZE);
+    print_state(lsm_backup);
+
+    // Keys absent, the filter of the keys disabled (saturated): only the
+    // filters of the components skip them
+    int num_reads = 100000;
+    filter* tree_filter = lsm_backup->tree_filter;
+    lsm_backup->tree_filter = filter_create(FILTER_BLOOM, 1);
+    lsm_backup->tree_filter->saturated = 1;
+    double filtered_time = batch_reads(lsm_backup, num_reads, num_elements, 2 * num_elements);
+    filter** filters = lsm_backup->filters;
+    lsm_backup->filters = (filter **) calloc(lsm_backup->Nc + 2, sizeof(filter*));
+    double unfiltered_time = batch_reads(lsm_backup, num_reads, num_elements, 2 * num_elements);
+    free(lsm_backup->filters);
+    lsm_backup->filters = filters;
+    filter_free(lsm_backup->tree_filter);
+    lsm_backup->tree_filter = tree_filter;
+    printf("Reads of absent keys with the filters of the components: %f\n", filtered_time);
+    printf("Reads of absent keys without filters: %f\n", unfiltered_time);
+
+    free_lsm(lsm_backup);
+}
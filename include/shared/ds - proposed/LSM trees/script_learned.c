@@ -0,0 +1,124 @@
+#include "LSMtree.h"
+
+// Searches in a disk component: binary search, fence pointers and learned index
+// Plots to display (time of the searches, size of the index)
+//     - on the largest component of a generated lsm (keys [0, num_elements[)
+//     - on sorted random keys with irregular gaps
+// for several error bounds of the learned index, then batch reads of the lsm
+// with and without the learned indexes.
+
+int fence_page = 1024;
+
+// Time of num_reads searches of random keys of the sorted keys[0..Ne-1]
+// method: 0 binary search, 1 fence pointers, 2 learned index
+double search_time(int* keys, int Ne, int num_reads, int method, int* fences, int Nfences,
+                   learned_index* model){
+    clock_t begin = clock();
+    int found = 0;
+    for (int i=0; i<num_reads; i++){
+        int key = keys[rand() % Ne];
+        int index;
+        if (method == 0) index = binary_search(keys, key, 0, Ne-1);
+        else if (method == 1) index = fence_search(fences, Nfences, keys, Ne, fence_page, key);
+        else index = learned_index_search(model, keys, key);
+        if (index != -1) found++;
+    }
+    if (found != num_reads) printf("ERROR: %d keys not found\n", num_reads - found);
+    return (double)(clock() - begin) / CLOCKS_PER_SEC;
+}
+
+void compare(int* keys, int Ne, int num_reads){
+    int epsilon_table[] = {4, 16, 64, 256};
+    int num_config = 4;
+    double * learned_time = (double *) malloc(num_config * sizeof(double));
+    int * segments = (int *) malloc(num_config * sizeof(int));
+
+    int Nfences;
+    int* fences = fence_build(keys, Ne, fence_page, &Nfences);
+    double binary_time = search_time(keys, Ne, num_reads, 0, NULL, 0, NULL);
+    double fence_time = search_time(keys, Ne, num_reads, 1, fences, Nfences, NULL);
+    for (int c=0; c<num_config; c++){
+        learned_index* model = learned_index_build(keys, Ne, epsilon_table[c]);
+        segments[c] = model->Nsegments;
+        learned_time[c] = search_time(keys, Ne, num_reads, 2, NULL, 0, model);
+        learned_index_free(model);
+    }
+
+    printf("Binary search time: %f\n", binary_time);
+    printf("Fence pointers time: %f (%d fences, %zu bytes)\n", fence_time, Nfences,
+           Nfences * sizeof(int));
+    printf("Error bounds: \n");
+    print_array_int(epsilon_table, num_config);
+    printf("Learned index time: \n");
+    print_array_double(learned_time, num_config);
+    printf("Learned index segments (%zu bytes each): \n", sizeof(segment));
+    print_array_int(segments, num_config);
+    free(fences);
+    free(learned_time);
+    free(segments);
+}
+
+int main(){
+    // LSMT parameters
+    int Nc = 7;
+    int value_size = 32;
+    int num_elements = 1000000;
+    int num_reads = 10000000;
+
+    // ------------------------ LSM Tree STRUCTURE
+    int SIZE = 1000;
+    int Cs_size[] = {SIZE, 3*SIZE, 9*SIZE, 27*SIZE, 81*SIZE, 243*SIZE, 729*SIZE, 2187*SIZE,
+                     1000000*SIZE};
+    char name[] = "test";
+
+    LSMTree_generation(name, Nc, Cs_size, value_size, num_elements, 0);
+    printf("Reading LSM from disk:\n");
+    LSM_tree *lsm_backup = (LSM_tree *)malloc(sizeof(LSM_tree));
+    read_lsm_from_disk(lsm_backup, name, FILENAME_SIZE);
+
+    // Largest disk component
+    int largest = 2;
+    for (int j=2; j<lsm_backup->Nc+2; j++){
+        if (lsm_backup->Cs_Ne[j] > lsm_backup->Cs_Ne[largest]) largest = j;
+    }
+    int Ne = lsm_backup->Cs_Ne[largest];
+    component* C = (component *) malloc(sizeof(component));
+    char component_id[16];
+    sprintf(component_id, "C%d", largest - 1);
+    read_disk_component(C, name, lsm_backup->Cs_Ne + largest, component_id, &Ne, value_size,
+                        FILENAME_SIZE);
+    printf("Component C%d (%d keys): \n", largest - 1, Ne);
+    srand(time(NULL));
+    compare(C->keys, Ne, num_reads);
+    free_component(C);
+
+    // Sorted random keys: gaps drawn from a heavy tailed distribution
+    int* keys = (int *) malloc(num_elements * sizeof(int));
+    int key = 0;
+    for (int i=0; i<num_elements; i++){
+        double u = (rand() + 1.0) / ((double) RAND_MAX + 2.0);
+        // Reduce the gap before the cast: 1/u^2 may exceed INT_MAX
+        double gap = 1.0 / (u * u);
+        key += 1 + (int) fmod(gap, 1000.0);
+        keys[i] = key;
+    }
+    for (int i=1; i<num_elements; i++) assert(keys[i-1] < keys[i]);
+    printf("Random keys (%d keys): \n", num_elements);
+    compare(keys, num_elements, num_reads);
+    free(keys);
+
+    // Batch reads of the lsm
+    int num_batch = 1000000;
+    row_cache_release(lsm_backup->cache);
+    lsm_backup->cache = NULL;
+    double learned_reads = batch_reads(lsm_backup, num_batch, 0, num_elements);
+    learned_index** models = lsm_backup->models;
+    lsm_backup->models = (learned_index **) calloc(lsm_backup->Nc + 2, sizeof(learned_index*));
+    double binary_reads = batch_reads(lsm_backup, num_batch, 0, num_elements);
+    free(lsm_backup->models);
+    lsm_backup->models = models;
+    printf("Batch reads time with learned indexes: %f\n", learned_reads);
+    printf("Batch reads time with binary search: %f\n", binary_reads);
+
+    free_lsm(lsm_backup);
+}
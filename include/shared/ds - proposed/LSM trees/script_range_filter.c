@@ -0,0 +1,68 @@
+#include "LSMtree.h"
+
+// Short range scans with and without the range filters of the disk components
+// Plot to display (time of num_scans scans of each width)
+//     - scans of width 1 to 1000 keys
+
+// Time of num_scans scans of width keys at random positions in [0, key_up[
+double batch_scans(LSM_tree *lsm, int num_scans, int width, int key_up){
+    int* keys = (int *) malloc(width * sizeof(int));
+    char* values = (char *) malloc(width * lsm->value_size * sizeof(char));
+    clock_t begin = clock();
+    for (int i=0; i<num_scans; i++){
+        int low = rand() % key_up;
+        scan_lsm(lsm, low, low + width - 1, keys, values, width, SEQ_MAX);
+    }
+    double time_spent = (double)(clock() - begin) / CLOCKS_PER_SEC;
+    free(keys);
+    free(values);
+    return time_spent;
+}
+
+int main(){
+    // LSMT parameters
+    int Nc = 7;
+    int value_size = 32;
+    int num_elements = 1000000;
+    int num_scans = 10000;
+
+    // ------------------------ LSM Tree STRUCTURE
+    int SIZE = 1000;
+    int Cs_size[] = {SIZE, 3*SIZE, 9*SIZE, 27*SIZE, 81*SIZE, 243*SIZE, 729*SIZE, 2187*SIZE,
+                     1000000*SIZE};
+    char name[] = "test";
+
+    LSMTree_generation(name, Nc, Cs_size, value_size, num_elements, 0);
+    printf("Reading LSM from disk:\n");
+    LSM_tree *lsm_backup = (LSM_tree *)malloc(sizeof(LSM_tree));
+    read_lsm_from_disk(lsm_backup, name, FILENAME_SIZE);
+    print_state(lsm_backup);
+
+    int width_table[] = {1, 10, 100, 1000};
+    int num_config = 4;
+    double * filtered_time = (double *) malloc(num_config * sizeof(double));
+    double * scan_time = (double *) malloc(num_config * sizeof(double));
+
+    srand(time(NULL));
+    for (int c=0; c<num_config; c++){
+        filtered_time[c] = batch_scans(lsm_backup, num_scans, width_table[c], num_elements);
+    }
+    // Without range filters
+    range_filter** range_filters = lsm_backup->range_filters;
+    lsm_backup->range_filters = (range_filter **) calloc(lsm_backup->Nc + 2,
+                                                         sizeof(range_filter*));
+    for (int c=0; c<num_config; c++){
+        scan_time[c] = batch_scans(lsm_backup, num_scans, width_table[c], num_elements);
+    }
+    free(lsm_backup->range_filters);
+    lsm_backup->range_filters = range_filters;
+
+    printf("Scan widths: \n");
+    print_array_int(width_table, num_config);
+    printf("Scans time with range filters: \n");
+    print_array_double(filtered_time, num_config);
+    printf("Scans time without range filters: \n");
+    print_array_double(scan_time, num_config);
+
+    free_lsm(lsm_backup);
+}
@@ -0,0 +1,81 @@
+#include "LSMtree.h"
+
+// Scaling of the sharded lsm with the number of shards (one worker thread each)
+// Plots to display (throughput will be displayed)
+//     - generation (inserts of random keys), wall clock time
+//     - batch multigets
+//     - one scan
+
+// Wall clock time in seconds (clock() sums the time of all the threads)
+double wall_time(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+int main(){
+    // LSMT parameters (per shard)
+    int Nc = 7;
+    int num_elements = 1000000;
+    int num_reads = 10000;
+    int value_size = 32;
+    int SIZE = 1000;
+    int Cs_size[] = {SIZE, 3*SIZE, 9*SIZE, 27*SIZE, 81*SIZE, 243*SIZE, 729*SIZE, 2187*SIZE,
+                     1000000*SIZE};
+    char name[] = "test";
+
+    int shards_table[] = {1, 2, 4, 8};
+    int num_config = 4;
+
+    double * generation_time = (double *) malloc(num_config * sizeof(double));
+    double * multiget_time = (double *) malloc(num_config * sizeof(double));
+    double * scan_time = (double *) malloc(num_config * sizeof(double));
+
+    char* value = (char*) malloc(value_size * sizeof(char));
+    int* keys = (int*) malloc(num_reads * sizeof(int));
+    int* found = (int*) malloc(num_reads * sizeof(int));
+    char* values = (char*) malloc(num_reads * value_size * sizeof(char));
+    for (int c=0; c<num_config; c++){
+        printf("config = '%d shards'\n", shards_table[c]);
+        sharded_lsm *slsm = (sharded_lsm *) malloc(sizeof(sharded_lsm));
+        build_sharded_lsm(slsm, name, shards_table[c], SHARD_HASH, 0, num_elements - 1, Nc,
+                          Cs_size, value_size, 32);
+
+        // Generation: random keys, value 'aa..aa_{key%10000}'
+        double begin = wall_time();
+        for (int i=0; i<value_size - 7; i++) value[i] = 'a';
+        for (int i=0; i<num_elements; i++){
+            int key = rand() % num_elements;
+            sprintf(value + value_size - 7, "_%d", key%10000);
+            insert_sharded(slsm, key, value);
+        }
+        sync_sharded(slsm);
+        generation_time[c] = wall_time() - begin;
+
+        // Multigets of random keys
+        for (int i=0; i<num_reads; i++) keys[i] = rand() % num_elements;
+        begin = wall_time();
+        multiget_sharded(slsm, keys, num_reads, values, found);
+        multiget_time[c] = wall_time() - begin;
+
+        // Scan of 1000 keys
+        begin = wall_time();
+        scan_sharded(slsm, 0, 999, keys, values, num_reads);
+        scan_time[c] = wall_time() - begin;
+
+        free_sharded_lsm(slsm);
+    }
+    free(value);
+    free(keys);
+    free(found);
+    free(values);
+
+    printf("Number of shards: \n");
+    print_array_int(shards_table, num_config);
+    printf("Generation time: \n");
+    print_array_double(generation_time, num_config);
+    printf("Multiget time: \n");
+    print_array_double(multiget_time, num_config);
+    printf("Scan time: \n");
+    print_array_double(scan_time, num_config);
+}
@@ -0,0 +1,422 @@
+#include "LSMTree.h"
+
+// Shared-nothing sharded lsm: the keys are hash or range partitioned between
+// Nshards independent lsm (own C0, merges and folder name/shardI). Each shard
+// is owned by one worker thread which executes the requests of its queue in
+// order, so writes to different shards run (and merge) in parallel.
+// Writes are asynchronous; reads, multigets and scans wait for their results.
+
+// Operations of the requests
+#define SHARD_INSERT 0
+#define SHARD_UPDATE 1
+#define SHARD_DELETE 2
+#define SHARD_DELETE_RANGE 3
+#define SHARD_READ 4
+#define SHARD_SCAN 5
+#define SHARD_SYNC 6
+#define SHARD_STOP 7
+
+// Save the partitioning of the sharded lsm in name/shards.data
+static void write_sharded_meta(sharded_lsm *slsm){
+    char *filename = (char*) calloc(strlen(slsm->name) + 16, sizeof(char));
+    sprintf(filename,"%s/shards.data", slsm->name);
+    FILE* fout = fopen(filename, "wb");
+    if (fout == NULL){
+        perror("fopen");
+        free(filename);
+        return;
+    }
+    fwrite(&slsm->Nshards, sizeof(int), 1, fout);
+    fwrite(&slsm->partition, sizeof(int), 1, fout);
+    fwrite(&slsm->key_low, sizeof(int), 1, fout);
+    fwrite(&slsm->key_high, sizeof(int), 1, fout);
+    fwrite(&slsm->value_size, sizeof(int), 1, fout);
+    fclose(fout);
+    free(filename);
+}
+
+// The shards use the row cache of the first one (their keys are disjoint)
+static void share_row_cache(sharded_lsm *slsm){
+    row_cache* cache = slsm->shards[0].lsm->cache;
+    if (cache == NULL) return;
+    for (int i=1; i<slsm->Nshards; i++){
+        row_cache_release(slsm->shards[i].lsm->cache);
+        slsm->shards[i].lsm->cache = cache;
+        row_cache_share(cache);
+    }
+}
+
+// Init the queues of the shards and start their workers
+static void start_shards(sharded_lsm *slsm){
+    for (int i=0; i<slsm->Nshards; i++){
+        shard* s = slsm->shards + i;
+        pthread_mutex_init(&s->lock, NULL);
+        pthread_cond_init(&s->not_empty, NULL);
+        pthread_cond_init(&s->not_full, NULL);
+        s->head = NULL;
+        s->tail = NULL;
+        s->Nq = 0;
+        if (pthread_create(&s->worker, NULL, shard_worker, (void *) s) != 0){
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+}
+
+// Build a sharded lsm in folder name (which must exist) with Nshards lsm of
+// the same structure (Nc, Cs_size, value_size). filename_size bounds the name
+// of a shard (name/shardI).
+// With SHARD_RANGE, [key_low, key_high] is split in Nshards equal ranges.
+void build_sharded_lsm(sharded_lsm *slsm, char* name, int Nshards, int partition, int key_low,
+                       int key_high, int Nc, int* Cs_size, int value_size, int filename_size){
+    // Check if folder exists
+    if (access(name, F_OK) == -1){
+        printf("ERROR: folder name %s not present\n", name);
+        exit(1);
+    }
+    slsm->name = (char*) calloc(strlen(name) + 1, sizeof(char));
+    strcpy(slsm->name, name);
+    slsm->Nshards = Nshards;
+    slsm->partition = partition;
+    slsm->key_low = key_low;
+    slsm->key_high = key_high;
+    slsm->value_size = value_size;
+    slsm->shards = (shard *) malloc(Nshards * sizeof(shard));
+
+    char* shard_name = (char*) calloc(filename_size + 8, sizeof(char));
+    for (int i=0; i<Nshards; i++){
+        sprintf(shard_name, "%s/shard%d", name, i);
+        // Room for the names of the component files: name/kbuffer.data
+        if ((int) strlen(shard_name) + 6 > filename_size){
+            printf("ERROR: shard name %s too long for filename_size %d\n", shard_name,
+                   filename_size);
+            exit(1);
+        }
+        mkdir(shard_name, 0755);
+        slsm->shards[i].lsm = (LSM_tree *) malloc(sizeof(LSM_tree));
+        build_lsm(slsm->shards[i].lsm, shard_name, Nc, Cs_size, value_size, filename_size);
+    }
+    free(shard_name);
+    write_sharded_meta(slsm);
+    share_row_cache(slsm);
+    start_shards(slsm);
+}
+
+// Read a sharded lsm from disk in its folder name
+void read_sharded_lsm_from_disk(sharded_lsm *slsm, char* name, int filename_size){
+    char *filename = (char*) calloc(strlen(name) + 16, sizeof(char));
+    sprintf(filename,"%s/shards.data", name);
+    FILE* fin = fopen(filename, "rb");
+    if (fin == NULL){
+        printf("ERROR: no sharded lsm in folder %s\n", name);
+        exit(1);
+    }
+    fread(&slsm->Nshards, sizeof(int), 1, fin);
+    fread(&slsm->partition, sizeof(int), 1, fin);
+    fread(&slsm->key_low, sizeof(int), 1, fin);
+    fread(&slsm->key_high, sizeof(int), 1, fin);
+    fread(&slsm->value_size, sizeof(int), 1, fin);
+    fclose(fin);
+    free(filename);
+
+    slsm->name = (char*) calloc(strlen(name) + 1, sizeof(char));
+    strcpy(slsm->name, name);
+    slsm->shards = (shard *) malloc(slsm->Nshards * sizeof(shard));
+    char* shard_name = (char*) calloc(filename_size + 8, sizeof(char));
+    for (int i=0; i<slsm->Nshards; i++){
+        sprintf(shard_name, "%s/shard%d", name, i);
+        slsm->shards[i].lsm = (LSM_tree *) malloc(sizeof(LSM_tree));
+        read_lsm_from_disk(slsm->shards[i].lsm, shard_name, filename_size);
+    }
+    free(shard_name);
+    share_row_cache(slsm);
+    start_shards(slsm);
+}
+
+// Stop the workers once their queues are drained, save the shards to disk
+// and free the sharded lsm
+void free_sharded_lsm(sharded_lsm *slsm){
+    for (int i=0; i<slsm->Nshards; i++){
+        shard_request* request = (shard_request *) calloc(1, sizeof(shard_request));
+        request->op = SHARD_STOP;
+        shard_submit(slsm->shards + i, request);
+    }
+    for (int i=0; i<slsm->Nshards; i++){
+        shard* s = slsm->shards + i;
+        pthread_join(s->worker, NULL);
+        write_lsm_to_disk(s->lsm);
+        free_lsm(s->lsm);
+        pthread_mutex_destroy(&s->lock);
+        pthread_cond_destroy(&s->not_empty);
+        pthread_cond_destroy(&s->not_full);
+    }
+    free(slsm->shards);
+    free(slsm->name);
+    free(slsm);
+}
+
+// Index of the shard storing key
+int shard_of(sharded_lsm *slsm, int key){
+    if (slsm->partition == SHARD_RANGE){
+        if (key <= slsm->key_low) return 0;
+        if (key >= slsm->key_high) return slsm->Nshards - 1;
+        int64_t width = (int64_t) slsm->key_high - slsm->key_low + 1;
+        return (int) (((int64_t) key - slsm->key_low) * slsm->Nshards / width);
+    }
+    // Multiplicative hash, then mapped to [0, Nshards[
+    uint32_t h = (uint32_t) key * 2654435761u;
+    return (int) (((uint64_t) h * slsm->Nshards) >> 32);
+}
+
+// Shards which may store keys in [low, high]: [*first, *last]
+static void shards_of_range(sharded_lsm *slsm, int low, int high, int* first, int* last){
+    if (slsm->partition == SHARD_RANGE){
+        *first = shard_of(slsm, low);
+        *last = shard_of(slsm, high);
+    }
+    else{
+        *first = 0;
+        *last = slsm->Nshards - 1;
+    }
+}
+
+// Append a request to the queue of shard s (wait while the queue is full)
+void shard_submit(shard* s, shard_request* request){
+    request->next = NULL;
+    pthread_mutex_lock(&s->lock);
+    while (s->Nq >= SHARD_QUEUE_SIZE) pthread_cond_wait(&s->not_full, &s->lock);
+    if (s->tail == NULL) s->head = request;
+    else s->tail->next = request;
+    s->tail = request;
+    s->Nq++;
+    pthread_cond_signal(&s->not_empty);
+    pthread_mutex_unlock(&s->lock);
+}
+
+// Signal the completion of a request to its waiter, or free it
+static void shard_complete(shard_request* request){
+    shard_waiter* waiter = request->waiter;
+    if (waiter == NULL){
+        free(request->value);
+        free(request);
+        return;
+    }
+    pthread_mutex_lock(&waiter->lock);
+    waiter->pending--;
+    if (waiter->pending == 0) pthread_cond_broadcast(&waiter->done);
+    pthread_mutex_unlock(&waiter->lock);
+}
+
+// Worker of a shard: takes all the pending requests of its queue at once and
+// executes them in order on its lsm (merges included), until SHARD_STOP
+void *shard_worker(void *argument){
+    shard* s = (shard*) argument;
+    int stop = 0;
+    while (!stop){
+        pthread_mutex_lock(&s->lock);
+        while (s->head == NULL) pthread_cond_wait(&s->not_empty, &s->lock);
+        shard_request* request = s->head;
+        s->head = NULL;
+        s->tail = NULL;
+        s->Nq = 0;
+        pthread_cond_broadcast(&s->not_full);
+        pthread_mutex_unlock(&s->lock);
+
+        while (request != NULL){
+            shard_request* next = request->next;
+            switch (request->op){
+                case SHARD_INSERT:
+                    insert_lsm(s->lsm, request->key, request->value);
+                    break;
+                case SHARD_UPDATE:
+                    update_lsm(s->lsm, request->key, request->value);
+                    break;
+                case SHARD_DELETE:
+                    delete_lsm(s->lsm, request->key);
+                    break;
+                case SHARD_DELETE_RANGE:
+                    delete_range_lsm(s->lsm, request->key, request->high);
+                    break;
+                case SHARD_READ:
+                    request->result = read_lsm(s->lsm, request->key, request->value);
+                    break;
+                case SHARD_SCAN:
+                    request->result = scan_lsm(s->lsm, request->key, request->high,
+                                               request->keys, request->values,
+                                               request->max_elements, SEQ_MAX);
+                    break;
+                case SHARD_STOP:
+                    stop = 1;
+                    break;
+            }
+            shard_complete(request);
+            request = next;
+        }
+    }
+    return NULL;
+}
+
+// Submit an asynchronous write to the shard of key
+static void submit_write(sharded_lsm *slsm, int op, int key, int high, char *value){
+    // Backpressure while the merges in progress use more than the memory budget
+    memory_throttle(memory_governor_get());
+    shard_request* request = (shard_request *) calloc(1, sizeof(shard_request));
+    request->op = op;
+    request->key = key;
+    request->high = high;
+    if (value != NULL){
+        request->value = (char *) malloc(slsm->value_size * sizeof(char));
+        strcpy(request->value, value);
+    }
+    shard_submit(slsm->shards + shard_of(slsm, key), request);
+}
+
+static void waiter_init(shard_waiter* waiter, int pending){
+    pthread_mutex_init(&waiter->lock, NULL);
+    pthread_cond_init(&waiter->done, NULL);
+    waiter->pending = pending;
+}
+
+// Wait for all the requests of waiter, then destroy it
+static void waiter_wait(shard_waiter* waiter){
+    pthread_mutex_lock(&waiter->lock);
+    while (waiter->pending > 0) pthread_cond_wait(&waiter->done, &waiter->lock);
+    pthread_mutex_unlock(&waiter->lock);
+    pthread_mutex_destroy(&waiter->lock);
+    pthread_cond_destroy(&waiter->done);
+}
+
+// Insert (key, value): returns once queued in the shard of key
+void insert_sharded(sharded_lsm *slsm, int key, char *value){
+    submit_write(slsm, SHARD_INSERT, key, key, value);
+}
+
+// Update (key, value): returns once queued in the shard of key
+void update_sharded(sharded_lsm *slsm, int key, char *value){
+    submit_write(slsm, SHARD_UPDATE, key, key, value);
+}
+
+// Delete key: returns once queued in the shard of key
+void delete_sharded(sharded_lsm *slsm, int key){
+    submit_write(slsm, SHARD_DELETE, key, key, NULL);
+}
+
+// Delete the keys in [low, high]: one range tombstone per shard concerned
+void delete_range_sharded(sharded_lsm *slsm, int low, int high){
+    int first, last;
+    shards_of_range(slsm, low, high, &first, &last);
+    memory_throttle(memory_governor_get());
+    for (int i=first; i<=last; i++){
+        shard_request* request = (shard_request *) calloc(1, sizeof(shard_request));
+        request->op = SHARD_DELETE_RANGE;
+        request->key = low;
+        request->high = high;
+        shard_submit(slsm->shards + i, request);
+    }
+}
+
+// Read value of key (sees all the writes submitted before)
+// return -1 if value not present, else 1 with value set
+int read_sharded(sharded_lsm *slsm, int key, char* value){
+    int found;
+    multiget_sharded(slsm, &key, 1, value, &found);
+    return found;
+}
+
+// Read the n keys in parallel on their shards: the value of keys[i] is set in
+// values + i*value_size and found[i] to 1 if present, else -1.
+// Return the number of keys found.
+int multiget_sharded(sharded_lsm *slsm, int* keys, int n, char* values, int* found){
+    shard_request* requests = (shard_request *) calloc(n, sizeof(shard_request));
+    shard_waiter waiter;
+    waiter_init(&waiter, n);
+    for (int i=0; i<n; i++){
+        requests[i].op = SHARD_READ;
+        requests[i].key = keys[i];
+        requests[i].value = values + i*slsm->value_size;
+        requests[i].waiter = &waiter;
+        shard_submit(slsm->shards + shard_of(slsm, keys[i]), requests + i);
+    }
+    waiter_wait(&waiter);
+    int count = 0;
+    for (int i=0; i<n; i++){
+        found[i] = requests[i].result;
+        if (found[i] == 1) count++;
+    }
+    free(requests);
+    return count;
+}
+
+// Range scan of the keys in [low, high] on all the shards concerned in
+// parallel: their sorted results are merged and the first max_elements live
+// keys are written in increasing order to keys (values to values).
+// Return the number of keys.
+int scan_sharded(sharded_lsm *slsm, int low, int high, int* keys, char* values,
+                 int max_elements){
+    int first, last;
+    shards_of_range(slsm, low, high, &first, &last);
+    int n = last - first + 1;
+    shard_request* requests = (shard_request *) calloc(n, sizeof(shard_request));
+    shard_waiter waiter;
+    waiter_init(&waiter, n);
+    for (int i=0; i<n; i++){
+        requests[i].op = SHARD_SCAN;
+        requests[i].key = low;
+        requests[i].high = high;
+        requests[i].max_elements = max_elements;
+        requests[i].keys = (int *) malloc(max_elements * sizeof(int));
+        requests[i].values = (char *) malloc(max_elements * slsm->value_size * sizeof(char));
+        requests[i].waiter = &waiter;
+        shard_submit(slsm->shards + first + i, requests + i);
+    }
+    waiter_wait(&waiter);
+
+    // Merge of the results (the shards store disjoint keys)
+    int* heads = (int *) calloc(n, sizeof(int));
+    int count = 0;
+    while (count < max_elements){
+        int best = -1;
+        for (int i=0; i<n; i++){
+            if ((heads[i] < requests[i].result) && ((best == -1) ||
+                (requests[i].keys[heads[i]] < requests[best].keys[heads[best]]))) best = i;
+        }
+        if (best == -1) break;
+        keys[count] = requests[best].keys[heads[best]];
+        strcpy(values + count*slsm->value_size,
+               requests[best].values + heads[best]*slsm->value_size);
+        heads[best]++;
+        count++;
+    }
+    for (int i=0; i<n; i++){
+        free(requests[i].keys);
+        free(requests[i].values);
+    }
+    free(heads);
+    free(requests);
+    return count;
+}
+
+// Wait until all the requests submitted before are executed
+void sync_sharded(sharded_lsm *slsm){
+    shard_request* requests = (shard_request *) calloc(slsm->Nshards, sizeof(shard_request));
+    shard_waiter waiter;
+    waiter_init(&waiter, slsm->Nshards);
+    for (int i=0; i<slsm->Nshards; i++){
+        requests[i].op = SHARD_SYNC;
+        requests[i].waiter = &waiter;
+        shard_submit(slsm->shards + i, requests + i);
+    }
+    waiter_wait(&waiter);
+    free(requests);
+}
+
+// Print number of element in each shard (after the pending requests)
+void print_sharded_state(sharded_lsm *slsm){
+    sync_sharded(slsm);
+    int Ne = 0;
+    for (int i=0; i<slsm->Nshards; i++) Ne += slsm->shards[i].lsm->Ne;
+    printf("State of the sharded lsm: %s (%d shards, %s partitioning)\n", slsm->name,
+           slsm->Nshards, (slsm->partition == SHARD_RANGE) ? "range" : "hash");
+    printf("Number of elements in sharded lsm: %d\n", Ne);
+    for (int i=0; i<slsm->Nshards; i++) print_state(slsm->shards[i].lsm);
+}
@@ -4,10 +4,23 @@
 #include <stdint.h>
 #include <time.h>
 #include <assert.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
 
 #include "skiplist.h"
+#include "skiplist_lf.h"
+#include "skiplist_slab.h"
+#include "skiplist_typed.h"
+#include "skiplist_mmap.h"
+#include "test_alloc.h"
 
 #include <sys/time.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#endif
 
 typedef struct skiplist skiplist;
 
@@ -47,6 +60,34 @@ static int intptr_cmp(void *v1, void *v2) {
     return a < b ? -1 : a > b ? 1 : 0;
 }
 
+SKIPLIST_TYPED(intmap, intptr_t, intptr_t, SKIPLIST_CMP_NUM)
+SKIPLIST_TYPED_COMPACT(cintmap, intptr_t, intptr_t, SKIPLIST_CMP_NUM)
+
+/* Keys as fixed-size strings, inline in the nodes. */
+struct key16 {
+    char s[16];
+};
+#define KEY16_CMP(a, b) memcmp((a).s, (b).s, sizeof((a).s))
+SKIPLIST_TYPED(strmap, struct key16, intptr_t, KEY16_CMP)
+
+static int key16_cmp(void *v1, void *v2) {
+    return memcmp(v1, v2, sizeof(struct key16));
+}
+
+/* malloc & free, counting the calls. */
+static size_t alloc_calls = 0;
+
+static void *counted_alloc(void *p, size_t osize, size_t nsize, void *udata) {
+    (void)osize;
+    (void)udata;
+    alloc_calls++;
+    if (p) {
+        free(p);
+        return NULL;
+    }
+    return malloc(nsize);
+}
+
 /* Measure insertions. */
 static void ins(void) {
     skiplist *sl = skiplist_new(intptr_cmp, NULL, NULL);
@@ -61,6 +102,106 @@ static void ins(void) {
     skiplist_free(sl, NULL, NULL);
 }
 
+#if SKIPLIST_KEY_PREFIX
+static int str_cmp(void *v1, void *v2) {
+    return strcmp((const char *) v1, (const char *) v2);
+}
+
+/* Measure random insertions then lookups of separately allocated
+ * string keys, without and with their prefixes in the nodes.
+ * Build with -DSKIPLIST_KEY_PREFIX=1. */
+static void ins_and_get_str_prefix(void) {
+    char **keys = malloc(lim * sizeof(char *));
+    assert(keys);
+    for (intptr_t i=0; i < lim; i++) {
+        keys[i] = malloc(20);
+        assert(keys[i]);
+        unsigned h = (unsigned) (i * 2654435761u);
+        snprintf(keys[i], 20, "%08x%08x", h, (unsigned) i);
+    }
+
+    for (int with_prefix = 0; with_prefix < 2; with_prefix++) {
+        skiplist *sl = skiplist_new(str_cmp, NULL, NULL);
+        if (with_prefix) { skiplist_set_prefix(sl, skiplist_prefix_str); }
+
+        TIME(pre);
+        for (intptr_t i=0; i < lim; i++) {
+            skiplist_add(sl, keys[i], (void *) i);
+        }
+        for (intptr_t i=0; i < lim; i++) {
+            intptr_t k = (i * largeish_prime) % lim;
+            bool found = skiplist_member(sl, keys[k]);
+            assert(found);
+            (void) found;
+        }
+        TIME(post);
+
+        CMP_TIME(with_prefix ? "ins_and_get/str/prefix"
+            : "ins_and_get/str/no_prefix", pre, post);
+        skiplist_free(sl, NULL, NULL);
+    }
+    for (intptr_t i=0; i < lim; i++) { free(keys[i]); }
+    free(keys);
+}
+#endif
+
+/* Measure building a skiplist from sorted keys at once. */
+static void build_sorted(void) {
+    skiplist *sl = skiplist_new(intptr_cmp, NULL, NULL);
+    void **keys = malloc(lim * sizeof(void *));
+    assert(keys);
+    for (intptr_t i=0; i < lim; i++) { keys[i] = (void *) i; }
+
+    TIME(pre);
+    skiplist_build_sorted(sl, keys, keys, lim);
+    TIME(post);
+
+    TDIFF();
+    skiplist_free(sl, NULL, NULL);
+    free(keys);
+}
+
+/* Fill A with the even keys below lim and B with the odd ones. */
+static void fill_interleaved(skiplist *a, skiplist *b) {
+    for (intptr_t i=0; i < lim / 2; i++) {
+        skiplist_add(a, (void *) (2 * i), NULL);
+        skiplist_add(b, (void *) (2 * i + 1), NULL);
+    }
+}
+
+/* Measure merging two interleaved lists, then splitting the result
+ * in half, against moving each pair over one at a time. */
+static void merge_and_split(void) {
+    skiplist *a = skiplist_new(intptr_cmp, NULL, NULL);
+    skiplist *b = skiplist_new(intptr_cmp, NULL, NULL);
+    fill_interleaved(a, b);
+
+    TIME(pre);
+    void *k = NULL;
+    while (skiplist_pop_first(b, &k, NULL)) { skiplist_add(a, k, NULL); }
+    while (skiplist_pop_last(a, &k, NULL)) {
+        skiplist_add(b, k, NULL);
+        if (skiplist_count(b) == skiplist_count(a)) { break; }
+    }
+    TIME(post);
+    CMP_TIME("merge_and_split/pairwise", pre, post);
+
+    skiplist_clear(a, NULL, NULL);
+    skiplist_clear(b, NULL, NULL);
+    fill_interleaved(a, b);
+
+    TIME(pre2);
+    skiplist_merge(a, b);
+    skiplist *hi = skiplist_split_at(a, (void *) (lim / 2));
+    TIME(post2);
+    CMP_TIME("merge_and_split", pre2, post2);
+    assert(hi && skiplist_count(hi) + skiplist_count(a) == (size_t) lim / 2 * 2);
+
+    skiplist_free(hi, NULL, NULL);
+    skiplist_free(a, NULL, NULL);
+    skiplist_free(b, NULL, NULL);
+}
+
 /* Measure getting existing values (successful lookup). */
 static void get(void) {
     skiplist *sl = skiplist_new(intptr_cmp, NULL, NULL);
@@ -127,6 +268,69 @@ static void ins_and_get(void) {
     skiplist_free(sl, NULL, NULL);
 }
 
+/* Fill KEYS with batch number B of a clustered workload: BATCH
+ * odd keys, out of order, from a window of 8 * BATCH keys. */
+#define BATCH 256
+static void clustered_batch(intptr_t b, void **keys) {
+    intptr_t start = 2 * ((b * largeish_prime * BATCH) % lim);
+    for (intptr_t j=0; j < BATCH; j++) {
+        keys[j] = (void *) (start + 8 * ((j * 37) % BATCH) + 1);
+    }
+}
+
+/* Measure clustered adds then gets, one at a time and in batches
+ * with skiplist_add_batch and skiplist_get_batch. */
+static void clustered_batches(void) {
+    skiplist *sl1 = skiplist_new(intptr_cmp, NULL, NULL);
+    skiplist *sl2 = skiplist_new(intptr_cmp, NULL, NULL);
+    for (intptr_t i=0; i < lim; i++) {
+        skiplist_add(sl1, (void *) (2 * i), (void *) i);
+        skiplist_add(sl2, (void *) (2 * i), (void *) i);
+    }
+    void *keys[BATCH], *values[BATCH];
+
+    TIME(pre);
+    for (intptr_t b=0; b < lim / BATCH; b++) {
+        clustered_batch(b, keys);
+        for (intptr_t j=0; j < BATCH; j++) {
+            skiplist_add(sl1, keys[j], keys[j]);
+        }
+    }
+    TIME(mid);
+    for (intptr_t b=0; b < lim / BATCH; b++) {
+        clustered_batch(b, keys);
+        skiplist_add_batch(sl2, keys, keys, BATCH);
+    }
+    TIME(post);
+    CMP_TIME("clustered_add", pre, mid);
+    CMP_TIME("clustered_add_batch", mid, post);
+
+    TIME(pre_get);
+    intptr_t total = 0;
+    for (intptr_t b=0; b < lim / BATCH; b++) {
+        clustered_batch(b, keys);
+        for (intptr_t j=0; j < BATCH; j++) {
+            void *v = NULL;
+            skiplist_get(sl1, keys[j], &v);
+            total += (intptr_t) v;
+        }
+    }
+    TIME(mid_get);
+    for (intptr_t b=0; b < lim / BATCH; b++) {
+        clustered_batch(b, keys);
+        skiplist_get_batch(sl2, keys, values, BATCH);
+        for (intptr_t j=0; j < BATCH; j++) { total -= (intptr_t) values[j]; }
+    }
+    TIME(post_get);
+    assert(total == 0);
+    if (0) { fprintf(stderr, "total: %ld\n", (long) total); }
+    CMP_TIME("clustered_get", pre_get, mid_get);
+    CMP_TIME("clustered_get_batch", mid_get, post_get);
+
+    skiplist_free(sl1, NULL, NULL);
+    skiplist_free(sl2, NULL, NULL);
+}
+
 /* Measure getting _nonexistent_ values (lookup failure). */
 static void ins_and_get_nonexistent(void) {
     skiplist *sl = skiplist_new(intptr_cmp, NULL, NULL);
@@ -367,6 +571,180 @@ static void pop_last(void) {
     skiplist_free(sl, NULL, NULL);
 }
 
+/* Measure reopening a committed skiplist_mmap file of lim pairs and
+ * looking up a key, against rebuilding the list in memory (from
+ * unsorted keys, then from sorted ones). */
+static void mmap_reopen(void) {
+    char path[] = "/tmp/skiplist_bench_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    struct skiplist_mmap *m = skiplist_mmap_open(path, NULL);
+    assert(m);
+    for (intptr_t i=0; i < lim; i++) {
+        uint64_t k = __builtin_bswap64((uint64_t) ((i * largeish_prime) % lim));
+        skiplist_mmap_set(m, &k, sizeof(k), &i, sizeof(i));
+    }
+    skiplist_mmap_commit(m);
+    skiplist_mmap_close(m);
+
+    TIME(pre);
+    m = skiplist_mmap_open(path, NULL);
+    uint64_t k = __builtin_bswap64((uint64_t) (lim / 2));
+    bool found = skiplist_mmap_get(m, &k, sizeof(k), NULL, NULL);
+    TIME(post);
+    CMP_TIME("mmap_reopen", pre, post);
+    assert(m && found && skiplist_mmap_count(m) == (size_t) lim);
+    (void)found;
+    skiplist_mmap_close(m);
+    unlink(path);
+
+    skiplist *sl = skiplist_new(intptr_cmp, NULL, NULL);
+    TIME(pre2);
+    for (intptr_t i=0; i < lim; i++) {
+        intptr_t key = (i * largeish_prime) % lim;
+        skiplist_add(sl, (void *) key, (void *) i);
+    }
+    TIME(post2);
+    CMP_TIME("mmap_reopen/rebuild", pre2, post2);
+    skiplist_clear(sl, NULL, NULL);
+
+    void **keys = malloc(lim * sizeof(void *));
+    assert(keys);
+    for (intptr_t i=0; i < lim; i++) { keys[i] = (void *) i; }
+    TIME(pre3);
+    skiplist_build_sorted(sl, keys, keys, lim);
+    TIME(post3);
+    CMP_TIME("mmap_reopen/rebuild_sorted", pre3, post3);
+    skiplist_free(sl, NULL, NULL);
+    free(keys);
+}
+
+static void print_per_pair(const char *label, size_t bytes) {
+    printf("%-30s limit %zd %9.1f bytes per pair (p = 1/%d)\n",
+        label, lim, bytes / (double)lim, 1 << SKIPLIST_P_LOG2);
+}
+
+/* Report the memory each pair of intptr_ts costs in each kind of
+ * list: the bytes requested from the allocator (the skiplist and
+ * typed nodes also pay malloc's per-allocation overhead, which the
+ * compact arena doesn't), or the space used in the mmap file. Build
+ * with -DSKIPLIST_P_LOG2=2 to compare p = 1/4. */
+static void memory_per_entry(void) {
+    test_reset();
+    skiplist *sl = skiplist_new(intptr_cmp, test_alloc, NULL);
+    for (intptr_t i=0; i < lim; i++) {
+        intptr_t k = (i * largeish_prime) % lim;
+        skiplist_add(sl, (void *) k, (void *) k);
+    }
+    print_per_pair("memory/skiplist", (size_t) allocated);
+    skiplist_free(sl, NULL, NULL);
+
+    test_reset();
+    struct intmap *im = intmap_new(test_alloc, NULL);
+    for (intptr_t i=0; i < lim; i++) {
+        intptr_t k = (i * largeish_prime) % lim;
+        intmap_add(im, k, k);
+    }
+    print_per_pair("memory/typed", (size_t) allocated);
+    intmap_free(im);
+
+    test_reset();
+    struct cintmap *cm = cintmap_new(test_alloc, NULL);
+    for (intptr_t i=0; i < lim; i++) {
+        intptr_t k = (i * largeish_prime) % lim;
+        cintmap_add(cm, k, k);
+    }
+    print_per_pair("memory/typed_compact", cintmap_bytes(cm));
+    print_per_pair("  with arena slack", (size_t) allocated);
+    cintmap_free(cm);
+
+    char path[] = "/tmp/skiplist_bench_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    struct skiplist_mmap *m = skiplist_mmap_open(path, NULL);
+    assert(m);
+    for (intptr_t i=0; i < lim; i++) {
+        uint64_t k = __builtin_bswap64((uint64_t) ((i * largeish_prime) % lim));
+        skiplist_mmap_set(m, &k, sizeof(k), &i, sizeof(i));
+    }
+    print_per_pair("memory/mmap", skiplist_mmap_bytes(m));
+    skiplist_mmap_close(m);
+    unlink(path);
+}
+
+/* Binary min-heap of intptr_ts, to compare against. */
+static void heap_push(intptr_t *heap, size_t *n, intptr_t k) {
+    size_t i = (*n)++;
+    while (i > 0 && heap[(i - 1) / 2] > k) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = k;
+}
+
+static intptr_t heap_pop(intptr_t *heap, size_t *n) {
+    intptr_t top = heap[0], k = heap[--(*n)];
+    size_t i = 0;
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= *n) { break; }
+        if (c + 1 < *n && heap[c + 1] < heap[c]) { c++; }
+        if (heap[c] >= k) { break; }
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = k;
+    return top;
+}
+
+/* Measure a scheduler-style hold model: with 10K pending events,
+ * repeatedly pop the earliest and add one a little later, against
+ * a binary heap. Then pop everything, from the latest, in batches. */
+static void priority_queue(void) {
+    enum { PENDING = 10000 };
+    skiplist *sl = skiplist_new(intptr_cmp, NULL, NULL);
+    intptr_t *heap = malloc(PENDING * sizeof(intptr_t));
+    void **keys = malloc(BATCH * sizeof(void *));
+    assert(heap && keys);
+    size_t hn = 0;
+    for (intptr_t i=0; i < PENDING; i++) {
+        intptr_t k = (i * largeish_prime) % PENDING;
+        skiplist_add(sl, (void *) k, NULL);
+        heap_push(heap, &hn, k);
+    }
+
+    TIME(pre);
+    for (intptr_t i=0; i < lim; i++) {
+        void *k = NULL;
+        skiplist_pop_first(sl, &k, NULL);
+        skiplist_add(sl, (void *) ((intptr_t) k + 1 + i % 997), NULL);
+    }
+    TIME(post);
+    CMP_TIME("priority_queue/skiplist", pre, post);
+
+    TIME(pre2);
+    for (intptr_t i=0; i < lim; i++) {
+        intptr_t k = heap_pop(heap, &hn);
+        heap_push(heap, &hn, k + 1 + i % 997);
+    }
+    TIME(post2);
+    CMP_TIME("priority_queue/heap", pre2, post2);
+
+    for (intptr_t i=0; i < lim; i++) {
+        skiplist_add(sl, (void *) ((i * largeish_prime) % lim), NULL);
+    }
+    TIME(pre3);
+    while (skiplist_pop_last_n(sl, BATCH, keys, NULL) > 0) {}
+    TIME(post3);
+    CMP_TIME("priority_queue/pop_last_n", pre3, post3);
+
+    skiplist_free(sl, NULL, NULL);
+    free(heap);
+    free(keys);
+}
+
 static void ins_and_member(void) {
     TIME(pre);
     skiplist *sl = skiplist_new(intptr_cmp, NULL, NULL);
@@ -480,11 +858,660 @@ static void ins_and_sum_partway(void) {
     skiplist_free(sl, NULL, NULL);
 }
 
+/* Measure scans of 100 keys from absent start keys, with
+ * skiplist_iter_range. */
+static void range_scans(void) {
+    skiplist *sl = skiplist_new(intptr_cmp, NULL, NULL);
+
+    for (intptr_t i=0; i < lim; i++) {
+        skiplist_add(sl, (void *) (2 * i), (void *) i);
+    }
+
+    TIME(pre);
+    intptr_t total = 0;
+    for (intptr_t i=0; i < lim; i++) {
+        intptr_t lo = 2 * ((i * largeish_prime) % lim) + 1;
+        skiplist_iter_range(sl, (void *) lo, (void *) (lo + 200),
+            sum_cb, &total);
+    }
+    if (0) { fprintf(stderr, "sum: %lu\n", total); }
+    TIME(post);
+
+    TDIFF();
+    skiplist_free(sl, NULL, NULL);
+}
+
+#if SKIPLIST_INDEXABLE
+static enum skiplist_iter_res count_cb(void *k, void *v, void *ud) {
+    (void)k;
+    (void)v;
+    (*(size_t *) ud)++;
+    return SKIPLIST_ITER_CONTINUE;
+}
+
+/* Measure counting keys in ranges of ~lim/10 keys, by walking them
+ * and with skiplist_count_range, then random skiplist_at lookups.
+ * Build with -DSKIPLIST_INDEXABLE=1. */
+static void rank_and_select(void) {
+    skiplist *sl = skiplist_new(intptr_cmp, NULL, NULL);
+
+    for (intptr_t i=0; i < lim; i++) {
+        skiplist_add(sl, (void *) (2 * i), (void *) i);
+    }
+
+    size_t walked = 0, counted = 0;
+    TIME(pre);
+    for (intptr_t i=0; i < lim / 100; i++) {
+        intptr_t lo = 2 * ((i * largeish_prime) % lim) + 1;
+        skiplist_iter_range(sl, (void *) lo, (void *) (lo + lim / 5),
+            count_cb, &walked);
+    }
+    TIME(mid);
+    for (intptr_t i=0; i < lim / 100; i++) {
+        intptr_t lo = 2 * ((i * largeish_prime) % lim) + 1;
+        counted += skiplist_count_range(sl, (void *) lo,
+            (void *) (lo + lim / 5));
+    }
+    TIME(post);
+    assert(walked == counted);
+    CMP_TIME("count_range_by_walking", pre, mid);
+    CMP_TIME("count_range_by_rank", mid, post);
+
+    TIME(pre_at);
+    intptr_t total = 0;
+    for (intptr_t i=0; i < lim; i++) {
+        void *v = NULL;
+        skiplist_at(sl, (size_t) ((i * largeish_prime) % lim), NULL, &v);
+        total += (intptr_t) v;
+    }
+    if (0) { fprintf(stderr, "sum: %lu\n", total); }
+    TIME(post_at);
+    CMP_TIME("random_at", pre_at, post_at);
+
+    skiplist_free(sl, NULL, NULL);
+}
+#endif
+
+/* Measure random insertions then lookups of integer keys, with
+ * the cmp callback and with the typed skiplist. */
+static void ins_and_get_typed(void) {
+    skiplist *sl = skiplist_new(intptr_cmp, NULL, NULL);
+
+    TIME(pre);
+    for (intptr_t i=0; i < lim; i++) {
+        intptr_t k = (i * largeish_prime) % lim;
+        skiplist_add(sl, (void *) k, (void *) k);
+    }
+    for (intptr_t i=0; i < lim; i++) {
+        bool found = skiplist_member(sl, (void *) i);
+        assert(found);
+        (void) found;
+    }
+    TIME(post);
+
+    CMP_TIME("ins_and_get/int/callback", pre, post);
+    skiplist_free(sl, NULL, NULL);
+
+    struct intmap *tl = intmap_new(NULL, NULL);
+
+    TIME(pre2);
+    for (intptr_t i=0; i < lim; i++) {
+        intptr_t k = (i * largeish_prime) % lim;
+        intmap_add(tl, k, k);
+    }
+    for (intptr_t i=0; i < lim; i++) {
+        bool found = intmap_member(tl, i);
+        assert(found);
+        (void) found;
+    }
+    TIME(post2);
+
+    CMP_TIME("ins_and_get/int/typed", pre2, post2);
+    intmap_free(tl);
+}
+
+/* The same with 16-byte string keys. The callback version keeps
+ * pointers to the keys, the typed one copies them into the nodes. */
+static void ins_and_get_typed_str(void) {
+    struct key16 *keys = malloc(lim * sizeof(struct key16));
+    assert(keys);
+    for (intptr_t i=0; i < lim; i++) {
+        memset(&keys[i], 0, sizeof(keys[i]));
+        snprintf(keys[i].s, sizeof(keys[i].s), "key%012d",
+            (int) ((i * largeish_prime) % lim));
+    }
+    skiplist *sl = skiplist_new(key16_cmp, NULL, NULL);
+
+    TIME(pre);
+    for (intptr_t i=0; i < lim; i++) {
+        skiplist_add(sl, &keys[i], (void *) i);
+    }
+    for (intptr_t i=0; i < lim; i++) {
+        bool found = skiplist_member(sl, &keys[lim - i - 1]);
+        assert(found);
+        (void) found;
+    }
+    TIME(post);
+
+    CMP_TIME("ins_and_get/str/callback", pre, post);
+    skiplist_free(sl, NULL, NULL);
+
+    struct strmap *tl = strmap_new(NULL, NULL);
+
+    TIME(pre2);
+    for (intptr_t i=0; i < lim; i++) {
+        strmap_add(tl, keys[i], i);
+    }
+    for (intptr_t i=0; i < lim; i++) {
+        bool found = strmap_member(tl, keys[lim - i - 1]);
+        assert(found);
+        (void) found;
+    }
+    TIME(post2);
+
+    CMP_TIME("ins_and_get/str/typed", pre2, post2);
+    strmap_free(tl);
+    free(keys);
+}
+
+/* Measure insertions then clearing, with malloc and with a slab,
+ * and how many times each calls malloc/free. */
+static void ins_and_clear_alloc_calls(void) {
+    alloc_calls = 0;
+    skiplist *sl = skiplist_new(intptr_cmp, counted_alloc, NULL);
+
+    TIME(pre);
+    for (intptr_t i=0; i < lim; i++) {
+        intptr_t k = (i * largeish_prime) % lim;
+        skiplist_add(sl, (void *) k, (void *) k);
+    }
+    skiplist_clear(sl, NULL, NULL);
+    TIME(post);
+
+    CMP_TIME("ins_and_clear/malloc", pre, post);
+    skiplist_free(sl, NULL, NULL);
+    printf("%-30s %zd calls\n", "  malloc/free", alloc_calls);
+
+    alloc_calls = 0;
+    struct skiplist_slab *slab = skiplist_slab_new(counted_alloc, NULL);
+    sl = skiplist_new(intptr_cmp, skiplist_slab_alloc, slab);
+
+    TIME(pre2);
+    for (intptr_t i=0; i < lim; i++) {
+        intptr_t k = (i * largeish_prime) % lim;
+        skiplist_add(sl, (void *) k, (void *) k);
+    }
+    skiplist_clear(sl, NULL, NULL);
+    TIME(post2);
+
+    CMP_TIME("ins_and_clear/slab", pre2, post2);
+    skiplist_free(sl, NULL, NULL);
+    skiplist_slab_free(slab);
+    printf("%-30s %zd calls\n", "  malloc/free", alloc_calls);
+}
+
+/* Build a list of this thread's share of the keys. */
+static void *ins_own_list_worker(void *arg) {
+    long threads = *(long *) arg;
+    skiplist *sl = skiplist_new(intptr_cmp, NULL, NULL);
+    for (intptr_t i=0; i < lim / threads; i++) {
+        intptr_t k = (i * largeish_prime) % lim;
+        skiplist_add(sl, (void *) k, (void *) k);
+    }
+    skiplist_free(sl, NULL, NULL);
+    return NULL;
+}
+
+/* Measure insertions from 1 to 8 threads, each into its own list.
+ * Each list draws heights from its own generator, so they don't
+ * contend on a shared one. */
+static void ins_threads_own_lists(void) {
+    long thread_counts[] = { 1, 2, 4, 8 };
+    for (size_t c = 0; c < sizeof(thread_counts) / sizeof(long); c++) {
+        long threads = thread_counts[c];
+        pthread_t tids[8];
+
+        TIME(pre);
+        for (long t = 0; t < threads; t++) {
+            pthread_create(&tids[t], NULL, ins_own_list_worker,
+                &thread_counts[c]);
+        }
+        for (long t = 0; t < threads; t++) { pthread_join(tids[t], NULL); }
+        TIME(post);
+
+        char label[64];
+        snprintf(label, sizeof(label), "%s/%ld", __FUNCTION__, threads);
+        CMP_TIME(label, pre, post);
+    }
+}
+
+struct lf_bench {
+    struct skiplist_lf *sl;
+    long id;
+    long threads;
+};
+
+/* Add this thread's share of the keys, then get them back. */
+static void *lf_ins_and_get_worker(void *arg) {
+    struct lf_bench *b = (struct lf_bench *) arg;
+    for (intptr_t i = b->id; i < lim; i += b->threads) {
+        intptr_t k = (i * largeish_prime) % lim;
+        skiplist_lf_add(b->sl, (void *) k, (void *) k);
+    }
+    for (intptr_t i = b->id; i < lim; i += b->threads) {
+        intptr_t k = (i * largeish_prime) % lim;
+        bool found = skiplist_lf_member(b->sl, (void *) k);
+        assert(found);
+        (void) found;
+    }
+    return NULL;
+}
+
+/* Measure concurrent insertions and lookups on the lock-free
+ * skiplist, with 1 to 8 threads. */
+static void lf_ins_and_get_threads(void) {
+    const long thread_counts[] = { 1, 2, 4, 8 };
+    for (size_t c = 0; c < sizeof(thread_counts) / sizeof(long); c++) {
+        long threads = thread_counts[c];
+        struct skiplist_lf *sl = skiplist_lf_new(intptr_cmp, NULL, NULL);
+        pthread_t tids[8];
+        struct lf_bench b[8];
+
+        TIME(pre);
+        for (long t = 0; t < threads; t++) {
+            b[t].sl = sl;
+            b[t].id = t;
+            b[t].threads = threads;
+            pthread_create(&tids[t], NULL, lf_ins_and_get_worker, &b[t]);
+        }
+        for (long t = 0; t < threads; t++) { pthread_join(tids[t], NULL); }
+        TIME(post);
+
+        char label[64];
+        snprintf(label, sizeof(label), "%s/%ld", __FUNCTION__, threads);
+        CMP_TIME(label, pre, post);
+        skiplist_lf_free(sl, NULL, NULL);
+    }
+}
+
+/*
+ * Workload harness, run with `bench mix [OPTIONS]`:
+ *
+ *     -n KEYS      key space, and keys added before timing (100000)
+ *     -o OPS       operations per thread (1000000)
+ *     -t T,T,...   thread counts to sweep (1,2,4,8)
+ *     -r R,R,...   percentages of gets to sweep (100,90,50)
+ *     -d DIST      key distribution: seq, uniform or zipf (uniform)
+ *     -z THETA     Zipfian skew, 0 < THETA < 1 (0.99)
+ *     -l LIST      lf (skiplist_lf) or locked (skiplist, rwlock) (lf)
+ *     -p           also count cache and branch misses (perf_event_open)
+ *
+ * Operations other than gets alternate between sets and deletes. For
+ * each thread count and get percentage, it prints a CSV line: the
+ * throughput, latency percentiles (from log-linear histograms, within
+ * 1/8), the peak bytes allocated (via test_alloc), and the counters,
+ * if asked for and available. Build with test_alloc.c and -lm:
+ *
+ *     cc -O2 bench.c skiplist.c skiplist_lf.c skiplist_slab.c \
+ *         skiplist_mmap.c test_alloc.c -lpthread -lm
+ */
+
+enum mix_dist { DIST_SEQ, DIST_UNIFORM, DIST_ZIPF };
+static const char *dist_names[] = { "seq", "uniform", "zipf" };
+
+/* Zipfian generator (Gray et al., "Quickly Generating Billion-Record
+ * Synthetic Databases"), over [0, n). */
+struct zipf {
+    uint64_t n;
+    double theta, alpha, zetan, eta;
+};
+
+static void zipf_init(struct zipf *z, uint64_t n, double theta) {
+    double zeta2 = 0;
+    z->n = n;
+    z->theta = theta;
+    z->zetan = 0;
+    for (uint64_t i = 1; i <= n; i++) {
+        z->zetan += 1.0 / pow((double) i, theta);
+        if (i == 2) { zeta2 = z->zetan; }
+    }
+    z->alpha = 1.0 / (1.0 - theta);
+    z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+static uint64_t zipf_next(const struct zipf *z, double u) {
+    double uz = u * z->zetan;
+    if (uz < 1.0) { return 0; }
+    if (uz < 1.0 + pow(0.5, z->theta)) { return 1; }
+    uint64_t r = (uint64_t) (z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+    return r < z->n ? r : z->n - 1;
+}
+
+/* Latency histogram: exact below 8 nsec, then 8 buckets per power
+ * of 2. */
+#define HIST_BUCKETS (62 * 8)
+
+static size_t hist_bucket(uint64_t ns) {
+    if (ns < 8) { return ns; }
+    int e = 63 - __builtin_clzll(ns);
+    return (size_t) (e - 2) * 8 + ((ns >> (e - 3)) & 7);
+}
+
+static uint64_t hist_value(size_t b) {
+    if (b < 8) { return b; }
+    return (uint64_t) (8 + b % 8) << (b / 8 - 1);
+}
+
+static uint64_t hist_percentile(const uint64_t *hist, uint64_t total,
+        double pct) {
+    uint64_t want = (uint64_t) ceil(total * pct / 100.0), seen = 0;
+    for (size_t b = 0; b < HIST_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen >= want && seen > 0) { return hist_value(b); }
+    }
+    return 0;
+}
+
+struct mix_run {
+    bool lf;
+    struct skiplist *sl;
+    pthread_rwlock_t lock;
+    struct skiplist_lf *lsl;
+    enum mix_dist dist;
+    struct zipf z;
+    uint64_t keys;
+    uint64_t ops;
+    long threads;
+    long read_pct;
+};
+
+struct mix_thread {
+    pthread_t tid;
+    struct mix_run *run;
+    long id;
+    uint64_t rng;
+    uint64_t seq;
+    uint64_t max_ns;
+    uint64_t hist[HIST_BUCKETS];
+};
+
+static uint64_t mix_rand(struct mix_thread *t) {
+    uint64_t x = t->rng;        /* xorshift64* */
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    t->rng = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static intptr_t mix_key(struct mix_thread *t) {
+    struct mix_run *r = t->run;
+    switch (r->dist) {
+    case DIST_SEQ:
+        return (intptr_t) (t->seq++ % r->keys);
+    case DIST_UNIFORM:
+        return (intptr_t) (mix_rand(t) % r->keys);
+    case DIST_ZIPF: default: {
+        double u = (mix_rand(t) >> 11) * (1.0 / 9007199254740992.0);
+        /* Scatter the hot keys through the list. */
+        return (intptr_t) ((zipf_next(&r->z, u) * largeish_prime) % r->keys);
+    }
+    }
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *mix_worker(void *arg) {
+    struct mix_thread *t = (struct mix_thread *) arg;
+    struct mix_run *r = t->run;
+    uint64_t writes = 0;
+    for (uint64_t i = 0; i < r->ops; i++) {
+        intptr_t k = mix_key(t);
+        bool read = (long) (mix_rand(t) % 100) < r->read_pct;
+        bool set = read ? false : (writes++ & 1) == 0;
+        uint64_t pre = now_ns();
+        if (r->lf) {
+            if (read) {
+                skiplist_lf_get(r->lsl, (void *) k, NULL);
+            } else if (set) {
+                skiplist_lf_set(r->lsl, (void *) k, (void *) k, NULL);
+            } else {
+                skiplist_lf_delete(r->lsl, (void *) k, NULL);
+            }
+        } else if (read) {
+            pthread_rwlock_rdlock(&r->lock);
+            skiplist_get(r->sl, (void *) k, NULL);
+            pthread_rwlock_unlock(&r->lock);
+        } else {
+            pthread_rwlock_wrlock(&r->lock);
+            if (set) {
+                skiplist_set(r->sl, (void *) k, (void *) k, NULL);
+            } else {
+                skiplist_delete(r->sl, (void *) k, NULL);
+            }
+            pthread_rwlock_unlock(&r->lock);
+        }
+        uint64_t ns = now_ns() - pre;
+        t->hist[hist_bucket(ns)]++;
+        if (ns > t->max_ns) { t->max_ns = ns; }
+    }
+    return NULL;
+}
+
+/* Hardware counters for this process and the threads it starts,
+ * or -1 if unavailable. */
+static int perf_open(uint64_t config) {
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    (void)config;
+    return -1;
+#endif
+}
+
+static void perf_start(int fd) {
+#ifdef __linux__
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#else
+    (void)fd;
+#endif
+}
+
+/* Print the counter in FD as a CSV field, or nothing. */
+static void perf_print(int fd, const char *sep) {
+#ifdef __linux__
+    uint64_t count = 0;
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) == sizeof(count)) {
+            printf("%llu", (unsigned long long) count);
+        }
+    }
+#else
+    (void)fd;
+#endif
+    printf("%s", sep);
+}
+
+static void mix_one(struct mix_run *r, bool counters) {
+    test_reset();
+    if (r->lf) {
+        r->lsl = skiplist_lf_new(intptr_cmp, test_alloc, NULL);
+        assert(r->lsl);
+    } else {
+        r->sl = skiplist_new(intptr_cmp, test_alloc, NULL);
+        assert(r->sl);
+        pthread_rwlock_init(&r->lock, NULL);
+    }
+    for (uint64_t k = 0; k < r->keys; k++) {
+        if (r->lf) {
+            skiplist_lf_add(r->lsl, (void *) k, (void *) k);
+        } else {
+            skiplist_add(r->sl, (void *) k, (void *) k);
+        }
+    }
+
+    struct mix_thread *ts = calloc(r->threads, sizeof(*ts));
+    assert(ts);
+    int cache_fd = counters ? perf_open(PERF_COUNT_HW_CACHE_MISSES) : -1;
+    int branch_fd = counters ? perf_open(PERF_COUNT_HW_BRANCH_MISSES) : -1;
+    perf_start(cache_fd);
+    perf_start(branch_fd);
+    uint64_t pre = now_ns();
+    for (long i = 0; i < r->threads; i++) {
+        ts[i].run = r;
+        ts[i].id = i;
+        ts[i].rng = 0x9E3779B97F4A7C15ULL * (i + 1);
+        ts[i].seq = (uint64_t) i * r->keys / r->threads;
+        pthread_create(&ts[i].tid, NULL, mix_worker, &ts[i]);
+    }
+    for (long i = 0; i < r->threads; i++) { pthread_join(ts[i].tid, NULL); }
+    uint64_t elapsed = now_ns() - pre;
+
+    static uint64_t hist[HIST_BUCKETS];
+    uint64_t max_ns = 0, total = r->ops * r->threads;
+    memset(hist, 0, sizeof(hist));
+    for (long i = 0; i < r->threads; i++) {
+        for (size_t b = 0; b < HIST_BUCKETS; b++) { hist[b] += ts[i].hist[b]; }
+        if (ts[i].max_ns > max_ns) { max_ns = ts[i].max_ns; }
+    }
+
+    printf("%s,%ld,%s,%ld,%llu,%llu,%.6f,%.3f,",
+        r->lf ? "lf" : "locked", r->threads, dist_names[r->dist],
+        r->read_pct, (unsigned long long) r->keys,
+        (unsigned long long) total, elapsed / 1e9,
+        total / (elapsed / 1e9) / 1e6);
+    printf("%llu,%llu,%llu,%llu,%llu,%ld,",
+        (unsigned long long) hist_percentile(hist, total, 50),
+        (unsigned long long) hist_percentile(hist, total, 90),
+        (unsigned long long) hist_percentile(hist, total, 99),
+        (unsigned long long) hist_percentile(hist, total, 99.9),
+        (unsigned long long) max_ns, allocated_peak);
+    perf_print(cache_fd, ",");
+    perf_print(branch_fd, "\n");
+    fflush(stdout);
+    if (cache_fd >= 0) { close(cache_fd); }
+    if (branch_fd >= 0) { close(branch_fd); }
+
+    if (r->lf) {
+        skiplist_lf_free(r->lsl, NULL, NULL);
+    } else {
+        skiplist_free(r->sl, NULL, NULL);
+        pthread_rwlock_destroy(&r->lock);
+    }
+    free(ts);
+}
+
+/* Parse a comma-separated list of up to MAX positive numbers. */
+static size_t parse_list(const char *arg, long *out, size_t max) {
+    size_t n = 0;
+    char *end = NULL;
+    while (n < max && *arg != '\0') {
+        out[n] = strtol(arg, &end, 10);
+        if (end == arg || out[n] < 0) { return 0; }
+        n++;
+        arg = *end == ',' ? end + 1 : end;
+    }
+    return n;
+}
+
+static int mix_main(int argc, char **argv) {
+    struct mix_run r;
+    memset(&r, 0, sizeof(r));
+    r.lf = true;
+    r.dist = DIST_UNIFORM;
+    r.keys = 100000;
+    r.ops = 1000000;
+    double theta = 0.99;
+    long threads[16] = { 1, 2, 4, 8 }, reads[16] = { 100, 90, 50 };
+    size_t nthreads = 4, nreads = 3;
+    bool counters = false;
+
+    int c;
+    while ((c = getopt(argc, argv, "n:o:t:r:d:z:l:ph")) != -1) {
+        switch (c) {
+        case 'n': r.keys = strtoull(optarg, NULL, 10); break;
+        case 'o': r.ops = strtoull(optarg, NULL, 10); break;
+        case 't': nthreads = parse_list(optarg, threads, 16); break;
+        case 'r': nreads = parse_list(optarg, reads, 16); break;
+        case 'z': theta = atof(optarg); break;
+        case 'p': counters = true; break;
+        case 'd':
+            if (0 == strcmp(optarg, "seq")) {
+                r.dist = DIST_SEQ;
+            } else if (0 == strcmp(optarg, "uniform")) {
+                r.dist = DIST_UNIFORM;
+            } else if (0 == strcmp(optarg, "zipf")) {
+                r.dist = DIST_ZIPF;
+            } else {
+                goto usage;
+            }
+            break;
+        case 'l':
+            if (0 == strcmp(optarg, "lf")) {
+                r.lf = true;
+            } else if (0 == strcmp(optarg, "locked")) {
+                r.lf = false;
+            } else {
+                goto usage;
+            }
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (r.keys < 2 || nthreads == 0 || nreads == 0
+        || theta <= 0 || theta >= 1) {
+        goto usage;
+    }
+    for (size_t i = 0; i < nthreads; i++) {
+        if (threads[i] < 1) { goto usage; }
+    }
+    if (r.dist == DIST_ZIPF) { zipf_init(&r.z, r.keys, theta); }
+
+    printf("list,threads,dist,read_pct,keys,ops,sec,mops_per_sec,"
+        "p50_ns,p90_ns,p99_ns,p999_ns,max_ns,peak_bytes,"
+        "cache_misses,branch_misses\n");
+    for (size_t i = 0; i < nthreads; i++) {
+        for (size_t j = 0; j < nreads; j++) {
+            r.threads = threads[i];
+            r.read_pct = reads[j];
+            mix_one(&r, counters);
+        }
+    }
+    return 0;
+
+usage:
+    fprintf(stderr, "Usage: bench mix [-n KEYS] [-o OPS] [-t T,...] "
+        "[-r READ_PCT,...]\n    [-d seq|uniform|zipf] [-z THETA] "
+        "[-l lf|locked] [-p]\n");
+    return 1;
+}
+
 int main(int argc, char **argv) {
-    if (argc > 1) {
+    if (argc > 1 && 0 == strcmp(argv[1], "mix")) {
+        return mix_main(argc - 1, argv + 1);
+    } else if (argc > 1) {
         lim = atol(argv[1]);
         if (lim <= 1) {
-            fprintf(stderr, "Bad limit.\nUsage: bench [LIMIT]\n");
+            fprintf(stderr, "Bad limit.\nUsage: bench [LIMIT]\n"
+                "       bench mix [OPTIONS]\n");
             exit(1);
         }
     } else {
@@ -493,12 +1520,17 @@ int main(int argc, char **argv) {
 
     TIME(pre);
     ins();
+    build_sorted();
+    merge_and_split();
+    mmap_reopen();
+    memory_per_entry();
     get();
     get_nonexistent();
     set();
     delete();
     delete_nonexistent();
     ins_and_get();
+    clustered_batches();
     ins_and_get_nonexistent();
     ins_and_count();
     set_and_get();
@@ -506,6 +1538,7 @@ int main(int argc, char **argv) {
     ins_and_delete_nonexistent();
     pop_first();
     pop_last();
+    priority_queue();
     ins_and_pop_first();
     ins_and_pop_last();
     member();
@@ -514,6 +1547,18 @@ int main(int argc, char **argv) {
     sum();
     ins_and_sum();
     ins_and_sum_partway();
+    range_scans();
+#if SKIPLIST_INDEXABLE
+    rank_and_select();
+#endif
+    ins_and_clear_alloc_calls();
+    ins_and_get_typed();
+    ins_and_get_typed_str();
+#if SKIPLIST_KEY_PREFIX
+    ins_and_get_str_prefix();
+#endif
+    ins_threads_own_lists();
+    lf_ins_and_get_threads();
 
     TIME(post);
     double usec_total = (double)get_usec_delta(&timer_pre, &timer_post);
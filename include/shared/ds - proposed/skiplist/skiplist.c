@@ -23,18 +23,38 @@
 #include "skiplist.h"
 #include "skiplist_macros_internal.h"
 
+/* Heights from a user-supplied function rather than the list's own
+ * generator? */
+#ifdef SKIPLIST_GEN_HEIGHT
+#define SKIPLIST_CUSTOM_HEIGHT 1
+#else
+#define SKIPLIST_CUSTOM_HEIGHT 0
+#endif
+
 struct skiplist {
     size_t count;
     struct skiplist_node *head;
     skiplist_cmp_cb *cmp;
     skiplist_alloc_cb *alloc;
     void *alloc_udata;
+    uint64_t rng;           /* height generator state */
+#if SKIPLIST_KEY_PREFIX
+    skiplist_prefix_cb *prefix;
+#endif
+    /* Last node on each level (or the head), for appends. */
+    struct skiplist_node *tails[SKIPLIST_MAX_HEIGHT];
 };
 
 struct skiplist_node {
     int h;                  /* node height */
+#if SKIPLIST_KEY_PREFIX
+    uint64_t prefix;        /* order-preserving prefix of k */
+#endif
     void *k;                /* key */
     void *v;                /* value */
+#if SKIPLIST_BACK_POINTERS
+    struct skiplist_node *prev;     /* predecessor on level 0 */
+#endif
 
     /* Forward pointers.
      * allocated with (h)*sizeof(N*) extra bytes. */
@@ -42,9 +62,42 @@ struct skiplist_node {
 };
 
 /* Sentinel. */
-static struct skiplist_node SENTINEL = { 0, NULL, NULL };
+static struct skiplist_node SENTINEL = { .h = 0 };
 #define IS_SENTINEL(n) (n == &SENTINEL)
 
+#if SKIPLIST_INDEXABLE
+/* Span widths follow the forward pointers: WIDTH(n, i) is how many
+ * level-0 steps next[i] skips (the sentinel being at count + 1). */
+#define WIDTH(n, i) (((size_t *)&(n)->next[(n)->h])[i])
+#define NODE_SIZE(h) (sizeof(struct skiplist_node) + \
+    (h) * (sizeof(struct skiplist_node *) + sizeof(size_t)))
+#else
+#define NODE_SIZE(h) (sizeof(struct skiplist_node) + \
+    (h) * sizeof(struct skiplist_node *))
+#endif
+
+#if SKIPLIST_KEY_PREFIX
+#define KEY_PREFIX(sl, key) ((sl)->prefix ? (sl)->prefix(key) : 0)
+#define SET_PREFIX(sl, n) ((n)->prefix = KEY_PREFIX(sl, (n)->k))
+/* Compare node N's key with KEY, whose prefix is KP. When the
+ * prefixes differ, that decides it without reading the key. */
+#define NODE_CMP(sl, n, key, kp)                                        \
+    ((n)->prefix != (kp) ? ((n)->prefix < (kp) ? -1 : 1)                \
+      : (sl)->cmp((n)->k, key))
+#else
+#define KEY_PREFIX(sl, key) 0
+#define SET_PREFIX(sl, n) ((void)0)
+#define NODE_CMP(sl, n, key, kp) ((sl)->cmp((n)->k, key))
+#endif
+
+#if SKIPLIST_BACK_POINTERS
+/* Make P the level-0 predecessor of N, unless N is the sentinel. */
+#define SET_BACK(n, p)                                                  \
+    do { if (!IS_SENTINEL(n)) { (n)->prev = (p); } } while (0)
+#else
+#define SET_BACK(n, p) ((void)0)
+#endif
+
 static struct skiplist_node *
 node_alloc(struct skiplist *sl, uint8_t height, void *key, void *value);
 static void *def_alloc(void *p,
@@ -65,6 +118,10 @@ struct skiplist *skiplist_new(skiplist_cmp_cb *cmp,
         sl->cmp = cmp;
         sl->alloc = alloc;
         sl->alloc_udata = alloc_udata;
+        skiplist_seed(sl, skiplist_new_seed());
+#if SKIPLIST_KEY_PREFIX
+        sl->prefix = NULL;
+#endif
 
         struct skiplist_node *head = node_alloc(sl, 1, &SENTINEL, &SENTINEL);
         if (head == NULL) {
@@ -72,6 +129,7 @@ struct skiplist *skiplist_new(skiplist_cmp_cb *cmp,
             return NULL;
         }
         sl->head = head;
+        DO(SKIPLIST_MAX_HEIGHT, sl->tails[i] = head);
     }
     return sl;
 }
@@ -82,15 +140,20 @@ static struct skiplist_node *node_alloc(struct skiplist *sl,
         uint8_t height, void *key, void *value) {
     assert(height > 0);
     assert(height <= SKIPLIST_MAX_HEIGHT);
-    size_t size = sizeof(struct skiplist_node) +
-      height * sizeof(struct skiplist_node *);
+    size_t size = NODE_SIZE(height);
     struct skiplist_node *n = sl->alloc(NULL, 0, size, sl->alloc_udata);
     if (n == NULL) { return NULL; }
     n->h = height;
     n->k = key;
     n->v = value;
+#if SKIPLIST_BACK_POINTERS
+    n->prev = NULL;
+#endif
     LOG2("allocated %d-level node at %p\n", height, (void *)n);
     DO(height, n->next[i] = &SENTINEL);
+#if SKIPLIST_INDEXABLE
+    DO(height, WIDTH(n, i) = 1);
+#endif
     return n;
 }
 
@@ -104,6 +167,17 @@ static void *def_alloc(void *p,
         return NULL;
     } else {
         assert(osize == 0);
+#if SKIPLIST_CACHE_LINE > 0
+        /* Tall nodes start on a cache line, so a search reads
+         * their header and lowest levels in one miss. */
+        if (nsize >= SKIPLIST_CACHE_LINE) {
+            void *np = NULL;
+            if (posix_memalign(&np, SKIPLIST_CACHE_LINE, nsize) != 0) {
+                return NULL;
+            }
+            return np;
+        }
+#endif
         return malloc(nsize);
     }
 }
@@ -112,89 +186,222 @@ static void *def_alloc(void *p,
 /* Free a node. If necessary, everything it references should be
  * freed by the calling function. */
 static void node_free(struct skiplist *sl, struct skiplist_node *n) {
-    sl->alloc(n, sizeof(*n) + n->h * sizeof(n), 0, sl->alloc_udata);
+    sl->alloc(n, NODE_SIZE(n->h), 0, sl->alloc_udata);
+}
+
+static uint64_t global_seed = 0;
+static uint64_t seeds_given = 0;
+
+/* splitmix64, to spread seeds over the state. */
+static uint64_t mix_seed(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
 }
 
 /* Set the random seed used when randomly constructing skiplists. */
 void skiplist_set_seed(unsigned seed) {
-    srandom(seed);
+    global_seed = seed;
+    seeds_given = 0;
+}
+
+uint64_t skiplist_new_seed(void) {
+#if defined(__GNUC__)
+    uint64_t n = __atomic_add_fetch(&seeds_given, 1, __ATOMIC_RELAXED);
+#else
+    uint64_t n = ++seeds_given;
+#endif
+    return mix_seed(global_seed ^ mix_seed(n));
+}
+
+void skiplist_seed(struct skiplist *sl, uint64_t seed) {
+    assert(sl);
+    sl->rng = mix_seed(seed);
+    if (sl->rng == 0) { sl->rng = 1; }
+}
+
+#if SKIPLIST_KEY_PREFIX
+bool skiplist_set_prefix(struct skiplist *sl, skiplist_prefix_cb *cb) {
+    assert(sl);
+    if (sl->count > 0) { return false; }
+    sl->prefix = cb;
+    return true;
+}
+
+uint64_t skiplist_prefix_str(void *key) {
+    const unsigned char *s = (const unsigned char *) key;
+    uint64_t p = 0;
+    int i = 0;
+    for (; i < 8 && s[i] != '\0'; i++) { p = (p << 8) | s[i]; }
+    for (; i < 8; i++) { p <<= 8; }     /* pad short keys with 0s */
+    return p;
+}
+#endif
+
+uint8_t skiplist_gen_height_r(uint64_t *state) {
+    /* xorshift64* */
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    uint64_t r = ~(x * 0x2545F4914F6CDD1DULL);
+    /* Trailing 1 bits of the draw: each run of SKIPLIST_P_LOG2 of them
+     * is another level, with probability p = 1 / 2^SKIPLIST_P_LOG2. */
+    if (r == 0) { return SKIPLIST_MAX_HEIGHT; }
+#if defined(__GNUC__)
+    int ones = __builtin_ctzll(r);
+#else
+    int ones = 0;
+    while ((r & 1) == 0) { ones++; r >>= 1; }
+#endif
+    int h = 1 + ones / SKIPLIST_P_LOG2;
+    return (uint8_t)(h > SKIPLIST_MAX_HEIGHT ? SKIPLIST_MAX_HEIGHT : h);
 }
 
 #ifndef SKIPLIST_GEN_HEIGHT
 uint8_t SKIPLIST_GEN_HEIGHT(void);
 uint8_t SKIPLIST_GEN_HEIGHT(void) {
-    uint8_t h = 1;
-    long r = random();
-    /* According to the random(3) manpages on OpenBSD and OS X,
-     * "[a]ll of the bits generated by random() are usable", so
-     * it should be adequate to only call random() once if the
-     * default probability of 50% for each additional level
-     * increase is used. */
-    for (uint8_t bit=0; r & (1 << bit); bit++) {
-        h++;
-    }
-    return (uint8_t)(h > SKIPLIST_MAX_HEIGHT ? SKIPLIST_MAX_HEIGHT : h);
+    /* Per-thread, so threads never share a generator. */
+#if defined(__GNUC__)
+    static __thread uint64_t state = 0;
+#else
+    static uint64_t state = 0;
+#endif
+    if (state == 0) { state = skiplist_new_seed() | 1; }
+    return skiplist_gen_height_r(&state);
 }
 #endif
 
-/* Get pointers to the HEIGHT nodes that precede the position
- * for key. Used by add/set/delete/delete_all. */
-static void init_prevs(struct skiplist *sl, void *key,
-        struct skiplist_node *head, int height,
-        struct skiplist_node **prevs) {
+/* Get pointers to the nodes that precede the position for key (with
+ * prefix KP) on levels LVL and below, searching from CUR, at position
+ * POS. If the skiplist is indexable, also get their positions in
+ * RANKS. */
+static void find_prevs(struct skiplist *sl, void *key, uint64_t kp,
+        struct skiplist_node *cur, int lvl, size_t pos,
+        struct skiplist_node **prevs, size_t *ranks) {
     assert(sl);
-    assert(head);
-    struct skiplist_node *cur = NULL, *next = NULL;
-    int lvl = height - 1, res = 0;
+    assert(cur);
+    struct skiplist_node *next = NULL;
+    int res = 0;
+    (void)kp;
+    (void)ranks;
+    (void)pos;
 
-    cur = head;
     LOG2("sentinel is %p\n", (void *)&SENTINEL);
-    LOG2("head is %p\n", (void *)head);
+    LOG2("start is %p\n", (void *)cur);
 
     do {
         assert(lvl < cur->h);
         assert(cur->h <= SKIPLIST_MAX_HEIGHT);
         next = cur->next[lvl];
         LOG2("next is %p, level is %d\n", (void *)next, lvl);
-        res = IS_SENTINEL(next) ? 1 : sl->cmp(next->k, key);
+        res = IS_SENTINEL(next) ? 1 : NODE_CMP(sl, next, key, kp);
         LOG2("res is %d\n", res);
         if (res < 0) {              /* < - advance. */
+#if SKIPLIST_INDEXABLE
+            pos += WIDTH(cur, lvl);
+#endif
             cur = next;
+            PREFETCH(cur->next[lvl]);
         } else /*if (res >= 0)*/ {  /* >= - overshot, descend. */
             prevs[lvl] = cur;
+#if SKIPLIST_INDEXABLE
+            ranks[lvl] = pos;
+#endif
             lvl--;
         }
     } while (lvl >= 0);
 }
 
-static bool grow_head(struct skiplist *sl, struct skiplist_node *nn) {
+/* Get pointers to the HEIGHT nodes that precede the position
+ * for key. Used by add/set/delete/delete_all. If the skiplist is
+ * indexable, also get their positions in RANKS (the head's is 0). */
+static void init_prevs(struct skiplist *sl, void *key,
+        struct skiplist_node *head, int height,
+        struct skiplist_node **prevs, size_t *ranks) {
+    assert(head);
+    find_prevs(sl, key, KEY_PREFIX(sl, key), head, height - 1, 0,
+        prevs, ranks);
+}
+
+/* Move the finger PREVS (and RANKS), left by a search for a key <=
+ * KEY, to the nodes that precede the position for KEY. It climbs
+ * only as far as needed, so a search for a nearby key is cheap. */
+static void finger_prevs(struct skiplist *sl, void *key,
+        struct skiplist_node **prevs, size_t *ranks) {
+    int lvl = 0, top = sl->head->h - 1;
+    uint64_t kp = KEY_PREFIX(sl, key);
+    (void)kp;
+    while (lvl < top) {
+        struct skiplist_node *next = prevs[lvl]->next[lvl];
+        if (IS_SENTINEL(next) || NODE_CMP(sl, next, key, kp) >= 0) { break; }
+        lvl++;
+    }
+    find_prevs(sl, key, kp, prevs[lvl], lvl, ranks[lvl], prevs, ranks);
+}
+
+/* Replace the head with one of HEIGHT levels, the new ones empty. */
+static bool grow_head_to(struct skiplist *sl, int height) {
     struct skiplist_node *old_head = sl->head;
-    LOG2("growing head from %d to %d\n", old_head->h, nn->h);
-    struct skiplist_node *new_head = node_alloc(sl, nn->h,
+    LOG2("growing head from %d to %d\n", old_head->h, height);
+    struct skiplist_node *new_head = node_alloc(sl, height,
         &SENTINEL, &SENTINEL);
     if (new_head == NULL) {
         fprintf(stderr, "alloc fail\n");
         return false;
     }
     DO(old_head->h, new_head->next[i] = old_head->next[i]);
-    for (int i = old_head->h; i < new_head->h; i++) {
-        /* The actual next[i] will be set later. */
-        new_head->next[i] = nn;
+    SET_BACK(new_head->next[0], new_head);
+#if SKIPLIST_INDEXABLE
+    DO(old_head->h, WIDTH(new_head, i) = WIDTH(old_head, i));
+    for (int i = old_head->h; i < height; i++) {
+        WIDTH(new_head, i) = sl->count + 1;
     }
+#endif
+    DO(SKIPLIST_MAX_HEIGHT, if (sl->tails[i] == old_head)
+                                sl->tails[i] = new_head);
     sl->head = new_head;
     node_free(sl, old_head);
     return true;
 }
 
+static bool grow_head(struct skiplist *sl, struct skiplist_node *nn) {
+    int old_height = sl->head->h;
+    if (!grow_head_to(sl, nn->h)) { return false; }
+    for (int i = old_height; i < nn->h; i++) {
+        /* The actual next[i] will be set later. */
+        sl->head->next[i] = nn;
+    }
+    return true;
+}
+
+static bool link_new(struct skiplist *sl, void *key, void *value,
+    struct skiplist_node **prevs, size_t *ranks);
+
 static bool add_or_set(struct skiplist *sl, int try_replace,
         void *key, void *value, void **old) {
     assert(sl);
     struct skiplist_node *head = sl->head;
     assert(head);
     int cur_height = head->h;
-    struct skiplist_node *prevs[cur_height];
-
-    init_prevs(sl, key, head, cur_height, prevs);
+    struct skiplist_node *prevs[SKIPLIST_MAX_HEIGHT];
+    size_t ranks[SKIPLIST_MAX_HEIGHT];
+
+    /* Appending after the last key? Then the tails are the prevs,
+     * with no need to search. */
+    struct skiplist_node *last = sl->tails[0];
+    int res = last == head ? 1 : sl->cmp(key, last->k);
+    if (res > 0) {
+        DO(cur_height, prevs[i] = sl->tails[i]);
+#if SKIPLIST_INDEXABLE
+        /* Their spans end at the sentinel, at count + 1. */
+        DO(cur_height, ranks[i] = sl->count + 1 - WIDTH(prevs[i], i));
+#endif
+    } else {
+        init_prevs(sl, key, head, cur_height, prevs, ranks);
+    }
 
     if (try_replace) {
         struct skiplist_node *next = prevs[0]->next[0];
@@ -210,9 +417,22 @@ static bool add_or_set(struct skiplist *sl, int try_replace,
         }
     }
 
-    uint8_t new_height = SKIPLIST_GEN_HEIGHT();
+    return link_new(sl, key, value, prevs, ranks);
+}
+
+/* Link a new node for KEY and VALUE after PREVS (at RANKS), which
+ * must have room for SKIPLIST_MAX_HEIGHT levels, then move them to
+ * the new node, so they stay a finger for a following key. */
+static bool link_new(struct skiplist *sl, void *key, void *value,
+        struct skiplist_node **prevs, size_t *ranks) {
+    struct skiplist_node *head = sl->head;
+    int cur_height = head->h;
+    (void)ranks;
+    uint8_t new_height = SKIPLIST_CUSTOM_HEIGHT
+      ? SKIPLIST_GEN_HEIGHT() : skiplist_gen_height_r(&sl->rng);
     struct skiplist_node *nn = node_alloc(sl, new_height, key, value);
     if (nn == NULL) { return false; }
+    SET_PREFIX(sl, nn);
 
     if (new_height > cur_height) {
         if (!grow_head(sl, nn)) { return false; }
@@ -229,7 +449,25 @@ static bool add_or_set(struct skiplist *sl, int try_replace,
         assert(prevs[i]->h <= SKIPLIST_MAX_HEIGHT);
         prevs[i]->next[i] = nn;
     }
+    SET_BACK(nn, prevs[0]);
+    SET_BACK(nn->next[0], nn);
+    DO(nn->h, if (IS_SENTINEL(nn->next[i])) { sl->tails[i] = nn; });
     sl->count++;
+#if SKIPLIST_INDEXABLE
+    /* nn is at position pos; the nodes after it move up by one. */
+    size_t pos = ranks[0] + 1;
+    for (int i = 0; i < minH; i++) {
+        WIDTH(nn, i) = ranks[i] + WIDTH(prevs[i], i) + 1 - pos;
+        WIDTH(prevs[i], i) = pos - ranks[i];
+    }
+    for (int i = minH; i < nn->h; i++) {    /* new head levels */
+        WIDTH(head, i) = pos;
+        WIDTH(nn, i) = sl->count + 1 - pos;
+    }
+    for (int i = nn->h; i < cur_height; i++) { WIDTH(prevs[i], i)++; }
+    DO(nn->h, ranks[i] = pos);
+#endif
+    DO(nn->h, prevs[i] = nn);
     return true;
 }
 
@@ -241,13 +479,338 @@ bool skiplist_set(struct skiplist *sl, void *key, void *value, void **old) {
     return add_or_set(sl, 1, key, value, old);
 }
 
+bool skiplist_build_sorted(struct skiplist *sl,
+        void **keys, void **values, size_t n) {
+    assert(sl);
+    assert(keys || n == 0);
+    /* Check the order first, so nothing is added if it's wrong. */
+    struct skiplist_node *last = sl->tails[0];
+    if (n > 0 && last != sl->head && sl->cmp(keys[0], last->k) <= 0) {
+        return false;
+    }
+    for (size_t j = 1; j < n; j++) {
+        if (sl->cmp(keys[j - 1], keys[j]) > 0) { return false; }
+    }
+
+#if SKIPLIST_INDEXABLE
+    /* Positions of the tails. Their spans are fixed at the end,
+     * rather than for every level on every append. */
+    size_t tailpos[SKIPLIST_MAX_HEIGHT];
+    DO(sl->head->h, tailpos[i] = sl->count + 1 - WIDTH(sl->tails[i], i));
+#endif
+    bool ok = true;
+    for (size_t j = 0; j < n; j++) {
+        uint8_t h = SKIPLIST_CUSTOM_HEIGHT
+          ? SKIPLIST_GEN_HEIGHT() : skiplist_gen_height_r(&sl->rng);
+        struct skiplist_node *nn = node_alloc(sl, h, keys[j],
+            values ? values[j] : NULL);
+        if (nn == NULL) { ok = false; break; }
+        SET_PREFIX(sl, nn);
+        if (h > sl->head->h) {
+#if SKIPLIST_INDEXABLE
+            for (int i = sl->head->h; i < h; i++) { tailpos[i] = 0; }
+#endif
+            if (!grow_head(sl, nn)) {
+                node_free(sl, nn);
+                ok = false;
+                break;
+            }
+        }
+
+        /* Link nn after the tails, in O(h). */
+        sl->count++;
+        SET_BACK(nn, sl->tails[0]);
+        for (int i = 0; i < h; i++) {
+            sl->tails[i]->next[i] = nn;
+#if SKIPLIST_INDEXABLE
+            WIDTH(sl->tails[i], i) = sl->count - tailpos[i];
+            tailpos[i] = sl->count;
+#endif
+            sl->tails[i] = nn;
+        }
+    }
+#if SKIPLIST_INDEXABLE
+    DO(sl->head->h, WIDTH(sl->tails[i], i) = sl->count + 1 - tailpos[i]);
+#endif
+    return ok;
+}
+
+/* Get the order of the N KEYS, as an array of indices, in *ORDER.
+ * It's allocated in *BUF with 2 * N entries (the second half is
+ * scratch), to free with free_order. *ORDER is NULL if the keys are
+ * already in order or allocation fails, and then the batch stays in
+ * input order. Returns whether the batch will be visited in order. */
+static bool sort_keys(struct skiplist *sl, void **keys, size_t n,
+        size_t **order, size_t **buf) {
+    *order = *buf = NULL;
+    size_t j = 1;
+    while (j < n && sl->cmp(keys[j - 1], keys[j]) <= 0) { j++; }
+    if (j >= n) { return true; }
+
+    size_t *idx = sl->alloc(NULL, 0, 2 * n * sizeof(size_t),
+        sl->alloc_udata);
+    if (idx == NULL) { return false; }
+    *buf = idx;
+    size_t *tmp = idx + n;
+    for (j = 0; j < n; j++) { idx[j] = j; }
+
+    /* Bottom-up merge sort, so equal keys keep their order. */
+    for (size_t w = 1; w < n; w *= 2) {
+        for (size_t lo = 0; lo < n; lo += 2 * w) {
+            size_t mid = lo + w < n ? lo + w : n;
+            size_t hi = lo + 2 * w < n ? lo + 2 * w : n;
+            size_t a = lo, b = mid, o = lo;
+            while (a < mid && b < hi) {
+                tmp[o++] = sl->cmp(keys[idx[b]], keys[idx[a]]) < 0
+                  ? idx[b++] : idx[a++];
+            }
+            while (a < mid) { tmp[o++] = idx[a++]; }
+            while (b < hi) { tmp[o++] = idx[b++]; }
+        }
+        size_t *t = idx;
+        idx = tmp;
+        tmp = t;
+    }
+    *order = idx;
+    return true;
+}
+
+static void free_order(struct skiplist *sl, size_t *buf, size_t n) {
+    if (buf) { sl->alloc(buf, 2 * n * sizeof(size_t), 0, sl->alloc_udata); }
+}
+
+/* Point the finger PREVS (and RANKS) at the nodes preceding KEY.
+ * For the FIRST key, or if the batch isn't SORTED and KEY is below
+ * the previous key PREV_KEY, search from the head. */
+static void batch_prevs(struct skiplist *sl, void *key, bool first,
+        void *prev_key, bool sorted,
+        struct skiplist_node **prevs, size_t *ranks) {
+    struct skiplist_node *head = sl->head;
+    if (first || (!sorted && sl->cmp(key, prev_key) < 0)) {
+        init_prevs(sl, key, head, head->h, prevs, ranks);
+    } else {
+        finger_prevs(sl, key, prevs, ranks);
+    }
+}
+
+bool skiplist_add_batch(struct skiplist *sl,
+        void **keys, void **values, size_t n) {
+    assert(sl);
+    assert(keys || n == 0);
+    struct skiplist_node *prevs[SKIPLIST_MAX_HEIGHT];
+    size_t ranks[SKIPLIST_MAX_HEIGHT];
+    DO(SKIPLIST_MAX_HEIGHT, ranks[i] = 0);
+    size_t *order = NULL, *buf = NULL;
+    bool sorted = sort_keys(sl, keys, n, &order, &buf);
+
+    bool ok = true;
+    void *prev_key = NULL;
+    for (size_t j = 0; j < n; j++) {
+        size_t x = order ? order[j] : j;
+        batch_prevs(sl, keys[x], j == 0, prev_key, sorted, prevs, ranks);
+        if (!link_new(sl, keys[x], values ? values[x] : NULL,
+                prevs, ranks)) {
+            ok = false;
+            break;
+        }
+        prev_key = keys[x];
+    }
+    free_order(sl, buf, n);
+    return ok;
+}
+
+size_t skiplist_get_batch(struct skiplist *sl,
+        void **keys, void **values, size_t n) {
+    assert(sl);
+    assert(keys || n == 0);
+    assert(values || n == 0);
+    struct skiplist_node *prevs[SKIPLIST_MAX_HEIGHT];
+    size_t ranks[SKIPLIST_MAX_HEIGHT];
+    DO(SKIPLIST_MAX_HEIGHT, ranks[i] = 0);
+    size_t *order = NULL, *buf = NULL;
+    bool sorted = sort_keys(sl, keys, n, &order, &buf);
+
+    size_t found = 0;
+    void *prev_key = NULL;
+    for (size_t j = 0; j < n; j++) {
+        size_t x = order ? order[j] : j;
+        batch_prevs(sl, keys[x], j == 0, prev_key, sorted, prevs, ranks);
+        struct skiplist_node *n0 = prevs[0]->next[0];
+        if (!IS_SENTINEL(n0) && 0 == sl->cmp(n0->k, keys[x])) {
+            values[x] = n0->v;
+            found++;
+        }
+        prev_key = keys[x];
+    }
+    free_order(sl, buf, n);
+    return found;
+}
+
+/* Append SRC's nodes to DST in O(height), when they all go after
+ * DST's last one. */
+static void merge_append(struct skiplist *dst, struct skiplist *src) {
+    struct skiplist_node *sh = src->head;
+    for (int i = 0; i < sh->h; i++) {
+#if SKIPLIST_INDEXABLE
+        /* SRC's positions are DST's count more in DST. */
+        size_t tailpos = dst->count + 1 - WIDTH(dst->tails[i], i);
+        WIDTH(dst->tails[i], i) = dst->count + WIDTH(sh, i) - tailpos;
+#endif
+        if (IS_SENTINEL(sh->next[i])) { continue; }
+        if (i == 0) { SET_BACK(sh->next[0], dst->tails[0]); }
+        dst->tails[i]->next[i] = sh->next[i];
+        dst->tails[i] = src->tails[i];
+    }
+#if SKIPLIST_INDEXABLE
+    /* Above SRC's height, the spans ending at the sentinel grow. */
+    for (int i = sh->h; i < dst->head->h; i++) {
+        WIDTH(dst->tails[i], i) += src->count;
+    }
+#endif
+}
+
+/* Relink DST's and SRC's nodes into DST, in order, in one pass. Each
+ * node keeps its height; the levels are rebuilt by appending each
+ * node after the tails, as in skiplist_build_sorted. */
+static void merge_all(struct skiplist *dst, struct skiplist *src) {
+    struct skiplist_node *head = dst->head;
+    struct skiplist_node *a = head->next[0], *b = src->head->next[0];
+    size_t count = 0;
+#if SKIPLIST_INDEXABLE
+    size_t tailpos[SKIPLIST_MAX_HEIGHT];
+    DO(head->h, tailpos[i] = 0);
+#endif
+    DO(SKIPLIST_MAX_HEIGHT, dst->tails[i] = head);
+    while (!IS_SENTINEL(a) || !IS_SENTINEL(b)) {
+        struct skiplist_node *n;
+        /* On ties DST's pairs go first, so equal keys keep their
+         * order. */
+        if (IS_SENTINEL(b)
+            || (!IS_SENTINEL(a) && dst->cmp(a->k, b->k) <= 0)) {
+            n = a;
+            a = a->next[0];
+        } else {
+            n = b;
+            b = b->next[0];
+        }
+        count++;
+        SET_BACK(n, dst->tails[0]);
+        for (int i = 0; i < n->h; i++) {
+            dst->tails[i]->next[i] = n;
+#if SKIPLIST_INDEXABLE
+            WIDTH(dst->tails[i], i) = count - tailpos[i];
+            tailpos[i] = count;
+#endif
+            dst->tails[i] = n;
+        }
+    }
+    DO(head->h, dst->tails[i]->next[i] = &SENTINEL);
+#if SKIPLIST_INDEXABLE
+    DO(head->h, WIDTH(dst->tails[i], i) = count + 1 - tailpos[i]);
+#endif
+}
+
+bool skiplist_merge(struct skiplist *dst, struct skiplist *src) {
+    assert(dst);
+    assert(src);
+    if (dst == src || dst->cmp != src->cmp || dst->alloc != src->alloc
+        || dst->alloc_udata != src->alloc_udata) {
+        return false;
+    }
+    if (src->count == 0) { return true; }
+    if (src->head->h > dst->head->h) {
+        if (!grow_head_to(dst, src->head->h)) { return false; }
+    }
+#if SKIPLIST_KEY_PREFIX
+    if (dst->prefix != src->prefix) {
+        struct skiplist_node *n;
+        for (n = src->head->next[0]; !IS_SENTINEL(n); n = n->next[0]) {
+            SET_PREFIX(dst, n);
+        }
+    }
+#endif
+
+    struct skiplist_node *last = dst->tails[0];
+    if (last == dst->head
+        || dst->cmp(last->k, src->head->next[0]->k) <= 0) {
+        merge_append(dst, src);
+    } else {
+        merge_all(dst, src);
+    }
+    dst->count += src->count;
+
+    /* SRC keeps its head, now empty. */
+    DO(src->head->h, src->head->next[i] = &SENTINEL);
+    DO(SKIPLIST_MAX_HEIGHT, src->tails[i] = src->head);
+    src->count = 0;
+#if SKIPLIST_INDEXABLE
+    DO(src->head->h, WIDTH(src->head, i) = 1);
+#endif
+    return true;
+}
+
+struct skiplist *skiplist_split_at(struct skiplist *sl, void *key) {
+    assert(sl);
+    struct skiplist_node *head = sl->head;
+    int height = head->h;
+    struct skiplist_node *prevs[SKIPLIST_MAX_HEIGHT];
+    size_t ranks[SKIPLIST_MAX_HEIGHT];
+
+    /* Allocate everything first, so failure leaves SL as it was. */
+    struct skiplist *nsl = skiplist_new(sl->cmp, sl->alloc, sl->alloc_udata);
+    if (nsl == NULL) { return NULL; }
+    if (height > 1 && !grow_head_to(nsl, height)) {
+        skiplist_free(nsl, NULL, NULL);
+        return NULL;
+    }
+#if SKIPLIST_KEY_PREFIX
+    nsl->prefix = sl->prefix;
+#endif
+    struct skiplist_node *nh = nsl->head;
+
+    init_prevs(sl, key, head, height, prevs, ranks);
+    for (int i = 0; i < height; i++) {
+        struct skiplist_node *first = prevs[i]->next[i];
+#if SKIPLIST_INDEXABLE
+        /* Positions in NSL are ranks[0] less than in SL. */
+        WIDTH(nh, i) = ranks[i] + WIDTH(prevs[i], i) - ranks[0];
+#endif
+        if (IS_SENTINEL(first)) { continue; }
+        if (i == 0) { SET_BACK(first, nh); }
+        nh->next[i] = first;
+        nsl->tails[i] = sl->tails[i];
+        prevs[i]->next[i] = &SENTINEL;
+        sl->tails[i] = prevs[i];
+    }
+
+#if SKIPLIST_INDEXABLE
+    size_t left = ranks[0];
+    DO(height, WIDTH(prevs[i], i) = left + 1 - ranks[i]);
+#else
+    /* Count the shorter part, walking both at once. */
+    size_t left = 0;
+    struct skiplist_node *l = head->next[0], *r = nh->next[0];
+    for (;;) {
+        if (IS_SENTINEL(l)) { break; }
+        if (IS_SENTINEL(r)) { left = sl->count - left; break; }
+        left++;
+        l = l->next[0];
+        r = r->next[0];
+    }
+#endif
+    nsl->count = sl->count - left;
+    sl->count = left;
+    return nsl;
+}
+
 static bool delete_one_or_all(struct skiplist *sl, void *key,
         skiplist_free_cb *cb, void *udata, void **old) {
     assert(sl);
     struct skiplist_node *head = sl->head;
     int cur_height = head->h;
     struct skiplist_node *prevs[cur_height];
-    init_prevs(sl, key, head, cur_height, prevs);
+    size_t ranks[cur_height];
+    init_prevs(sl, key, head, cur_height, prevs, ranks);
 
     struct skiplist_node *doomed = prevs[0]->next[0];
     if (IS_SENTINEL(doomed) || 0 != sl->cmp(doomed->k, key)) {
@@ -255,7 +818,13 @@ static bool delete_one_or_all(struct skiplist *sl, void *key,
     }
 
     if (cb == NULL) {           /* delete one w/ key */
+#if SKIPLIST_INDEXABLE
+        DO(doomed->h, WIDTH(prevs[i], i) += WIDTH(doomed, i) - 1);
+        for (int i = doomed->h; i < cur_height; i++) { WIDTH(prevs[i], i)--; }
+#endif
         DO(doomed->h, prevs[i]->next[i]=doomed->next[i]);
+        SET_BACK(doomed->next[0], prevs[0]);
+        DO(doomed->h, if (sl->tails[i] == doomed) { sl->tails[i] = prevs[i]; });
         if (old) { *old = doomed->v; }
         node_free(sl, doomed);
         sl->count--;
@@ -264,6 +833,10 @@ static bool delete_one_or_all(struct skiplist *sl, void *key,
         int res = 0;
         int tdh = 0;            /* tallest doomed height */
         struct skiplist_node *nexts[cur_height];
+#if SKIPLIST_INDEXABLE
+        size_t pos = ranks[0] + 1, d = 0;
+        size_t nextpos[cur_height];     /* positions of nexts */
+#endif
 
         DO(cur_height, nexts[i] = &SENTINEL);
 
@@ -292,6 +865,10 @@ static bool delete_one_or_all(struct skiplist *sl, void *key,
                 nexts[i] = doomed->next[i]);
             if (SKIPLIST_LOG_LEVEL > 1)
                 DO(tdh, fprintf(stderr, "nexts[%d] = %p\n", i, (void *)nexts[i]));
+#if SKIPLIST_INDEXABLE
+            DO(doomed->h, nextpos[i] = pos + d + WIDTH(doomed, i));
+            d++;
+#endif
 
             cb(key, doomed->v, udata);
             sl->count--;
@@ -305,6 +882,12 @@ static bool delete_one_or_all(struct skiplist *sl, void *key,
         DO(tdh,
             LOG2("setting prevs[%d]->next[%d] to %p\n", i, i, (void *)nexts[i]);
             prevs[i]->next[i] = nexts[i]);
+        SET_BACK(nexts[0], prevs[0]);
+        DO(tdh, if (IS_SENTINEL(nexts[i])) { sl->tails[i] = prevs[i]; });
+#if SKIPLIST_INDEXABLE
+        DO(tdh, WIDTH(prevs[i], i) = nextpos[i] - d - ranks[i]);
+        for (int i = tdh; i < cur_height; i++) { WIDTH(prevs[i], i) -= d; }
+#endif
         return false;
     }
 }
@@ -325,13 +908,15 @@ static struct skiplist_node *get_first_eq_node(struct skiplist *sl, void *key) {
     int height = head->h;
     int lvl = height - 1;
     struct skiplist_node *cur = head, *next = NULL;
+    uint64_t kp = KEY_PREFIX(sl, key);
+    (void)kp;
 
     do {
         assert(cur->h > lvl);
         next = cur->next[lvl];
 
         assert(next->h <= SKIPLIST_MAX_HEIGHT);
-        int res = IS_SENTINEL(next) ? 1 : sl->cmp(next->k, key);
+        int res = IS_SENTINEL(next) ? 1 : NODE_CMP(sl, next, key, kp);
         if (res < 0) {  /* next->key < key, advance */
             cur = next;
         } else if (res >= 0) { /* next->key >= key, descend */
@@ -372,18 +957,8 @@ bool skiplist_first(struct skiplist *sl, void **key, void **value) {
 
 bool skiplist_last(struct skiplist *sl, void **key, void **value) {
     assert(sl);
-    struct skiplist_node *head = sl->head;
-    int lvl = head->h - 1;
-    struct skiplist_node *cur = head->next[lvl];
-    if (IS_SENTINEL(cur)) { return false; }
-    do {
-        struct skiplist_node *next = cur->next[lvl];
-        if (IS_SENTINEL(next)) {
-            lvl--;
-        } else {
-            cur = next;
-        }
-    } while (lvl >= 0);
+    struct skiplist_node *cur = sl->tails[0];
+    if (cur == sl->head) { return false; }
 
     assert(!IS_SENTINEL(cur));
     assert(IS_SENTINEL(cur->next[0]));
@@ -404,7 +979,13 @@ bool skiplist_pop_first(struct skiplist *sl, void **key, void **value) {
     if (value) { *value = first->v; }
     sl->count--;
 
+#if SKIPLIST_INDEXABLE
+    DO(height, WIDTH(head, i) = WIDTH(first, i));
+    for (int i = height; i < head->h; i++) { WIDTH(head, i)--; }
+#endif
     DO(height, head->next[i] = first->next[i]);
+    SET_BACK(head->next[0], head);
+    DO(height, if (sl->tails[i] == first) { sl->tails[i] = head; });
     node_free(sl, first);
     return true;
 }
@@ -412,43 +993,58 @@ bool skiplist_pop_first(struct skiplist *sl, void **key, void **value) {
 bool skiplist_pop_last(struct skiplist *sl, void **key, void **value) {
     assert(sl);
     struct skiplist_node *head = sl->head;
-    struct skiplist_node *prevs[head->h];
-    int lvl = head->h - 1;
-    struct skiplist_node *cur = head;
     if (sl->count == 0) { return false; }
-
-    /* Get all the nodes that are (node -> last -> &SENTINEL) so
-     * node can skip directly to the sentinel. */
-    do {
-        if (IS_SENTINEL(cur->next[lvl])) {
-            prevs[lvl--] = cur;
-        } else {
-            struct skiplist_node *next = cur->next[lvl]->next[lvl];
-            if (IS_SENTINEL(next)) {
-                prevs[lvl--] = cur;
-            } else {
-                cur = cur->next[lvl];
-            }
-        }
-    } while (lvl >= 0);
-
-    cur = cur->next[0];
+    struct skiplist_node *cur = sl->tails[0];
     assert(!IS_SENTINEL(cur));
     assert(IS_SENTINEL(cur->next[0]));
 
-    /* skip over the last non-SENTINEL nodes. */
-    DO(cur->h, assert(prevs[i]->next[i] == cur));
-    DO(cur->h, prevs[i]->next[i] = &SENTINEL);
+    /* The tail a level above cur precedes it, so cur's predecessors
+     * are found by stepping down from there, comparing pointers
+     * rather than keys: O(1) expected steps per level. */
+    int h = cur->h;
+    struct skiplist_node *p = h < head->h ? sl->tails[h] : head;
+    for (int i = h - 1; i >= 0; i--) {
+        while (p->next[i] != cur) { p = p->next[i]; }
+#if SKIPLIST_INDEXABLE
+        WIDTH(p, i) += WIDTH(cur, i) - 1;
+#endif
+        p->next[i] = &SENTINEL;
+        sl->tails[i] = p;
+    }
+#if SKIPLIST_INDEXABLE
+    /* Above cur's height, the span ending at the sentinel shrinks. */
+    for (int i = cur->h; i < head->h; i++) { WIDTH(sl->tails[i], i)--; }
+#endif
 
     if (key) { *key = cur->k; }
     if (value) { *value = cur->v; }
     sl->count--;
-
-    assert(!IS_SENTINEL(cur));
     node_free(sl, cur);
     return true;
 }
 
+size_t skiplist_pop_first_n(struct skiplist *sl, size_t n,
+        void **keys, void **values) {
+    assert(sl);
+    size_t ct = 0;
+    while (ct < n && skiplist_pop_first(sl,
+            keys ? &keys[ct] : NULL, values ? &values[ct] : NULL)) {
+        ct++;
+    }
+    return ct;
+}
+
+size_t skiplist_pop_last_n(struct skiplist *sl, size_t n,
+        void **keys, void **values) {
+    assert(sl);
+    size_t ct = 0;
+    while (ct < n && skiplist_pop_last(sl,
+            keys ? &keys[ct] : NULL, values ? &values[ct] : NULL)) {
+        ct++;
+    }
+    return ct;
+}
+
 size_t skiplist_count(struct skiplist *sl) {
     assert(sl);
     return sl->count;
@@ -484,6 +1080,175 @@ void skiplist_iter_from(struct skiplist *sl, void *key,
     walk_and_apply(cur, cb, udata);
 }
 
+/* Last node with a key < KEY (or <= KEY, if INCLUSIVE), or the head. */
+static struct skiplist_node *get_last_lt_node(struct skiplist *sl,
+        void *key, int inclusive) {
+    assert(sl);
+    struct skiplist_node *cur = sl->head, *next = NULL;
+    uint64_t kp = KEY_PREFIX(sl, key);
+    (void)kp;
+    for (int lvl = cur->h - 1; lvl >= 0; lvl--) {
+        for (;;) {
+            next = cur->next[lvl];
+            if (IS_SENTINEL(next)) { break; }
+            int res = NODE_CMP(sl, next, key, kp);
+            if (res < 0 || (inclusive && res == 0)) {   /* advance */
+                cur = next;
+            } else {                                    /* descend */
+                break;
+            }
+        }
+    }
+    return cur;
+}
+
+void skiplist_iter_range(struct skiplist *sl, void *lo, void *hi,
+        skiplist_iter_cb *cb, void *udata) {
+    assert(sl);
+    assert(cb);
+    struct skiplist_node *cur = get_last_lt_node(sl, lo, 0)->next[0];
+    while (!IS_SENTINEL(cur) && sl->cmp(cur->k, hi) <= 0) {
+        if (cb(cur->k, cur->v, udata) != SKIPLIST_ITER_CONTINUE) { break; }
+        cur = cur->next[0];
+    }
+}
+
+static bool cursor_set(struct skiplist *sl, struct skiplist_cursor *c,
+        struct skiplist_node *n) {
+    c->sl = sl;
+    c->node = (IS_SENTINEL(n) || n == sl->head) ? NULL : n;
+    return c->node != NULL;
+}
+
+bool skiplist_seek_ge(struct skiplist *sl, void *key,
+        struct skiplist_cursor *c) {
+    return cursor_set(sl, c, get_last_lt_node(sl, key, 0)->next[0]);
+}
+
+bool skiplist_seek_gt(struct skiplist *sl, void *key,
+        struct skiplist_cursor *c) {
+    return cursor_set(sl, c, get_last_lt_node(sl, key, 1)->next[0]);
+}
+
+bool skiplist_seek_le(struct skiplist *sl, void *key,
+        struct skiplist_cursor *c) {
+    return cursor_set(sl, c, get_last_lt_node(sl, key, 1));
+}
+
+bool skiplist_seek_lt(struct skiplist *sl, void *key,
+        struct skiplist_cursor *c) {
+    return cursor_set(sl, c, get_last_lt_node(sl, key, 0));
+}
+
+bool skiplist_cursor_first(struct skiplist *sl, struct skiplist_cursor *c) {
+    assert(sl);
+    return cursor_set(sl, c, sl->head->next[0]);
+}
+
+bool skiplist_cursor_last(struct skiplist *sl, struct skiplist_cursor *c) {
+    assert(sl);
+    return cursor_set(sl, c, sl->tails[0]);
+}
+
+bool skiplist_cursor_next(struct skiplist_cursor *c) {
+    assert(c);
+    struct skiplist_node *n = c->node;
+    if (n == NULL) { return false; }
+    return cursor_set(c->sl, c, n->next[0]);
+}
+
+bool skiplist_cursor_prev(struct skiplist_cursor *c) {
+    assert(c);
+    struct skiplist_node *n = c->node;
+    if (n == NULL) { return false; }
+#if SKIPLIST_BACK_POINTERS
+    return cursor_set(c->sl, c, n->prev);
+#else
+    /* The node before n is after the last one with a smaller key,
+     * past any others with an equal key. */
+    struct skiplist_node *prev = get_last_lt_node(c->sl, n->k, 0);
+    while (prev->next[0] != n) { prev = prev->next[0]; }
+    return cursor_set(c->sl, c, prev);
+#endif
+}
+
+bool skiplist_cursor_get(struct skiplist_cursor *c,
+        void **key, void **value) {
+    assert(c);
+    struct skiplist_node *n = c->node;
+    if (n == NULL) { return false; }
+    if (key) { *key = n->k; }
+    if (value) { *value = n->v; }
+    return true;
+}
+
+#if SKIPLIST_INDEXABLE
+/* Node at position POS (the head is at 0), or the sentinel. */
+static struct skiplist_node *get_node_at(struct skiplist *sl, size_t pos) {
+    struct skiplist_node *cur = sl->head;
+    size_t cur_pos = 0;
+    for (int lvl = cur->h - 1; lvl >= 0; lvl--) {
+        while (!IS_SENTINEL(cur->next[lvl])
+            && cur_pos + WIDTH(cur, lvl) <= pos) {
+            cur_pos += WIDTH(cur, lvl);
+            cur = cur->next[lvl];
+        }
+    }
+    return cur_pos == pos ? cur : &SENTINEL;
+}
+
+/* How many nodes have a key < KEY (or <= KEY, if INCLUSIVE)? */
+static size_t count_lt(struct skiplist *sl, void *key, int inclusive) {
+    struct skiplist_node *cur = sl->head, *next = NULL;
+    uint64_t kp = KEY_PREFIX(sl, key);
+    (void)kp;
+    size_t pos = 0;
+    for (int lvl = cur->h - 1; lvl >= 0; lvl--) {
+        for (;;) {
+            next = cur->next[lvl];
+            if (IS_SENTINEL(next)) { break; }
+            int res = NODE_CMP(sl, next, key, kp);
+            if (res < 0 || (inclusive && res == 0)) {   /* advance */
+                pos += WIDTH(cur, lvl);
+                cur = next;
+            } else {                                    /* descend */
+                break;
+            }
+        }
+    }
+    return pos;
+}
+
+bool skiplist_at(struct skiplist *sl, size_t index,
+        void **key, void **value) {
+    assert(sl);
+    if (index >= sl->count) { return false; }
+    struct skiplist_node *n = get_node_at(sl, index + 1);
+    assert(!IS_SENTINEL(n));
+    if (key) { *key = n->k; }
+    if (value) { *value = n->v; }
+    return true;
+}
+
+bool skiplist_seek_at(struct skiplist *sl, size_t index,
+        struct skiplist_cursor *c) {
+    assert(sl);
+    if (index >= sl->count) { return cursor_set(sl, c, &SENTINEL); }
+    return cursor_set(sl, c, get_node_at(sl, index + 1));
+}
+
+size_t skiplist_rank(struct skiplist *sl, void *key) {
+    assert(sl);
+    return count_lt(sl, key, 0);
+}
+
+size_t skiplist_count_range(struct skiplist *sl, void *lo, void *hi) {
+    assert(sl);
+    if (sl->cmp(lo, hi) > 0) { return 0; }
+    return count_lt(sl, hi, 1) - count_lt(sl, lo, 0);
+}
+#endif
+
 size_t skiplist_clear(struct skiplist *sl,
         skiplist_free_cb *cb, void *udata) {
     assert(sl);
@@ -497,6 +1262,11 @@ size_t skiplist_clear(struct skiplist *sl,
         ct++;
     }
     DO(sl->head->h, sl->head->next[i] = &SENTINEL);
+    DO(SKIPLIST_MAX_HEIGHT, sl->tails[i] = sl->head);
+    sl->count = 0;
+#if SKIPLIST_INDEXABLE
+    DO(sl->head->h, WIDTH(sl->head, i) = 1);
+#endif
     return ct;
 }
 
@@ -529,7 +1299,23 @@ void skiplist_debug(struct skiplist *sl, FILE *f,
     int ct = 0, prev_ct = 0;
     for (int i = max_lvl - 1; i>=0; i--) {
         if (f) { fprintf(f, "-- L %d:", i); }
+        assert(IS_SENTINEL(sl->tails[i]->next[i]));
+#if SKIPLIST_INDEXABLE
+        /* Each level's spans add up to the sentinel's position. */
+        size_t span = 0;
+        for (n = head; n != &SENTINEL; n = n->next[i]) {
+            assert(WIDTH(n, i) >= 1);
+            span += WIDTH(n, i);
+        }
+        assert(span == sl->count + 1);
+#endif
         for (n = head->next[i]; n != &SENTINEL; n = n->next[i]) {
+#if SKIPLIST_BACK_POINTERS
+            if (i == 0 && !IS_SENTINEL(n->next[0])) {
+                assert(n->next[0]->prev == n);
+            }
+            if (i == 0 && n == head->next[0]) { assert(n->prev == head); }
+#endif
             if (f) {
                 fprintf(f, " -> %p(%d%s",
                     (void *)n, n->h, cb == NULL ? "" : ":");
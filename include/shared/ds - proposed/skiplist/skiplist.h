@@ -26,6 +26,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "skiplist_config.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -58,20 +60,58 @@ typedef int skiplist_cmp_cb(void *key_a, void *key_b);
 struct skiplist *skiplist_new(skiplist_cmp_cb *cmp,
     skiplist_alloc_cb *alloc, void *alloc_udata);
 
-/* Set the random seed used when randomly constructing skiplists. */
+#if SKIPLIST_KEY_PREFIX
+/* Key prefix callback: map a key to a number that orders the same
+ * way as the cmp callback, as far as it can tell keys apart. If
+ * prefix(a) < prefix(b), cmp(a, b) must be < 0; keys with equal
+ * prefixes are compared with cmp. For strings, this could be their
+ * first 8 bytes, big-endian (see skiplist_prefix_str). */
+typedef uint64_t skiplist_prefix_cb(void *key);
+
+/* Store each key's prefix in its node, so searches compare the
+ * prefixes first, and only read the key (and call cmp) on a tie.
+ * Returns false if SL isn't empty. */
+bool skiplist_set_prefix(struct skiplist *sl, skiplist_prefix_cb *cb);
+
+/* Prefix callback for NUL-terminated string keys, compared with
+ * strcmp: their first 8 bytes, big-endian. */
+uint64_t skiplist_prefix_str(void *key);
+#endif
+
+/* Set the random seed used when randomly constructing skiplists.
+ * Each skiplist has its own generator for node heights, seeded when
+ * created from SEED and how many skiplists were created since, so
+ * lists built in the same order get the same structure. */
 void skiplist_set_seed(unsigned seed);
 
+/* Reseed the height generator of SL. */
+void skiplist_seed(struct skiplist *sl, uint64_t seed);
+
+/* Get a seed for a new height generator (see skiplist_set_seed). */
+uint64_t skiplist_new_seed(void);
+
+/* Randomly generate a node height from the generator *STATE (xorshift,
+ * so the state must not be 0; a seed from skiplist_new_seed is fine):
+ * one level, plus one per SKIPLIST_P_LOG2 trailing 1 bits of the
+ * number drawn. */
+uint8_t skiplist_gen_height_r(uint64_t *state);
+
 /* Randomly generate the height for the next level.
  * Should return between 1 and SKIPLIST_MAX_HEIGHT, inclusive.
  * Returning an illegal height is a checked error.
  *
+ * By default, skiplists use their own generator (see
+ * skiplist_gen_height_r), and this one uses a per-thread generator.
+ * When SKIPLIST_GEN_HEIGHT is replaced, skiplists call it instead.
+ *
  * For the skiplist's invariants to hold, the propability of
  * >= level N should be a constant proportion of the probability
  * of the level beneath it, e.g. prob(>=1) -> 1, prob(>=2) -> 1/2,
  * prob(>=3) -> 1/4, prob(>=4) -> 1/8, etc.
  *
  * SKIPLIST_GEN_HEIGHT can be replaced at compile-time, but
- * defaults to a probability of 0.5 per each additional level.
+ * defaults to a probability of 1 / 2^SKIPLIST_P_LOG2 (0.5, unless
+ * configured) per each additional level.
  */
 uint8_t SKIPLIST_GEN_HEIGHT(void);
 
@@ -79,6 +119,7 @@ uint8_t SKIPLIST_GEN_HEIGHT(void);
  * functionality). KEY and/or VALUE are allowed to be NULL, provided the
  * cmp callback can handle it. If you add multiple values under the same
  * key, they will not necessarily be stored in any particular order.
+ * Adding a key > the last one appends it at the tail, without a search.
  *
  * Returns whether the value was successfully added. */
 bool skiplist_add(struct skiplist *sl, void *key, void *value);
@@ -90,11 +131,55 @@ bool skiplist_add(struct skiplist *sl, void *key, void *value);
 bool skiplist_set(struct skiplist *sl,
     void *key, void *value, void **old);
 
+/* Add N pairs, with keys from KEYS and values from VALUES (or NULL,
+ * if VALUES is NULL), appending each at the tail without a search.
+ * The keys must be in ascending order, and all above the skiplist's
+ * last key, so building a list from sorted input takes O(n). Equal
+ * keys within KEYS are kept in the order given.
+ * Returns false, adding nothing, if the keys are out of order, or
+ * on allocation failure, after adding the pairs before it. */
+bool skiplist_build_sorted(struct skiplist *sl,
+    void **keys, void **values, size_t n);
+
+/* Add N pairs, with keys from KEYS and values from VALUES (or NULL,
+ * if VALUES is NULL), in any order. The batch is sorted first, then
+ * each search starts from the previous key's position rather than
+ * from the head, so keys close together cost few comparisons.
+ * Sorting takes a temporary array of 2 * N size_ts; if that can't be
+ * allocated, the batch is added in input order.
+ * Returns false on allocation failure, after adding some pairs. */
+bool skiplist_add_batch(struct skiplist *sl,
+    void **keys, void **values, size_t n);
+
+/* Move all of SRC's pairs into DST, in O(n + m), reusing their nodes
+ * rather than allocating new ones. Pairs with keys equal to some of
+ * DST's go after them. If all of SRC's keys are >= DST's last one,
+ * it takes O(log n) instead. SRC is left empty, and still has to be
+ * freed. Both lists must have the same cmp and allocator callbacks
+ * (and allocator udata), or it returns false, merging nothing; it
+ * also returns false if DST needs a taller head and it can't be
+ * allocated. */
+bool skiplist_merge(struct skiplist *dst, struct skiplist *src);
+
+/* Split SL at KEY: move the pairs with keys >= KEY into a new skiplist,
+ * with the same callbacks, and return it, keeping the rest in SL.
+ * Unlinking takes O(log n); the pair counts are then known right
+ * away if SL is indexable, or otherwise found by walking the shorter
+ * part. Returns NULL, leaving SL unchanged, on allocation failure. */
+struct skiplist *skiplist_split_at(struct skiplist *sl, void *key);
+
 /* Get the value associated with KEY. If the key is found and VALUE is
  * non-NULL, it will be written into *VALUE.
  * Returns whether the key was found. */
 bool skiplist_get(struct skiplist *sl, void *key, void **value);
 
+/* Get the values of the N KEYS, in any order, writing each one found
+ * into VALUES at the same index (others are left unchanged). Like
+ * skiplist_add_batch, it sorts the batch and starts each search from
+ * the previous one's position. Returns how many keys were found. */
+size_t skiplist_get_batch(struct skiplist *sl,
+    void **keys, void **values, size_t n);
+
 /* Does the skiplist contain KEY? */
 bool skiplist_member(struct skiplist *sl, void *key);
 
@@ -124,10 +209,20 @@ bool skiplist_first(struct skiplist *sl, void **key, void **value);
 bool skiplist_last(struct skiplist *sl, void **key, void **value);
 
 /* Pop the key/value pair off the skiplist with the first/last key. Same
- * return behavior as skiplist_first/last, but also deletes the pair. */
+ * return behavior as skiplist_first/last, but also deletes the pair.
+ * Both take O(1) expected time, and don't call cmp. */
 bool skiplist_pop_first(struct skiplist *sl, void **key, void **value);
 bool skiplist_pop_last(struct skiplist *sl, void **key, void **value);
 
+/* Pop up to N pairs with the first/last keys, in the order popped,
+ * into KEYS and VALUES (either can be NULL). With them, the skiplist
+ * works as a double-ended priority queue. Returns how many pairs
+ * were popped. */
+size_t skiplist_pop_first_n(struct skiplist *sl, size_t n,
+    void **keys, void **values);
+size_t skiplist_pop_last_n(struct skiplist *sl, size_t n,
+    void **keys, void **values);
+
 /* How many pairs are in the skiplist?
  * Returns 0 on error. */
 size_t skiplist_count(struct skiplist *sl);
@@ -150,10 +245,73 @@ skiplist_iter_cb(void *key, void *value, void *udata);
 void skiplist_iter(struct skiplist *sl,
     skiplist_iter_cb *cb, void *udata);
 
-/* Iterate over the skiplist, beginning at KEY. */
+/* Iterate over the skiplist, beginning at KEY. Nothing is visited if
+ * KEY is absent; see skiplist_iter_range to start at the first key
+ * >= KEY instead. */
 void skiplist_iter_from(struct skiplist *sl, void *key,
     skiplist_iter_cb *cb, void *udata);
 
+/* Iterate over the pairs with LO <= key <= HI, in order.
+ * O(log n + k), for k pairs visited. */
+void skiplist_iter_range(struct skiplist *sl, void *lo, void *hi,
+    skiplist_iter_cb *cb, void *udata);
+
+/* Cursor, positioned on a pair of the skiplist or off its ends.
+ * The fields are private. Any change to the skiplist, other than
+ * setting an existing key's value, invalidates its cursors. */
+struct skiplist_cursor {
+    struct skiplist *sl;
+    void *node;             /* NULL when off the ends */
+};
+
+/* Position cursor C on the first pair with a key >= KEY (ge), > KEY
+ * (gt), or on the last with a key <= KEY (le), < KEY (lt), in
+ * O(log n). Returns whether there is such a pair; if not, C is off
+ * the ends. */
+bool skiplist_seek_ge(struct skiplist *sl, void *key,
+    struct skiplist_cursor *c);
+bool skiplist_seek_gt(struct skiplist *sl, void *key,
+    struct skiplist_cursor *c);
+bool skiplist_seek_le(struct skiplist *sl, void *key,
+    struct skiplist_cursor *c);
+bool skiplist_seek_lt(struct skiplist *sl, void *key,
+    struct skiplist_cursor *c);
+
+/* Position cursor C on the first or last pair.
+ * Returns whether the skiplist is non-empty. */
+bool skiplist_cursor_first(struct skiplist *sl, struct skiplist_cursor *c);
+bool skiplist_cursor_last(struct skiplist *sl, struct skiplist_cursor *c);
+
+/* Move cursor C to the next pair, in O(1), or the previous one, in
+ * O(log n) (it seeks the key before), or O(1) with
+ * SKIPLIST_BACK_POINTERS. Returns whether C is still on a pair. */
+bool skiplist_cursor_next(struct skiplist_cursor *c);
+bool skiplist_cursor_prev(struct skiplist_cursor *c);
+
+/* Get the pair under cursor C, in *KEY and *VALUE if non-NULL.
+ * Returns whether C is on a pair. */
+bool skiplist_cursor_get(struct skiplist_cursor *c,
+    void **key, void **value);
+
+#if SKIPLIST_INDEXABLE
+/* Get the pair at INDEX (0-based, in key order) in O(log n), in *KEY
+ * and *VALUE if non-NULL. Returns whether INDEX < the pair count. */
+bool skiplist_at(struct skiplist *sl, size_t index,
+    void **key, void **value);
+
+/* Position cursor C on the pair at INDEX. Returns whether C is on
+ * a pair. */
+bool skiplist_seek_at(struct skiplist *sl, size_t index,
+    struct skiplist_cursor *c);
+
+/* How many pairs have a key < KEY? This is also the index of the
+ * first pair with a key >= KEY. */
+size_t skiplist_rank(struct skiplist *sl, void *key);
+
+/* How many pairs have a key in [LO, HI]? */
+size_t skiplist_count_range(struct skiplist *sl, void *lo, void *hi);
+#endif
+
 /* Clear the skiplist. Returns the number of pairs removed,
  * or 0 on error. */
 size_t skiplist_clear(struct skiplist *sl,
@@ -14,6 +14,13 @@
 #define SKIPLIST_MAX_HEIGHT 28
 #endif
 
+/* Each level holds 1 / 2^SKIPLIST_P_LOG2 of the nodes of the one
+ * below it. At 1 (p = 1/2) nodes have 2 forward pointers on average;
+ * at 2 (p = 1/4), 1.33, for about as many comparisons per search. */
+#ifndef SKIPLIST_P_LOG2
+#define SKIPLIST_P_LOG2 1
+#endif
+
 /* Level for debugging logs.
  * 0 = no logging, 1 = debug, 2 = the firehose. */
 #ifndef SKIPLIST_LOG_LEVEL
@@ -25,13 +32,67 @@
 #define SKIPLIST_DEBUG 0
 #endif
 
+/* Prefetch the next node at each step of a search? Whether it pays
+ * depends on the machine and on how cmp uses the keys. */
+#ifndef SKIPLIST_PREFETCH
+#define SKIPLIST_PREFETCH 0
+#endif
+
+/* Keep the span of each forward pointer, for skiplist_at,
+ * skiplist_rank and skiplist_count_range in O(log n)? This costs
+ * a size_t per pointer and some bookkeeping on every update. */
+#ifndef SKIPLIST_INDEXABLE
+#define SKIPLIST_INDEXABLE 0
+#endif
+
+/* Link each node to its predecessor on the bottom level? Costs a
+ * pointer per node, and makes skiplist_cursor_prev O(1) rather than
+ * a search from the head. */
+#ifndef SKIPLIST_BACK_POINTERS
+#define SKIPLIST_BACK_POINTERS 0
+#endif
+
+/* Store an order-preserving prefix of each key in its node (see
+ * skiplist_set_prefix)? Costs 8 bytes per node, and saves reading
+ * the key behind its pointer on most steps of a search. */
+#ifndef SKIPLIST_KEY_PREFIX
+#define SKIPLIST_KEY_PREFIX 0
+#endif
+
+/* If > 0, the default allocator aligns nodes at least this many
+ * bytes long (tall ones) to this many bytes, a cache line. */
+#ifndef SKIPLIST_CACHE_LINE
+#define SKIPLIST_CACHE_LINE 0
+#endif
+
+/* Bytes per chunk of the slab allocator (skiplist_slab.h). */
+#ifndef SKIPLIST_SLAB_CHUNK
+#define SKIPLIST_SLAB_CHUNK (64 * 1024)
+#endif
+
+/* Objects moved at once between a thread's free lists and the
+ * slab's shared ones. */
+#ifndef SKIPLIST_SLAB_BATCH
+#define SKIPLIST_SLAB_BATCH 32
+#endif
+
+/* Largest object size served from slab size classes (enough for a
+ * node of SKIPLIST_MAX_HEIGHT). */
+#ifndef SKIPLIST_SLAB_MAX_SIZE
+#if SKIPLIST_INDEXABLE
+#define SKIPLIST_SLAB_MAX_SIZE ((2 * SKIPLIST_MAX_HEIGHT + 8) * sizeof(void *))
+#else
+#define SKIPLIST_SLAB_MAX_SIZE ((SKIPLIST_MAX_HEIGHT + 8) * sizeof(void *))
+#endif
+#endif
+
 /* Define a custom random-height-calculation function.
  * 
  * To keep expected skiplist behavior, the probability of a
  * new node having a level >= N should be:
  *     probability(1)   :- 1.
  *     probability(N+1) :- P * probability(N).
- * By default, P is 0.5.
+ * By default, P is 1 / 2^SKIPLIST_P_LOG2.
  */
 /* #define SKIPLIST_GEN_HEIGHT skiplist_gen_height_function */
 
@@ -0,0 +1,687 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Lock-free skiplist, after Fraser's "Practical lock-freedom" and
+ * Herlihy & Shavit's LockFreeSkipList.
+ *
+ * A pair is deleted by swapping its value for DELETED (whoever wins
+ * the swap owns the delete), then marking the low bit of each of its
+ * forward pointers. Marked nodes are unlinked by any search passing
+ * them; each node counts the levels it is still linked in, and the
+ * thread unlinking the last one retires it. Retired nodes are freed
+ * two epochs later, when no thread can still hold a reference.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "skiplist_config.h"
+#include "skiplist_lf.h"
+#include "skiplist_macros_internal.h"
+
+/* The low bit of a forward pointer is set once its node is deleted. */
+#define MARK(p) ((struct lf_node *)((uintptr_t)(p) | 1))
+#define UNMARK(p) ((struct lf_node *)((uintptr_t)(p) & ~(uintptr_t)1))
+#define IS_MARKED(p) (((uintptr_t)(p) & 1) != 0)
+
+#define LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define STORE(p, v) __atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+
+/* Retired nodes a thread keeps before trying to advance the epoch. */
+#define LF_RETIRE_BATCH 64
+
+/* Value of a deleted pair. */
+static char DELETED;
+#define IS_DELETED(v) ((v) == (void *)&DELETED)
+
+struct lf_node {
+    int h;                  /* node height */
+    int links;              /* levels linked, +1 while being inserted */
+    void *k;                /* key */
+    void *v;                /* value, DELETED once deleted */
+    struct lf_node *retired; /* next in its thread's limbo list */
+
+    /* Forward pointers (NULL at the end).
+     * allocated with (h)*sizeof(N*) extra bytes. */
+    struct lf_node *next[];
+};
+
+/* Per-thread state for epoch-based reclamation. */
+struct lf_thread {
+    pthread_t owner;
+    int active;             /* inside an operation */
+    unsigned long epoch;    /* global epoch seen when it began */
+    unsigned ops;
+    uint64_t rng;           /* for node heights */
+    struct lf_node *limbo[3]; /* retired nodes, by global epoch % 3 */
+    size_t nlimbo;
+    struct lf_thread *next;
+};
+
+struct skiplist_lf {
+    size_t count;
+    int height;             /* tallest node ever linked */
+    unsigned long epoch;    /* global epoch */
+    unsigned long id;
+    struct lf_thread *threads;
+    struct lf_node *head;   /* SKIPLIST_MAX_HEIGHT levels, never replaced */
+    skiplist_cmp_cb *cmp;
+    skiplist_alloc_cb *alloc;
+    void *alloc_udata;
+};
+
+/* Per-thread cache of the state for the last list used. */
+static unsigned long next_id = 0;
+static __thread unsigned long tls_id = 0;
+static __thread struct lf_thread *tls_thread = NULL;
+
+static void *def_alloc(void *p,
+        size_t osize, size_t nsize, void *udata) {
+    (void)udata;
+    (void)osize;
+    if (p) {
+        assert(nsize == 0);
+        free(p);
+        return NULL;
+    } else {
+        assert(osize == 0);
+        return malloc(nsize);
+    }
+}
+
+static bool cas_ptr(struct lf_node **p,
+        struct lf_node *old, struct lf_node *new) {
+    return __atomic_compare_exchange_n(p, &old, new, false,
+        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static bool cas_value(void **p, void *old, void *new) {
+    return __atomic_compare_exchange_n(p, &old, new, false,
+        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+/* Allocate a node, counting level 0 (about to be linked) and the
+ * inserting thread as its links. Returns NULL on failure. */
+static struct lf_node *node_alloc(struct skiplist_lf *sl,
+        uint8_t height, void *key, void *value) {
+    assert(height > 0);
+    assert(height <= SKIPLIST_MAX_HEIGHT);
+    size_t size = sizeof(struct lf_node) +
+      height * sizeof(struct lf_node *);
+    struct lf_node *n = sl->alloc(NULL, 0, size, sl->alloc_udata);
+    if (n == NULL) { return NULL; }
+    n->h = height;
+    n->links = 2;
+    n->k = key;
+    n->v = value;
+    n->retired = NULL;
+    LOG2("allocated %d-level node at %p\n", height, (void *)n);
+    DO(height, n->next[i] = NULL);
+    return n;
+}
+
+static void node_free(struct skiplist_lf *sl, struct lf_node *n) {
+    sl->alloc(n, sizeof(*n) + n->h * sizeof(struct lf_node *), 0,
+        sl->alloc_udata);
+}
+
+/* Create a new lock-free skiplist, returns NULL on error. */
+struct skiplist_lf *skiplist_lf_new(skiplist_cmp_cb *cmp,
+        skiplist_alloc_cb *alloc, void *alloc_udata) {
+    if (cmp == NULL) { return NULL; }
+    if (alloc == NULL) { alloc = def_alloc; }
+
+    struct skiplist_lf *sl = alloc(NULL, 0, sizeof(*sl), alloc_udata);
+    if (sl) {
+        sl->count = 0;
+        sl->height = 1;
+        sl->epoch = 0;
+        sl->id = __atomic_add_fetch(&next_id, 1, __ATOMIC_SEQ_CST);
+        sl->threads = NULL;
+        sl->cmp = cmp;
+        sl->alloc = alloc;
+        sl->alloc_udata = alloc_udata;
+
+        /* The head has every level, so it never needs to grow. */
+        struct lf_node *head = node_alloc(sl, SKIPLIST_MAX_HEIGHT,
+            NULL, NULL);
+        if (head == NULL) {
+            alloc(sl, sizeof(*sl), 0, alloc_udata);
+            return NULL;
+        }
+        sl->head = head;
+    }
+    return sl;
+}
+
+/* Get the calling thread's state for SL, registering it on first use.
+ * Returns NULL on allocation failure. */
+static struct lf_thread *get_thread(struct skiplist_lf *sl) {
+    if (tls_id == sl->id) { return tls_thread; }
+    pthread_t self = pthread_self();
+    struct lf_thread *t = LOAD(&sl->threads);
+    while (t && !pthread_equal(t->owner, self)) { t = t->next; }
+
+    if (t == NULL) {
+        t = sl->alloc(NULL, 0, sizeof(*t), sl->alloc_udata);
+        if (t == NULL) { return NULL; }
+        t->owner = self;
+        t->active = 0;
+        t->epoch = LOAD(&sl->epoch);
+        t->ops = 0;
+        t->rng = ((uint64_t)(uintptr_t)t * 0x9E3779B97F4A7C15ULL)
+          ^ sl->id ^ 1;
+        DO(3, t->limbo[i] = NULL);
+        t->nlimbo = 0;
+        struct lf_thread *head = LOAD(&sl->threads);
+        do {
+            t->next = head;
+        } while (!__atomic_compare_exchange_n(&sl->threads, &head, t,
+                false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+    }
+    tls_id = sl->id;
+    tls_thread = t;
+    return t;
+}
+
+/* Free the nodes of one of T's limbo lists. */
+static void reclaim(struct skiplist_lf *sl, struct lf_thread *t, int slot) {
+    struct lf_node *n = t->limbo[slot];
+    t->limbo[slot] = NULL;
+    while (n) {
+        struct lf_node *next = n->retired;
+        node_free(sl, n);
+        t->nlimbo--;
+        n = next;
+    }
+}
+
+/* Advance the global epoch if every active thread has seen it. */
+static void try_advance(struct skiplist_lf *sl) {
+    unsigned long e = __atomic_load_n(&sl->epoch, __ATOMIC_SEQ_CST);
+    for (struct lf_thread *t = LOAD(&sl->threads); t; t = t->next) {
+        if (__atomic_load_n(&t->active, __ATOMIC_SEQ_CST) &&
+            __atomic_load_n(&t->epoch, __ATOMIC_SEQ_CST) != e) {
+            return;
+        }
+    }
+    __atomic_compare_exchange_n(&sl->epoch, &e, e + 1, false,
+        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+/* Begin an operation: until lf_exit, no node reachable now is freed.
+ * The nodes retired two epochs ago are freed. */
+static struct lf_thread *lf_enter(struct skiplist_lf *sl) {
+    struct lf_thread *t = get_thread(sl);
+    if (t == NULL) { return NULL; }
+    STORE(&t->active, 1);
+    unsigned long e = __atomic_load_n(&sl->epoch, __ATOMIC_SEQ_CST);
+    if (t->epoch != e) {
+        STORE(&t->epoch, e);
+        reclaim(sl, t, (e + 1) % 3);
+    }
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return t;
+}
+
+static void lf_exit(struct skiplist_lf *sl, struct lf_thread *t) {
+    STORE(&t->active, 0);
+    if (++t->ops % LF_RETIRE_BATCH == 0) { try_advance(sl); }
+}
+
+/* N is no longer reachable from the list. It goes in the limbo list
+ * of the global epoch: the threads which may still be reading it have
+ * all finished by the time the epoch advances twice. */
+static void retire(struct skiplist_lf *sl, struct lf_thread *t,
+        struct lf_node *n) {
+    int slot = __atomic_load_n(&sl->epoch, __ATOMIC_SEQ_CST) % 3;
+    n->retired = t->limbo[slot];
+    t->limbo[slot] = n;
+    if (++t->nlimbo % LF_RETIRE_BATCH == 0) { try_advance(sl); }
+}
+
+/* One level of N was unlinked (or will never be linked). */
+static void unlinked(struct skiplist_lf *sl, struct lf_thread *t,
+        struct lf_node *n) {
+    if (__atomic_sub_fetch(&n->links, 1, __ATOMIC_SEQ_CST) == 0) {
+        retire(sl, t, n);
+    }
+}
+
+/* Mark every forward pointer of N, top-down. */
+static void mark_node(struct lf_node *n) {
+    for (int lvl = n->h - 1; lvl >= 0; lvl--) {
+        struct lf_node *next;
+        do {
+            next = LOAD(&n->next[lvl]);
+        } while (!IS_MARKED(next) &&
+                 !cas_ptr(&n->next[lvl], next, MARK(next)));
+    }
+}
+
+static uint8_t gen_height(struct lf_thread *t) {
+    return skiplist_gen_height_r(&t->rng);
+}
+
+/* Get the nodes preceding (PREDS) and following (SUCCS) the position
+ * for key on every level, unlinking the marked nodes on the way.
+ * With PAST_EQUAL, the position is after the nodes with KEY rather
+ * than before them, so a marked duplicate behind a live one gets
+ * unlinked too. Returns whether SUCCS[0] has KEY. */
+static bool lf_find(struct skiplist_lf *sl, struct lf_thread *t,
+        void *key, bool past_equal,
+        struct lf_node **preds, struct lf_node **succs) {
+    struct lf_node *pred, *curr, *succ;
+    int height = LOAD(&sl->height);
+retry:
+    pred = sl->head;
+    for (int lvl = height - 1; lvl >= 0; lvl--) {
+        curr = UNMARK(LOAD(&pred->next[lvl]));
+        while (curr) {
+            succ = LOAD(&curr->next[lvl]);
+            while (IS_MARKED(succ)) {   /* curr is deleted, unlink it */
+                if (!cas_ptr(&pred->next[lvl], curr, UNMARK(succ))) {
+                    goto retry;
+                }
+                unlinked(sl, t, curr);
+                curr = UNMARK(succ);
+                if (curr == NULL) { break; }
+                succ = LOAD(&curr->next[lvl]);
+            }
+            if (curr == NULL) { break; }
+            int res = sl->cmp(curr->k, key);
+            if (res < 0 || (res == 0 && past_equal)) {  /* advance */
+                pred = curr;
+                curr = succ;
+            } else {                                    /* descend */
+                break;
+            }
+        }
+        preds[lvl] = pred;
+        succs[lvl] = curr;
+    }
+    return succs[0] && sl->cmp(succs[0]->k, key) == 0;
+}
+
+/* First node with KEY or after it, without modifying the list. */
+static struct lf_node *lf_seek(struct skiplist_lf *sl, void *key) {
+    struct lf_node *pred = sl->head, *curr = NULL, *succ;
+    for (int lvl = LOAD(&sl->height) - 1; lvl >= 0; lvl--) {
+        curr = UNMARK(LOAD(&pred->next[lvl]));
+        while (curr) {
+            succ = LOAD(&curr->next[lvl]);
+            if (IS_MARKED(succ)) {              /* deleted, skip it */
+                curr = UNMARK(succ);
+            } else if (sl->cmp(curr->k, key) < 0) {
+                pred = curr;
+                curr = succ;
+            } else {
+                break;
+            }
+        }
+    }
+    return curr;
+}
+
+/* The first pair at or after N still present, or NULL. */
+static struct lf_node *live_from(struct lf_node *n, void **value) {
+    while (n) {
+        struct lf_node *next = LOAD(&n->next[0]);
+        if (!IS_MARKED(next)) {
+            void *v = LOAD(&n->v);
+            if (!IS_DELETED(v)) {
+                if (value) { *value = v; }
+                return n;
+            }
+        }
+        n = UNMARK(next);
+    }
+    return NULL;
+}
+
+static void raise_height(struct skiplist_lf *sl, int h) {
+    int cur = LOAD(&sl->height);
+    while (cur < h && !__atomic_compare_exchange_n(&sl->height, &cur, h,
+            false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {}
+}
+
+static bool add_or_set(struct skiplist_lf *sl, int try_replace,
+        void *key, void *value, void **old) {
+    assert(sl);
+    struct lf_thread *t = lf_enter(sl);
+    if (t == NULL) { return false; }
+    struct lf_node *preds[SKIPLIST_MAX_HEIGHT];
+    struct lf_node *succs[SKIPLIST_MAX_HEIGHT];
+    struct lf_node *nn = NULL;
+    uint8_t new_height = gen_height(t);
+    raise_height(sl, new_height);
+
+    for (;;) {
+        bool found = lf_find(sl, t, key, false, preds, succs);
+        if (try_replace && found) {
+            struct lf_node *n = succs[0];
+            void *v = LOAD(&n->v);
+            if (IS_DELETED(v)) {    /* being deleted, help it along */
+                mark_node(n);
+                continue;
+            }
+            if (!cas_value(&n->v, v, value)) { continue; }
+            if (old) { *old = v; }
+            if (nn) { node_free(sl, nn); }
+            lf_exit(sl, t);
+            return true;
+        }
+        if (try_replace && old) { *old = NULL; }
+
+        if (nn == NULL) {
+            nn = node_alloc(sl, new_height, key, value);
+            if (nn == NULL) {
+                lf_exit(sl, t);
+                return false;
+            }
+        }
+        DO(new_height, nn->next[i] = succs[i]);
+        /* Linking level 0 adds the pair. */
+        if (cas_ptr(&preds[0]->next[0], succs[0], nn)) { break; }
+    }
+    __atomic_add_fetch(&sl->count, 1, __ATOMIC_SEQ_CST);
+
+    /* Link the other levels, unless it gets deleted meanwhile. The
+     * extra link held until then keeps it from being retired while
+     * the count is raised for each level. */
+    for (int lvl = 1; lvl < new_height; lvl++) {
+        __atomic_add_fetch(&nn->links, 1, __ATOMIC_SEQ_CST);
+        for (;;) {
+            struct lf_node *next = LOAD(&nn->next[lvl]);
+            if (IS_MARKED(next) || (next != succs[lvl] &&
+                    !cas_ptr(&nn->next[lvl], next, succs[lvl]))) {
+                unlinked(sl, t, nn);
+                goto done;
+            }
+            if (cas_ptr(&preds[lvl]->next[lvl], succs[lvl], nn)) { break; }
+            (void)lf_find(sl, t, key, false, preds, succs);
+        }
+    }
+done:
+    unlinked(sl, t, nn);
+    lf_exit(sl, t);
+    return true;
+}
+
+bool skiplist_lf_add(struct skiplist_lf *sl, void *key, void *value) {
+    return add_or_set(sl, 0, key, value, NULL);
+}
+
+bool skiplist_lf_set(struct skiplist_lf *sl,
+        void *key, void *value, void **old) {
+    return add_or_set(sl, 1, key, value, old);
+}
+
+/* Delete the pair of N (returning its value in *VALUE) if no other
+ * thread deleted it first. */
+static bool delete_node(struct skiplist_lf *sl, struct lf_thread *t,
+        struct lf_node *n, void **value) {
+    void *v = LOAD(&n->v);
+    if (IS_DELETED(v) || !cas_value(&n->v, v, &DELETED)) {
+        return false;
+    }
+    mark_node(n);
+    __atomic_sub_fetch(&sl->count, 1, __ATOMIC_SEQ_CST);
+    if (value) { *value = v; }
+
+    /* Unlink it, wherever it is among its equal keys. */
+    struct lf_node *preds[SKIPLIST_MAX_HEIGHT];
+    struct lf_node *succs[SKIPLIST_MAX_HEIGHT];
+    (void)lf_find(sl, t, n->k, true, preds, succs);
+    return true;
+}
+
+bool skiplist_lf_delete(struct skiplist_lf *sl, void *key, void **value) {
+    assert(sl);
+    struct lf_thread *t = lf_enter(sl);
+    if (t == NULL) { return false; }
+    struct lf_node *preds[SKIPLIST_MAX_HEIGHT];
+    struct lf_node *succs[SKIPLIST_MAX_HEIGHT];
+    bool found;
+    do {
+        found = lf_find(sl, t, key, false, preds, succs);
+        if (found && IS_DELETED(LOAD(&succs[0]->v))) {
+            mark_node(succs[0]);    /* help the other delete */
+            continue;
+        }
+    } while (found && !delete_node(sl, t, succs[0], value));
+    lf_exit(sl, t);
+    return found;
+}
+
+void skiplist_lf_delete_all(struct skiplist_lf *sl, void *key,
+        skiplist_free_cb *cb, void *udata) {
+    assert(cb);
+    void *v = NULL;
+    while (skiplist_lf_delete(sl, key, &v)) { cb(key, v, udata); }
+}
+
+bool skiplist_lf_get(struct skiplist_lf *sl, void *key, void **value) {
+    assert(sl);
+    struct lf_thread *t = lf_enter(sl);
+    if (t == NULL) { return false; }
+    struct lf_node *n = live_from(lf_seek(sl, key), value);
+    bool found = n && sl->cmp(n->k, key) == 0;
+    lf_exit(sl, t);
+    return found;
+}
+
+bool skiplist_lf_member(struct skiplist_lf *sl, void *key) {
+    return skiplist_lf_get(sl, key, NULL);
+}
+
+bool skiplist_lf_first(struct skiplist_lf *sl, void **key, void **value) {
+    assert(sl);
+    struct lf_thread *t = lf_enter(sl);
+    if (t == NULL) { return false; }
+    struct lf_node *n = live_from(UNMARK(LOAD(&sl->head->next[0])), value);
+    if (n && key) { *key = n->k; }
+    lf_exit(sl, t);
+    return n != NULL;
+}
+
+/* The last node still present, or NULL. */
+static struct lf_node *last_node(struct skiplist_lf *sl) {
+    struct lf_node *cur = sl->head;
+    for (int lvl = LOAD(&sl->height) - 1; lvl > 0; lvl--) {
+        struct lf_node *next = UNMARK(LOAD(&cur->next[lvl]));
+        while (next) {
+            struct lf_node *after = LOAD(&next->next[lvl]);
+            if (!IS_MARKED(after)) { cur = next; }
+            next = UNMARK(after);
+        }
+    }
+    /* The last node with a live pair on level 0, from cur. If cur
+     * and everything after it were deleted meanwhile, start over
+     * from the head. */
+    struct lf_node *last = NULL;
+    for (int pass = 0; pass < 2 && last == NULL; pass++) {
+        struct lf_node *n = live_from(pass == 0 && cur != sl->head
+            ? cur : UNMARK(LOAD(&sl->head->next[0])), NULL);
+        while (n) {
+            last = n;
+            n = live_from(UNMARK(LOAD(&n->next[0])), NULL);
+        }
+    }
+    return last;
+}
+
+bool skiplist_lf_last(struct skiplist_lf *sl, void **key, void **value) {
+    assert(sl);
+    struct lf_thread *t = lf_enter(sl);
+    if (t == NULL) { return false; }
+    struct lf_node *n = last_node(sl);
+    if (n) {
+        if (key) { *key = n->k; }
+        if (value) { *value = LOAD(&n->v); }
+    }
+    lf_exit(sl, t);
+    return n != NULL;
+}
+
+static bool pop_first_or_last(struct skiplist_lf *sl, int last,
+        void **key, void **value) {
+    assert(sl);
+    struct lf_thread *t = lf_enter(sl);
+    if (t == NULL) { return false; }
+    struct lf_node *n;
+    do {
+        n = last ? last_node(sl)
+          : live_from(UNMARK(LOAD(&sl->head->next[0])), NULL);
+    } while (n && !delete_node(sl, t, n, value));
+    if (n && key) { *key = n->k; }
+    lf_exit(sl, t);
+    return n != NULL;
+}
+
+bool skiplist_lf_pop_first(struct skiplist_lf *sl, void **key, void **value) {
+    return pop_first_or_last(sl, 0, key, value);
+}
+
+bool skiplist_lf_pop_last(struct skiplist_lf *sl, void **key, void **value) {
+    return pop_first_or_last(sl, 1, key, value);
+}
+
+size_t skiplist_lf_count(struct skiplist_lf *sl) {
+    assert(sl);
+    return __atomic_load_n(&sl->count, __ATOMIC_SEQ_CST);
+}
+
+bool skiplist_lf_empty(struct skiplist_lf *sl) {
+    return (skiplist_lf_count(sl) == 0);
+}
+
+static void walk_and_apply(struct skiplist_lf *sl, struct lf_node *cur,
+        skiplist_iter_cb *cb, void *udata) {
+    void *v = NULL;
+    (void)sl;
+    while ((cur = live_from(cur, &v)) != NULL) {
+        enum skiplist_iter_res res;
+        res = cb(cur->k, v, udata);
+        if (res != SKIPLIST_ITER_CONTINUE) { break; }
+        cur = UNMARK(LOAD(&cur->next[0]));
+    }
+}
+
+void skiplist_lf_iter(struct skiplist_lf *sl,
+        skiplist_iter_cb *cb, void *udata) {
+    assert(sl);
+    assert(cb);
+    struct lf_thread *t = lf_enter(sl);
+    if (t == NULL) { return; }
+    walk_and_apply(sl, UNMARK(LOAD(&sl->head->next[0])), cb, udata);
+    lf_exit(sl, t);
+}
+
+void skiplist_lf_iter_from(struct skiplist_lf *sl, void *key,
+        skiplist_iter_cb *cb, void *udata) {
+    assert(sl);
+    assert(cb);
+    struct lf_thread *t = lf_enter(sl);
+    if (t == NULL) { return; }
+    struct lf_node *cur = live_from(lf_seek(sl, key), NULL);
+    LOG2("first node is %p\n", (void *)cur);
+    if (cur && sl->cmp(cur->k, key) == 0) {
+        walk_and_apply(sl, cur, cb, udata);
+    }
+    lf_exit(sl, t);
+}
+
+size_t skiplist_lf_clear(struct skiplist_lf *sl,
+        skiplist_free_cb *cb, void *udata) {
+    assert(sl);
+    size_t ct = 0;
+    void *k = NULL, *v = NULL;
+    while (skiplist_lf_pop_first(sl, &k, &v)) {
+        if (cb) { cb(k, v, udata); }
+        ct++;
+    }
+    return ct;
+}
+
+size_t skiplist_lf_free(struct skiplist_lf *sl,
+        skiplist_free_cb *cb, void *udata) {
+    assert(sl);
+    size_t ct = skiplist_lf_clear(sl, cb, udata);
+
+    /* Nobody else uses the list anymore: unlink the nodes still
+     * marked, then free everything retired. */
+    struct lf_thread *t = lf_enter(sl);
+    struct lf_node *preds[SKIPLIST_MAX_HEIGHT];
+    struct lf_node *succs[SKIPLIST_MAX_HEIGHT];
+    for (int lvl = sl->height - 1; lvl >= 0; lvl--) {
+        struct lf_node *n;
+        while ((n = sl->head->next[lvl]) != NULL) {
+            (void)lf_find(sl, t, n->k, false, preds, succs);
+        }
+    }
+    lf_exit(sl, t);
+    struct lf_thread *th = sl->threads;
+    while (th) {
+        struct lf_thread *next = th->next;
+        DO(3, reclaim(sl, th, i));
+        sl->alloc(th, sizeof(*th), 0, sl->alloc_udata);
+        th = next;
+    }
+    tls_id = 0;
+    node_free(sl, sl->head);
+    sl->alloc(sl, sizeof(*sl), 0, sl->alloc_udata);
+    return ct;
+}
+
+#if SKIPLIST_DEBUG
+void skiplist_lf_debug(struct skiplist_lf *sl, FILE *f,
+        skiplist_fprintf_kv_cb *cb, void *udata) {
+    assert(sl);
+    int max_lvl = sl->height;
+    if (f) {
+        fprintf(f, "max level is %d, epoch %lu\n", max_lvl, sl->epoch);
+    }
+
+    int prev_ct = 0;
+    for (int i = max_lvl - 1; i >= 0; i--) {
+        int ct = 0;
+        struct lf_node *prev = NULL;
+        if (f) { fprintf(f, "-- L %d:", i); }
+        for (struct lf_node *n = UNMARK(sl->head->next[i]); n;
+             n = UNMARK(n->next[i])) {
+            if (f) {
+                fprintf(f, " -> %p(%d%s%s", (void *)n, n->h,
+                    IS_MARKED(n->next[i]) ? ",deleted" : "",
+                    cb == NULL ? "" : ":");
+                if (cb) { cb(f, n->k, n->v, udata); }
+                fprintf(f, ")");
+            }
+            assert(n->h > i);
+            assert(prev == NULL || sl->cmp(prev->k, n->k) <= 0);
+            prev = n;
+            ct++;
+        }
+        if (prev_ct != 0) { assert(ct >= prev_ct); }
+        prev_ct = ct;
+        if (f) { fprintf(f, " -> NULL\n"); }
+    }
+}
+#endif
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Lock-free concurrent variant of the skiplist.
+ *
+ * Same interface as skiplist.h, with a skiplist_lf_ prefix. Every
+ * operation may be called from any number of threads at once, except
+ * skiplist_lf_free (and skiplist_lf_debug), which need the list to no
+ * longer be in use. Gets, inserts and deletes are lock-free: forward
+ * pointers are linked with compare-and-swap, and deleted nodes are
+ * marked, unlinked by whichever thread passes them, then freed once
+ * no thread can still be reading them (epoch-based reclamation).
+ *
+ * Counts are exact when the list is quiescent; iteration sees every
+ * pair present for its whole duration, and may or may not see the
+ * pairs added or deleted meanwhile.
+ *
+ * The allocation callback must be thread-safe. Requires GCC or Clang
+ * (__atomic builtins, __thread) and pthreads.
+ */
+
+#ifndef SKIPLIST_LF_H
+#define SKIPLIST_LF_H
+
+#include "skiplist.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Opaque lock-free skiplist type. */
+struct skiplist_lf;
+
+/* Create a new lock-free skiplist, returns NULL on error.
+ * See skiplist_new. */
+struct skiplist_lf *skiplist_lf_new(skiplist_cmp_cb *cmp,
+    skiplist_alloc_cb *alloc, void *alloc_udata);
+
+/* Add a key/value pair to the skiplist. Equal keys will be kept.
+ * Returns whether the value was successfully added. */
+bool skiplist_lf_add(struct skiplist_lf *sl, void *key, void *value);
+
+/* Set a key/value pair in the skiplist, replacing an existing
+ * value if present. If OLD is non-NULL, then *old will be set
+ * to the previous value, or NULL if it was not present. */
+bool skiplist_lf_set(struct skiplist_lf *sl,
+    void *key, void *value, void **old);
+
+/* Get the value associated with KEY. If the key is found and VALUE is
+ * non-NULL, it will be written into *VALUE.
+ * Returns whether the key was found. */
+bool skiplist_lf_get(struct skiplist_lf *sl, void *key, void **value);
+
+/* Does the skiplist contain KEY? */
+bool skiplist_lf_member(struct skiplist_lf *sl, void *key);
+
+/* Delete an association for KEY in the skiplist.
+ * If found and VALUE is non-NULL, the old value will be
+ * written to *VALUE.
+ * Returns whether the key was found. */
+bool skiplist_lf_delete(struct skiplist_lf *sl, void *key, void **value);
+
+/* Delete all associations for KEY in the skiplist. The callback is
+ * called for each key/value pair, and cannot be NULL. */
+void skiplist_lf_delete_all(struct skiplist_lf *sl, void *key,
+    skiplist_free_cb *cb, void *udata);
+
+/* Get the first or last pair from the skiplist.
+ * Returns whether a pair was found. */
+bool skiplist_lf_first(struct skiplist_lf *sl, void **key, void **value);
+bool skiplist_lf_last(struct skiplist_lf *sl, void **key, void **value);
+
+/* Pop the key/value pair off the skiplist with the first/last key. */
+bool skiplist_lf_pop_first(struct skiplist_lf *sl, void **key, void **value);
+bool skiplist_lf_pop_last(struct skiplist_lf *sl, void **key, void **value);
+
+/* How many pairs are in the skiplist? */
+size_t skiplist_lf_count(struct skiplist_lf *sl);
+
+/* Is the skiplist empty? */
+bool skiplist_lf_empty(struct skiplist_lf *sl);
+
+/* Iterate over the skiplist, from the start or beginning at KEY.
+ * See skiplist_iter. The callback must not call skiplist_lf_free. */
+void skiplist_lf_iter(struct skiplist_lf *sl,
+    skiplist_iter_cb *cb, void *udata);
+void skiplist_lf_iter_from(struct skiplist_lf *sl, void *key,
+    skiplist_iter_cb *cb, void *udata);
+
+/* Clear the skiplist. Returns the number of pairs removed. */
+size_t skiplist_lf_clear(struct skiplist_lf *sl,
+    skiplist_free_cb *cb, void *udata);
+
+/* Clear and free the skiplist. No other thread may be using it.
+ * Returns the number of pairs removed. */
+size_t skiplist_lf_free(struct skiplist_lf *sl,
+    skiplist_free_cb *cb, void *udata);
+
+#if SKIPLIST_DEBUG
+#include <stdio.h>
+
+/* Do an internal consistency check, on a quiescent skiplist.
+ * Prints debugging info to F (if non-NULL). */
+void skiplist_lf_debug(struct skiplist_lf *sl, FILE *f,
+    skiplist_fprintf_kv_cb *cb, void *udata);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -19,4 +19,10 @@
 #define DO(count, block)                                \
         { for(int i=0; i<count; i++) { block; } }
 
+#if SKIPLIST_PREFETCH && defined(__GNUC__)
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p) ((void)0)
+#endif
+
 #endif
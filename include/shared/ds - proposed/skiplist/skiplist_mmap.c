@@ -0,0 +1,470 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "skiplist_config.h"
+#include "skiplist_mmap.h"
+#include "skiplist_macros_internal.h"
+
+#define MMAP_MAGIC "SKLMMAP"
+#define MMAP_VERSION 2
+#define MMAP_MIN_SIZE (64 * 1024)
+/* Size classes: blocks of 32 bytes, 64, ..., 2^(5 + MMAP_CLASSES - 1). */
+#define MMAP_MIN_BLOCK 32
+#define MMAP_CLASSES 48
+
+/* File header, at offset 0. Offset 0 is never a block, so it means
+ * "none" (the sentinel) in links. */
+struct mmap_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t dirty;         /* changed since the last commit? */
+    uint64_t used;          /* end of the blocks carved so far */
+    uint64_t count;
+    uint64_t head;          /* offset of the head node */
+    uint64_t height;        /* levels in use */
+    uint64_t rng;           /* height generator state */
+    uint64_t free[MMAP_CLASSES];    /* free lists, by size class */
+};
+
+#define HEADER_SIZE ((sizeof(struct mmap_header) + 63) & ~(size_t)63)
+
+struct mmap_node {
+    uint32_t h;             /* node height */
+    uint32_t klen;          /* the key follows next[h] */
+    uint64_t vofs;          /* value block, 0, or the value (see VALUE) */
+    uint64_t vlen;
+    uint64_t next[];        /* forward links, as offsets */
+};
+
+struct skiplist_mmap {
+    int fd;
+    char *base;
+    size_t size;            /* mapped (and file) size */
+    skiplist_mmap_cmp_cb *cmp;
+};
+
+#define HDR(m) ((struct mmap_header *) (m)->base)
+#define NODE(m, ofs) ((struct mmap_node *) ((m)->base + (ofs)))
+
+/* Values that fit in vofs are kept there, saving a block (32 bytes,
+ * at least) and a jump to it. */
+#define IS_INLINE(vlen) ((vlen) <= sizeof(uint64_t))
+#define VALUE(m, n) ((n)->vlen == 0 ? NULL                             \
+      : IS_INLINE((n)->vlen) ? (const void *) &(n)->vofs               \
+      : (const void *) ((m)->base + (n)->vofs))
+#define NODE_KEY(n) ((const char *) &(n)->next[(n)->h])
+#define NODE_SIZE(h, klen) (sizeof(struct mmap_node) \
+    + (h) * sizeof(uint64_t) + (klen))
+
+static int def_cmp(const void *k1, size_t len1,
+        const void *k2, size_t len2) {
+    int res = memcmp(k1, k2, len1 < len2 ? len1 : len2);
+    if (res != 0) { return res; }
+    return len1 < len2 ? -1 : len1 > len2 ? 1 : 0;
+}
+
+static size_t size_class(size_t size, size_t *block) {
+    size_t c = 0, b = MMAP_MIN_BLOCK;
+    while (b < size) { b <<= 1; c++; }
+    *block = b;
+    return c;
+}
+
+/* Extend the file and remap it, to at least NEED bytes. The mapping
+ * may move. */
+static bool grow(struct skiplist_mmap *m, size_t need) {
+    size_t nsize = m->size;
+    long page = sysconf(_SC_PAGESIZE);
+    while (nsize < need) { nsize *= 2; }
+    nsize = (nsize + page - 1) & ~((size_t) page - 1);
+    if (ftruncate(m->fd, (off_t) nsize) != 0) { return false; }
+    char *nbase = mmap(NULL, nsize, PROT_READ | PROT_WRITE, MAP_SHARED,
+        m->fd, 0);
+    if (nbase == MAP_FAILED) { return false; }
+    munmap(m->base, m->size);
+    LOG2("grew file from %zd to %zd bytes\n", m->size, nsize);
+    m->base = nbase;
+    m->size = nsize;
+    return true;
+}
+
+void *skiplist_mmap_alloc(void *p, size_t osize, size_t nsize, void *udata) {
+    struct skiplist_mmap *m = (struct skiplist_mmap *) udata;
+    assert(m);
+    size_t block = 0;
+    if (p) {                    /* free */
+        assert(nsize == 0);
+        size_t c = size_class(osize, &block);
+        uint64_t ofs = skiplist_mmap_offset(m, p);
+        *(uint64_t *) p = HDR(m)->free[c];
+        HDR(m)->free[c] = ofs;
+        return NULL;
+    }
+
+    size_t c = size_class(nsize, &block);
+    if (c >= MMAP_CLASSES) { return NULL; }
+    uint64_t ofs = HDR(m)->free[c];
+    if (ofs != 0) {
+        HDR(m)->free[c] = *(uint64_t *) (m->base + ofs);
+        return m->base + ofs;
+    }
+    ofs = HDR(m)->used;
+    if (ofs + block > m->size && !grow(m, ofs + block)) { return NULL; }
+    HDR(m)->used = ofs + block;
+    return m->base + ofs;
+}
+
+uint64_t skiplist_mmap_offset(struct skiplist_mmap *m, void *p) {
+    assert(m);
+    assert((char *) p >= m->base && (char *) p < m->base + m->size);
+    return (uint64_t) ((char *) p - m->base);
+}
+
+void *skiplist_mmap_ptr(struct skiplist_mmap *m, uint64_t offset) {
+    assert(m);
+    assert(offset < m->size);
+    return m->base + offset;
+}
+
+/* Allocate a block of SIZE bytes, returning its offset, or 0. */
+static uint64_t alloc_block(struct skiplist_mmap *m, size_t size) {
+    void *p = skiplist_mmap_alloc(NULL, 0, size, m);
+    return p ? skiplist_mmap_offset(m, p) : 0;
+}
+
+static void free_block(struct skiplist_mmap *m, uint64_t ofs, size_t size) {
+    if (ofs != 0) { skiplist_mmap_alloc(m->base + ofs, size, 0, m); }
+}
+
+/* Mark the file as changed since the last commit, on disk, before
+ * changing anything else. */
+static void mark_dirty(struct skiplist_mmap *m) {
+    if (HDR(m)->dirty) { return; }
+    HDR(m)->dirty = 1;
+    msync(m->base, HEADER_SIZE, MS_SYNC);
+}
+
+/* Relink every level above the bottom one from the bottom one, and
+ * recount, after a crash mid-update. Drops the free lists, which may
+ * be inconsistent, so the space they held isn't reused. */
+static void recover(struct skiplist_mmap *m) {
+    struct mmap_header *hdr = HDR(m);
+    struct mmap_node *head = NODE(m, hdr->head);
+    uint64_t tails[SKIPLIST_MAX_HEIGHT];
+    uint64_t ct = 0, height = 1, most = hdr->used / MMAP_MIN_BLOCK;
+    int hh = (int) head->h;
+    LOG1("recovering %zd-byte file\n", m->size);
+
+    DO(hh, tails[i] = hdr->head);
+    uint64_t ofs = head->next[0];
+    while (ofs != 0) {
+        struct mmap_node *n = NODE(m, ofs);
+        if (ofs < HEADER_SIZE || ofs >= hdr->used
+            || n->h == 0 || (int) n->h > hh || ct == most) {
+            break;              /* a link never written; stop here */
+        }
+        uint64_t next = n->next[0];
+        for (int i = 0; i < (int) n->h; i++) {
+            NODE(m, tails[i])->next[i] = ofs;
+            tails[i] = ofs;
+        }
+        if (n->h > height) { height = n->h; }
+        ct++;
+        ofs = next;
+    }
+    DO(hh, NODE(m, tails[i])->next[i] = 0);
+    hdr->count = ct;
+    hdr->height = height;
+    DO(MMAP_CLASSES, hdr->free[i] = 0);
+}
+
+struct skiplist_mmap *skiplist_mmap_open(const char *path,
+        skiplist_mmap_cmp_cb *cmp) {
+    assert(path);
+    struct skiplist_mmap *m = malloc(sizeof(*m));
+    if (m == NULL) { return NULL; }
+    m->cmp = cmp ? cmp : def_cmp;
+    m->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (m->fd < 0) { goto fail; }
+    struct stat st;
+    if (fstat(m->fd, &st) != 0) { goto fail_fd; }
+    bool create = st.st_size == 0;
+    if (create) {
+        if (ftruncate(m->fd, MMAP_MIN_SIZE) != 0) { goto fail_fd; }
+        m->size = MMAP_MIN_SIZE;
+    } else if ((size_t) st.st_size < HEADER_SIZE) {
+        errno = EINVAL;
+        goto fail_fd;
+    } else {
+        m->size = (size_t) st.st_size;
+    }
+    m->base = mmap(NULL, m->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        m->fd, 0);
+    if (m->base == MAP_FAILED) { goto fail_fd; }
+    struct mmap_header *hdr = HDR(m);
+
+    if (create) {
+        memset(hdr, 0, HEADER_SIZE);
+        memcpy(hdr->magic, MMAP_MAGIC, sizeof(MMAP_MAGIC));
+        hdr->version = MMAP_VERSION;
+        hdr->used = HEADER_SIZE;
+        hdr->height = 1;
+        hdr->rng = skiplist_new_seed() | 1;
+        /* The head is full height, so it never has to grow. */
+        size_t size = NODE_SIZE(SKIPLIST_MAX_HEIGHT, 0);
+        uint64_t head = alloc_block(m, size);
+        assert(head != 0);      /* fits in MMAP_MIN_SIZE */
+        memset(NODE(m, head), 0, size);
+        NODE(m, head)->h = SKIPLIST_MAX_HEIGHT;
+        HDR(m)->head = head;
+        if (!skiplist_mmap_commit(m)) { goto fail_map; }
+    } else if (memcmp(hdr->magic, MMAP_MAGIC, sizeof(MMAP_MAGIC)) != 0
+        || hdr->version != MMAP_VERSION
+        || hdr->used > m->size || hdr->head < HEADER_SIZE
+        || hdr->head >= hdr->used
+        || NODE(m, hdr->head)->h > SKIPLIST_MAX_HEIGHT) {
+        errno = EINVAL;
+        goto fail_map;
+    } else if (hdr->dirty) {
+        recover(m);
+    }
+    return m;
+
+fail_map:
+    munmap(m->base, m->size);
+fail_fd: {
+        int e = errno;
+        close(m->fd);
+        errno = e;
+    }
+fail:
+    free(m);
+    return NULL;
+}
+
+/* Get the offsets of the nodes preceding the position for KEY, on
+ * every level of the head. Returns the first node >= KEY, or 0. */
+static uint64_t find_prevs(struct skiplist_mmap *m, const void *key,
+        size_t klen, uint64_t *prevs) {
+    struct mmap_header *hdr = HDR(m);
+    uint64_t cur = hdr->head;
+    int hh = (int) NODE(m, cur)->h;
+    for (int lvl = hh - 1; lvl >= (int) hdr->height; lvl--) {
+        prevs[lvl] = cur;
+    }
+    for (int lvl = (int) hdr->height - 1; lvl >= 0; lvl--) {
+        for (;;) {
+            uint64_t next = NODE(m, cur)->next[lvl];
+            if (next == 0) { break; }
+            struct mmap_node *n = NODE(m, next);
+            if (m->cmp(NODE_KEY(n), n->klen, key, klen) >= 0) { break; }
+            cur = next;
+        }
+        prevs[lvl] = cur;
+    }
+    return NODE(m, cur)->next[0];
+}
+
+static bool is_key(struct skiplist_mmap *m, uint64_t ofs,
+        const void *key, size_t klen) {
+    if (ofs == 0) { return false; }
+    struct mmap_node *n = NODE(m, ofs);
+    return m->cmp(NODE_KEY(n), n->klen, key, klen) == 0;
+}
+
+/* Copy VALUE into a new block, setting *VOFS to its offset, or into
+ * *VOFS itself if it fits. Returns false on allocation failure. */
+static bool store_value(struct skiplist_mmap *m, const void *value,
+        size_t vlen, uint64_t *vofs) {
+    *vofs = 0;
+    if (IS_INLINE(vlen)) {
+        if (vlen > 0) { memcpy(vofs, value, vlen); }
+        return true;
+    }
+    *vofs = alloc_block(m, vlen);
+    if (*vofs == 0) { return false; }
+    memcpy(m->base + *vofs, value, vlen);
+    return true;
+}
+
+static void free_value(struct skiplist_mmap *m, uint64_t vofs,
+        size_t vlen) {
+    if (!IS_INLINE(vlen)) { free_block(m, vofs, vlen); }
+}
+
+bool skiplist_mmap_set(struct skiplist_mmap *m,
+        const void *key, size_t klen, const void *value, size_t vlen) {
+    assert(m);
+    assert(key || klen == 0);
+    assert(value || vlen == 0);
+    uint64_t prevs[SKIPLIST_MAX_HEIGHT];
+    if (klen > UINT32_MAX) { return false; }
+    mark_dirty(m);
+    uint64_t found = find_prevs(m, key, klen, prevs);
+
+    /* Allocate first: that may move the mapping, so only offsets
+     * are kept across it. */
+    uint64_t vofs = 0;
+    if (!store_value(m, value, vlen, &vofs)) { return false; }
+    if (is_key(m, found, key, klen)) {
+        /* Swap in a copy of the node with the new value, rather than
+         * storing vofs and vlen in place: a crash between those two
+         * stores could leave an inline value read as an offset, or a
+         * block read with another value's length. Linking the copy
+         * on the bottom level is a single 8-byte store, and recover
+         * relinks the levels above from it. */
+        size_t size = NODE_SIZE(NODE(m, found)->h, NODE(m, found)->klen);
+        uint64_t ofs = alloc_block(m, size);
+        if (ofs == 0) {
+            free_value(m, vofs, vlen);
+            return false;
+        }
+        struct mmap_node *old = NODE(m, found);
+        struct mmap_node *nn = NODE(m, ofs);
+        memcpy(nn, old, size);
+        nn->vofs = vofs;
+        nn->vlen = vlen;
+        for (int i = 0; i < (int) nn->h; i++) {
+            struct mmap_node *prev = NODE(m, prevs[i]);
+            assert(prev->next[i] == found);
+            prev->next[i] = ofs;
+        }
+        free_value(m, old->vofs, old->vlen);
+        free_block(m, found, size);
+        return true;
+    }
+
+    struct mmap_header *hdr = HDR(m);
+    int hh = (int) NODE(m, hdr->head)->h;
+    int h = skiplist_gen_height_r(&hdr->rng);
+    if (h > hh) { h = hh; }
+    uint64_t ofs = alloc_block(m, NODE_SIZE(h, klen));
+    if (ofs == 0) {
+        free_value(m, vofs, vlen);
+        return false;
+    }
+    hdr = HDR(m);
+    struct mmap_node *nn = NODE(m, ofs);
+    nn->h = (uint32_t) h;
+    nn->klen = (uint32_t) klen;
+    nn->vofs = vofs;
+    nn->vlen = vlen;
+    memcpy((char *) NODE_KEY(nn), key, klen);
+
+    /* Bottom level first, so it always holds every pair (see
+     * recover). */
+    for (int i = 0; i < h; i++) {
+        struct mmap_node *prev = NODE(m, prevs[i]);
+        nn->next[i] = prev->next[i];
+        prev->next[i] = ofs;
+    }
+    if ((uint64_t) h > hdr->height) { hdr->height = h; }
+    hdr->count++;
+    return true;
+}
+
+bool skiplist_mmap_get(struct skiplist_mmap *m, const void *key,
+        size_t klen, const void **value, size_t *vlen) {
+    assert(m);
+    uint64_t prevs[SKIPLIST_MAX_HEIGHT];
+    uint64_t found = find_prevs(m, key, klen, prevs);
+    if (!is_key(m, found, key, klen)) { return false; }
+    struct mmap_node *n = NODE(m, found);
+    if (value) { *value = VALUE(m, n); }
+    if (vlen) { *vlen = n->vlen; }
+    return true;
+}
+
+bool skiplist_mmap_delete(struct skiplist_mmap *m,
+        const void *key, size_t klen) {
+    assert(m);
+    uint64_t prevs[SKIPLIST_MAX_HEIGHT];
+    uint64_t found = find_prevs(m, key, klen, prevs);
+    if (!is_key(m, found, key, klen)) { return false; }
+    mark_dirty(m);
+
+    struct mmap_header *hdr = HDR(m);
+    struct mmap_node *doomed = NODE(m, found);
+    /* Bottom level last, so it holds the pair until unlinked from
+     * the others. */
+    for (int i = (int) doomed->h - 1; i >= 0; i--) {
+        struct mmap_node *prev = NODE(m, prevs[i]);
+        assert(prev->next[i] == found);
+        prev->next[i] = doomed->next[i];
+    }
+    hdr->count--;
+    struct mmap_node *head = NODE(m, hdr->head);
+    while (hdr->height > 1 && head->next[hdr->height - 1] == 0) {
+        hdr->height--;
+    }
+    free_value(m, doomed->vofs, doomed->vlen);
+    free_block(m, found, NODE_SIZE(doomed->h, doomed->klen));
+    return true;
+}
+
+size_t skiplist_mmap_count(struct skiplist_mmap *m) {
+    assert(m);
+    return (size_t) HDR(m)->count;
+}
+
+size_t skiplist_mmap_bytes(struct skiplist_mmap *m) {
+    assert(m);
+    return (size_t) HDR(m)->used;
+}
+
+void skiplist_mmap_iter(struct skiplist_mmap *m, const void *key,
+        size_t klen, skiplist_mmap_iter_cb *cb, void *udata) {
+    assert(m);
+    assert(cb);
+    uint64_t prevs[SKIPLIST_MAX_HEIGHT];
+    uint64_t ofs = key ? find_prevs(m, key, klen, prevs)
+      : NODE(m, HDR(m)->head)->next[0];
+    while (ofs != 0) {
+        struct mmap_node *n = NODE(m, ofs);
+        if (cb(NODE_KEY(n), n->klen, VALUE(m, n), n->vlen, udata)
+            != SKIPLIST_ITER_CONTINUE) {
+            break;
+        }
+        ofs = n->next[0];
+    }
+}
+
+bool skiplist_mmap_commit(struct skiplist_mmap *m) {
+    assert(m);
+    /* Everything reaches the disk before the header says so. */
+    if (msync(m->base, m->size, MS_SYNC) != 0) { return false; }
+    HDR(m)->dirty = 0;
+    if (msync(m->base, HEADER_SIZE, MS_SYNC) != 0) { return false; }
+    return fsync(m->fd) == 0;
+}
+
+bool skiplist_mmap_close(struct skiplist_mmap *m) {
+    assert(m);
+    bool ok = munmap(m->base, m->size) == 0;
+    ok = close(m->fd) == 0 && ok;
+    free(m);
+    return ok;
+}
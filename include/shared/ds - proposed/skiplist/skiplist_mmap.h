@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Persistent skiplist, kept in a memory-mapped file:
+ *
+ *     struct skiplist_mmap *m = skiplist_mmap_open("index.skl", NULL);
+ *     skiplist_mmap_set(m, "key", 3, "value", 5);
+ *     skiplist_mmap_commit(m);
+ *     skiplist_mmap_close(m);
+ *
+ * Reopening the file maps it back in, with no rebuilding, so a large
+ * index is ready at once. Nodes link to each other by their offsets
+ * in the file rather than by pointers, so the file can be mapped at
+ * any address, and keys and values are copied into the file, as
+ * byte strings; values of up to 8 bytes are kept in the node itself.
+ * Nodes and values come from an allocator over the file
+ * (skiplist_mmap_alloc, a skiplist_alloc_cb), which grows the file
+ * as needed.
+ *
+ * skiplist_mmap_commit syncs the file to disk; the state as of the
+ * last commit survives a crash. Reopening a file that was changed
+ * after its last commit rebuilds the upper levels from the bottom
+ * one, which is always linked before the others are updated, so a
+ * process that crashed mid-update leaves a usable list. The pairs
+ * changed since the last commit may or may not be there, and after
+ * a power failure they may have been written only in part.
+ *
+ * Like struct skiplist, it isn't thread-safe. Requires POSIX mmap.
+ */
+
+#ifndef SKIPLIST_MMAP_H
+#define SKIPLIST_MMAP_H
+
+#include "skiplist.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Opaque persistent skiplist type. */
+struct skiplist_mmap;
+
+/* Comparison callback for keys of LEN1 and LEN2 bytes. Returns <0,
+ * 0, or >0 like memcmp. */
+typedef int skiplist_mmap_cmp_cb(const void *k1, size_t len1,
+    const void *k2, size_t len2);
+
+/* Open the skiplist in the file at PATH, creating it if it's missing
+ * or empty. Keys are ordered by CMP, or bytewise (shorter first on a
+ * tie) if NULL; a file must always be opened with the same order.
+ * Returns NULL on error, with errno set (EINVAL if the file isn't a
+ * skiplist). */
+struct skiplist_mmap *skiplist_mmap_open(const char *path,
+    skiplist_mmap_cmp_cb *cmp);
+
+/* Set KEY's value, copying both into the file, replacing any value
+ * already there. Returns false on allocation failure (when the file
+ * can't grow). */
+bool skiplist_mmap_set(struct skiplist_mmap *m,
+    const void *key, size_t klen, const void *value, size_t vlen);
+
+/* Get KEY's value, in *VALUE and *VLEN (if non-NULL). The value
+ * points into the mapping, and is only valid until the next change
+ * to the list. Returns whether the key was found. */
+bool skiplist_mmap_get(struct skiplist_mmap *m, const void *key,
+    size_t klen, const void **value, size_t *vlen);
+
+/* Delete KEY and its value. Returns whether the key was found. */
+bool skiplist_mmap_delete(struct skiplist_mmap *m,
+    const void *key, size_t klen);
+
+/* How many pairs are in the list? */
+size_t skiplist_mmap_count(struct skiplist_mmap *m);
+
+/* How many bytes of the file are in use, including freed blocks
+ * waiting to be reused? */
+size_t skiplist_mmap_bytes(struct skiplist_mmap *m);
+
+/* Iteration callback: keys and values point into the mapping. */
+typedef enum skiplist_iter_res skiplist_mmap_iter_cb(const void *key,
+    size_t klen, const void *value, size_t vlen, void *udata);
+
+/* Call CB on each pair in key order, starting with the first key >=
+ * KEY (or the first key, if KEY is NULL), until it returns
+ * SKIPLIST_ITER_HALT. CB must not change the list. */
+void skiplist_mmap_iter(struct skiplist_mmap *m, const void *key,
+    size_t klen, skiplist_mmap_iter_cb *cb, void *udata);
+
+/* Sync the whole file to disk, then mark it as committed. Returns
+ * false on I/O error, with errno set. */
+bool skiplist_mmap_commit(struct skiplist_mmap *m);
+
+/* Unmap and close the file, without committing. Returns false on
+ * error, with errno set; M is freed either way. */
+bool skiplist_mmap_close(struct skiplist_mmap *m);
+
+/* Allocation callback over the file, with the list as UDATA, which
+ * the list allocates its nodes and values with. Blocks are rounded
+ * up to a power of 2, and freed ones are reused. Growing the file
+ * may move the mapping, so a pointer it returns is only valid until
+ * the next allocation; keep skiplist_mmap_offset of it instead. */
+void *skiplist_mmap_alloc(void *p, size_t osize, size_t nsize, void *udata);
+
+/* Convert a pointer into the mapping to its offset in the file, and
+ * back. Offsets stay valid as the file grows, and when reopened. */
+uint64_t skiplist_mmap_offset(struct skiplist_mmap *m, void *p);
+void *skiplist_mmap_ptr(struct skiplist_mmap *m, uint64_t offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,262 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "skiplist_config.h"
+#include "skiplist_slab.h"
+#include "skiplist_macros_internal.h"
+
+/* One size class per pointer-sized step. */
+#define SLAB_STEP sizeof(void *)
+#define SLAB_CLASSES ((int) (SKIPLIST_SLAB_MAX_SIZE / SLAB_STEP))
+#define SLAB_CLASS(size) (((size) + SLAB_STEP - 1) / SLAB_STEP - 1)
+
+/* A free object, linked in its class's free list. */
+struct slab_obj {
+    struct slab_obj *next;
+};
+
+/* Chunk header; objects follow. As the classes step by SLAB_STEP, the
+ * objects are only pointer-aligned, which is all the nodes need. */
+struct slab_chunk {
+    struct slab_chunk *next;
+    size_t size;
+};
+
+/* A thread's free lists. */
+struct slab_cache {
+    pthread_t owner;
+    struct slab_obj *free[SLAB_CLASSES];
+    unsigned n[SLAB_CLASSES];
+    struct slab_cache *next;
+};
+
+struct skiplist_slab {
+    pthread_mutex_t lock;   /* for everything below but live */
+    unsigned long id;
+    size_t live;            /* objects in use, updated atomically */
+    struct slab_obj *free[SLAB_CLASSES];
+    char *bump;             /* unused part of the last chunk */
+    size_t left;
+    struct slab_chunk *chunks;
+    size_t nchunks;
+    struct slab_cache *caches;
+    skiplist_alloc_cb *backing;
+    void *backing_udata;
+};
+
+/* Per-thread cache of the free lists for the last slab used. */
+static unsigned long next_id = 0;
+static __thread unsigned long tls_id = 0;
+static __thread struct slab_cache *tls_cache = NULL;
+
+static void *def_alloc(void *p,
+        size_t osize, size_t nsize, void *udata) {
+    (void)udata;
+    (void)osize;
+    if (p) {
+        assert(nsize == 0);
+        free(p);
+        return NULL;
+    } else {
+        assert(osize == 0);
+        return malloc(nsize);
+    }
+}
+
+struct skiplist_slab *skiplist_slab_new(skiplist_alloc_cb *backing,
+        void *backing_udata) {
+    if (backing == NULL) { backing = def_alloc; }
+    struct skiplist_slab *slab = backing(NULL, 0, sizeof(*slab),
+        backing_udata);
+    if (slab) {
+        if (pthread_mutex_init(&slab->lock, NULL) != 0) {
+            backing(slab, sizeof(*slab), 0, backing_udata);
+            return NULL;
+        }
+        slab->id = __atomic_add_fetch(&next_id, 1, __ATOMIC_SEQ_CST);
+        slab->live = 0;
+        DO(SLAB_CLASSES, slab->free[i] = NULL);
+        slab->bump = NULL;
+        slab->left = 0;
+        slab->chunks = NULL;
+        slab->nchunks = 0;
+        slab->caches = NULL;
+        slab->backing = backing;
+        slab->backing_udata = backing_udata;
+    }
+    return slab;
+}
+
+/* Get the calling thread's free lists, creating them on first use.
+ * Returns NULL on allocation failure. */
+static struct slab_cache *get_cache(struct skiplist_slab *slab) {
+    if (tls_id == slab->id) { return tls_cache; }
+    pthread_t self = pthread_self();
+    pthread_mutex_lock(&slab->lock);
+    struct slab_cache *c = slab->caches;
+    while (c && !pthread_equal(c->owner, self)) { c = c->next; }
+    if (c == NULL) {
+        c = slab->backing(NULL, 0, sizeof(*c), slab->backing_udata);
+        if (c) {
+            c->owner = self;
+            DO(SLAB_CLASSES, c->free[i] = NULL; c->n[i] = 0);
+            c->next = slab->caches;
+            slab->caches = c;
+        }
+    }
+    pthread_mutex_unlock(&slab->lock);
+    if (c) {
+        tls_id = slab->id;
+        tls_cache = c;
+    }
+    return c;
+}
+
+/* Move up to SKIPLIST_SLAB_BATCH objects of class CL to the thread's
+ * free list, carving new ones from the chunks if needed.
+ * Call with the lock held. */
+static void refill(struct skiplist_slab *slab, struct slab_cache *c,
+        size_t cl) {
+    size_t size = (cl + 1) * SLAB_STEP;
+    for (int i = 0; i < SKIPLIST_SLAB_BATCH; i++) {
+        struct slab_obj *o = slab->free[cl];
+        if (o) {
+            slab->free[cl] = o->next;
+        } else {
+            if (slab->left < size) {
+                size_t csize = SKIPLIST_SLAB_CHUNK;
+                struct slab_chunk *ch = slab->backing(NULL, 0, csize,
+                    slab->backing_udata);
+                if (ch == NULL) { return; }
+                ch->next = slab->chunks;
+                ch->size = csize;
+                slab->chunks = ch;
+                slab->nchunks++;
+                slab->bump = (char *) (ch + 1);
+                slab->left = csize - sizeof(*ch);
+                LOG2("slab chunk %zd at %p\n", slab->nchunks, (void *)ch);
+            }
+            o = (struct slab_obj *) slab->bump;
+            slab->bump += size;
+            slab->left -= size;
+        }
+        o->next = c->free[cl];
+        c->free[cl] = o;
+        c->n[cl]++;
+    }
+}
+
+/* Move SKIPLIST_SLAB_BATCH objects of class CL from the thread's
+ * free list back to the shared one. */
+static void flush(struct skiplist_slab *slab, struct slab_cache *c,
+        size_t cl) {
+    pthread_mutex_lock(&slab->lock);
+    for (int i = 0; i < SKIPLIST_SLAB_BATCH; i++) {
+        struct slab_obj *o = c->free[cl];
+        c->free[cl] = o->next;
+        c->n[cl]--;
+        o->next = slab->free[cl];
+        slab->free[cl] = o;
+    }
+    pthread_mutex_unlock(&slab->lock);
+}
+
+void *skiplist_slab_alloc(void *p, size_t osize, size_t nsize, void *udata) {
+    struct skiplist_slab *slab = (struct skiplist_slab *) udata;
+    assert(slab);
+    size_t size = p ? osize : nsize;
+    if (size == 0 || size > SKIPLIST_SLAB_MAX_SIZE) {
+        return slab->backing(p, osize, nsize, slab->backing_udata);
+    }
+    size_t cl = SLAB_CLASS(size);
+    struct slab_cache *c = get_cache(slab);
+    if (c == NULL) { return NULL; }
+
+    if (p) {                    /* free */
+        assert(nsize == 0);
+        struct slab_obj *o = (struct slab_obj *) p;
+        o->next = c->free[cl];
+        c->free[cl] = o;
+        if (++c->n[cl] >= 2 * SKIPLIST_SLAB_BATCH) { flush(slab, c, cl); }
+        __atomic_sub_fetch(&slab->live, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    if (c->free[cl] == NULL) {
+        pthread_mutex_lock(&slab->lock);
+        refill(slab, c, cl);
+        pthread_mutex_unlock(&slab->lock);
+        if (c->free[cl] == NULL) { return NULL; }
+    }
+    struct slab_obj *o = c->free[cl];
+    c->free[cl] = o->next;
+    c->n[cl]--;
+    __atomic_add_fetch(&slab->live, 1, __ATOMIC_RELAXED);
+    return o;
+}
+
+size_t skiplist_slab_live(struct skiplist_slab *slab) {
+    assert(slab);
+    return __atomic_load_n(&slab->live, __ATOMIC_RELAXED);
+}
+
+size_t skiplist_slab_chunks(struct skiplist_slab *slab) {
+    assert(slab);
+    pthread_mutex_lock(&slab->lock);
+    size_t ct = slab->nchunks;
+    pthread_mutex_unlock(&slab->lock);
+    return ct;
+}
+
+void skiplist_slab_release(struct skiplist_slab *slab) {
+    assert(slab);
+    pthread_mutex_lock(&slab->lock);
+    struct slab_chunk *ch = slab->chunks;
+    while (ch) {
+        struct slab_chunk *next = ch->next;
+        slab->backing(ch, ch->size, 0, slab->backing_udata);
+        ch = next;
+    }
+    slab->chunks = NULL;
+    slab->nchunks = 0;
+    slab->bump = NULL;
+    slab->left = 0;
+    DO(SLAB_CLASSES, slab->free[i] = NULL);
+    for (struct slab_cache *c = slab->caches; c; c = c->next) {
+        DO(SLAB_CLASSES, c->free[i] = NULL; c->n[i] = 0);
+    }
+    slab->live = 0;
+    pthread_mutex_unlock(&slab->lock);
+}
+
+void skiplist_slab_free(struct skiplist_slab *slab) {
+    assert(slab);
+    skiplist_slab_release(slab);
+    struct slab_cache *c = slab->caches;
+    while (c) {
+        struct slab_cache *next = c->next;
+        slab->backing(c, sizeof(*c), 0, slab->backing_udata);
+        c = next;
+    }
+    if (tls_id == slab->id) { tls_id = 0; }
+    pthread_mutex_destroy(&slab->lock);
+    slab->backing(slab, sizeof(*slab), 0, slab->backing_udata);
+}
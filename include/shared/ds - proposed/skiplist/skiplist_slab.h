@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Size-class slab allocator, for use as a skiplist allocation callback:
+ *
+ *     struct skiplist_slab *slab = skiplist_slab_new(NULL, NULL);
+ *     struct skiplist *sl = skiplist_new(cmp, skiplist_slab_alloc, slab);
+ *
+ * Nodes only differ in size by their height, so there is one size
+ * class per pointer-sized step (one per height). Objects are carved
+ * out of SKIPLIST_SLAB_CHUNK-byte chunks, in allocation order, and
+ * freed objects go back on their class's free list. Each thread keeps
+ * its own free lists, refilled from (and flushed to) the shared ones
+ * SKIPLIST_SLAB_BATCH objects at a time, so one slab can serve lists
+ * used from several threads (e.g. skiplist_lf).
+ *
+ * Sizes above SKIPLIST_SLAB_MAX_SIZE go straight to the backing
+ * allocator, and are not covered by skiplist_slab_release.
+ */
+
+#ifndef SKIPLIST_SLAB_H
+#define SKIPLIST_SLAB_H
+
+#include "skiplist.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Opaque slab allocator type. */
+struct skiplist_slab;
+
+/* Create a new slab allocator, returns NULL on error. Chunks are
+ * allocated with the BACKING callback, or malloc & free if NULL. */
+struct skiplist_slab *skiplist_slab_new(skiplist_alloc_cb *backing,
+    void *backing_udata);
+
+/* Allocation callback, with the slab as UDATA. */
+void *skiplist_slab_alloc(void *p, size_t osize, size_t nsize, void *udata);
+
+/* How many objects are allocated from the slab and not yet freed? */
+size_t skiplist_slab_live(struct skiplist_slab *slab);
+
+/* How many chunks has the slab allocated? */
+size_t skiplist_slab_chunks(struct skiplist_slab *slab);
+
+/* Free every object of the slab at once, returning its chunks to the
+ * backing allocator. If the slab holds a single skiplist, this drops
+ * it and all its nodes, instead of skiplist_free. No other thread may
+ * be using the slab. */
+void skiplist_slab_release(struct skiplist_slab *slab);
+
+/* Release and free the slab. */
+void skiplist_slab_free(struct skiplist_slab *slab);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
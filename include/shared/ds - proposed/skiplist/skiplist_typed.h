@@ -0,0 +1,621 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Type-specialized skiplists, generated at compile time.
+ *
+ *     SKIPLIST_TYPED(intmap, long, void *, SKIPLIST_CMP_NUM)
+ *
+ * defines `struct intmap` and static inline functions intmap_new,
+ * intmap_add, intmap_get, etc., following skiplist.h, except that keys
+ * and values are passed by value as K and V. The key is stored inline
+ * in the node (any assignable type: a number, a pointer, or a struct
+ * such as a fixed-size string buffer), and CMP(a, b) - a macro or an
+ * inline function returning <0, 0, or >0 - is expanded in place, so
+ * searches make no indirect calls.
+ *
+ * Each list has its own height generator (skiplist_gen_height_r, so
+ * link with skiplist.c), which NAME_seed reseeds.
+ */
+
+#ifndef SKIPLIST_TYPED_H
+#define SKIPLIST_TYPED_H
+
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+
+#include "skiplist_config.h"
+#include "skiplist.h"
+
+/* Comparisons for numeric and C string keys. */
+#define SKIPLIST_CMP_NUM(a, b) (((a) > (b)) - ((a) < (b)))
+#define SKIPLIST_CMP_STR(a, b) strcmp((a), (b))
+
+#define SKIPLIST_TYPED(NAME, K, V, CMP)                                 \
+                                                                        \
+struct NAME##_node {                                                    \
+    int h;                  /* node height */                           \
+    K k;                    /* key, inline */                           \
+    V v;                    /* value */                                 \
+    struct NAME##_node *next[]; /* NULL at the end */                   \
+};                                                                      \
+                                                                        \
+struct NAME {                                                           \
+    size_t count;                                                       \
+    int height;             /* levels in use */                         \
+    struct NAME##_node *head; /* SKIPLIST_MAX_HEIGHT levels */          \
+    skiplist_alloc_cb *alloc;                                           \
+    void *alloc_udata;                                                  \
+    uint64_t rng;           /* height generator state */                \
+};                                                                      \
+                                                                        \
+typedef enum skiplist_iter_res                                          \
+NAME##_iter_cb(K key, V value, void *udata);                            \
+                                                                        \
+static inline void *NAME##_def_alloc(void *p,                           \
+        size_t osize, size_t nsize, void *udata) {                      \
+    (void)udata;                                                        \
+    (void)osize;                                                        \
+    if (p) {                                                            \
+        free(p);                                                        \
+        return NULL;                                                    \
+    }                                                                   \
+    return malloc(nsize);                                               \
+}                                                                       \
+                                                                        \
+static inline struct NAME##_node *NAME##_node_alloc(struct NAME *sl,    \
+        int height) {                                                   \
+    size_t size = sizeof(struct NAME##_node) +                          \
+      height * sizeof(struct NAME##_node *);                            \
+    struct NAME##_node *n = (struct NAME##_node *)                      \
+      sl->alloc(NULL, 0, size, sl->alloc_udata);                        \
+    if (n == NULL) { return NULL; }                                     \
+    n->h = height;                                                      \
+    for (int i = 0; i < height; i++) { n->next[i] = NULL; }             \
+    return n;                                                           \
+}                                                                       \
+                                                                        \
+static inline void NAME##_node_free(struct NAME *sl,                    \
+        struct NAME##_node *n) {                                        \
+    sl->alloc(n, sizeof(*n) + n->h * sizeof(struct NAME##_node *), 0,   \
+        sl->alloc_udata);                                               \
+}                                                                       \
+                                                                        \
+/* Create a new skiplist, returns NULL on error.                        \
+ * ALLOC is optional, as for skiplist_new. */                           \
+static inline struct NAME *NAME##_new(skiplist_alloc_cb *alloc,         \
+        void *alloc_udata) {                                            \
+    if (alloc == NULL) { alloc = NAME##_def_alloc; }                    \
+    struct NAME *sl = (struct NAME *)                                   \
+      alloc(NULL, 0, sizeof(*sl), alloc_udata);                         \
+    if (sl) {                                                           \
+        sl->count = 0;                                                  \
+        sl->height = 1;                                                 \
+        sl->alloc = alloc;                                              \
+        sl->alloc_udata = alloc_udata;                                  \
+        sl->rng = skiplist_new_seed() | 1;                              \
+        sl->head = NAME##_node_alloc(sl, SKIPLIST_MAX_HEIGHT);          \
+        if (sl->head == NULL) {                                         \
+            alloc(sl, sizeof(*sl), 0, alloc_udata);                     \
+            return NULL;                                                \
+        }                                                               \
+    }                                                                   \
+    return sl;                                                          \
+}                                                                       \
+                                                                        \
+/* Reseed the height generator. */                                      \
+static inline void NAME##_seed(struct NAME *sl, uint64_t seed) {        \
+    sl->rng = seed ^ 0x9E3779B97F4A7C15ULL;                             \
+    if (sl->rng == 0) { sl->rng = 1; }                                  \
+}                                                                       \
+                                                                        \
+/* Get the nodes preceding the position for KEY on each level. */       \
+static inline void NAME##_prevs(struct NAME *sl, K key,                 \
+        struct NAME##_node **prevs) {                                   \
+    struct NAME##_node *cur = sl->head, *next;                          \
+    for (int lvl = sl->height - 1; lvl >= 0; lvl--) {                   \
+        while ((next = cur->next[lvl]) != NULL && CMP(next->k, key) < 0) { \
+            cur = next;                                                 \
+        }                                                               \
+        prevs[lvl] = cur;                                               \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+/* First node with KEY, or NULL. */                                     \
+static inline struct NAME##_node *NAME##_first_eq_node(struct NAME *sl, \
+        K key) {                                                        \
+    struct NAME##_node *cur = sl->head, *next = NULL;                   \
+    for (int lvl = sl->height - 1; lvl >= 0; lvl--) {                   \
+        while ((next = cur->next[lvl]) != NULL && CMP(next->k, key) < 0) { \
+            cur = next;                                                 \
+        }                                                               \
+    }                                                                   \
+    return (next && CMP(next->k, key) == 0) ? next : NULL;              \
+}                                                                       \
+                                                                        \
+static inline bool NAME##_add_or_set(struct NAME *sl, int try_replace,  \
+        K key, V value, V *old) {                                       \
+    assert(sl);                                                         \
+    struct NAME##_node *prevs[SKIPLIST_MAX_HEIGHT];                     \
+    NAME##_prevs(sl, key, prevs);                                       \
+    if (try_replace) {                                                  \
+        struct NAME##_node *next = prevs[0]->next[0];                   \
+        if (next && CMP(next->k, key) == 0) {                           \
+            if (old) { *old = next->v; }                                \
+            next->v = value;                                            \
+            return true;                                                \
+        }                                                               \
+    }                                                                   \
+                                                                        \
+    int height = skiplist_gen_height_r(&sl->rng);                       \
+    struct NAME##_node *nn = NAME##_node_alloc(sl, height);             \
+    if (nn == NULL) { return false; }                                   \
+    nn->k = key;                                                        \
+    nn->v = value;                                                      \
+    while (sl->height < height) { prevs[sl->height++] = sl->head; }     \
+    for (int i = 0; i < height; i++) {                                  \
+        nn->next[i] = prevs[i]->next[i];                                \
+        prevs[i]->next[i] = nn;                                         \
+    }                                                                   \
+    sl->count++;                                                        \
+    return true;                                                        \
+}                                                                       \
+                                                                        \
+/* Add a key/value pair. Equal keys will be kept. */                    \
+static inline bool NAME##_add(struct NAME *sl, K key, V value) {        \
+    return NAME##_add_or_set(sl, 0, key, value, NULL);                  \
+}                                                                       \
+                                                                        \
+/* Set a key/value pair, replacing an existing value if present         \
+ * (returned in *OLD, if OLD is non-NULL). */                           \
+static inline bool NAME##_set(struct NAME *sl, K key, V value, V *old) { \
+    return NAME##_add_or_set(sl, 1, key, value, old);                   \
+}                                                                       \
+                                                                        \
+/* Get the value associated with KEY, in *VALUE if non-NULL.            \
+ * Returns whether the key was found. */                                \
+static inline bool NAME##_get(struct NAME *sl, K key, V *value) {       \
+    assert(sl);                                                         \
+    struct NAME##_node *n = NAME##_first_eq_node(sl, key);              \
+    if (n && value) { *value = n->v; }                                  \
+    return n != NULL;                                                   \
+}                                                                       \
+                                                                        \
+static inline bool NAME##_member(struct NAME *sl, K key) {              \
+    return NAME##_get(sl, key, NULL);                                   \
+}                                                                       \
+                                                                        \
+/* Delete an association for KEY, returning its value in *VALUE        \
+ * if non-NULL. Returns whether the key was found. */                   \
+static inline bool NAME##_delete(struct NAME *sl, K key, V *value) {    \
+    assert(sl);                                                         \
+    struct NAME##_node *prevs[SKIPLIST_MAX_HEIGHT];                     \
+    NAME##_prevs(sl, key, prevs);                                       \
+    struct NAME##_node *doomed = prevs[0]->next[0];                     \
+    if (doomed == NULL || CMP(doomed->k, key) != 0) { return false; }   \
+    for (int i = 0; i < doomed->h; i++) {                               \
+        prevs[i]->next[i] = doomed->next[i];                            \
+    }                                                                   \
+    if (value) { *value = doomed->v; }                                  \
+    NAME##_node_free(sl, doomed);                                       \
+    sl->count--;                                                        \
+    return true;                                                        \
+}                                                                       \
+                                                                        \
+/* Get the first or last pair. Returns whether one was found. */        \
+static inline bool NAME##_first(struct NAME *sl, K *key, V *value) {    \
+    assert(sl);                                                         \
+    struct NAME##_node *first = sl->head->next[0];                      \
+    if (first == NULL) { return false; }                                \
+    if (key) { *key = first->k; }                                       \
+    if (value) { *value = first->v; }                                   \
+    return true;                                                        \
+}                                                                       \
+                                                                        \
+static inline bool NAME##_last(struct NAME *sl, K *key, V *value) {     \
+    assert(sl);                                                         \
+    struct NAME##_node *cur = sl->head;                                 \
+    for (int lvl = sl->height - 1; lvl >= 0; lvl--) {                   \
+        while (cur->next[lvl]) { cur = cur->next[lvl]; }                \
+    }                                                                   \
+    if (cur == sl->head) { return false; }                              \
+    if (key) { *key = cur->k; }                                         \
+    if (value) { *value = cur->v; }                                     \
+    return true;                                                        \
+}                                                                       \
+                                                                        \
+/* Pop the pair with the first key. */                                  \
+static inline bool NAME##_pop_first(struct NAME *sl, K *key, V *value) { \
+    assert(sl);                                                         \
+    struct NAME##_node *first = sl->head->next[0];                      \
+    if (first == NULL) { return false; }                                \
+    if (key) { *key = first->k; }                                       \
+    if (value) { *value = first->v; }                                   \
+    for (int i = 0; i < first->h; i++) {                                \
+        sl->head->next[i] = first->next[i];                             \
+    }                                                                   \
+    NAME##_node_free(sl, first);                                        \
+    sl->count--;                                                        \
+    return true;                                                        \
+}                                                                       \
+                                                                        \
+static inline size_t NAME##_count(struct NAME *sl) {                    \
+    assert(sl);                                                         \
+    return sl->count;                                                   \
+}                                                                       \
+                                                                        \
+static inline bool NAME##_empty(struct NAME *sl) {                      \
+    return NAME##_count(sl) == 0;                                       \
+}                                                                       \
+                                                                        \
+/* Iterate over the skiplist, from the start or beginning at KEY        \
+ * (which must be present). */                                          \
+static inline void NAME##_iter(struct NAME *sl,                         \
+        NAME##_iter_cb *cb, void *udata) {                              \
+    assert(sl);                                                         \
+    assert(cb);                                                         \
+    for (struct NAME##_node *n = sl->head->next[0]; n; n = n->next[0]) { \
+        if (cb(n->k, n->v, udata) != SKIPLIST_ITER_CONTINUE) { break; } \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+static inline void NAME##_iter_from(struct NAME *sl, K key,             \
+        NAME##_iter_cb *cb, void *udata) {                              \
+    assert(sl);                                                         \
+    assert(cb);                                                         \
+    for (struct NAME##_node *n = NAME##_first_eq_node(sl, key); n;      \
+         n = n->next[0]) {                                              \
+        if (cb(n->k, n->v, udata) != SKIPLIST_ITER_CONTINUE) { break; } \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+/* Clear the skiplist. Returns the number of pairs removed. */          \
+static inline size_t NAME##_clear(struct NAME *sl) {                    \
+    assert(sl);                                                         \
+    size_t ct = 0;                                                      \
+    struct NAME##_node *n = sl->head->next[0];                          \
+    while (n) {                                                         \
+        struct NAME##_node *doomed = n;                                 \
+        n = n->next[0];                                                 \
+        NAME##_node_free(sl, doomed);                                   \
+        ct++;                                                           \
+    }                                                                   \
+    for (int i = 0; i < sl->height; i++) { sl->head->next[i] = NULL; }  \
+    sl->height = 1;                                                     \
+    sl->count = 0;                                                      \
+    return ct;                                                          \
+}                                                                       \
+                                                                        \
+/* Clear and free the skiplist. Returns the number of pairs removed. */ \
+static inline size_t NAME##_free(struct NAME *sl) {                     \
+    size_t ct = NAME##_clear(sl);                                       \
+    NAME##_node_free(sl, sl->head);                                     \
+    sl->alloc(sl, sizeof(*sl), 0, sl->alloc_udata);                     \
+    return ct;                                                          \
+}                                                                       \
+
+/* Like SKIPLIST_TYPED, but smaller: the nodes live in one arena,
+ * allocated with ALLOC and doubled as needed, and link to each other
+ * by 32-bit indices (in 8-byte units, so the arena is at most 32 GB)
+ * rather than pointers. With the value inline too, each pair costs
+ * its key and value, a byte of height, and 4 bytes per level, rounded
+ * up to 8 bytes, with no per-node allocator overhead. Nodes are only
+ * as aligned as 8 bytes. Deleted nodes are reused, by height; the
+ * arena only shrinks when the list is freed. Adds NAME_bytes, the
+ * arena space in use. */
+#define SKIPLIST_TYPED_COMPACT(NAME, K, V, CMP)                         \
+                                                                        \
+struct NAME##_node {                                                    \
+    K k;                    /* key, inline */                           \
+    V v;                    /* value, inline */                         \
+    uint8_t h;              /* node height */                           \
+    uint32_t next[];        /* arena indices, 0 at the end */           \
+};                                                                      \
+                                                                        \
+struct NAME {                                                           \
+    size_t count;                                                       \
+    int height;             /* levels in use */                         \
+    char *arena;            /* nodes, in 8-byte units; the head is at 1 */ \
+    uint32_t used;          /* units carved so far */                   \
+    uint32_t cap;           /* units allocated */                       \
+    uint32_t free[SKIPLIST_MAX_HEIGHT + 1]; /* freed nodes, by height */ \
+    skiplist_alloc_cb *alloc;                                           \
+    void *alloc_udata;                                                  \
+    uint64_t rng;           /* height generator state */                \
+};                                                                      \
+                                                                        \
+typedef enum skiplist_iter_res                                          \
+NAME##_iter_cb(K key, V value, void *udata);                            \
+                                                                        \
+static inline struct NAME##_node *NAME##_at(struct NAME *sl,            \
+        uint32_t i) {                                                   \
+    return (struct NAME##_node *) (sl->arena + (size_t) i * 8);         \
+}                                                                       \
+                                                                        \
+static inline void *NAME##_def_alloc(void *p,                           \
+        size_t osize, size_t nsize, void *udata) {                      \
+    (void)udata;                                                        \
+    (void)osize;                                                        \
+    if (p) {                                                            \
+        free(p);                                                        \
+        return NULL;                                                    \
+    }                                                                   \
+    return malloc(nsize);                                               \
+}                                                                       \
+                                                                        \
+static inline uint32_t NAME##_units(int height) {                       \
+    return (uint32_t) ((offsetof(struct NAME##_node, next)              \
+        + height * sizeof(uint32_t) + 7) / 8);                          \
+}                                                                       \
+                                                                        \
+/* Allocate a node, returning its index, or 0. The arena may move. */   \
+static inline uint32_t NAME##_node_alloc(struct NAME *sl, int height) { \
+    uint32_t i = sl->free[height];                                      \
+    if (i != 0) {                                                       \
+        sl->free[height] = NAME##_at(sl, i)->next[0];                   \
+    } else {                                                            \
+        uint32_t units = NAME##_units(height);                          \
+        if (sl->used + units > sl->cap) {                               \
+            uint64_t ncap = 2 * (uint64_t) sl->cap;                     \
+            if (ncap < sl->used + units) { ncap = sl->used + units; }   \
+            if (ncap > UINT32_MAX) { ncap = UINT32_MAX; }               \
+            if (ncap < sl->used + (uint64_t) units) { return 0; }       \
+            char *na = (char *) sl->alloc(NULL, 0, ncap * 8,            \
+                sl->alloc_udata);                                       \
+            if (na == NULL) { return 0; }                               \
+            if (sl->arena) {                                            \
+                memcpy(na, sl->arena, (size_t) sl->used * 8);           \
+                sl->alloc(sl->arena, (size_t) sl->cap * 8, 0,           \
+                    sl->alloc_udata);                                   \
+            }                                                           \
+            sl->arena = na;                                             \
+            sl->cap = (uint32_t) ncap;                                  \
+        }                                                               \
+        i = sl->used;                                                   \
+        sl->used += units;                                              \
+    }                                                                   \
+    struct NAME##_node *n = NAME##_at(sl, i);                           \
+    n->h = (uint8_t) height;                                            \
+    for (int l = 0; l < height; l++) { n->next[l] = 0; }                \
+    return i;                                                           \
+}                                                                       \
+                                                                        \
+static inline void NAME##_node_free(struct NAME *sl, uint32_t i) {      \
+    struct NAME##_node *n = NAME##_at(sl, i);                           \
+    n->next[0] = sl->free[n->h];                                        \
+    sl->free[n->h] = i;                                                 \
+}                                                                       \
+                                                                        \
+/* Create a new skiplist, returns NULL on error.                        \
+ * ALLOC is optional, as for skiplist_new; it allocates the arena. */   \
+static inline struct NAME *NAME##_new(skiplist_alloc_cb *alloc,         \
+        void *alloc_udata) {                                            \
+    if (alloc == NULL) { alloc = NAME##_def_alloc; }                    \
+    struct NAME *sl = (struct NAME *)                                   \
+      alloc(NULL, 0, sizeof(*sl), alloc_udata);                         \
+    if (sl) {                                                           \
+        sl->count = 0;                                                  \
+        sl->height = 1;                                                 \
+        sl->arena = NULL;                                               \
+        sl->used = 1;       /* index 0 is the end */                    \
+        sl->cap = 0;                                                    \
+        for (int i = 0; i <= SKIPLIST_MAX_HEIGHT; i++) { sl->free[i] = 0; } \
+        sl->alloc = alloc;                                              \
+        sl->alloc_udata = alloc_udata;                                  \
+        sl->rng = skiplist_new_seed() | 1;                              \
+        if (NAME##_node_alloc(sl, SKIPLIST_MAX_HEIGHT) != 1) {          \
+            alloc(sl, sizeof(*sl), 0, alloc_udata);                     \
+            return NULL;                                                \
+        }                                                               \
+    }                                                                   \
+    return sl;                                                          \
+}                                                                       \
+                                                                        \
+/* Reseed the height generator. */                                      \
+static inline void NAME##_seed(struct NAME *sl, uint64_t seed) {        \
+    sl->rng = seed ^ 0x9E3779B97F4A7C15ULL;                             \
+    if (sl->rng == 0) { sl->rng = 1; }                                  \
+}                                                                       \
+                                                                        \
+/* Get the nodes preceding the position for KEY on each level.          \
+ * Returns the first node >= KEY, or 0. */                              \
+static inline uint32_t NAME##_prevs(struct NAME *sl, K key,             \
+        uint32_t *prevs) {                                              \
+    uint32_t cur = 1, next = 0;                                         \
+    for (int lvl = sl->height - 1; lvl >= 0; lvl--) {                   \
+        while ((next = NAME##_at(sl, cur)->next[lvl]) != 0              \
+            && CMP(NAME##_at(sl, next)->k, key) < 0) {                  \
+            cur = next;                                                 \
+        }                                                               \
+        if (prevs) { prevs[lvl] = cur; }                                \
+    }                                                                   \
+    return next;                                                        \
+}                                                                       \
+                                                                        \
+static inline bool NAME##_add_or_set(struct NAME *sl, int try_replace,  \
+        K key, V value, V *old) {                                       \
+    assert(sl);                                                         \
+    uint32_t prevs[SKIPLIST_MAX_HEIGHT];                                \
+    uint32_t next = NAME##_prevs(sl, key, prevs);                       \
+    if (try_replace && next && CMP(NAME##_at(sl, next)->k, key) == 0) { \
+        struct NAME##_node *n = NAME##_at(sl, next);                    \
+        if (old) { *old = n->v; }                                       \
+        n->v = value;                                                   \
+        return true;                                                    \
+    }                                                                   \
+                                                                        \
+    int height = skiplist_gen_height_r(&sl->rng);                       \
+    uint32_t ni = NAME##_node_alloc(sl, height);                        \
+    if (ni == 0) { return false; }                                      \
+    struct NAME##_node *nn = NAME##_at(sl, ni);                         \
+    nn->k = key;                                                        \
+    nn->v = value;                                                      \
+    while (sl->height < height) { prevs[sl->height++] = 1; }            \
+    for (int i = 0; i < height; i++) {                                  \
+        struct NAME##_node *prev = NAME##_at(sl, prevs[i]);             \
+        nn->next[i] = prev->next[i];                                    \
+        prev->next[i] = ni;                                             \
+    }                                                                   \
+    sl->count++;                                                        \
+    return true;                                                        \
+}                                                                       \
+                                                                        \
+/* Add a key/value pair. Equal keys will be kept. */                    \
+static inline bool NAME##_add(struct NAME *sl, K key, V value) {        \
+    return NAME##_add_or_set(sl, 0, key, value, NULL);                  \
+}                                                                       \
+                                                                        \
+/* Set a key/value pair, replacing an existing value if present         \
+ * (returned in *OLD, if OLD is non-NULL). */                           \
+static inline bool NAME##_set(struct NAME *sl, K key, V value, V *old) { \
+    return NAME##_add_or_set(sl, 1, key, value, old);                   \
+}                                                                       \
+                                                                        \
+/* Get the value associated with KEY, in *VALUE if non-NULL.            \
+ * Returns whether the key was found. */                                \
+static inline bool NAME##_get(struct NAME *sl, K key, V *value) {       \
+    assert(sl);                                                         \
+    uint32_t n = NAME##_prevs(sl, key, NULL);                           \
+    if (n == 0 || CMP(NAME##_at(sl, n)->k, key) != 0) { return false; } \
+    if (value) { *value = NAME##_at(sl, n)->v; }                        \
+    return true;                                                        \
+}                                                                       \
+                                                                        \
+static inline bool NAME##_member(struct NAME *sl, K key) {              \
+    return NAME##_get(sl, key, NULL);                                   \
+}                                                                       \
+                                                                        \
+/* Delete an association for KEY, returning its value in *VALUE         \
+ * if non-NULL. Returns whether the key was found. */                   \
+static inline bool NAME##_delete(struct NAME *sl, K key, V *value) {    \
+    assert(sl);                                                         \
+    uint32_t prevs[SKIPLIST_MAX_HEIGHT];                                \
+    uint32_t di = NAME##_prevs(sl, key, prevs);                         \
+    if (di == 0 || CMP(NAME##_at(sl, di)->k, key) != 0) { return false; } \
+    struct NAME##_node *doomed = NAME##_at(sl, di);                     \
+    for (int i = 0; i < doomed->h; i++) {                               \
+        NAME##_at(sl, prevs[i])->next[i] = doomed->next[i];             \
+    }                                                                   \
+    if (value) { *value = doomed->v; }                                  \
+    NAME##_node_free(sl, di);                                           \
+    sl->count--;                                                        \
+    return true;                                                        \
+}                                                                       \
+                                                                        \
+/* Get the first or last pair. Returns whether one was found. */        \
+static inline bool NAME##_first(struct NAME *sl, K *key, V *value) {    \
+    assert(sl);                                                         \
+    uint32_t first = NAME##_at(sl, 1)->next[0];                         \
+    if (first == 0) { return false; }                                   \
+    if (key) { *key = NAME##_at(sl, first)->k; }                        \
+    if (value) { *value = NAME##_at(sl, first)->v; }                    \
+    return true;                                                        \
+}                                                                       \
+                                                                        \
+static inline bool NAME##_last(struct NAME *sl, K *key, V *value) {     \
+    assert(sl);                                                         \
+    uint32_t cur = 1;                                                   \
+    for (int lvl = sl->height - 1; lvl >= 0; lvl--) {                   \
+        while (NAME##_at(sl, cur)->next[lvl]) {                         \
+            cur = NAME##_at(sl, cur)->next[lvl];                        \
+        }                                                               \
+    }                                                                   \
+    if (cur == 1) { return false; }                                     \
+    if (key) { *key = NAME##_at(sl, cur)->k; }                          \
+    if (value) { *value = NAME##_at(sl, cur)->v; }                      \
+    return true;                                                        \
+}                                                                       \
+                                                                        \
+/* Pop the pair with the first key. */                                  \
+static inline bool NAME##_pop_first(struct NAME *sl, K *key, V *value) { \
+    assert(sl);                                                         \
+    struct NAME##_node *head = NAME##_at(sl, 1);                        \
+    uint32_t fi = head->next[0];                                        \
+    if (fi == 0) { return false; }                                      \
+    struct NAME##_node *first = NAME##_at(sl, fi);                      \
+    if (key) { *key = first->k; }                                       \
+    if (value) { *value = first->v; }                                   \
+    for (int i = 0; i < first->h; i++) { head->next[i] = first->next[i]; } \
+    NAME##_node_free(sl, fi);                                           \
+    sl->count--;                                                        \
+    return true;                                                        \
+}                                                                       \
+                                                                        \
+static inline size_t NAME##_count(struct NAME *sl) {                    \
+    assert(sl);                                                         \
+    return sl->count;                                                   \
+}                                                                       \
+                                                                        \
+static inline bool NAME##_empty(struct NAME *sl) {                      \
+    return NAME##_count(sl) == 0;                                       \
+}                                                                       \
+                                                                        \
+/* Bytes of arena in use, including freed nodes not yet reused. */      \
+static inline size_t NAME##_bytes(struct NAME *sl) {                    \
+    assert(sl);                                                         \
+    return (size_t) sl->used * 8;                                       \
+}                                                                       \
+                                                                        \
+/* Iterate over the skiplist, from the start or beginning at KEY        \
+ * (which must be present). */                                          \
+static inline void NAME##_iter(struct NAME *sl,                         \
+        NAME##_iter_cb *cb, void *udata) {                              \
+    assert(sl);                                                         \
+    assert(cb);                                                         \
+    for (uint32_t n = NAME##_at(sl, 1)->next[0]; n;                     \
+         n = NAME##_at(sl, n)->next[0]) {                               \
+        struct NAME##_node *node = NAME##_at(sl, n);                    \
+        if (cb(node->k, node->v, udata) != SKIPLIST_ITER_CONTINUE) { break; } \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+static inline void NAME##_iter_from(struct NAME *sl, K key,             \
+        NAME##_iter_cb *cb, void *udata) {                              \
+    assert(sl);                                                         \
+    assert(cb);                                                         \
+    uint32_t n = NAME##_prevs(sl, key, NULL);                           \
+    if (n == 0 || CMP(NAME##_at(sl, n)->k, key) != 0) { return; }       \
+    for (; n; n = NAME##_at(sl, n)->next[0]) {                          \
+        struct NAME##_node *node = NAME##_at(sl, n);                    \
+        if (cb(node->k, node->v, udata) != SKIPLIST_ITER_CONTINUE) { break; } \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+/* Clear the skiplist, keeping the arena for reuse. Returns the         \
+ * number of pairs removed. */                                          \
+static inline size_t NAME##_clear(struct NAME *sl) {                    \
+    assert(sl);                                                         \
+    size_t ct = sl->count;                                              \
+    struct NAME##_node *head = NAME##_at(sl, 1);                        \
+    for (int i = 0; i < SKIPLIST_MAX_HEIGHT; i++) { head->next[i] = 0; } \
+    for (int i = 0; i <= SKIPLIST_MAX_HEIGHT; i++) { sl->free[i] = 0; } \
+    sl->used = 1 + NAME##_units(SKIPLIST_MAX_HEIGHT);                   \
+    sl->height = 1;                                                     \
+    sl->count = 0;                                                      \
+    return ct;                                                          \
+}                                                                       \
+                                                                        \
+/* Clear and free the skiplist. Returns the number of pairs removed. */ \
+static inline size_t NAME##_free(struct NAME *sl) {                     \
+    size_t ct = NAME##_clear(sl);                                       \
+    sl->alloc(sl->arena, (size_t) sl->cap * 8, 0, sl->alloc_udata);     \
+    sl->alloc(sl, sizeof(*sl), 0, sl->alloc_udata);                     \
+    return ct;                                                          \
+}                                                                       \
+                                                                        \
+
+#endif
@@ -4,7 +4,9 @@
 
 #include "test_alloc.h"
 
+/* Updated atomically, for the lock-free skiplist tests. */
 long allocated = 0;
+long allocated_peak = 0;
 
 #define TRACE_ALLOC 0
 
@@ -13,14 +15,17 @@ void *test_alloc(void *p, size_t osize, size_t nsize, void *udata) {
     if (p) {
         assert(nsize == 0);
         if (TRACE_ALLOC) { fprintf(stderr, "free %zd bytes\n", osize); }
-        allocated -= osize;
+        __atomic_sub_fetch(&allocated, osize, __ATOMIC_RELAXED);
         free(p);
         return NULL;
     } else {
         if (TRACE_ALLOC) { fprintf(stderr, "alloc %zd bytes\n", nsize); }
         assert(osize == 0);
         p = malloc(nsize);
-        allocated += nsize;
+        long now = __atomic_add_fetch(&allocated, nsize, __ATOMIC_RELAXED);
+        long peak = __atomic_load_n(&allocated_peak, __ATOMIC_RELAXED);
+        while (now > peak && !__atomic_compare_exchange_n(&allocated_peak,
+                &peak, now, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
         return p;
     }
 }
@@ -34,7 +39,7 @@ void test_free(void *p, size_t sz) {
 }
 
 
-void test_reset(void) { allocated = 0; }
+void test_reset(void) { allocated = 0; allocated_peak = 0; }
 
 int test_check_for_leaks(void) {
     if (allocated != 0)
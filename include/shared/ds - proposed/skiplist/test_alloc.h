@@ -2,6 +2,7 @@
 #define TEST_ALLOC_H
 
 extern long allocated;
+extern long allocated_peak;     /* most allocated since test_reset */
 
 void *test_alloc(void *p, size_t osize, size_t nsize, void *udata);
 
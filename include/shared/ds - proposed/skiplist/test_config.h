@@ -7,4 +7,16 @@
 
 #define SKIPLIST_DEBUG 1
 
+#ifndef SKIPLIST_INDEXABLE
+#define SKIPLIST_INDEXABLE 1
+#endif
+
+#ifndef SKIPLIST_KEY_PREFIX
+#define SKIPLIST_KEY_PREFIX 1
+#endif
+
+#ifndef SKIPLIST_BACK_POINTERS
+#define SKIPLIST_BACK_POINTERS 1
+#endif
+
 #endif
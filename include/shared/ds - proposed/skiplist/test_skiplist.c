@@ -3,11 +3,17 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <string.h>
+#include <limits.h>
 #include <err.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "test_config.h"
 #include "skiplist.h"
+#include "skiplist_lf.h"
+#include "skiplist_slab.h"
+#include "skiplist_typed.h"
+#include "skiplist_mmap.h"
 #include "greatest.h"
 #include "test_alloc.h"
 
@@ -67,20 +73,22 @@ TEST add_one_word(void) {
 /* This is a quick and dirty test that (for severaral random seeds)
  * the expectation for the distribution of levels generally holds.
  * This could be replaced by a more formal statistical analysis, and
- * should also be modified if the user supplies their own function. */
+ * should also be modified if the user supplies their own function.
+ * Levels with too few nodes to judge are skipped. */
 TEST level_statistical_distribution(void) {
-    int counts[SKIPLIST_MAX_HEIGHT];
-    for(int i = 0; i < SKIPLIST_MAX_HEIGHT; i++) counts[i] = 0;
+    int counts[SKIPLIST_MAX_HEIGHT + 1];
+    for(int i = 0; i <= SKIPLIST_MAX_HEIGHT; i++) counts[i] = 0;
     for (long lseed = 1; lseed < 1000; lseed++) {
         int counted = 0, in_bounds = 0;
         for (long trials = 0; trials < 10000; trials++)
             counts[SKIPLIST_GEN_HEIGHT()]++;
 
-        for(int i = 1; i < SKIPLIST_MAX_HEIGHT; i++) {
-            if (counts[i - 1] != 0 && counts[i] != 0) {
+        for(int i = 1; i <= SKIPLIST_MAX_HEIGHT; i++) {
+            if (counts[i - 1] >= 100 && counts[i] != 0) {
                 counted++;
                 double ratio = counts[i] / (1.0 * counts[i - 1]);
-                if (ratio >= 0.3 && ratio <= 0.75)
+                ratio *= 1 << SKIPLIST_P_LOG2; /* relative to P */
+                if (ratio >= 0.6 && ratio <= 1.5)
                     in_bounds++;
                 else
                     in_bounds--;
@@ -759,6 +767,1079 @@ TEST pop_last(void) {
     PASS();
 }
 
+/* The lock-free variant behaves like the skiplist on a single thread. */
+TEST lf_single_thread(void) {
+    struct skiplist_lf *sl = skiplist_lf_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    const long limit = 1000;
+    for (long i = 0; i < limit; i++) {
+        long k = (i * 7919) % limit;
+        ASSERT(skiplist_lf_add(sl, (void *) k, (void *) (k + 1)));
+    }
+    ASSERT(skiplist_lf_count(sl) == (size_t) limit);
+    skiplist_lf_debug(sl, NULL, NULL, NULL);
+
+    void *k = NULL, *v = NULL;
+    ASSERT(skiplist_lf_get(sl, (void *) 10, &v));
+    ASSERT((long) v == 11);
+    ASSERT(!skiplist_lf_member(sl, (void *) limit));
+    ASSERT(skiplist_lf_set(sl, (void *) 10, (void *) 100, &v));
+    ASSERT((long) v == 11);
+    ASSERT(skiplist_lf_get(sl, (void *) 10, &v));
+    ASSERT((long) v == 100);
+    ASSERT(skiplist_lf_count(sl) == (size_t) limit);
+
+    ASSERT(skiplist_lf_delete(sl, (void *) 10, &v));
+    ASSERT((long) v == 100);
+    ASSERT(!skiplist_lf_member(sl, (void *) 10));
+    ASSERT(!skiplist_lf_delete(sl, (void *) 10, NULL));
+
+    ASSERT(skiplist_lf_first(sl, &k, &v));
+    ASSERT((long) k == 0);
+    ASSERT(skiplist_lf_last(sl, &k, &v));
+    ASSERT((long) k == limit - 1);
+    ASSERT(skiplist_lf_pop_first(sl, &k, NULL));
+    ASSERT((long) k == 0);
+    ASSERT(skiplist_lf_pop_last(sl, &k, NULL));
+    ASSERT((long) k == limit - 1);
+    ASSERT(skiplist_lf_count(sl) == (size_t) limit - 3);
+
+    ASSERT(skiplist_lf_free(sl, NULL, NULL) == (size_t) limit - 3);
+    PASS();
+}
+
+#define LF_THREADS 4
+#define LF_PER_THREAD 20000
+
+struct lf_thread_ud {
+    struct skiplist_lf *sl;
+    long id;
+    int ok;
+};
+
+/* Add this thread's keys, then delete the odd ones while the
+ * other threads are still adding theirs. */
+static void *lf_worker(void *arg) {
+    struct lf_thread_ud *ud = (struct lf_thread_ud *) arg;
+    long first = ud->id * LF_PER_THREAD;
+    for (long i = first; i < first + LF_PER_THREAD; i++) {
+        if (!skiplist_lf_add(ud->sl, (void *) i, (void *) i)) { ud->ok = 0; }
+    }
+    for (long i = first + 1; i < first + LF_PER_THREAD; i += 2) {
+        void *v = NULL;
+        if (!skiplist_lf_delete(ud->sl, (void *) i, &v) || (long) v != i) {
+            ud->ok = 0;
+        }
+        if (!skiplist_lf_member(ud->sl, (void *) (i - 1))) { ud->ok = 0; }
+    }
+    return NULL;
+}
+
+static enum skiplist_iter_res lf_sorted_cb(void *k, void *v, void *udata) {
+    long *prev = (long *) udata;
+    (void)v;
+    if ((long) k <= *prev || ((long) k & 1)) { return SKIPLIST_ITER_HALT; }
+    *prev = (long) k;
+    return SKIPLIST_ITER_CONTINUE;
+}
+
+/* Concurrent adds, deletes and gets keep every pair exactly once. */
+TEST lf_concurrent(void) {
+    struct skiplist_lf *sl = skiplist_lf_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    pthread_t threads[LF_THREADS];
+    struct lf_thread_ud ud[LF_THREADS];
+    for (long t = 0; t < LF_THREADS; t++) {
+        ud[t].sl = sl;
+        ud[t].id = t;
+        ud[t].ok = 1;
+        ASSERT(0 == pthread_create(&threads[t], NULL, lf_worker, &ud[t]));
+    }
+    for (int t = 0; t < LF_THREADS; t++) {
+        ASSERT(0 == pthread_join(threads[t], NULL));
+        ASSERT(ud[t].ok);
+    }
+
+    ASSERT(skiplist_lf_count(sl) == LF_THREADS * LF_PER_THREAD / 2);
+    skiplist_lf_debug(sl, NULL, NULL, NULL);
+    long prev = -1;
+    skiplist_lf_iter(sl, lf_sorted_cb, &prev);
+    ASSERT(prev == LF_THREADS * LF_PER_THREAD - 2);
+    skiplist_lf_free(sl, NULL, NULL);
+    PASS();
+}
+
+/* Nodes allocated from a slab go back to it, and the slab's chunks
+ * go back to the backing allocator. */
+TEST slab_alloc(void) {
+    struct skiplist_slab *slab = skiplist_slab_new(test_alloc, NULL);
+    ASSERT(slab);
+    struct skiplist *sl = skiplist_new(sl_longcmp, skiplist_slab_alloc, slab);
+    ASSERT(sl);
+    const long limit = 100000;
+    for (long i = 0; i < limit; i++) {
+        ASSERT(skiplist_add(sl, (void *) i, (void *) i));
+    }
+    ASSERT(skiplist_slab_live(slab) == (size_t) limit + 2);
+    size_t chunks = skiplist_slab_chunks(slab);
+    ASSERT(chunks > 0);
+    skiplist_debug(sl, NULL, NULL, NULL);
+
+    for (long i = 0; i < limit; i += 2) {
+        ASSERT(skiplist_delete(sl, (void *) i, NULL));
+    }
+    for (long i = 0; i < limit; i += 2) {
+        ASSERT(skiplist_add(sl, (void *) i, (void *) i));
+    }
+    /* The freed nodes were reused. */
+    ASSERT(skiplist_slab_chunks(slab) <= chunks + 1);
+    ASSERT(skiplist_count(sl) == (size_t) limit);
+
+    ASSERT(skiplist_free(sl, NULL, NULL) == (size_t) limit);
+    ASSERT(skiplist_slab_live(slab) == 0);
+    skiplist_slab_free(slab);
+    PASS();
+}
+
+/* A slab holding a single skiplist can drop it at once. */
+TEST slab_release(void) {
+    struct skiplist_slab *slab = skiplist_slab_new(test_alloc, NULL);
+    ASSERT(slab);
+    for (int round = 0; round < 3; round++) {
+        struct skiplist *sl = skiplist_new(sl_longcmp,
+            skiplist_slab_alloc, slab);
+        ASSERT(sl);
+        for (long i = 0; i < 10000; i++) {
+            ASSERT(skiplist_add(sl, (void *) i, (void *) i));
+        }
+        skiplist_slab_release(slab);
+        ASSERT(skiplist_slab_live(slab) == 0);
+        ASSERT(skiplist_slab_chunks(slab) == 0);
+    }
+    skiplist_slab_free(slab);
+    PASS();
+}
+
+SKIPLIST_TYPED(longmap, long, long, SKIPLIST_CMP_NUM)
+
+/* Fixed-size string keys, stored inline in the node. */
+struct word16 {
+    char s[16];
+};
+#define WORD16_CMP(a, b) strcmp((a).s, (b).s)
+SKIPLIST_TYPED(wordmap, struct word16, int, WORD16_CMP)
+
+static enum skiplist_iter_res longmap_sorted_cb(long k, long v, void *udata) {
+    long *prev = (long *) udata;
+    if (k <= *prev || v != -k) { return SKIPLIST_ITER_HALT; }
+    *prev = k;
+    return SKIPLIST_ITER_CONTINUE;
+}
+
+/* The typed skiplist keeps numeric keys sorted and behaves like the
+ * skiplist. */
+TEST typed_long_keys(void) {
+    struct longmap *sl = longmap_new(test_alloc, NULL);
+    ASSERT(sl);
+    const long limit = 10000;
+    for (long i = 0; i < limit; i++) {
+        long k = (i * 7919) % limit;
+        ASSERT(longmap_add(sl, k, -k));
+    }
+    ASSERT(longmap_count(sl) == (size_t) limit);
+    long prev = -1;
+    longmap_iter(sl, longmap_sorted_cb, &prev);
+    ASSERT(prev == limit - 1);
+
+    long k = 0, v = 0;
+    ASSERT(longmap_get(sl, 42, &v));
+    ASSERT(v == -42);
+    ASSERT(!longmap_member(sl, limit));
+    ASSERT(longmap_set(sl, 42, 7, &v));
+    ASSERT(v == -42);
+    ASSERT(longmap_delete(sl, 42, &v));
+    ASSERT(v == 7);
+    ASSERT(!longmap_member(sl, 42));
+    ASSERT(longmap_first(sl, &k, NULL));
+    ASSERT(k == 0);
+    ASSERT(longmap_last(sl, &k, NULL));
+    ASSERT(k == limit - 1);
+    ASSERT(longmap_pop_first(sl, &k, NULL));
+    ASSERT(k == 0);
+    ASSERT(longmap_count(sl) == (size_t) limit - 2);
+    ASSERT(longmap_free(sl) == (size_t) limit - 2);
+    PASS();
+}
+
+/* Fill with words as inline fixed-size keys. */
+TEST typed_inline_words(void) {
+    struct wordmap *sl = wordmap_new(test_alloc, NULL);
+    ASSERT(sl);
+    int ct = 0;
+    for (int i = 0; wordlist[i]; i++) {
+        struct word16 w;
+        if (strlen(wordlist[i]) >= sizeof(w.s)) { continue; }
+        strcpy(w.s, wordlist[i]);
+        ASSERT(wordmap_set(sl, w, i, NULL));
+        ct++;
+    }
+    ASSERT(wordmap_count(sl) <= (size_t) ct);
+    for (int i = 0; wordlist[i]; i++) {
+        struct word16 w;
+        if (strlen(wordlist[i]) >= sizeof(w.s)) { continue; }
+        strcpy(w.s, wordlist[i]);
+        ASSERT(wordmap_member(sl, w));
+    }
+    struct word16 first, last;
+    ASSERT(wordmap_first(sl, &first, NULL));
+    ASSERT(wordmap_last(sl, &last, NULL));
+    ASSERT(strcmp(first.s, last.s) < 0);
+    wordmap_free(sl);
+    PASS();
+}
+
+SKIPLIST_TYPED_COMPACT(compactmap, long, long, SKIPLIST_CMP_NUM)
+
+static enum skiplist_iter_res compactmap_sorted_cb(long k, long v,
+        void *udata) {
+    return longmap_sorted_cb(k, v, udata);
+}
+
+/* The compact typed skiplist behaves like the typed one, reuses
+ * deleted nodes, and survives the arena moving as it grows. */
+TEST typed_compact(void) {
+    struct compactmap *sl = compactmap_new(test_alloc, NULL);
+    ASSERT(sl);
+    const long limit = 10000;
+    for (long i = 0; i < limit; i++) {
+        long k = (i * 7919) % limit;
+        ASSERT(compactmap_add(sl, k, -k));
+    }
+    ASSERT(compactmap_count(sl) == (size_t) limit);
+    long prev = -1;
+    compactmap_iter(sl, compactmap_sorted_cb, &prev);
+    ASSERT(prev == limit - 1);
+    prev = 4999;
+    compactmap_iter_from(sl, 5000, compactmap_sorted_cb, &prev);
+    ASSERT(prev == limit - 1);
+
+    long k = 0, v = 0;
+    ASSERT(compactmap_get(sl, 42, &v));
+    ASSERT(v == -42);
+    ASSERT(!compactmap_member(sl, limit));
+    ASSERT(compactmap_set(sl, 42, 7, &v));
+    ASSERT(v == -42);
+    ASSERT(compactmap_delete(sl, 42, &v));
+    ASSERT(v == 7);
+    ASSERT(!compactmap_member(sl, 42));
+    ASSERT(compactmap_first(sl, &k, NULL));
+    ASSERT(k == 0);
+    ASSERT(compactmap_last(sl, &k, NULL));
+    ASSERT(k == limit - 1);
+    ASSERT(compactmap_pop_first(sl, &k, NULL));
+    ASSERT(k == 0);
+    ASSERT(compactmap_count(sl) == (size_t) limit - 2);
+
+    /* Re-adding deleted keys mostly reuses their nodes (the new
+     * heights differ, so not all of them). */
+    for (long i = 0; i < limit; i += 2) {
+        compactmap_delete(sl, i, NULL);
+    }
+    size_t bytes = compactmap_bytes(sl);
+    for (long i = 0; i < limit; i += 2) {
+        ASSERT(compactmap_add(sl, i, -i));
+    }
+    ASSERT(compactmap_bytes(sl) < bytes + bytes / 10);
+    ASSERT(compactmap_count(sl) == (size_t) limit);
+    prev = -1;
+    compactmap_iter(sl, compactmap_sorted_cb, &prev);
+    ASSERT(prev == limit - 1);
+
+    ASSERT(compactmap_clear(sl) == (size_t) limit);
+    ASSERT(compactmap_empty(sl));
+    ASSERT(!compactmap_first(sl, NULL, NULL));
+    ASSERT(compactmap_add(sl, 1, -1));
+    ASSERT(compactmap_free(sl) == 1);
+    PASS();
+}
+
+/* Per-list height generators: the same seed gives the same heights,
+ * with about P (1 / 2^SKIPLIST_P_LOG2) as many nodes on each level
+ * as on the one below. */
+TEST seeded_heights(void) {
+    uint64_t a = skiplist_new_seed(), b = a, c = skiplist_new_seed();
+    int counts[SKIPLIST_MAX_HEIGHT + 1];
+    int same = 1, differ = 0;
+    for (int i = 0; i <= SKIPLIST_MAX_HEIGHT; i++) counts[i] = 0;
+    for (int i = 0; i < 100000; i++) {
+        uint8_t h = skiplist_gen_height_r(&a);
+        ASSERT(h >= 1 && h <= SKIPLIST_MAX_HEIGHT);
+        counts[h]++;
+        same = same && h == skiplist_gen_height_r(&b);
+        differ = differ || h != skiplist_gen_height_r(&c);
+    }
+    ASSERT(same);
+    ASSERT(differ);
+    for (int h = 1; h < 6 / SKIPLIST_P_LOG2; h++) {
+        int expect = counts[h] >> SKIPLIST_P_LOG2;
+        ASSERT(counts[h + 1] > expect * 2 / 3);
+        ASSERT(counts[h + 1] < expect * 4 / 3);
+    }
+
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    skiplist_seed(sl, 42);
+    for (long i = 0; i < 1000; i++) {
+        ASSERT(skiplist_add(sl, (void *) i, (void *) i));
+    }
+    skiplist_debug(sl, NULL, NULL, NULL);
+    ASSERT(skiplist_count(sl) == 1000);
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+/* Seeks find the nearest keys whether or not KEY is present. */
+TEST seek(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    for (long i = 0; i < 1000; i++) {   /* even keys, 0 to 1998 */
+        ASSERT(skiplist_add(sl, (void *) (2 * ((i * 7919) % 1000)), NULL));
+    }
+    struct skiplist_cursor c;
+    void *k = NULL;
+    for (long key = -1; key <= 1999; key++) {
+        long even = key % 2 == 0;
+        ASSERT(skiplist_seek_ge(sl, (void *) key, &c) == (key <= 1998));
+        if (skiplist_cursor_get(&c, &k, NULL)) {
+            ASSERT((long) k == (even ? key : key + 1));
+        }
+        ASSERT(skiplist_seek_gt(sl, (void *) key, &c) == (key < 1998));
+        if (skiplist_cursor_get(&c, &k, NULL)) {
+            ASSERT((long) k == (even ? key + 2 : key + 1));
+        }
+        ASSERT(skiplist_seek_le(sl, (void *) key, &c) == (key >= 0));
+        if (skiplist_cursor_get(&c, &k, NULL)) {
+            ASSERT((long) k == (even ? key : key - 1));
+        }
+        ASSERT(skiplist_seek_lt(sl, (void *) key, &c) == (key > 0));
+        if (skiplist_cursor_get(&c, &k, NULL)) {
+            ASSERT((long) k == (even ? key - 2 : key - 1));
+        }
+    }
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+/* Cursors walk the whole skiplist both ways, duplicates included. */
+TEST cursor_both_ways(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    const long limit = 1000;
+    for (long i = 0; i < limit; i++) {
+        long k = (i * 7919) % limit;
+        ASSERT(skiplist_add(sl, (void *) (k / 2), (void *) k));
+    }
+    struct skiplist_cursor c;
+    void *k = NULL, *v = NULL;
+    long ct = 0, prev = -1;
+    for (bool ok = skiplist_cursor_first(sl, &c); ok;
+         ok = skiplist_cursor_next(&c)) {
+        ASSERT(skiplist_cursor_get(&c, &k, &v));
+        ASSERT((long) k >= prev);
+        prev = (long) k;
+        ct++;
+    }
+    ASSERT(ct == limit);
+    ASSERT(!skiplist_cursor_get(&c, NULL, NULL));
+
+    ct = 0;
+    prev = limit;
+    long sum = 0;
+    for (bool ok = skiplist_cursor_last(sl, &c); ok;
+         ok = skiplist_cursor_prev(&c)) {
+        ASSERT(skiplist_cursor_get(&c, &k, &v));
+        ASSERT((long) k <= prev);
+        prev = (long) k;
+        sum += (long) v;
+        ct++;
+    }
+    ASSERT(ct == limit);
+    ASSERT(sum == limit * (limit - 1) / 2);   /* each pair once */
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+struct range_ud {
+    long count;
+    long first;
+    long last;
+};
+
+static enum skiplist_iter_res range_cb(void *k, void *v, void *udata) {
+    struct range_ud *ud = (struct range_ud *) udata;
+    (void)v;
+    if (ud->count++ == 0) { ud->first = (long) k; }
+    ud->last = (long) k;
+    return SKIPLIST_ITER_CONTINUE;
+}
+
+/* Range iteration works between absent bounds. */
+TEST iter_range(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    for (long i = 0; i < 1000; i++) {   /* multiples of 10 */
+        ASSERT(skiplist_add(sl, (void *) (10 * ((i * 7919) % 1000)), NULL));
+    }
+    struct range_ud ud = { 0, 0, 0 };
+    skiplist_iter_range(sl, (void *) 15, (void *) 95, range_cb, &ud);
+    ASSERT(ud.count == 8);
+    ASSERT(ud.first == 20);
+    ASSERT(ud.last == 90);
+
+    ud.count = 0;
+    skiplist_iter_range(sl, (void *) 20, (void *) 90, range_cb, &ud);
+    ASSERT(ud.count == 8);
+
+    ud.count = 0;
+    skiplist_iter_range(sl, (void *) 21, (void *) 29, range_cb, &ud);
+    ASSERT(ud.count == 0);
+
+    ud.count = 0;
+    skiplist_iter_range(sl, (void *) -5, (void *) 100000, range_cb, &ud);
+    ASSERT(ud.count == 1000);
+    ASSERT(ud.last == 9990);
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+#if SKIPLIST_INDEXABLE
+TEST indexable_at_and_rank(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    skiplist_seed(sl, 7);
+    /* counts[k] is how many times k is in the list, as a reference. */
+    enum { KEYS = 200 };
+    int counts[KEYS] = { 0 };
+    srandom(global_seed);
+    for (int round = 0; round < 3000; round++) {
+        long k = random() % KEYS;
+        switch (random() % 8) {
+        case 0:
+            skiplist_delete(sl, (void *) k, NULL);
+            if (counts[k] > 0) { counts[k]--; }
+            break;
+        case 1: {
+            int removed = 0;
+            skiplist_delete_all(sl, (void *) k, inc_cb, &removed);
+            ASSERT_EQ(counts[k], removed);
+            counts[k] = 0;
+            break;
+        }
+        case 2: {
+            void *pk = NULL;
+            if (skiplist_pop_first(sl, &pk, NULL)) { counts[(long) pk]--; }
+            break;
+        }
+        case 3: {
+            void *pk = NULL;
+            if (skiplist_pop_last(sl, &pk, NULL)) { counts[(long) pk]--; }
+            break;
+        }
+        default:
+            ASSERT(skiplist_add(sl, (void *) k, NULL));
+            counts[k]++;
+            break;
+        }
+        if (round % 100 != 0) { continue; }
+        skiplist_debug(sl, NULL, NULL, NULL);   /* checks the spans */
+
+        size_t below = 0;
+        for (long i = 0; i < KEYS; i++) {
+            ASSERT_EQ(below, skiplist_rank(sl, (void *) i));
+            ASSERT_EQ((size_t) counts[i],
+                skiplist_count_range(sl, (void *) i, (void *) i));
+            for (int j = 0; j < counts[i]; j++) {
+                void *pk = NULL;
+                ASSERT(skiplist_at(sl, below + j, &pk, NULL));
+                ASSERT_EQ(i, (long) pk);
+            }
+            below += counts[i];
+        }
+        ASSERT_EQ(below, skiplist_count(sl));
+        ASSERT_FALSE(skiplist_at(sl, below, NULL, NULL));
+    }
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+TEST indexable_count_range(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    for (long i = 0; i < 1000; i++) {   /* multiples of 10 */
+        ASSERT(skiplist_add(sl, (void *) (10 * ((i * 7919) % 1000)), NULL));
+    }
+    ASSERT_EQ(8, skiplist_count_range(sl, (void *) 15, (void *) 95));
+    ASSERT_EQ(9, skiplist_count_range(sl, (void *) 10, (void *) 90));
+    ASSERT_EQ(0, skiplist_count_range(sl, (void *) 21, (void *) 29));
+    ASSERT_EQ(0, skiplist_count_range(sl, (void *) 90, (void *) 10));
+    ASSERT_EQ(1000, skiplist_count_range(sl, (void *) -5, (void *) 100000));
+    ASSERT_EQ(500, skiplist_rank(sl, (void *) 5000));
+
+    struct skiplist_cursor c;
+    void *k = NULL;
+    ASSERT(skiplist_seek_at(sl, 123, &c));
+    ASSERT(skiplist_cursor_get(&c, &k, NULL));
+    ASSERT_EQ(1230, (long) k);
+    ASSERT(skiplist_cursor_next(&c));
+    ASSERT(skiplist_cursor_get(&c, &k, NULL));
+    ASSERT_EQ(1240, (long) k);
+    ASSERT_FALSE(skiplist_seek_at(sl, 1000, &c));
+
+    ASSERT_EQ(1000, skiplist_clear(sl, NULL, NULL));
+    ASSERT_FALSE(skiplist_at(sl, 0, NULL, NULL));
+    ASSERT(skiplist_add(sl, (void *) 5, NULL));
+    ASSERT(skiplist_at(sl, 0, &k, NULL));
+    ASSERT_EQ(5, (long) k);
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+#endif
+
+/* A duplicate goes in front of its equal keys, at the tail as in the
+ * middle, so get, delete and iter_from see the newest one first. */
+TEST duplicate_order_at_tail(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    for (long i = 0; i < 100; i++) {
+        ASSERT(skiplist_add(sl, (void *) i, (void *) 1));
+    }
+    ASSERT(skiplist_add(sl, (void *) 50L, (void *) 2));
+    ASSERT(skiplist_add(sl, (void *) 99L, (void *) 2));
+    skiplist_debug(sl, NULL, NULL, NULL);
+    void *v = NULL;
+    ASSERT(skiplist_get(sl, (void *) 50L, &v));
+    ASSERT_EQ(2, (long) v);
+    ASSERT(skiplist_get(sl, (void *) 99L, &v));
+    ASSERT_EQ(2, (long) v);
+    void *k = NULL;
+    ASSERT(skiplist_last(sl, &k, &v));
+    ASSERT_EQ(99, (long) k);
+    ASSERT_EQ(1, (long) v);
+    ASSERT(skiplist_delete(sl, (void *) 99L, &v));
+    ASSERT_EQ(2, (long) v);
+    ASSERT(skiplist_get(sl, (void *) 99L, &v));
+    ASSERT_EQ(1, (long) v);
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+TEST build_sorted(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    enum { N = 10000 };
+    static void *keys[N], *values[N];
+    for (long i = 0; i < N; i++) {
+        keys[i] = (void *) (i / 2);     /* each key twice */
+        values[i] = (void *) i;
+    }
+    ASSERT(skiplist_build_sorted(sl, keys, values, N));
+    skiplist_debug(sl, NULL, NULL, NULL);
+    ASSERT_EQ(N, skiplist_count(sl));
+
+    struct skiplist_cursor c;
+    long i = 0;
+    for (bool ok = skiplist_cursor_first(sl, &c); ok;
+         ok = skiplist_cursor_next(&c)) {
+        void *k = NULL, *v = NULL;
+        ASSERT(skiplist_cursor_get(&c, &k, &v));
+        ASSERT_EQ(i / 2, (long) k);
+        ASSERT_EQ(i, (long) v);     /* kept in input order */
+        i++;
+    }
+    ASSERT_EQ(N, i);
+#if SKIPLIST_INDEXABLE
+    ASSERT_EQ(N / 2, skiplist_rank(sl, (void *) (N / 4)));
+#endif
+
+    /* Out of order, or not above the last key: nothing is added. */
+    keys[0] = (void *) (N / 2 + 1);
+    keys[1] = (void *) (N / 2);
+    ASSERT_FALSE(skiplist_build_sorted(sl, keys, NULL, 2));
+    keys[0] = (void *) 5;
+    ASSERT_FALSE(skiplist_build_sorted(sl, keys, NULL, 1));
+    keys[0] = (void *) (N / 2 - 1);
+    ASSERT_FALSE(skiplist_build_sorted(sl, keys, NULL, 1));
+    ASSERT_EQ(N, skiplist_count(sl));
+
+    /* Appending more, then adding past the end. */
+    keys[0] = (void *) (N / 2);
+    keys[1] = (void *) (N / 2 + 1);
+    ASSERT(skiplist_build_sorted(sl, keys, NULL, 2));
+    for (long k = N / 2 + 2; k < N; k++) {
+        ASSERT(skiplist_add(sl, (void *) k, NULL));
+    }
+    skiplist_debug(sl, NULL, NULL, NULL);
+    ASSERT_EQ(N + 2 + N / 2 - 2, skiplist_count(sl));
+#if SKIPLIST_INDEXABLE
+    void *k = NULL;
+    ASSERT(skiplist_at(sl, N + 1, &k, NULL));
+    ASSERT_EQ(N / 2 + 1, (long) k);
+#endif
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+TEST tails_follow_updates(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    skiplist_seed(sl, 11);
+    /* Mostly appends, with deletes and pops, checking the last key
+     * and that appends after them still land in order. */
+    long max = -1;
+    srandom(global_seed);
+    for (int round = 0; round < 5000; round++) {
+        long r = random() % 10;
+        void *k = NULL;
+        if (r < 6) {
+            long key = max + 1 - random() % 3;
+            ASSERT(skiplist_add(sl, (void *) key, NULL));
+        } else if (r == 6) {
+            skiplist_pop_last(sl, NULL, NULL);
+        } else if (r == 7) {
+            skiplist_pop_first(sl, NULL, NULL);
+        } else if (r == 8) {
+            if (skiplist_last(sl, &k, NULL)) {
+                skiplist_delete(sl, k, NULL);
+            }
+        } else {
+            int removed = 0;
+            if (skiplist_last(sl, &k, NULL)) {
+                skiplist_delete_all(sl, k, inc_cb, &removed);
+            }
+        }
+        size_t seen = 0;
+        struct skiplist_cursor c;
+        for (bool ok = skiplist_cursor_first(sl, &c); ok;
+             ok = skiplist_cursor_next(&c)) {
+            void *ck = NULL;
+            skiplist_cursor_get(&c, &ck, NULL);
+            if (seen++ > 0) { ASSERT((long) ck >= max); }
+            max = (long) ck;
+        }
+        ASSERT_EQ(seen, skiplist_count(sl));
+        if (seen > 0) {
+            ASSERT(skiplist_last(sl, &k, NULL));
+            ASSERT_EQ(max, (long) k);
+        } else {
+            ASSERT_FALSE(skiplist_last(sl, NULL, NULL));
+        }
+        skiplist_debug(sl, NULL, NULL, NULL);
+    }
+    skiplist_clear(sl, NULL, NULL);
+    ASSERT_FALSE(skiplist_last(sl, NULL, NULL));
+    ASSERT(skiplist_add(sl, (void *) 3, NULL));
+    ASSERT(skiplist_add(sl, (void *) 1, NULL));
+    void *k = NULL;
+    ASSERT(skiplist_last(sl, &k, NULL));
+    ASSERT_EQ(3, (long) k);
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+TEST add_and_get_batch(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    enum { N = 5000 };
+    static void *keys[N], *values[N];
+    for (long i = 0; i < N; i++) {      /* scattered, with duplicates */
+        keys[i] = (void *) (2 * ((i * 7919) % (N / 2)));
+        values[i] = (void *) i;
+    }
+    ASSERT(skiplist_add_batch(sl, keys, values, N));
+    skiplist_debug(sl, NULL, NULL, NULL);
+    ASSERT_EQ(N, skiplist_count(sl));
+#if SKIPLIST_INDEXABLE
+    ASSERT_EQ(N / 2, skiplist_rank(sl, (void *) (N / 2)));
+#endif
+
+    /* Already sorted, interleaved with the keys present. */
+    for (long i = 0; i < N / 2; i++) { keys[i] = (void *) (2 * i + 1); }
+    ASSERT(skiplist_add_batch(sl, keys, NULL, N / 2));
+    skiplist_debug(sl, NULL, NULL, NULL);
+    ASSERT_EQ(N + N / 2, skiplist_count(sl));
+    long prev = -1;
+    struct skiplist_cursor c;
+    for (bool ok = skiplist_cursor_first(sl, &c); ok;
+         ok = skiplist_cursor_next(&c)) {
+        void *k = NULL;
+        ASSERT(skiplist_cursor_get(&c, &k, NULL));
+        ASSERT((long) k >= prev);
+        prev = (long) k;
+    }
+
+    /* Half the keys are absent (beyond the last). */
+    for (long i = 0; i < N; i++) {
+        keys[i] = (void *) ((i * 7919) % N * 2);
+        values[i] = (void *) -1;
+    }
+    ASSERT_EQ(N / 2, skiplist_get_batch(sl, keys, values, N));
+    for (long i = 0; i < N; i++) {
+        long k = (long) keys[i];
+        if (k < N) {
+            void *v = NULL;
+            ASSERT(skiplist_get(sl, keys[i], &v));
+            ASSERT_EQ((long) v, (long) values[i]);
+        } else {
+            ASSERT_EQ(-1, (long) values[i]);
+        }
+    }
+    ASSERT_EQ(0, skiplist_get_batch(sl, keys, values, 0));
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+#if SKIPLIST_KEY_PREFIX
+TEST key_prefixes(void) {
+    struct skiplist *sl = skiplist_new(sl_strcmp, test_alloc, NULL);
+    ASSERT(sl);
+    ASSERT(skiplist_set_prefix(sl, skiplist_prefix_str));
+
+    /* Short keys, keys equal to a prefix of others, and long keys
+     * sharing their first 8 bytes. */
+    enum { N = 600 };
+    static char buf[N][32];
+    for (int i = 0; i < N; i++) {
+        switch (i % 3) {
+        case 0: snprintf(buf[i], sizeof(buf[i]), "%d", i); break;
+        case 1: snprintf(buf[i], sizeof(buf[i]), "%dab", i / 10); break;
+        default: snprintf(buf[i], sizeof(buf[i]), "long_prefix_%d", i); break;
+        }
+        skiplist_set(sl, buf[i], buf[i], NULL);
+    }
+    ASSERT_FALSE(skiplist_set_prefix(sl, NULL));
+    skiplist_debug(sl, NULL, NULL, NULL);
+
+    for (int i = 0; i < N; i++) {
+        void *v = NULL;
+        ASSERT(skiplist_get(sl, buf[i], &v));
+        ASSERT_STR_EQ(buf[i], (char *) v);
+    }
+    ASSERT_FALSE(skiplist_member(sl, "long_prefix_"));
+    ASSERT_FALSE(skiplist_member(sl, "1a"));
+
+    const char *prev = NULL;
+    struct skiplist_cursor c;
+    for (bool ok = skiplist_cursor_first(sl, &c); ok;
+         ok = skiplist_cursor_next(&c)) {
+        void *k = NULL;
+        ASSERT(skiplist_cursor_get(&c, &k, NULL));
+        if (prev) { ASSERT(strcmp(prev, (char *) k) < 0); }
+        prev = (char *) k;
+    }
+
+    ASSERT(skiplist_seek_ge(sl, "long_prefix_2", &c));
+    void *k = NULL;
+    ASSERT(skiplist_cursor_get(&c, &k, NULL));
+    ASSERT_STR_EQ("long_prefix_2", (char *) k);
+    ASSERT(skiplist_seek_gt(sl, "long_prefix_5", &c));
+    ASSERT(skiplist_cursor_get(&c, &k, NULL));
+    ASSERT_STR_EQ("long_prefix_50", (char *) k);
+
+    ASSERT(skiplist_delete(sl, "long_prefix_50", NULL));
+    ASSERT_FALSE(skiplist_member(sl, "long_prefix_50"));
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+#endif
+
+/* Check that SL holds COUNT keys in order, and (if indexable) that
+ * at and rank agree with the order. */
+static enum greatest_test_res check_ordered(struct skiplist *sl,
+        size_t count) {
+    skiplist_debug(sl, NULL, NULL, NULL);
+    ASSERT_EQ(count, skiplist_count(sl));
+    struct skiplist_cursor c;
+    size_t seen = 0;
+    long prev = LONG_MIN;
+    for (bool ok = skiplist_cursor_first(sl, &c); ok;
+         ok = skiplist_cursor_next(&c)) {
+        void *k = NULL;
+        ASSERT(skiplist_cursor_get(&c, &k, NULL));
+        ASSERT((long) k >= prev);
+#if SKIPLIST_INDEXABLE
+        void *ak = NULL;
+        ASSERT(skiplist_at(sl, seen, &ak, NULL));
+        ASSERT_EQ((long) k, (long) ak);
+        if ((long) k > prev) { ASSERT_EQ(seen, skiplist_rank(sl, k)); }
+#endif
+        prev = (long) k;
+        seen++;
+    }
+    ASSERT_EQ(count, seen);
+    PASS();
+}
+
+TEST merge_lists(void) {
+    struct skiplist *a = skiplist_new(sl_longcmp, test_alloc, NULL);
+    struct skiplist *b = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(a);
+    ASSERT(b);
+    enum { N = 3000 };
+    /* Interleaved, with some keys in both. */
+    for (long i = 0; i < N; i++) {
+        ASSERT(skiplist_add(a, (void *) (2 * i), (void *) 'a'));
+        ASSERT(skiplist_add(b, (void *) (3 * i), (void *) 'b'));
+    }
+    long before = allocated;
+    ASSERT(skiplist_merge(a, b));
+    ASSERT(allocated < before + 1024);  /* no new nodes, maybe a head */
+    CHECK_CALL(check_ordered(a, 2 * N));
+    CHECK_CALL(check_ordered(b, 0));
+    void *v = NULL;
+    ASSERT(skiplist_pop_first(a, NULL, &v));
+    ASSERT_EQ('a', (long) v);       /* a's equal keys first */
+
+    /* Disjoint: appended, then merged into an empty list. */
+    for (long i = 0; i < N; i++) {
+        ASSERT(skiplist_add(b, (void *) (3 * N + i), NULL));
+    }
+    ASSERT(skiplist_merge(a, b));
+    CHECK_CALL(check_ordered(a, 3 * N - 1));
+    ASSERT(skiplist_merge(b, a));
+    CHECK_CALL(check_ordered(b, 3 * N - 1));
+    CHECK_CALL(check_ordered(a, 0));
+    ASSERT(skiplist_merge(b, a));   /* nothing to merge */
+    ASSERT(skiplist_add(a, (void *) -1, NULL));
+    ASSERT(skiplist_add(a, (void *) (4 * N), NULL));
+    ASSERT(skiplist_merge(b, a));
+    CHECK_CALL(check_ordered(b, 3 * N + 1));
+    ASSERT_FALSE(skiplist_merge(b, b));
+
+    /* Lists with other callbacks can't be merged. */
+    struct skiplist *c = skiplist_new(sl_longcmp, NULL, NULL);
+    ASSERT(c);
+    ASSERT(skiplist_add(c, (void *) 1, NULL));
+    ASSERT_FALSE(skiplist_merge(b, c));
+    ASSERT_EQ(1, skiplist_count(c));
+    skiplist_free(c, NULL, NULL);
+    skiplist_free(a, NULL, NULL);
+    skiplist_free(b, NULL, NULL);
+    PASS();
+}
+
+TEST split_at(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    enum { N = 4000 };
+    for (long i = 0; i < N; i++) {
+        ASSERT(skiplist_add(sl, (void *) (i / 2), NULL));
+    }
+
+    struct skiplist *hi = skiplist_split_at(sl, (void *) (N / 8));
+    ASSERT(hi);
+    CHECK_CALL(check_ordered(sl, N / 4));
+    CHECK_CALL(check_ordered(hi, N - N / 4));
+    void *k = NULL;
+    ASSERT(skiplist_last(sl, &k, NULL));
+    ASSERT_EQ(N / 8 - 1, (long) k);
+    ASSERT(skiplist_first(hi, &k, NULL));
+    ASSERT_EQ(N / 8, (long) k);
+
+    /* Both halves keep working, and merge back. */
+    ASSERT(skiplist_add(sl, (void *) (N / 8 - 1), NULL));
+    ASSERT(skiplist_add(hi, (void *) N, NULL));
+    ASSERT(skiplist_delete(hi, (void *) (N / 8), NULL));
+    ASSERT(skiplist_merge(sl, hi));
+    CHECK_CALL(check_ordered(sl, N + 1));
+    skiplist_free(hi, NULL, NULL);
+
+    /* At either end, one part is empty. */
+    hi = skiplist_split_at(sl, (void *) -1);
+    ASSERT(hi);
+    CHECK_CALL(check_ordered(sl, 0));
+    CHECK_CALL(check_ordered(hi, N + 1));
+    struct skiplist *none = skiplist_split_at(hi, (void *) (N + 1));
+    ASSERT(none);
+    CHECK_CALL(check_ordered(none, 0));
+    CHECK_CALL(check_ordered(hi, N + 1));
+    skiplist_free(none, NULL, NULL);
+    skiplist_free(hi, NULL, NULL);
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+TEST pop_n_both_ends(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    skiplist_seed(sl, 5);
+    enum { N = 2000 };
+    static void *keys[N], *values[N];
+    for (long i = 0; i < N; i++) {
+        ASSERT(skiplist_add(sl, (void *) ((i * 7919) % N), (void *) i));
+    }
+
+    ASSERT_EQ(10, skiplist_pop_first_n(sl, 10, keys, NULL));
+    for (long i = 0; i < 10; i++) { ASSERT_EQ(i, (long) keys[i]); }
+    ASSERT_EQ(10, skiplist_pop_last_n(sl, 10, keys, values));
+    for (long i = 0; i < 10; i++) {
+        void *k = NULL;
+        ASSERT_EQ(N - 1 - i, (long) keys[i]);
+        ASSERT(skiplist_add(sl, keys[i], values[i]));
+        ASSERT(skiplist_pop_last(sl, &k, NULL));
+        ASSERT_EQ((long) keys[i], (long) k);
+    }
+    skiplist_debug(sl, NULL, NULL, NULL);
+
+    /* Scheduler-style: pop the earliest, add it back later, and
+     * drop the latest now and then. */
+    srandom(global_seed);
+    for (int round = 0; round < 3000; round++) {
+        void *k = NULL;
+        ASSERT(skiplist_pop_first(sl, &k, NULL));
+        ASSERT(skiplist_add(sl, (void *) ((long) k + random() % 500), NULL));
+        if (round % 7 == 0) {
+            size_t before = skiplist_count(sl);
+            ASSERT_EQ(3, skiplist_pop_last_n(sl, 3, NULL, NULL));
+            ASSERT_EQ(before - 3, skiplist_count(sl));
+            ASSERT(skiplist_add(sl, k, NULL));
+        }
+    }
+    CHECK_CALL(check_ordered(sl, skiplist_count(sl)));
+
+    /* Walking back with a cursor sees the keys in reverse. */
+    struct skiplist_cursor c;
+    size_t seen = 0;
+    long prev = LONG_MAX;
+    for (bool ok = skiplist_cursor_last(sl, &c); ok;
+         ok = skiplist_cursor_prev(&c)) {
+        void *k = NULL;
+        ASSERT(skiplist_cursor_get(&c, &k, NULL));
+        ASSERT((long) k <= prev);
+        prev = (long) k;
+        seen++;
+    }
+    ASSERT_EQ(skiplist_count(sl), seen);
+
+    size_t left = skiplist_count(sl);
+    ASSERT_EQ(left, skiplist_pop_last_n(sl, left + 5, NULL, NULL));
+    ASSERT_EQ(0, skiplist_pop_first_n(sl, 5, NULL, NULL));
+    ASSERT(skiplist_empty(sl));
+    skiplist_debug(sl, NULL, NULL, NULL);
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+static enum skiplist_iter_res mmap_check_cb(const void *key, size_t klen,
+        const void *value, size_t vlen, void *udata) {
+    long *prev = (long *) udata;
+    long k = 0, v = 0;
+    if (klen != sizeof(k) || vlen != sizeof(v)) { return SKIPLIST_ITER_HALT; }
+    memcpy(&k, key, sizeof(k));
+    memcpy(&v, value, sizeof(v));
+    /* Keys are stored big-endian, so bytewise order is numeric. */
+    k = (long) __builtin_bswap64((uint64_t) k);
+    if (k <= *prev || v != 3 * k) { return SKIPLIST_ITER_HALT; }
+    *prev = k;
+    return SKIPLIST_ITER_CONTINUE;
+}
+
+static bool mmap_set_long(struct skiplist_mmap *m, long k, long v) {
+    uint64_t be = __builtin_bswap64((uint64_t) k);
+    return skiplist_mmap_set(m, &be, sizeof(be), &v, sizeof(v));
+}
+
+static bool mmap_get_long(struct skiplist_mmap *m, long k, long *v) {
+    uint64_t be = __builtin_bswap64((uint64_t) k);
+    const void *p = NULL;
+    size_t len = 0;
+    if (!skiplist_mmap_get(m, &be, sizeof(be), &p, &len)) { return false; }
+    if (len != sizeof(*v)) { return false; }
+    memcpy(v, p, sizeof(*v));
+    return true;
+}
+
+TEST mmap_reopen(void) {
+    char path[] = "/tmp/test_skiplist_mmap_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT(fd >= 0);
+    close(fd);
+    struct skiplist_mmap *m = skiplist_mmap_open(path, NULL);
+    ASSERT(m);
+    enum { N = 20000 };
+    for (long i = 0; i < N; i++) {
+        long k = (i * 7919) % N;
+        ASSERT(mmap_set_long(m, k, k == 7 ? -1 : 3 * k));
+    }
+    ASSERT(mmap_set_long(m, 7, 21));        /* replaced */
+    uint64_t be = __builtin_bswap64(5);
+    ASSERT(skiplist_mmap_delete(m, &be, sizeof(be)));
+    ASSERT_FALSE(skiplist_mmap_delete(m, &be, sizeof(be)));
+    ASSERT(skiplist_mmap_commit(m));
+    ASSERT(skiplist_mmap_close(m));
+
+    /* Reopened as committed, with offsets still good. */
+    m = skiplist_mmap_open(path, NULL);
+    ASSERT(m);
+    ASSERT_EQ(N - 1, skiplist_mmap_count(m));
+    for (long k = 0; k < N; k++) {
+        long v = 0;
+        if (k == 5) {
+            ASSERT_FALSE(mmap_get_long(m, k, &v));
+        } else {
+            ASSERT(mmap_get_long(m, k, &v));
+            ASSERT_EQ(3 * k, v);
+        }
+    }
+    long prev = -1;
+    skiplist_mmap_iter(m, NULL, 0, mmap_check_cb, &prev);
+    ASSERT_EQ(N - 1, prev);
+    prev = N / 2 - 1;
+    be = __builtin_bswap64(N / 2);
+    skiplist_mmap_iter(m, &be, sizeof(be), mmap_check_cb, &prev);
+    ASSERT_EQ(N - 1, prev);
+
+    /* Values too big to keep in the node, replaced by one that
+     * isn't. */
+    const char *big = "longer than eight bytes";
+    const void *p = NULL;
+    size_t len = 0;
+    be = __builtin_bswap64(N + 1);
+    ASSERT(skiplist_mmap_set(m, &be, sizeof(be), big, strlen(big)));
+    ASSERT(skiplist_mmap_get(m, &be, sizeof(be), &p, &len));
+    ASSERT_EQ(strlen(big), len);
+    ASSERT_EQ(0, memcmp(p, big, len));
+    ASSERT(skiplist_mmap_set(m, &be, sizeof(be), "abc", 3));
+    ASSERT(skiplist_mmap_get(m, &be, sizeof(be), &p, &len));
+    ASSERT_EQ(3, len);
+    ASSERT_EQ(0, memcmp(p, "abc", len));
+    ASSERT(skiplist_mmap_delete(m, &be, sizeof(be)));
+
+    /* Changed but not committed: recovered on open. Freed space
+     * gets reused first. */
+    for (long k = 0; k < N; k += 2) {
+        be = __builtin_bswap64((uint64_t) k);
+        if (k != 5) { ASSERT(skiplist_mmap_delete(m, &be, sizeof(be))); }
+    }
+    ASSERT(mmap_set_long(m, N, 3 * N));
+    ASSERT(skiplist_mmap_close(m));
+    m = skiplist_mmap_open(path, NULL);
+    ASSERT(m);
+    ASSERT_EQ(N / 2, skiplist_mmap_count(m));
+    prev = -1;
+    skiplist_mmap_iter(m, NULL, 0, mmap_check_cb, &prev);
+    ASSERT_EQ(N, prev);
+    long v = 0;
+    ASSERT(mmap_get_long(m, N - 1, &v));
+    ASSERT_FALSE(mmap_get_long(m, N - 2, &v));
+    ASSERT(skiplist_mmap_close(m));
+
+    /* Not a skiplist file. */
+    FILE *f = fopen(path, "w");
+    ASSERT(f);
+    fputs("junk\n", f);
+    fclose(f);
+    ASSERT_EQ(NULL, skiplist_mmap_open(path, NULL));
+    unlink(path);
+    PASS();
+}
 
 /*********/
 /* Suite */
@@ -793,6 +1874,32 @@ SUITE(suite) {
     RUN_TEST(free_clear);
     RUN_TEST(pop_first);
     RUN_TEST(pop_last);
+    RUN_TEST(lf_single_thread);
+    RUN_TEST(lf_concurrent);
+    RUN_TEST(slab_alloc);
+    RUN_TEST(slab_release);
+    RUN_TEST(typed_long_keys);
+    RUN_TEST(typed_inline_words);
+    RUN_TEST(typed_compact);
+    RUN_TEST(seeded_heights);
+    RUN_TEST(seek);
+    RUN_TEST(cursor_both_ways);
+    RUN_TEST(iter_range);
+#if SKIPLIST_INDEXABLE
+    RUN_TEST(indexable_at_and_rank);
+    RUN_TEST(indexable_count_range);
+#endif
+    RUN_TEST(duplicate_order_at_tail);
+    RUN_TEST(build_sorted);
+    RUN_TEST(tails_follow_updates);
+    RUN_TEST(add_and_get_batch);
+#if SKIPLIST_KEY_PREFIX
+    RUN_TEST(key_prefixes);
+#endif
+    RUN_TEST(merge_lists);
+    RUN_TEST(split_at);
+    RUN_TEST(pop_n_both_ends);
+    RUN_TEST(mmap_reopen);
 }
 
 int main(int argc, char **argv) {